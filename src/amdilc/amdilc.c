@@ -8,14 +8,9 @@
 
 static HCRYPTPROV mCryptProvider = 0;
 
-static void calcSha1(
-    uint8_t* digest,
-    const uint8_t* data,
-    unsigned size)
+static HCRYPTHASH createSha1()
 {
     HCRYPTHASH hash;
-    DWORD digestSize = 0;
-    DWORD dwordSize = sizeof(DWORD);
 
     if (mCryptProvider == 0) {
         // This function is very slow (~250ms), acquire once
@@ -23,13 +18,33 @@ static void calcSha1(
     }
 
     CryptCreateHash(mCryptProvider, CALG_SHA1, 0, 0, &hash);
-    CryptHashData(hash, data, size, 0);
+    return hash;
+}
+
+static void finishSha1(
+    uint8_t* digest,
+    HCRYPTHASH hash)
+{
+    DWORD digestSize = 0;
+    DWORD dwordSize = sizeof(DWORD);
+
     CryptGetHashParam(hash, HP_HASHSIZE, (BYTE*)&digestSize, &dwordSize, 0);
     assert(digestSize == SHA1_SIZE);
     CryptGetHashParam(hash, HP_HASHVAL, digest, &digestSize, 0);
     CryptDestroyHash(hash);
 }
 
+static void calcSha1(
+    uint8_t* digest,
+    const uint8_t* data,
+    unsigned size)
+{
+    HCRYPTHASH hash = createSha1();
+
+    CryptHashData(hash, data, size, 0);
+    finishSha1(digest, hash);
+}
+
 static void freeSource(
     Source* src)
 {
@@ -50,13 +65,14 @@ static void freeInstruction(
     free(instr->extras);
 }
 
-static void freeKernel(
+void ilcFreeKernel(
     Kernel* kernel)
 {
     for (int i = 0; i < kernel->instrCount; i++) {
         freeInstruction(&kernel->instrs[i]);
     }
     free(kernel->instrs);
+    free(kernel);
 }
 
 static bool isShaderDumpEnabled()
@@ -100,6 +116,44 @@ static void dumpBuffer(
     fclose(file);
 }
 
+static void dumpMappings(
+    const uint32_t* mappingData,
+    unsigned mappingSize,
+    const char* name)
+{
+    char fileName[NAME_LEN];
+    snprintf(fileName, NAME_LEN, "%s_map.bin", name);
+
+    // The same IL can be used with several mappings, keep one record of each
+    FILE* file = fopen(fileName, "a+b");
+    if (file == NULL) {
+        LOGW("failed to open %s\n", fileName);
+        return;
+    }
+
+    uint32_t recordSize;
+    uint32_t* record = NULL;
+    bool found = false;
+
+    fseek(file, 0, SEEK_SET);
+    while (!found && fread(&recordSize, sizeof(recordSize), 1, file) == 1) {
+        record = realloc(record, recordSize);
+        if (fread(record, 1, recordSize, file) != recordSize) {
+            break;
+        }
+        found = recordSize == mappingSize && memcmp(record, mappingData, mappingSize) == 0;
+    }
+    free(record);
+
+    if (!found) {
+        recordSize = mappingSize;
+        fseek(file, 0, SEEK_END);
+        fwrite(&recordSize, sizeof(recordSize), 1, file);
+        fwrite(mappingData, 1, mappingSize, file);
+    }
+    fclose(file);
+}
+
 static void dumpKernel(
     const Kernel* kernel,
     const char* name)
@@ -112,7 +166,23 @@ static void dumpKernel(
     fclose(file);
 }
 
-uint32_t* ilcCompileShader(
+void ilcGetCacheKey(
+    uint8_t* key,
+    const void* code,
+    unsigned size,
+    const void* mappingData,
+    unsigned mappingSize)
+{
+    HCRYPTHASH hash = createSha1();
+
+    CryptHashData(hash, code, size, 0);
+    if (mappingSize > 0) {
+        CryptHashData(hash, mappingData, mappingSize, 0);
+    }
+    finishSha1(key, hash);
+}
+
+const uint32_t* ilcCompileShader(
     unsigned* compiledSize,
     const GR_PIPELINE_SHADER* mappings,
     const void* code,
@@ -120,24 +190,50 @@ uint32_t* ilcCompileShader(
 {
     char name[NAME_LEN];
     getShaderName(name, NAME_LEN, code, size);
-    LOGV("compiling %s...\n", name);
 
-    Kernel* kernel = ilcDecodeStream((Token*)code, size / sizeof(Token));
+    unsigned mappingSize = 0;
+    uint32_t* mappingData = ilcSerializeMappings(&mappingSize, mappings);
+    uint8_t key[ILC_CACHE_KEY_SIZE];
+    ilcGetCacheKey(key, code, size, mappingData, mappingSize);
+
     bool dump = isShaderDumpEnabled();
+    bool profile = ilcIsProfilingEnabled();
 
     if (dump) {
         dumpBuffer(code, size, name, "il");
+        dumpMappings(mappingData, mappingSize, name);
+    }
+    free(mappingData);
+
+    // Cached shaders would never be profiled, always compile them while profiling
+    const uint32_t* cachedCode = profile ? NULL : ilcCacheLookup(compiledSize, key);
+    if (cachedCode != NULL) {
+        LOGV("found %s in shader cache\n", name);
+        return cachedCode;
+    }
+
+    LOGV("compiling %s...\n", name);
+
+    Kernel* kernel = ilcDecodeStream((Token*)code, size / sizeof(Token));
+
+    if (dump) {
         dumpKernel(kernel, name);
     }
 
-    uint32_t* compiledCode = ilcCompileKernel(compiledSize, mappings, kernel);
+    IlcProfile* ilcProfile = profile ? calloc(1, sizeof(IlcProfile)) : NULL;
+    uint32_t* compiledCode = ilcCompileKernel(compiledSize, mappings, kernel, ilcProfile);
 
     if (dump) {
         dumpBuffer((uint8_t*)compiledCode, *compiledSize, name, "spv");
     }
+    if (ilcProfile != NULL) {
+        ilcDumpProfile(ilcProfile, name);
+        free(ilcProfile);
+    }
 
-    freeKernel(kernel);
-    free(kernel);
+    ilcFreeKernel(kernel);
+
+    ilcCacheStore(key, compiledCode, *compiledSize);
     return compiledCode;
 }
 
@@ -149,6 +245,5 @@ void ilcDisassembleShader(
     Kernel* kernel = ilcDecodeStream((Token*)code, size / sizeof(Token));
 
     ilcDumpKernel(file, kernel);
-    freeKernel(kernel);
-    free(kernel);
+    ilcFreeKernel(kernel);
 }
@@ -15,12 +15,64 @@ enum IlcDescriptorResourceTable {
     TABLE_MAX_ID  = 5,
 };
 
-uint32_t* ilcCompileShader(
+#define ILC_CACHE_KEY_SIZE  (20)
+
+typedef struct {
+    unsigned instrCount;
+    unsigned declInstrCount;
+    unsigned floatInstrCount;
+    unsigned intInstrCount;
+    unsigned flowControlInstrCount;
+    unsigned memoryInstrCount;
+    unsigned otherInstrCount;
+    unsigned declaredRegisterCount;
+    unsigned usedRegisterCount;
+    unsigned tempRegisterCount;
+    unsigned resourceCount;
+    unsigned uavCount;
+    unsigned samplerCount;
+    unsigned maxControlFlowDepth;
+    unsigned spirvWordCount;
+    double translationTime; // In microseconds
+} IlcShaderStats;
+
+// Returned code is owned by the caller and has to be freed with ilcReleaseShader
+const uint32_t* ilcCompileShader(
     unsigned* compiledSize,
     const GR_PIPELINE_SHADER* mappings,
     const void* code,
     unsigned size);
 
+void ilcReleaseShader(
+    const uint32_t* code);
+
+void ilcOpenShaderCache(
+    const char* path,
+    unsigned maxSize,
+    bool compress);
+
+void ilcCloseShaderCache();
+
+bool ilcCompactShaderCache(
+    const char* path,
+    unsigned maxSize);
+
+uint32_t* ilcSerializeMappings(
+    unsigned* size,
+    const GR_PIPELINE_SHADER* mappings);
+
+GR_PIPELINE_SHADER* ilcDeserializeMappings(
+    const void* data,
+    unsigned size);
+
+void ilcFreeMappings(
+    GR_PIPELINE_SHADER* mappings);
+
+void ilcGetShaderStats(
+    IlcShaderStats* stats,
+    const void* code,
+    unsigned size);
+
 void ilcDisassembleShader(
     FILE* file,
     const void* code,
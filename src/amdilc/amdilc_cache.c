@@ -0,0 +1,1124 @@
+#include <time.h>
+#include <windows.h>
+#include "amdilc_internal.h"
+
+// Bump whenever the translator output changes, stale entries are then ignored
+#define CACHE_VERSION       (4)
+#define PACK_MAGIC          (0x50535247) // "GRSP"
+#define JOURNAL_MAGIC       (0x4A535247) // "GRSJ"
+#define LRU_MAGIC           (0x4C535247) // "GRSL"
+#define PACK_FILE_NAME      "shaders.pack"
+#define JOURNAL_FILE_NAME   "shaders.journal"
+#define LRU_FILE_NAME       "shaders.lru"
+#define PACK_ALIGNMENT      (16)
+#define CACHE_PATH_LEN      (260)
+
+// Evicting below the cap avoids rewriting the pack on every exit
+#define EVICTION_TARGET(maxSize) ((maxSize) / 4 * 3)
+
+// Pack layout: header, index sorted by key, then SPIR-V blobs aligned to PACK_ALIGNMENT
+// LRU layout: header, then hit time records
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entryCount;
+    uint32_t reserved;
+} CacheFileHeader;
+
+typedef struct {
+    uint8_t key[ILC_CACHE_KEY_SIZE];
+    uint32_t offset;
+    uint32_t storedSize; // Equal to size for uncompressed entries
+    uint32_t size;
+} PackIndexEntry;
+
+// Journal layout: a record header followed by the stored code, repeated
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint8_t key[ILC_CACHE_KEY_SIZE];
+    uint32_t storedSize;
+    uint32_t size;
+} JournalRecordHeader;
+
+typedef struct {
+    uint8_t key[ILC_CACHE_KEY_SIZE];
+    uint32_t lastUsed;
+} LruRecord;
+
+typedef struct {
+    uint8_t key[ILC_CACHE_KEY_SIZE];
+    unsigned size;
+    unsigned storedSize;
+    const uint8_t* storedData; // Compressed code, decompressed on first use
+    const uint32_t* code;
+    bool isHeapCopy;
+    uint32_t lastUsed;
+} JournalEntry;
+
+typedef struct {
+    unsigned refCount;
+    char path[CACHE_PATH_LEN];
+    unsigned maxSize;
+    bool compress;
+    uint32_t sessionTime;
+    uint64_t storedSize;
+    // Read-only pack mapping, immutable while the cache is open
+    HANDLE packFile;
+    HANDLE packMapping;
+    const uint8_t* packData;
+    unsigned packEntryCount;
+    const PackIndexEntry* packIndex;
+    uint32_t* packLastUsed;
+    // Journal entries and decompressed pack entries, guarded by the lock
+    SRWLOCK lock;
+    const uint32_t** packCodes;
+    FILE* journalFile;
+    uint8_t* journalData;
+    unsigned journalEntryCount;
+    JournalEntry* journalEntries;
+    unsigned journalTableSize;
+    unsigned* journalTable; // Entry index + 1, 0 is an empty slot
+} ShaderCache;
+
+typedef struct {
+    uint8_t key[ILC_CACHE_KEY_SIZE];
+    unsigned order;
+    unsigned storedSize;
+    unsigned size;
+    const uint8_t* data;
+    uint32_t lastUsed;
+} CompactionEntry;
+
+static ShaderCache mCache = { .refCount = 0, .lock = SRWLOCK_INIT };
+
+static void putMappingWord(
+    uint32_t** data,
+    unsigned* wordCount,
+    uint32_t word)
+{
+    *data = realloc(*data, sizeof(uint32_t) * (*wordCount + 1));
+    (*data)[*wordCount] = word;
+    (*wordCount)++;
+}
+
+static void putDescriptorSetMapping(
+    uint32_t** data,
+    unsigned* wordCount,
+    const GR_DESCRIPTOR_SET_MAPPING* mapping)
+{
+    putMappingWord(data, wordCount, mapping->descriptorCount);
+
+    for (unsigned i = 0; i < mapping->descriptorCount; i++) {
+        const GR_DESCRIPTOR_SLOT_INFO* slotInfo = &mapping->pDescriptorInfo[i];
+
+        putMappingWord(data, wordCount, slotInfo->slotObjectType);
+        if (slotInfo->slotObjectType == GR_SLOT_NEXT_DESCRIPTOR_SET) {
+            putDescriptorSetMapping(data, wordCount, slotInfo->pNextLevelSet);
+        } else {
+            putMappingWord(data, wordCount, slotInfo->shaderEntityIndex);
+        }
+    }
+}
+
+static bool getDescriptorSetMapping(
+    GR_DESCRIPTOR_SET_MAPPING* mapping,
+    const uint32_t* data,
+    unsigned wordCount,
+    unsigned* idx)
+{
+    if (*idx >= wordCount) {
+        return false;
+    }
+
+    mapping->descriptorCount = data[(*idx)++];
+    mapping->pDescriptorInfo = NULL;
+    if (mapping->descriptorCount == 0) {
+        return true;
+    } else if (mapping->descriptorCount > wordCount - *idx) {
+        // Every slot takes at least a word, bail out on corrupted data
+        mapping->descriptorCount = 0;
+        return false;
+    }
+
+    GR_DESCRIPTOR_SLOT_INFO* slotInfos =
+        calloc(mapping->descriptorCount, sizeof(GR_DESCRIPTOR_SLOT_INFO));
+    mapping->pDescriptorInfo = slotInfos;
+
+    for (unsigned i = 0; i < mapping->descriptorCount; i++) {
+        GR_DESCRIPTOR_SLOT_INFO* slotInfo = &slotInfos[i];
+
+        if (*idx >= wordCount) {
+            return false;
+        }
+
+        slotInfo->slotObjectType = data[(*idx)++];
+        if (slotInfo->slotObjectType == GR_SLOT_NEXT_DESCRIPTOR_SET) {
+            GR_DESCRIPTOR_SET_MAPPING* nestedMapping = calloc(1, sizeof(GR_DESCRIPTOR_SET_MAPPING));
+
+            slotInfo->pNextLevelSet = nestedMapping;
+            if (!getDescriptorSetMapping(nestedMapping, data, wordCount, idx)) {
+                return false;
+            }
+        } else {
+            if (*idx >= wordCount) {
+                return false;
+            }
+            slotInfo->shaderEntityIndex = data[(*idx)++];
+        }
+    }
+
+    return true;
+}
+
+static void freeDescriptorSetMapping(
+    const GR_DESCRIPTOR_SET_MAPPING* mapping)
+{
+    for (unsigned i = 0; i < mapping->descriptorCount; i++) {
+        const GR_DESCRIPTOR_SLOT_INFO* slotInfo = &mapping->pDescriptorInfo[i];
+
+        if (slotInfo->slotObjectType == GR_SLOT_NEXT_DESCRIPTOR_SET &&
+            slotInfo->pNextLevelSet != NULL) {
+            freeDescriptorSetMapping(slotInfo->pNextLevelSet);
+            free((void*)slotInfo->pNextLevelSet);
+        }
+    }
+    free((void*)mapping->pDescriptorInfo);
+}
+
+uint32_t* ilcSerializeMappings(
+    unsigned* size,
+    const GR_PIPELINE_SHADER* mappings)
+{
+    uint32_t* data = NULL;
+    unsigned wordCount = 0;
+
+    putMappingWord(&data, &wordCount, mappings->dynamicMemoryViewMapping.slotObjectType);
+    putMappingWord(&data, &wordCount, mappings->dynamicMemoryViewMapping.shaderEntityIndex);
+    for (unsigned i = 0; i < GR_MAX_DESCRIPTOR_SETS; i++) {
+        putDescriptorSetMapping(&data, &wordCount, &mappings->descriptorSetMapping[i]);
+    }
+
+    *size = sizeof(uint32_t) * wordCount;
+    return data;
+}
+
+GR_PIPELINE_SHADER* ilcDeserializeMappings(
+    const void* data,
+    unsigned size)
+{
+    const uint32_t* words = (const uint32_t*)data;
+    unsigned wordCount = size / sizeof(uint32_t);
+    unsigned idx = 0;
+
+    if (wordCount < 2) {
+        return NULL;
+    }
+
+    GR_PIPELINE_SHADER* mappings = calloc(1, sizeof(GR_PIPELINE_SHADER));
+    mappings->dynamicMemoryViewMapping.slotObjectType = words[idx++];
+    mappings->dynamicMemoryViewMapping.shaderEntityIndex = words[idx++];
+
+    for (unsigned i = 0; i < GR_MAX_DESCRIPTOR_SETS; i++) {
+        if (!getDescriptorSetMapping(&mappings->descriptorSetMapping[i], words, wordCount, &idx)) {
+            LOGW("malformed mapping data\n");
+            ilcFreeMappings(mappings);
+            return NULL;
+        }
+    }
+
+    return mappings;
+}
+
+void ilcFreeMappings(
+    GR_PIPELINE_SHADER* mappings)
+{
+    if (mappings == NULL) {
+        return;
+    }
+
+    for (unsigned i = 0; i < GR_MAX_DESCRIPTOR_SETS; i++) {
+        freeDescriptorSetMapping(&mappings->descriptorSetMapping[i]);
+    }
+    free(mappings);
+}
+
+static void getCacheFilePath(
+    char* path,
+    unsigned pathLen,
+    const char* cachePath,
+    const char* fileName)
+{
+    snprintf(path, pathLen, "%s\\%s", cachePath, fileName);
+}
+
+static int compareKeys(
+    const void* a,
+    const void* b)
+{
+    return memcmp(a, b, ILC_CACHE_KEY_SIZE);
+}
+
+static unsigned getKeyHash(
+    const uint8_t* key)
+{
+    // Keys are already uniformly distributed
+    return *(uint32_t*)key;
+}
+
+static const uint32_t* copyCode(
+    const uint32_t* code,
+    unsigned size)
+{
+    uint32_t* copy = malloc(size);
+
+    memcpy(copy, code, size);
+    return copy;
+}
+
+static const uint32_t* decompressCode(
+    const uint8_t* data,
+    unsigned storedSize,
+    unsigned size)
+{
+    uint32_t* code = malloc(size);
+
+    if (!ilcDecompress((uint8_t*)code, size, data, storedSize)) {
+        LOGW("corrupted shader cache entry\n");
+        free(code);
+        return NULL;
+    }
+
+    return code;
+}
+
+static const PackIndexEntry* findPackEntry(
+    const uint8_t* key)
+{
+    if (mCache.packData == NULL) {
+        return NULL;
+    }
+
+    return bsearch(key, mCache.packIndex, mCache.packEntryCount, sizeof(PackIndexEntry), compareKeys);
+}
+
+static JournalEntry* findJournalEntry(
+    const uint8_t* key)
+{
+    if (mCache.journalTableSize == 0) {
+        return NULL;
+    }
+
+    unsigned mask = mCache.journalTableSize - 1;
+
+    for (unsigned i = getKeyHash(key) & mask; mCache.journalTable[i] != 0; i = (i + 1) & mask) {
+        JournalEntry* entry = &mCache.journalEntries[mCache.journalTable[i] - 1];
+
+        if (memcmp(entry->key, key, ILC_CACHE_KEY_SIZE) == 0) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+static void insertJournalTableEntry(
+    unsigned entryIndex)
+{
+    unsigned mask = mCache.journalTableSize - 1;
+    unsigned i = getKeyHash(mCache.journalEntries[entryIndex].key) & mask;
+
+    while (mCache.journalTable[i] != 0) {
+        i = (i + 1) & mask;
+    }
+    mCache.journalTable[i] = entryIndex + 1;
+}
+
+static void addJournalEntry(
+    const JournalEntry* newEntry)
+{
+    // Keep the load factor under 50%
+    if (2 * (mCache.journalEntryCount + 1) > mCache.journalTableSize) {
+        free(mCache.journalTable);
+        mCache.journalTableSize = max(2 * mCache.journalTableSize, 64);
+        mCache.journalTable = calloc(mCache.journalTableSize, sizeof(unsigned));
+
+        for (unsigned i = 0; i < mCache.journalEntryCount; i++) {
+            insertJournalTableEntry(i);
+        }
+    }
+
+    mCache.journalEntries = realloc(mCache.journalEntries,
+                                    sizeof(JournalEntry) * (mCache.journalEntryCount + 1));
+    mCache.journalEntries[mCache.journalEntryCount] = *newEntry;
+    insertJournalTableEntry(mCache.journalEntryCount);
+    mCache.journalEntryCount++;
+    mCache.storedSize += newEntry->storedSize;
+}
+
+static uint8_t* readWholeFile(
+    unsigned* size,
+    const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    *size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    uint8_t* data = malloc(max(*size, 1));
+    if (fread(data, 1, *size, file) != *size) {
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+
+    return data;
+}
+
+static bool isFileHeaderValid(
+    const uint8_t* data,
+    unsigned size,
+    uint32_t magic,
+    unsigned entrySize)
+{
+    const CacheFileHeader* header = (const CacheFileHeader*)data;
+
+    return data != NULL && size >= sizeof(CacheFileHeader) &&
+           header->magic == magic && header->version == CACHE_VERSION &&
+           header->entryCount <= (size - sizeof(CacheFileHeader)) / entrySize;
+}
+
+static bool isPackEntryValid(
+    const PackIndexEntry* entry,
+    unsigned packSize)
+{
+    return entry->offset % PACK_ALIGNMENT == 0 &&
+           entry->offset <= packSize && entry->storedSize <= packSize - entry->offset &&
+           entry->storedSize <= entry->size && entry->size % sizeof(uint32_t) == 0;
+}
+
+// Calls the callback for each valid record, returns the size of the valid part of the journal
+static unsigned parseJournal(
+    const uint8_t* data,
+    unsigned size,
+    void (*callback)(const JournalRecordHeader* header, const uint8_t* storedData, void* userData),
+    void* userData)
+{
+    unsigned offset = 0;
+
+    while (size - offset >= sizeof(JournalRecordHeader)) {
+        const JournalRecordHeader* header = (const JournalRecordHeader*)&data[offset];
+
+        if (header->magic != JOURNAL_MAGIC ||
+            header->storedSize > header->size ||
+            header->size % sizeof(uint32_t) != 0 ||
+            header->storedSize > size - offset - sizeof(JournalRecordHeader)) {
+            break;
+        }
+
+        if (header->version == CACHE_VERSION) {
+            callback(header, (const uint8_t*)&header[1], userData);
+        }
+
+        // Keep records 4-byte aligned so that uncompressed code can be used in place
+        offset += sizeof(JournalRecordHeader) + ((header->storedSize + 3) & ~3);
+        offset = min(offset, size);
+    }
+
+    return offset;
+}
+
+static void loadJournalRecord(
+    const JournalRecordHeader* header,
+    const uint8_t* storedData,
+    void* userData)
+{
+    if (findPackEntry(header->key) != NULL || findJournalEntry(header->key) != NULL) {
+        return;
+    }
+
+    bool isCompressed = header->storedSize != header->size;
+    JournalEntry entry = {
+        .size = header->size,
+        .storedSize = header->storedSize,
+        .storedData = isCompressed ? storedData : NULL,
+        .code = isCompressed ? NULL : (const uint32_t*)storedData,
+        .isHeapCopy = false,
+        .lastUsed = mCache.sessionTime,
+    };
+    memcpy(entry.key, header->key, ILC_CACHE_KEY_SIZE);
+
+    addJournalEntry(&entry);
+}
+
+static bool openPack(
+    const char* path)
+{
+    LARGE_INTEGER fileSize;
+
+    mCache.packFile = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                                 FILE_ATTRIBUTE_NORMAL, NULL);
+    if (mCache.packFile == INVALID_HANDLE_VALUE) {
+        mCache.packFile = NULL;
+        return false;
+    }
+
+    if (!GetFileSizeEx(mCache.packFile, &fileSize) ||
+        fileSize.QuadPart < sizeof(CacheFileHeader) || fileSize.QuadPart > UINT32_MAX) {
+        LOGW("invalid shader pack size\n");
+        return false;
+    }
+
+    mCache.packMapping = CreateFileMapping(mCache.packFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mCache.packMapping == NULL) {
+        LOGW("CreateFileMapping failed (%d)\n", GetLastError());
+        return false;
+    }
+
+    mCache.packData = MapViewOfFile(mCache.packMapping, FILE_MAP_READ, 0, 0, 0);
+    if (mCache.packData == NULL) {
+        LOGW("MapViewOfFile failed (%d)\n", GetLastError());
+        return false;
+    }
+
+    unsigned packSize = fileSize.QuadPart;
+
+    if (!isFileHeaderValid(mCache.packData, packSize, PACK_MAGIC, sizeof(PackIndexEntry))) {
+        LOGI("ignoring outdated shader pack\n");
+        return false;
+    }
+
+    const CacheFileHeader* header = (const CacheFileHeader*)mCache.packData;
+    const PackIndexEntry* index = (const PackIndexEntry*)&header[1];
+
+    for (unsigned i = 0; i < header->entryCount; i++) {
+        if (!isPackEntryValid(&index[i], packSize)) {
+            LOGW("corrupted shader pack entry %u\n", i);
+            return false;
+        }
+        mCache.storedSize += index[i].storedSize;
+    }
+
+    mCache.packEntryCount = header->entryCount;
+    mCache.packIndex = index;
+    // Entries missing from the LRU file were never used on this machine
+    mCache.packLastUsed = calloc(max(mCache.packEntryCount, 1), sizeof(uint32_t));
+    mCache.packCodes = calloc(max(mCache.packEntryCount, 1), sizeof(uint32_t*));
+    return true;
+}
+
+static void closePack()
+{
+    for (unsigned i = 0; i < mCache.packEntryCount; i++) {
+        free((void*)mCache.packCodes[i]);
+    }
+    if (mCache.packData != NULL) {
+        UnmapViewOfFile(mCache.packData);
+    }
+    if (mCache.packMapping != NULL) {
+        CloseHandle(mCache.packMapping);
+    }
+    if (mCache.packFile != NULL) {
+        CloseHandle(mCache.packFile);
+    }
+    free(mCache.packLastUsed);
+    free(mCache.packCodes);
+    mCache.packData = NULL;
+    mCache.packMapping = NULL;
+    mCache.packFile = NULL;
+    mCache.packEntryCount = 0;
+    mCache.packIndex = NULL;
+    mCache.packLastUsed = NULL;
+    mCache.packCodes = NULL;
+}
+
+static void openJournal(
+    const char* path)
+{
+    unsigned journalSize = 0;
+    mCache.journalData = readWholeFile(&journalSize, path);
+
+    if (mCache.journalData != NULL) {
+        unsigned validSize = parseJournal(mCache.journalData, journalSize, loadJournalRecord, NULL);
+
+        if (validSize != journalSize) {
+            // Drop the torn tail left by an interrupted write so that appends stay parseable
+            LOGW("truncating shader cache journal from %u to %u bytes\n", journalSize, validSize);
+
+            FILE* file = fopen(path, "wb");
+            if (file != NULL) {
+                fwrite(mCache.journalData, 1, validSize, file);
+                fclose(file);
+            }
+        }
+    }
+
+    mCache.journalFile = fopen(path, "ab");
+    if (mCache.journalFile == NULL) {
+        LOGW("failed to open shader cache journal %s\n", path);
+    }
+}
+
+static void closeJournal()
+{
+    if (mCache.journalFile != NULL) {
+        fclose(mCache.journalFile);
+    }
+    for (unsigned i = 0; i < mCache.journalEntryCount; i++) {
+        if (mCache.journalEntries[i].isHeapCopy) {
+            free((void*)mCache.journalEntries[i].code);
+        }
+    }
+    free(mCache.journalData);
+    free(mCache.journalEntries);
+    free(mCache.journalTable);
+    mCache.journalFile = NULL;
+    mCache.journalData = NULL;
+    mCache.journalEntryCount = 0;
+    mCache.journalEntries = NULL;
+    mCache.journalTableSize = 0;
+    mCache.journalTable = NULL;
+}
+
+static void writeJournalRecord(
+    const uint8_t* key,
+    const void* storedData,
+    unsigned storedSize,
+    unsigned size)
+{
+    static const uint8_t padding[4] = { 0 };
+    JournalRecordHeader header = {
+        .magic = JOURNAL_MAGIC,
+        .version = CACHE_VERSION,
+        .storedSize = storedSize,
+        .size = size,
+    };
+    memcpy(header.key, key, ILC_CACHE_KEY_SIZE);
+
+    fwrite(&header, sizeof(header), 1, mCache.journalFile);
+    fwrite(storedData, 1, storedSize, mCache.journalFile);
+    fwrite(padding, 1, ((storedSize + 3) & ~3) - storedSize, mCache.journalFile);
+    fflush(mCache.journalFile);
+}
+
+static void loadLruFile(
+    const char* cachePath)
+{
+    char path[CACHE_PATH_LEN];
+    unsigned size = 0;
+    getCacheFilePath(path, sizeof(path), cachePath, LRU_FILE_NAME);
+
+    uint8_t* data = readWholeFile(&size, path);
+    if (!isFileHeaderValid(data, size, LRU_MAGIC, sizeof(LruRecord))) {
+        free(data);
+        return;
+    }
+
+    const CacheFileHeader* header = (const CacheFileHeader*)data;
+    const LruRecord* records = (const LruRecord*)&header[1];
+
+    for (unsigned i = 0; i < header->entryCount; i++) {
+        const PackIndexEntry* packEntry = findPackEntry(records[i].key);
+        JournalEntry* journalEntry = findJournalEntry(records[i].key);
+
+        if (packEntry != NULL) {
+            mCache.packLastUsed[packEntry - mCache.packIndex] = records[i].lastUsed;
+        } else if (journalEntry != NULL) {
+            journalEntry->lastUsed = records[i].lastUsed;
+        }
+    }
+
+    free(data);
+}
+
+static bool writeLruFile(
+    const char* cachePath,
+    const LruRecord* records,
+    unsigned recordCount)
+{
+    char path[CACHE_PATH_LEN];
+    char tempPath[CACHE_PATH_LEN + 8];
+    getCacheFilePath(path, sizeof(path), cachePath, LRU_FILE_NAME);
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", path);
+
+    FILE* file = fopen(tempPath, "wb");
+    if (file == NULL) {
+        return false;
+    }
+
+    const CacheFileHeader header = {
+        .magic = LRU_MAGIC,
+        .version = CACHE_VERSION,
+        .entryCount = recordCount,
+        .reserved = 0,
+    };
+
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   fwrite(records, sizeof(LruRecord), recordCount, file) == recordCount;
+    fclose(file);
+
+    if (!written || !MoveFileEx(tempPath, path, MOVEFILE_REPLACE_EXISTING)) {
+        LOGW("failed to write %s\n", path);
+        remove(tempPath);
+        return false;
+    }
+    return true;
+}
+
+static void saveLruFile()
+{
+    unsigned recordCount = mCache.packEntryCount + mCache.journalEntryCount;
+    LruRecord* records = malloc(sizeof(LruRecord) * max(recordCount, 1));
+
+    for (unsigned i = 0; i < mCache.packEntryCount; i++) {
+        memcpy(records[i].key, mCache.packIndex[i].key, ILC_CACHE_KEY_SIZE);
+        records[i].lastUsed = mCache.packLastUsed[i];
+    }
+    for (unsigned i = 0; i < mCache.journalEntryCount; i++) {
+        LruRecord* record = &records[mCache.packEntryCount + i];
+
+        memcpy(record->key, mCache.journalEntries[i].key, ILC_CACHE_KEY_SIZE);
+        record->lastUsed = mCache.journalEntries[i].lastUsed;
+    }
+
+    writeLruFile(mCache.path, records, recordCount);
+    free(records);
+}
+
+void ilcOpenShaderCache(
+    const char* path,
+    unsigned maxSize,
+    bool compress)
+{
+    if (path == NULL || strlen(path) == 0 || strlen(path) >= CACHE_PATH_LEN - 32) {
+        return;
+    }
+
+    AcquireSRWLockExclusive(&mCache.lock);
+
+    // Devices share the cache, only the first one opens it
+    if (mCache.refCount++ > 0) {
+        ReleaseSRWLockExclusive(&mCache.lock);
+        return;
+    }
+
+    if (!CreateDirectory(path, NULL) && GetLastError() != ERROR_ALREADY_EXISTS) {
+        LOGW("failed to create shader cache directory \"%s\"\n", path);
+        mCache.refCount = 0;
+        ReleaseSRWLockExclusive(&mCache.lock);
+        return;
+    }
+
+    char filePath[CACHE_PATH_LEN];
+    strcpy(mCache.path, path);
+    mCache.maxSize = maxSize;
+    mCache.compress = compress;
+    mCache.sessionTime = time(NULL);
+    mCache.storedSize = 0;
+
+    getCacheFilePath(filePath, sizeof(filePath), path, PACK_FILE_NAME);
+    if (!openPack(filePath)) {
+        closePack();
+        mCache.storedSize = 0;
+    }
+
+    getCacheFilePath(filePath, sizeof(filePath), path, JOURNAL_FILE_NAME);
+    openJournal(filePath);
+
+    loadLruFile(path);
+
+    // Warm up the hashing provider before compiles get spread across threads
+    uint8_t key[ILC_CACHE_KEY_SIZE];
+    ilcGetCacheKey(key, path, strlen(path), NULL, 0);
+
+    LOGI("using shader cache \"%s\" (%u packed, %u journaled, %llu KB)\n",
+         path, mCache.packEntryCount, mCache.journalEntryCount,
+         (unsigned long long)(mCache.storedSize / 1024));
+
+    ReleaseSRWLockExclusive(&mCache.lock);
+}
+
+void ilcCloseShaderCache()
+{
+    // Device destruction closes the cache whether or not one was opened
+    ilcDumpTotalProfile();
+
+    AcquireSRWLockExclusive(&mCache.lock);
+
+    if (mCache.refCount == 0 || --mCache.refCount > 0) {
+        ReleaseSRWLockExclusive(&mCache.lock);
+        return;
+    }
+
+    bool isOverCap = mCache.maxSize > 0 && mCache.storedSize > mCache.maxSize;
+
+    saveLruFile();
+    closeJournal();
+    closePack();
+
+    if (isOverCap) {
+        LOGI("shader cache exceeds %u KB, evicting\n", mCache.maxSize / 1024);
+        ilcCompactShaderCache(mCache.path, mCache.maxSize);
+    }
+
+    ReleaseSRWLockExclusive(&mCache.lock);
+}
+
+// Returns a copy of the cached code, owned by the caller
+uint32_t* ilcCacheLookup(
+    unsigned* size,
+    const uint8_t* key)
+{
+    const uint32_t* cachedCode = NULL;
+    unsigned cachedSize = 0;
+    uint32_t* code = NULL;
+
+    // Lookups update the use times and may decompress entries
+    AcquireSRWLockExclusive(&mCache.lock);
+
+    if (mCache.refCount == 0) {
+        ReleaseSRWLockExclusive(&mCache.lock);
+        return NULL;
+    }
+
+    const PackIndexEntry* packEntry = findPackEntry(key);
+    if (packEntry != NULL) {
+        unsigned index = packEntry - mCache.packIndex;
+
+        mCache.packLastUsed[index] = mCache.sessionTime;
+        cachedSize = packEntry->size;
+
+        if (packEntry->storedSize == packEntry->size) {
+            cachedCode = (const uint32_t*)&mCache.packData[packEntry->offset];
+        } else {
+            if (mCache.packCodes[index] == NULL) {
+                mCache.packCodes[index] = decompressCode(&mCache.packData[packEntry->offset],
+                                                         packEntry->storedSize, packEntry->size);
+            }
+            cachedCode = mCache.packCodes[index];
+        }
+    }
+
+    if (cachedCode == NULL) {
+        JournalEntry* entry = findJournalEntry(key);
+
+        if (entry != NULL) {
+            if (entry->code == NULL && entry->storedData != NULL) {
+                entry->code = decompressCode(entry->storedData, entry->storedSize, entry->size);
+                entry->storedData = NULL;
+                entry->isHeapCopy = true;
+            }
+            entry->lastUsed = mCache.sessionTime;
+            cachedCode = entry->code;
+            cachedSize = entry->size;
+        }
+    }
+
+    if (cachedCode != NULL) {
+        code = malloc(cachedSize);
+        memcpy(code, cachedCode, cachedSize);
+        *size = cachedSize;
+    }
+
+    ReleaseSRWLockExclusive(&mCache.lock);
+    return code;
+}
+
+// Stores a copy of the code
+void ilcCacheStore(
+    const uint8_t* key,
+    const uint32_t* code,
+    unsigned size)
+{
+    AcquireSRWLockShared(&mCache.lock);
+    bool isOpen = mCache.refCount > 0;
+    bool compress = mCache.compress;
+    ReleaseSRWLockShared(&mCache.lock);
+
+    if (!isOpen) {
+        return;
+    }
+
+    const uint8_t* storedData = (uint8_t*)code;
+    unsigned storedSize = size;
+    uint8_t* compressedData = NULL;
+
+    if (compress) {
+        compressedData = malloc(ilcGetMaxCompressedSize(size));
+        unsigned compressedSize = ilcCompress(compressedData, (uint8_t*)code, size);
+
+        // Not worth a decompression for small gains
+        if (compressedSize < size - size / 8) {
+            storedData = compressedData;
+            storedSize = compressedSize;
+        }
+    }
+
+    AcquireSRWLockExclusive(&mCache.lock);
+
+    // The cache may have been closed in the meantime, and another thread may have compiled the
+    // same shader
+    JournalEntry* entry = mCache.refCount > 0 ? findJournalEntry(key) : NULL;
+    if (mCache.refCount == 0 || (entry != NULL && entry->code != NULL)) {
+        // Nothing to store
+    } else if (entry != NULL) {
+        // Replaces a corrupted entry
+        entry->code = copyCode(code, size);
+        entry->storedData = NULL;
+        entry->isHeapCopy = true;
+    } else {
+        JournalEntry newEntry = {
+            .size = size,
+            .storedSize = storedSize,
+            .storedData = NULL,
+            .code = copyCode(code, size),
+            .isHeapCopy = true,
+            .lastUsed = mCache.sessionTime,
+        };
+        memcpy(newEntry.key, key, ILC_CACHE_KEY_SIZE);
+        addJournalEntry(&newEntry);
+
+        if (mCache.journalFile != NULL) {
+            writeJournalRecord(key, storedData, storedSize, size);
+        }
+    }
+
+    ReleaseSRWLockExclusive(&mCache.lock);
+
+    free(compressedData);
+}
+
+void ilcReleaseShader(
+    const uint32_t* code)
+{
+    // Compiled code is always owned by the caller
+    free((void*)code);
+}
+
+static void addCompactionEntry(
+    unsigned* entryCount,
+    CompactionEntry** entries,
+    const uint8_t* key,
+    const uint8_t* data,
+    unsigned storedSize,
+    unsigned size,
+    uint32_t lastUsed)
+{
+    *entries = realloc(*entries, sizeof(CompactionEntry) * (*entryCount + 1));
+
+    CompactionEntry* entry = &(*entries)[*entryCount];
+    memcpy(entry->key, key, ILC_CACHE_KEY_SIZE);
+    entry->order = *entryCount;
+    entry->storedSize = storedSize;
+    entry->size = size;
+    entry->data = data;
+    entry->lastUsed = lastUsed;
+    (*entryCount)++;
+}
+
+static int compareCompactionEntries(
+    const void* a,
+    const void* b)
+{
+    const CompactionEntry* entryA = a;
+    const CompactionEntry* entryB = b;
+    int res = compareKeys(entryA->key, entryB->key);
+
+    // Keep the first occurrence of duplicate keys in front
+    if (res == 0) {
+        return entryA->order < entryB->order ? -1 : 1;
+    }
+    return res;
+}
+
+static int compareCompactionEntriesByUse(
+    const void* a,
+    const void* b)
+{
+    const CompactionEntry* entryA = a;
+    const CompactionEntry* entryB = b;
+
+    // Most recently used first
+    if (entryA->lastUsed != entryB->lastUsed) {
+        return entryA->lastUsed > entryB->lastUsed ? -1 : 1;
+    }
+    return entryA->order < entryB->order ? -1 : 1;
+}
+
+typedef struct {
+    unsigned entryCount;
+    CompactionEntry* entries;
+} CompactionState;
+
+static void addCompactionRecord(
+    const JournalRecordHeader* header,
+    const uint8_t* storedData,
+    void* userData)
+{
+    CompactionState* state = userData;
+
+    // Journaled entries were compiled recently
+    addCompactionEntry(&state->entryCount, &state->entries, header->key, storedData,
+                       header->storedSize, header->size, time(NULL));
+}
+
+static bool writePack(
+    const char* path,
+    const CompactionEntry* entries,
+    unsigned entryCount)
+{
+    static const uint8_t padding[PACK_ALIGNMENT] = { 0 };
+    PackIndexEntry* index = malloc(sizeof(PackIndexEntry) * max(entryCount, 1));
+    unsigned offset = sizeof(CacheFileHeader) + entryCount * sizeof(PackIndexEntry);
+
+    for (unsigned i = 0; i < entryCount; i++) {
+        offset = (offset + PACK_ALIGNMENT - 1) & ~(PACK_ALIGNMENT - 1);
+        memcpy(index[i].key, entries[i].key, ILC_CACHE_KEY_SIZE);
+        index[i].offset = offset;
+        index[i].storedSize = entries[i].storedSize;
+        index[i].size = entries[i].size;
+        offset += entries[i].storedSize;
+    }
+
+    const CacheFileHeader header = {
+        .magic = PACK_MAGIC,
+        .version = CACHE_VERSION,
+        .entryCount = entryCount,
+        .reserved = 0,
+    };
+    bool written = false;
+
+    FILE* file = fopen(path, "wb");
+    if (file != NULL) {
+        written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                  fwrite(index, sizeof(PackIndexEntry), entryCount, file) == entryCount;
+
+        for (unsigned i = 0; written && i < entryCount; i++) {
+            unsigned paddingSize = index[i].offset - ftell(file);
+
+            written = fwrite(padding, 1, paddingSize, file) == paddingSize &&
+                      fwrite(entries[i].data, 1, entries[i].storedSize, file) == entries[i].storedSize;
+        }
+        fclose(file);
+    }
+
+    free(index);
+    return written;
+}
+
+bool ilcCompactShaderCache(
+    const char* path,
+    unsigned maxSize)
+{
+    if (mCache.refCount > 0) {
+        LOGE("can't compact an open shader cache\n");
+        return false;
+    }
+
+    char packPath[CACHE_PATH_LEN];
+    char journalPath[CACHE_PATH_LEN];
+    char lruPath[CACHE_PATH_LEN];
+    char tempPath[CACHE_PATH_LEN + 8];
+    getCacheFilePath(packPath, sizeof(packPath), path, PACK_FILE_NAME);
+    getCacheFilePath(journalPath, sizeof(journalPath), path, JOURNAL_FILE_NAME);
+    getCacheFilePath(lruPath, sizeof(lruPath), path, LRU_FILE_NAME);
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", packPath);
+
+    CompactionState state = { 0 };
+    unsigned packSize = 0;
+    unsigned journalSize = 0;
+    unsigned lruSize = 0;
+    uint8_t* packData = readWholeFile(&packSize, packPath);
+    uint8_t* journalData = readWholeFile(&journalSize, journalPath);
+    uint8_t* lruData = readWholeFile(&lruSize, lruPath);
+
+    // Pack entries come first so that they take precedence over journaled duplicates
+    if (isFileHeaderValid(packData, packSize, PACK_MAGIC, sizeof(PackIndexEntry))) {
+        const CacheFileHeader* header = (const CacheFileHeader*)packData;
+        const PackIndexEntry* index = (const PackIndexEntry*)&header[1];
+
+        for (unsigned i = 0; i < header->entryCount; i++) {
+            if (isPackEntryValid(&index[i], packSize)) {
+                addCompactionEntry(&state.entryCount, &state.entries, index[i].key,
+                                   &packData[index[i].offset], index[i].storedSize, index[i].size, 0);
+            }
+        }
+    }
+    if (journalData != NULL) {
+        parseJournal(journalData, journalSize, addCompactionRecord, &state);
+    }
+
+    if (isFileHeaderValid(lruData, lruSize, LRU_MAGIC, sizeof(LruRecord))) {
+        const CacheFileHeader* header = (const CacheFileHeader*)lruData;
+        LruRecord* records = (LruRecord*)&header[1];
+
+        qsort(records, header->entryCount, sizeof(LruRecord), compareKeys);
+        for (unsigned i = 0; i < state.entryCount; i++) {
+            const LruRecord* record = bsearch(state.entries[i].key, records, header->entryCount,
+                                              sizeof(LruRecord), compareKeys);
+            if (record != NULL) {
+                state.entries[i].lastUsed = record->lastUsed;
+            }
+        }
+    }
+
+    qsort(state.entries, state.entryCount, sizeof(CompactionEntry), compareCompactionEntries);
+
+    unsigned entryCount = 0;
+    uint64_t totalSize = 0;
+    for (unsigned i = 0; i < state.entryCount; i++) {
+        if (entryCount == 0 ||
+            compareKeys(state.entries[entryCount - 1].key, state.entries[i].key) != 0) {
+            state.entries[entryCount++] = state.entries[i];
+            totalSize += state.entries[i].storedSize;
+        }
+    }
+
+    unsigned evictedCount = 0;
+    if (maxSize > 0 && totalSize > maxSize) {
+        uint64_t keptSize = 0;
+        unsigned keptCount = 0;
+
+        qsort(state.entries, entryCount, sizeof(CompactionEntry), compareCompactionEntriesByUse);
+        while (keptCount < entryCount &&
+               keptSize + state.entries[keptCount].storedSize <= EVICTION_TARGET(maxSize)) {
+            keptSize += state.entries[keptCount].storedSize;
+            keptCount++;
+        }
+
+        evictedCount = entryCount - keptCount;
+        entryCount = keptCount;
+        qsort(state.entries, entryCount, sizeof(CompactionEntry), compareCompactionEntries);
+    }
+
+    bool written = writePack(tempPath, state.entries, entryCount);
+
+    if (written && MoveFileEx(tempPath, packPath, MOVEFILE_REPLACE_EXISTING)) {
+        LruRecord* records = malloc(sizeof(LruRecord) * max(entryCount, 1));
+
+        for (unsigned i = 0; i < entryCount; i++) {
+            memcpy(records[i].key, state.entries[i].key, ILC_CACHE_KEY_SIZE);
+            records[i].lastUsed = state.entries[i].lastUsed;
+        }
+        writeLruFile(path, records, entryCount);
+        free(records);
+
+        remove(journalPath);
+        LOGI("compacted %u shaders into %s, evicted %u\n", entryCount, packPath, evictedCount);
+    } else {
+        LOGE("failed to write %s\n", tempPath);
+        remove(tempPath);
+        written = false;
+    }
+
+    free(state.entries);
+    free(packData);
+    free(journalData);
+    free(lruData);
+
+    return written;
+}
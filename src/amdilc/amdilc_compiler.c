@@ -136,6 +136,7 @@ typedef struct {
     unsigned controlFlowBlockCount;
     IlcControlFlowBlock* controlFlowBlocks;
     bool isInFunction;
+    IlcSpvWord threadGroupSize[3];
 } IlcCompiler;
 
 static IlcSpvId emitVectorVariable(
@@ -3112,6 +3113,12 @@ static void emitInstr(
     case IL_DCL_GLOBAL_FLAGS:
         emitGlobalFlags(compiler, instr);
         break;
+    case IL_OP_DCL_NUM_THREAD_PER_GROUP:
+        // Unspecified dimensions default to 1
+        for (int i = 0; i < instr->extraCount && i < 3; i++) {
+            compiler->threadGroupSize[i] = instr->extras[i];
+        }
+        break;
     default:
         LOGW("unhandled instruction %d\n", instr->opcode);
     }
@@ -3187,17 +3194,50 @@ static void emitEntryPoint(
     switch (compiler->kernel->shaderType) {
     case IL_SHADER_PIXEL:
         ilcSpvPutExecMode(compiler->module, compiler->entryPointId,
-                          SpvExecutionModeOriginUpperLeft);
+                          SpvExecutionModeOriginUpperLeft, 0, NULL);
+        break;
+    case IL_SHADER_COMPUTE:
+        ilcSpvPutExecMode(compiler->module, compiler->entryPointId,
+                          SpvExecutionModeLocalSize, 3, compiler->threadGroupSize);
         break;
     }
 
     free(interfaces);
 }
 
+static unsigned getModuleWordCount(
+    const IlcSpvModule* module)
+{
+    unsigned wordCount = 0;
+
+    for (int i = 0; i < ID_MAX; i++) {
+        wordCount += module->buffer[i].wordCount;
+    }
+    return wordCount;
+}
+
+static void emitProfiledInstr(
+    IlcCompiler* compiler,
+    const Instruction* instr,
+    IlcProfile* profile)
+{
+    IlcOpcodeStats* stats = &profile->opcodes[instr->opcode];
+    // Types and constants count as well, they're emitted on first use
+    unsigned wordCount = getModuleWordCount(compiler->module);
+    uint64_t timestamp = ilcGetTimestamp();
+
+    emitInstr(compiler, instr);
+
+    stats->ticks += ilcGetTimestamp() - timestamp;
+    stats->wordCount += getModuleWordCount(compiler->module) - wordCount;
+    stats->count++;
+}
+
 uint32_t* ilcCompileKernel(
     unsigned* size,
     const GR_PIPELINE_SHADER* mappings,
-    const Kernel* kernel)
+    const Kernel* kernel,
+    IlcProfile* profile)
 {
     IlcSpvModule module;
 
@@ -3276,11 +3316,16 @@ uint32_t* ilcCompileKernel(
         .controlFlowBlockCount = 0,
         .controlFlowBlocks = NULL,
         .isInFunction = true,
+        .threadGroupSize = { 1, 1, 1 },
     };
 
     emitFunc(&compiler, compiler.entryPointId);
     for (int i = 0; i < kernel->instrCount; i++) {
-        emitInstr(&compiler, &kernel->instrs[i]);
+        if (profile != NULL && kernel->instrs[i].opcode < IL_OP_LAST) {
+            emitProfiledInstr(&compiler, &kernel->instrs[i], profile);
+        } else {
+            emitInstr(&compiler, &kernel->instrs[i]);
+        }
     }
 
     emitEntryPoint(&compiler);
@@ -0,0 +1,182 @@
+#include "amdilc_internal.h"
+
+// LZ77 byte-oriented format, each sequence is:
+// - a token with the literal count in the high nibble and the match length minus
+//   MIN_MATCH in the low nibble, 15 meaning that extra length bytes follow
+// - the literals
+// - a 16-bit little-endian match offset, omitted for the last sequence
+#define MIN_MATCH           (4)
+#define MAX_OFFSET          (0xFFFF)
+#define HASH_BITS           (12)
+
+static uint32_t read32(
+    const uint8_t* ptr)
+{
+    uint32_t value;
+    memcpy(&value, ptr, sizeof(value));
+    return value;
+}
+
+static unsigned hashSequence(
+    uint32_t sequence)
+{
+    return (sequence * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static uint8_t* putLength(
+    uint8_t* op,
+    unsigned length)
+{
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = length;
+    return op;
+}
+
+static uint8_t* putSequence(
+    uint8_t* op,
+    const uint8_t* literals,
+    unsigned literalCount,
+    unsigned offset,
+    unsigned matchLength)
+{
+    uint8_t* token = op++;
+    unsigned matchCode = matchLength > 0 ? matchLength - MIN_MATCH : 0;
+
+    *token = ((literalCount < 15 ? literalCount : 15) << 4) | (matchCode < 15 ? matchCode : 15);
+    if (literalCount >= 15) {
+        op = putLength(op, literalCount - 15);
+    }
+    memcpy(op, literals, literalCount);
+    op += literalCount;
+
+    if (matchLength > 0) {
+        *op++ = offset & 0xFF;
+        *op++ = offset >> 8;
+        if (matchCode >= 15) {
+            op = putLength(op, matchCode - 15);
+        }
+    }
+
+    return op;
+}
+
+static bool getLength(
+    unsigned* length,
+    const uint8_t** ip,
+    const uint8_t* ipEnd)
+{
+    uint8_t byte;
+
+    do {
+        if (*ip >= ipEnd) {
+            return false;
+        }
+        byte = *(*ip)++;
+        *length += byte;
+    } while (byte == 255);
+
+    return true;
+}
+
+unsigned ilcGetMaxCompressedSize(
+    unsigned size)
+{
+    return size + size / 255 + 16;
+}
+
+unsigned ilcCompress(
+    uint8_t* dst,
+    const uint8_t* src,
+    unsigned size)
+{
+    unsigned* table = calloc(1 << HASH_BITS, sizeof(unsigned)); // Position + 1, 0 is empty
+    uint8_t* op = dst;
+    unsigned anchor = 0;
+    unsigned pos = 0;
+
+    while (pos + MIN_MATCH <= size) {
+        uint32_t sequence = read32(&src[pos]);
+        unsigned hash = hashSequence(sequence);
+        unsigned ref = table[hash];
+        table[hash] = pos + 1;
+
+        if (ref == 0 || pos - (ref - 1) > MAX_OFFSET || read32(&src[ref - 1]) != sequence) {
+            pos++;
+            continue;
+        }
+
+        ref--;
+        unsigned matchLength = MIN_MATCH;
+        while (pos + matchLength < size && src[ref + matchLength] == src[pos + matchLength]) {
+            matchLength++;
+        }
+
+        op = putSequence(op, &src[anchor], pos - anchor, pos - ref, matchLength);
+        pos += matchLength;
+        anchor = pos;
+    }
+
+    if (anchor < size) {
+        op = putSequence(op, &src[anchor], size - anchor, 0, 0);
+    }
+
+    free(table);
+    return op - dst;
+}
+
+bool ilcDecompress(
+    uint8_t* dst,
+    unsigned dstSize,
+    const uint8_t* src,
+    unsigned srcSize)
+{
+    const uint8_t* ip = src;
+    const uint8_t* ipEnd = src + srcSize;
+    uint8_t* op = dst;
+    uint8_t* opEnd = dst + dstSize;
+
+    while (ip < ipEnd) {
+        uint8_t token = *ip++;
+        unsigned literalCount = token >> 4;
+        unsigned matchLength = token & 0xF;
+
+        if (literalCount == 15 && !getLength(&literalCount, &ip, ipEnd)) {
+            return false;
+        }
+        if (literalCount > ipEnd - ip || literalCount > opEnd - op) {
+            return false;
+        }
+        memcpy(op, ip, literalCount);
+        ip += literalCount;
+        op += literalCount;
+
+        if (ip == ipEnd) {
+            break;
+        } else if (ipEnd - ip < 2) {
+            return false;
+        }
+
+        unsigned offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (matchLength == 15 && !getLength(&matchLength, &ip, ipEnd)) {
+            return false;
+        }
+        matchLength += MIN_MATCH;
+
+        if (offset == 0 || offset > op - dst || matchLength > opEnd - op) {
+            return false;
+        }
+
+        // Byte by byte since the match can overlap with its own output
+        const uint8_t* ref = op - offset;
+        for (unsigned i = 0; i < matchLength; i++) {
+            op[i] = ref[i];
+        }
+        op += matchLength;
+    }
+
+    return op == opEnd;
+}
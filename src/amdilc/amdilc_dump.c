@@ -9,6 +9,127 @@ const char* mIlShaderTypeNames[IL_SHADER_LAST] = {
     "ds",
 };
 
+// Mnemonics of the opcodes, those with control fields get printed along with them below
+const char* mIlOpcodeNames[IL_OP_LAST] = {
+    [IL_OP_ABS] = "abs",
+    [IL_OP_ACOS] = "acos",
+    [IL_OP_ADD] = "add",
+    [IL_OP_ASIN] = "asin",
+    [IL_OP_ATAN] = "atan",
+    [IL_OP_BREAK] = "break",
+    [IL_OP_CONTINUE] = "continue",
+    [IL_OP_DIV] = "div_zeroop",
+    [IL_OP_DP3] = "dp3",
+    [IL_OP_DP4] = "dp4",
+    [IL_OP_DSX] = "dsx",
+    [IL_OP_DSY] = "dsy",
+    [IL_OP_ELSE] = "else",
+    [IL_OP_END] = "end",
+    [IL_OP_ENDIF] = "endif",
+    [IL_OP_ENDLOOP] = "endloop",
+    [IL_OP_ENDMAIN] = "endmain",
+    [IL_OP_FRC] = "frc",
+    [IL_OP_MAD] = "mad",
+    [IL_OP_MAX] = "max",
+    [IL_OP_MIN] = "min",
+    [IL_OP_MOV] = "mov",
+    [IL_OP_MUL] = "mul",
+    [IL_OP_BREAK_LOGICALZ] = "break_logicalz",
+    [IL_OP_BREAK_LOGICALNZ] = "break_logicalnz",
+    [IL_OP_CASE] = "case",
+    [IL_OP_DEFAULT] = "default",
+    [IL_OP_ENDSWITCH] = "endswitch",
+    [IL_OP_IF_LOGICALZ] = "if_logicalz",
+    [IL_OP_IF_LOGICALNZ] = "if_logicalnz",
+    [IL_OP_WHILE] = "whileloop",
+    [IL_OP_SWITCH] = "switch",
+    [IL_OP_RET_DYN] = "ret_dyn",
+    [IL_DCL_CONST_BUFFER] = "dcl_cb",
+    [IL_DCL_INDEXED_TEMP_ARRAY] = "dcl_indexed_temp_array",
+    [IL_DCL_LITERAL] = "dcl_literal",
+    [IL_DCL_OUTPUT] = "dcl_output",
+    [IL_DCL_INPUT] = "dcl_input",
+    [IL_DCL_RESOURCE] = "dcl_resource",
+    [IL_OP_DISCARD_LOGICALNZ] = "discard_logicalnz",
+    [IL_OP_LOAD] = "load_resource",
+    [IL_OP_RESINFO] = "resinfo_resource",
+    [IL_OP_SAMPLE] = "sample_resource",
+    [IL_OP_SAMPLE_B] = "sample_b_resource",
+    [IL_OP_SAMPLE_G] = "sample_g_resource",
+    [IL_OP_SAMPLE_L] = "sample_l_resource",
+    [IL_OP_SAMPLE_C] = "sample_c",
+    [IL_OP_SAMPLE_C_LZ] = "sample_c_lz_resource",
+    [IL_OP_I_NOT] = "inot",
+    [IL_OP_I_OR] = "ior",
+    [IL_OP_I_ADD] = "iadd",
+    [IL_OP_I_MAD] = "imad",
+    [IL_OP_I_MUL] = "imul",
+    [IL_OP_I_EQ] = "ieq",
+    [IL_OP_I_GE] = "ige",
+    [IL_OP_I_LT] = "ilt",
+    [IL_OP_I_NEGATE] = "inegate",
+    [IL_OP_I_NE] = "ine",
+    [IL_OP_I_SHL] = "ishl",
+    [IL_OP_U_SHR] = "ushr",
+    [IL_OP_U_DIV] = "udiv",
+    [IL_OP_U_MOD] = "umod",
+    [IL_OP_U_LT] = "ult",
+    [IL_OP_U_GE] = "uge",
+    [IL_OP_FTOI] = "ftoi",
+    [IL_OP_FTOU] = "ftou",
+    [IL_OP_ITOF] = "itof",
+    [IL_OP_UTOF] = "utof",
+    [IL_OP_AND] = "iand",
+    [IL_OP_CMOV_LOGICAL] = "cmov_logical",
+    [IL_OP_EQ] = "eq",
+    [IL_OP_EXP_VEC] = "exp_vec",
+    [IL_OP_GE] = "ge",
+    [IL_OP_LOG_VEC] = "log_vec",
+    [IL_OP_LT] = "lt",
+    [IL_OP_NE] = "ne",
+    [IL_OP_ROUND_NEAR] = "round_nearest",
+    [IL_OP_ROUND_NEG_INF] = "round_neginf",
+    [IL_OP_ROUND_PLUS_INF] = "round_plusinf",
+    [IL_OP_ROUND_ZERO] = "round_z",
+    [IL_OP_RSQ_VEC] = "rsq_vec",
+    [IL_OP_SIN_VEC] = "sin_vec",
+    [IL_OP_COS_VEC] = "cos_vec",
+    [IL_OP_SQRT_VEC] = "sqrt_vec",
+    [IL_OP_DP2] = "dp2",
+    [IL_OP_FETCH4] = "fetch4",
+    [IL_OP_DCL_NUM_THREAD_PER_GROUP] = "dcl_num_thread_per_group",
+    [IL_OP_FENCE] = "fence",
+    [IL_OP_LDS_LOAD_VEC] = "lds_load_vec",
+    [IL_OP_LDS_STORE_VEC] = "lds_store_vec",
+    [IL_OP_DCL_UAV] = "dcl_uav",
+    [IL_OP_DCL_RAW_UAV] = "dcl_raw_uav",
+    [IL_OP_DCL_STRUCT_UAV] = "dcl_struct_uav",
+    [IL_OP_UAV_LOAD] = "uav_load",
+    [IL_OP_UAV_RAW_LOAD] = "uav_raw_load",
+    [IL_OP_UAV_STRUCT_LOAD] = "uav_struct_load",
+    [IL_OP_UAV_STORE] = "uav_store",
+    [IL_OP_UAV_RAW_STORE] = "uav_raw_store",
+    [IL_OP_UAV_STRUCT_STORE] = "uav_struct_store",
+    [IL_OP_UAV_ADD] = "uav_add",
+    [IL_OP_UAV_READ_ADD] = "uav_read_add",
+    [IL_OP_DCL_RAW_SRV] = "dcl_raw_srv",
+    [IL_OP_DCL_STRUCT_SRV] = "dcl_struct_srv",
+    [IL_OP_SRV_RAW_LOAD] = "srv_raw_load",
+    [IL_OP_SRV_STRUCT_LOAD] = "srv_struct_load",
+    [IL_DCL_STRUCT_LDS] = "dcl_struct_lds",
+    [IL_OP_SAMPLE_C_L] = "sample_c_l",
+    [IL_OP_SAMPLE_C_G] = "sample_c_g",
+    [IL_OP_SAMPLE_C_B] = "sample_c_b",
+    [IL_OP_U_BIT_EXTRACT] = "ubit_extract",
+    [IL_OP_U_BIT_INSERT] = "ubit_insert",
+    [IL_OP_FETCH4_C] = "fetch4_c",
+    [IL_OP_FETCH4_PO] = "fetch4_po",
+    [IL_OP_FETCH4_PO_C] = "fetch4_po_c",
+    [IL_DCL_GLOBAL_FLAGS] = "dcl_global_flags",
+    [IL_OP_DCL_TYPED_UAV] = "dcl_typed_uav",
+    [IL_UNK_660] = "unk",
+};
+
 static const char* mIlLanguageTypeNames[IL_LANG_LAST] = {
     "generic",
     "opengl",
@@ -393,27 +514,6 @@ static void dumpInstruction(
     }
 
     switch (instr->opcode) {
-    case IL_OP_ABS:
-        fprintf(file, "abs");
-        break;
-    case IL_OP_ACOS:
-        fprintf(file, "acos");
-        break;
-    case IL_OP_ADD:
-        fprintf(file, "add");
-        break;
-    case IL_OP_ASIN:
-        fprintf(file, "asin");
-        break;
-    case IL_OP_ATAN:
-        fprintf(file, "atan");
-        break;
-    case IL_OP_BREAK:
-        fprintf(file, "break");
-        break;
-    case IL_OP_CONTINUE:
-        fprintf(file, "continue");
-        break;
     case IL_OP_DIV:
         fprintf(file, "div_zeroop(%s)", mIlZeroOpNames[instr->control]);
         break;
@@ -433,21 +533,6 @@ static void dumpInstruction(
         fprintf(file, "else");
         indentLevel++;
         break;
-    case IL_OP_END:
-        fprintf(file, "end");
-        break;
-    case IL_OP_ENDIF:
-        fprintf(file, "endif");
-        break;
-    case IL_OP_ENDLOOP:
-        fprintf(file, "endloop");
-        break;
-    case IL_OP_ENDMAIN:
-        fprintf(file, "endmain");
-        break;
-    case IL_OP_FRC:
-        fprintf(file, "frc");
-        break;
     case IL_OP_MAD:
         fprintf(file, "mad%s", GET_BIT(instr->control, 0) ? "_ieee" : "");
         break;
@@ -457,18 +542,9 @@ static void dumpInstruction(
     case IL_OP_MIN:
         fprintf(file, "min%s", GET_BIT(instr->control, 0) ? "_ieee" : "");
         break;
-    case IL_OP_MOV:
-        fprintf(file, "mov");
-        break;
     case IL_OP_MUL:
         fprintf(file, "mul%s", GET_BIT(instr->control, 0) ? "_ieee" : "");
         break;
-    case IL_OP_BREAK_LOGICALZ:
-        fprintf(file, "break_logicalz");
-        break;
-    case IL_OP_BREAK_LOGICALNZ:
-        fprintf(file, "break_logicalnz");
-        break;
     case IL_OP_IF_LOGICALZ:
         fprintf(file, "if_logicalz");
         indentLevel++;
@@ -481,21 +557,12 @@ static void dumpInstruction(
         fprintf(file, "whileloop");
         indentLevel++;
         break;
-    case IL_OP_RET_DYN:
-        fprintf(file, "ret_dyn");
-        break;
     case IL_DCL_CONST_BUFFER:
         if (GET_BIT(instr->control, 15)) {
             LOGW("unhandled immediate constant buffer\n");
         }
         fprintf(file, "dcl_cb");
         break;
-    case IL_DCL_INDEXED_TEMP_ARRAY:
-        fprintf(file, "dcl_indexed_temp_array");
-        break;
-    case IL_DCL_LITERAL:
-        fprintf(file, "dcl_literal");
-        break;
     case IL_DCL_OUTPUT:
         fprintf(file, "dcl_output_%s", mIlImportUsageNames[instr->control]);
         break;
@@ -514,9 +581,6 @@ static void dumpInstruction(
                 mIlElementFormatNames[GET_BITS(instr->extras[0], 26, 28)],
                 mIlElementFormatNames[GET_BITS(instr->extras[0], 29, 31)]);
         break;
-    case IL_OP_DISCARD_LOGICALNZ:
-        fprintf(file, "discard_logicalnz");
-        break;
     case IL_OP_LOAD:
         // Sampler ID is ignored
         fprintf(file, "load_resource(%u)", GET_BITS(instr->control, 0, 7));
@@ -564,114 +628,9 @@ static void dumpInstruction(
         fprintf(file, "sample_c_lz_resource(%u)_sampler(%u)",
                 GET_BITS(instr->control, 0, 7), GET_BITS(instr->control, 8, 11));
         break;
-    case IL_OP_I_NOT:
-        fprintf(file, "inot");
-        break;
-    case IL_OP_I_OR:
-        fprintf(file, "ior");
-        break;
-    case IL_OP_I_ADD:
-        fprintf(file, "iadd");
-        break;
-    case IL_OP_I_MAD:
-        fprintf(file, "imad");
-        break;
-    case IL_OP_I_MUL:
-        fprintf(file, "imul");
-        break;
-    case IL_OP_I_EQ:
-        fprintf(file, "ieq");
-        break;
-    case IL_OP_I_GE:
-        fprintf(file, "ige");
-        break;
-    case IL_OP_I_LT:
-        fprintf(file, "ilt");
-        break;
-    case IL_OP_I_NEGATE:
-        fprintf(file, "inegate");
-        break;
-    case IL_OP_I_NE:
-        fprintf(file, "ine");
-        break;
-    case IL_OP_I_SHL:
-        fprintf(file, "ishl");
-        break;
-    case IL_OP_U_SHR:
-        fprintf(file, "ushr");
-        break;
-    case IL_OP_U_DIV:
-        fprintf(file, "udiv");
-        break;
-    case IL_OP_U_MOD:
-        fprintf(file, "umod");
-        break;
-    case IL_OP_U_LT:
-        fprintf(file, "ult");
-        break;
-    case IL_OP_U_GE:
-        fprintf(file, "uge");
-        break;
-    case IL_OP_FTOI:
-        fprintf(file, "ftoi");
-        break;
-    case IL_OP_FTOU:
-        fprintf(file, "ftou");
-        break;
-    case IL_OP_ITOF:
-        fprintf(file, "itof");
-        break;
-    case IL_OP_UTOF:
-        fprintf(file, "utof");
-        break;
     case IL_OP_AND:
         fprintf(file, "iand"); // IL_OP_I_AND doesn't exist
         break;
-    case IL_OP_CMOV_LOGICAL:
-        fprintf(file, "cmov_logical");
-        break;
-    case IL_OP_EQ:
-        fprintf(file, "eq");
-        break;
-    case IL_OP_EXP_VEC:
-        fprintf(file, "exp_vec");
-        break;
-    case IL_OP_GE:
-        fprintf(file, "ge");
-        break;
-    case IL_OP_LOG_VEC:
-        fprintf(file, "log_vec");
-        break;
-    case IL_OP_LT:
-        fprintf(file, "lt");
-        break;
-    case IL_OP_NE:
-        fprintf(file, "ne");
-        break;
-    case IL_OP_ROUND_NEAR:
-        fprintf(file, "round_nearest");
-        break;
-    case IL_OP_ROUND_NEG_INF:
-        fprintf(file, "round_neginf");
-        break;
-    case IL_OP_ROUND_PLUS_INF:
-        fprintf(file, "round_plusinf");
-        break;
-    case IL_OP_ROUND_ZERO:
-        fprintf(file, "round_z");
-        break;
-    case IL_OP_RSQ_VEC:
-        fprintf(file, "rsq_vec");
-        break;
-    case IL_OP_SIN_VEC:
-        fprintf(file, "sin_vec");
-        break;
-    case IL_OP_COS_VEC:
-        fprintf(file, "cos_vec");
-        break;
-    case IL_OP_SQRT_VEC:
-        fprintf(file, "sqrt_vec");
-        break;
     case IL_OP_DP2:
         fprintf(file, "dp2%s", GET_BIT(instr->control, 0) ? "_ieee" : "");
         break;
@@ -727,15 +686,6 @@ static void dumpInstruction(
         fprintf(file, "dcl_struct_lds_id(%u) %u, %u",
                 GET_BITS(instr->control, 0, 13), instr->extras[0], instr->extras[1]);
         break;
-    case IL_OP_U_BIT_EXTRACT:
-        fprintf(file, "ubit_extract");
-        break;
-    case IL_OP_U_BIT_INSERT:
-        fprintf(file, "ubit_insert");
-        break;
-    case IL_DCL_GLOBAL_FLAGS:
-        fprintf(file, "dcl_global_flags");
-        break;
     case IL_OP_DCL_TYPED_UAV:
         // FIXME guessed from IL_OP_DCL_UAV
         fprintf(file, "dcl_typed_uav_id(%u)_type(%s)_fmtx(%s)",
@@ -747,8 +697,12 @@ static void dumpInstruction(
         fprintf(file, "unk_%u", instr->opcode);
         break;
     default:
-        fprintf(file, "%u?\n", instr->opcode);
-        return;
+        if (instr->opcode >= IL_OP_LAST || mIlOpcodeNames[instr->opcode] == NULL) {
+            fprintf(file, "%u?\n", instr->opcode);
+            return;
+        }
+        fprintf(file, "%s", mIlOpcodeNames[instr->opcode]);
+        break;
     }
 
     assert(instr->dstCount <= 1);
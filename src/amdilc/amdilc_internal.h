@@ -74,12 +74,26 @@ typedef struct {
     Instruction* instrs;
 } Kernel;
 
+typedef struct {
+    unsigned count;
+    uint64_t ticks;
+    uint64_t wordCount;
+} IlcOpcodeStats;
+
+typedef struct {
+    IlcOpcodeStats opcodes[IL_OP_LAST];
+} IlcProfile;
+
 extern const char* mIlShaderTypeNames[IL_SHADER_LAST];
+extern const char* mIlOpcodeNames[IL_OP_LAST];
 
 Kernel* ilcDecodeStream(
     const Token* tokens,
     unsigned count);
 
+void ilcFreeKernel(
+    Kernel* kernel);
+
 void ilcDumpKernel(
     FILE* file,
     const Kernel* kernel);
@@ -87,6 +101,50 @@ void ilcDumpKernel(
 uint32_t* ilcCompileKernel(
     unsigned* size,
     const GR_PIPELINE_SHADER* mappings,
-    const Kernel* kernel);
+    const Kernel* kernel,
+    IlcProfile* profile);
+
+void ilcGetCacheKey(
+    uint8_t* key,
+    const void* code,
+    unsigned size,
+    const void* mappingData,
+    unsigned mappingSize);
+
+uint32_t* ilcCacheLookup(
+    unsigned* size,
+    const uint8_t* key);
+
+void ilcCacheStore(
+    const uint8_t* key,
+    const uint32_t* code,
+    unsigned size);
+
+bool ilcIsProfilingEnabled();
+
+uint64_t ilcGetTimestamp();
+
+double ilcGetElapsedMicroseconds(
+    uint64_t startTimestamp);
+
+void ilcDumpProfile(
+    const IlcProfile* profile,
+    const char* name);
+
+void ilcDumpTotalProfile();
+
+unsigned ilcGetMaxCompressedSize(
+    unsigned size);
+
+unsigned ilcCompress(
+    uint8_t* dst,
+    const uint8_t* src,
+    unsigned size);
+
+bool ilcDecompress(
+    uint8_t* dst,
+    unsigned dstSize,
+    const uint8_t* src,
+    unsigned srcSize);
 
 #endif // AMDILC_INTERNAL_H_
@@ -0,0 +1,133 @@
+#include <windows.h>
+#include "amdilc_internal.h"
+
+#define PROFILE_FILE_NAME   "grvk_shader_profile.txt"
+#define NAME_LEN            (128)
+
+static SRWLOCK mProfileLock = SRWLOCK_INIT;
+static IlcProfile mTotalProfile;
+static unsigned mProfiledShaderCount = 0;
+
+static double getMicroseconds(
+    uint64_t ticks)
+{
+    static LARGE_INTEGER frequency = { .QuadPart = 0 };
+
+    if (frequency.QuadPart == 0) {
+        QueryPerformanceFrequency(&frequency);
+    }
+    return (double)ticks * 1000000.0 / frequency.QuadPart;
+}
+
+static void writeProfile(
+    FILE* file,
+    const IlcProfile* profile)
+{
+    uint16_t opcodes[IL_OP_LAST];
+    unsigned opcodeCount = 0;
+    uint64_t totalTicks = 0;
+    uint64_t totalWordCount = 0;
+
+    for (uint16_t i = 0; i < IL_OP_LAST; i++) {
+        if (profile->opcodes[i].count > 0) {
+            opcodes[opcodeCount++] = i;
+            totalTicks += profile->opcodes[i].ticks;
+            totalWordCount += profile->opcodes[i].wordCount;
+        }
+    }
+
+    // Slowest first, insertion sort is enough for a few hundred opcodes
+    for (unsigned i = 1; i < opcodeCount; i++) {
+        uint16_t opcode = opcodes[i];
+        unsigned j = i;
+
+        while (j > 0 && profile->opcodes[opcodes[j - 1]].ticks < profile->opcodes[opcode].ticks) {
+            opcodes[j] = opcodes[j - 1];
+            j--;
+        }
+        opcodes[j] = opcode;
+    }
+
+    fprintf(file, "%-24s %10s %12s %10s %12s %10s\n",
+            "opcode", "count", "time_us", "time_pct", "spv_words", "words_avg");
+    for (unsigned i = 0; i < opcodeCount; i++) {
+        const IlcOpcodeStats* stats = &profile->opcodes[opcodes[i]];
+        char name[NAME_LEN];
+
+        if (mIlOpcodeNames[opcodes[i]] != NULL) {
+            snprintf(name, NAME_LEN, "%s", mIlOpcodeNames[opcodes[i]]);
+        } else {
+            snprintf(name, NAME_LEN, "opcode_%u", opcodes[i]);
+        }
+
+        fprintf(file, "%-24s %10u %12.1f %9.1f%% %12llu %10.1f\n",
+                name, stats->count, getMicroseconds(stats->ticks),
+                totalTicks > 0 ? 100.0 * stats->ticks / totalTicks : 0.0,
+                (unsigned long long)stats->wordCount, (double)stats->wordCount / stats->count);
+    }
+    fprintf(file, "total: %.1f us, %llu words\n", getMicroseconds(totalTicks),
+            (unsigned long long)totalWordCount);
+}
+
+bool ilcIsProfilingEnabled()
+{
+    const char* envValue = getenv("GRVK_PROFILE_SHADERS");
+
+    return envValue != NULL && strcmp(envValue, "1") == 0;
+}
+
+uint64_t ilcGetTimestamp()
+{
+    LARGE_INTEGER counter;
+
+    QueryPerformanceCounter(&counter);
+    return counter.QuadPart;
+}
+
+double ilcGetElapsedMicroseconds(
+    uint64_t startTimestamp)
+{
+    return getMicroseconds(ilcGetTimestamp() - startTimestamp);
+}
+
+void ilcDumpProfile(
+    const IlcProfile* profile,
+    const char* name)
+{
+    char fileName[NAME_LEN];
+    snprintf(fileName, NAME_LEN, "%s_prof.txt", name);
+
+    FILE* file = fopen(fileName, "w");
+    if (file != NULL) {
+        writeProfile(file, profile);
+        fclose(file);
+    }
+
+    AcquireSRWLockExclusive(&mProfileLock);
+
+    for (unsigned i = 0; i < IL_OP_LAST; i++) {
+        mTotalProfile.opcodes[i].count += profile->opcodes[i].count;
+        mTotalProfile.opcodes[i].ticks += profile->opcodes[i].ticks;
+        mTotalProfile.opcodes[i].wordCount += profile->opcodes[i].wordCount;
+    }
+    mProfiledShaderCount++;
+
+    ReleaseSRWLockExclusive(&mProfileLock);
+}
+
+// Writes the sum of the shader profiles so far, if any
+void ilcDumpTotalProfile()
+{
+    AcquireSRWLockExclusive(&mProfileLock);
+
+    if (mProfiledShaderCount > 0) {
+        FILE* file = fopen(PROFILE_FILE_NAME, "w");
+        if (file != NULL) {
+            fprintf(file, "%u shaders\n", mProfiledShaderCount);
+            writeProfile(file, &mTotalProfile);
+            fclose(file);
+        }
+    }
+
+    ReleaseSRWLockExclusive(&mProfileLock);
+}
@@ -346,13 +346,18 @@ void ilcSpvPutEntryPoint(
 void ilcSpvPutExecMode(
     IlcSpvModule* module,
     IlcSpvId id,
-    SpvExecutionMode execMode)
+    SpvExecutionMode execMode,
+    unsigned literalCount,
+    const IlcSpvWord* literals)
 {
     IlcSpvBuffer* buffer = &module->buffer[ID_EXEC_MODES];
 
-    putInstr(buffer, SpvOpExecutionMode, 3);
+    putInstr(buffer, SpvOpExecutionMode, 3 + literalCount);
     putWord(buffer, id);
     putWord(buffer, execMode);
+    for (unsigned i = 0; i < literalCount; i++) {
+        putWord(buffer, literals[i]);
+    }
 }
 
 void ilcSpvPutCapability(
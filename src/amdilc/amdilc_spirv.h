@@ -67,7 +67,9 @@ void ilcSpvPutEntryPoint(
 void ilcSpvPutExecMode(
     IlcSpvModule* module,
     IlcSpvId id,
-    SpvExecutionMode execMode);
+    SpvExecutionMode execMode,
+    unsigned literalCount,
+    const IlcSpvWord* literals);
 
 void ilcSpvPutCapability(
     IlcSpvModule* module,
@@ -0,0 +1,422 @@
+#include "amdilc_internal.h"
+
+#define MAX_SAMPLER_COUNT   (16)
+
+typedef enum {
+    CATEGORY_DECLARATION,
+    CATEGORY_FLOAT,
+    CATEGORY_INTEGER,
+    CATEGORY_FLOW_CONTROL,
+    CATEGORY_MEMORY,
+    CATEGORY_OTHER,
+} InstrCategory;
+
+typedef struct {
+    unsigned count;
+    uint32_t* regs;
+} RegisterSet;
+
+static InstrCategory getInstrCategory(
+    uint16_t opcode)
+{
+    switch (opcode) {
+    case IL_OP_DCLARRAY:
+    case IL_OP_DCLDEF:
+    case IL_OP_DCLPI:
+    case IL_OP_DCLPIN:
+    case IL_OP_DCLPP:
+    case IL_OP_DCLPT:
+    case IL_OP_DCLV:
+    case IL_OP_DCLVOUT:
+    case IL_OP_DEF:
+    case IL_OP_DEFB:
+    case IL_DCL_CONST_BUFFER:
+    case IL_DCL_INDEXED_TEMP_ARRAY:
+    case IL_DCL_INPUT_PRIMITIVE:
+    case IL_DCL_LITERAL:
+    case IL_DCL_MAX_OUTPUT_VERTEX_COUNT:
+    case IL_DCL_ODEPTH:
+    case IL_DCL_OUTPUT_TOPOLOGY:
+    case IL_DCL_OUTPUT:
+    case IL_DCL_INPUT:
+    case IL_DCL_VPRIM:
+    case IL_DCL_RESOURCE:
+    case IL_DCL_PERSIST:
+    case IL_OP_DCL_SHARED_TEMP:
+    case IL_OP_DCL_NUM_THREAD_PER_GROUP:
+    case IL_OP_DCL_TOTAL_NUM_THREAD_GROUP:
+    case IL_OP_DCL_LDS_SIZE_PER_THREAD:
+    case IL_OP_DCL_LDS_SHARING_MODE:
+    case IL_OP_DCL_UAV:
+    case IL_OP_DCL_RAW_UAV:
+    case IL_OP_DCL_STRUCT_UAV:
+    case IL_OP_DCL_ARENA_UAV:
+    case IL_OP_DCL_RAW_SRV:
+    case IL_OP_DCL_STRUCT_SRV:
+    case IL_DCL_LDS:
+    case IL_DCL_STRUCT_LDS:
+    case IL_DCL_NUM_ICP:
+    case IL_DCL_NUM_OCP:
+    case IL_DCL_NUM_INSTANCES:
+    case IL_DCL_TS_DOMAIN:
+    case IL_DCL_TS_PARTITION:
+    case IL_DCL_TS_OUTPUT_PRIMITIVE:
+    case IL_DCL_MAX_TESSFACTOR:
+    case IL_OP_DCL_FUNCTION_BODY:
+    case IL_OP_DCL_FUNCTION_TABLE:
+    case IL_OP_DCL_INTERFACE_PTR:
+    case IL_DCL_STREAM:
+    case IL_DCL_GLOBAL_FLAGS:
+    case IL_DCL_MAX_THREAD_PER_GROUP:
+    case IL_DCL_GDS:
+    case IL_DCL_STRUCT_GDS:
+    case IL_OP_DCL_TYPED_UAV:
+    case IL_OP_DCL_TYPELESS_UAV:
+    case IL_DCL_GWS_THREAD_COUNT:
+    case IL_DCL_SEMAPHORE:
+        return CATEGORY_DECLARATION;
+    case IL_OP_BREAK:
+    case IL_OP_BREAKC:
+    case IL_OP_CALL:
+    case IL_OP_CALLNZ:
+    case IL_OP_CONTINUE:
+    case IL_OP_CONTINUEC:
+    case IL_OP_ELSE:
+    case IL_OP_END:
+    case IL_OP_ENDIF:
+    case IL_OP_ENDLOOP:
+    case IL_OP_ENDMAIN:
+    case IL_OP_FUNC:
+    case IL_OP_IFC:
+    case IL_OP_IFNZ:
+    case IL_OP_KILL:
+    case IL_OP_LOOP:
+    case IL_OP_RET:
+    case IL_OP_BREAK_LOGICALZ:
+    case IL_OP_BREAK_LOGICALNZ:
+    case IL_OP_CALL_LOGICALZ:
+    case IL_OP_CALL_LOGICALNZ:
+    case IL_OP_CASE:
+    case IL_OP_CONTINUE_LOGICALZ:
+    case IL_OP_CONTINUE_LOGICALNZ:
+    case IL_OP_DEFAULT:
+    case IL_OP_ENDSWITCH:
+    case IL_OP_ENDFUNC:
+    case IL_OP_IF_LOGICALZ:
+    case IL_OP_IF_LOGICALNZ:
+    case IL_OP_WHILE:
+    case IL_OP_SWITCH:
+    case IL_OP_RET_DYN:
+    case IL_OP_RET_LOGICALZ:
+    case IL_OP_RET_LOGICALNZ:
+    case IL_OP_DISCARD_LOGICALZ:
+    case IL_OP_DISCARD_LOGICALNZ:
+    case IL_OP_FCALL:
+        return CATEGORY_FLOW_CONTROL;
+    case IL_OP_I_NOT:
+    case IL_OP_I_OR:
+    case IL_OP_I_XOR:
+    case IL_OP_I_ADD:
+    case IL_OP_I_MAD:
+    case IL_OP_I_MAX:
+    case IL_OP_I_MIN:
+    case IL_OP_I_MUL:
+    case IL_OP_I_MUL_HIGH:
+    case IL_OP_I_EQ:
+    case IL_OP_I_GE:
+    case IL_OP_I_LT:
+    case IL_OP_I_NEGATE:
+    case IL_OP_I_NE:
+    case IL_OP_I_SHL:
+    case IL_OP_I_SHR:
+    case IL_OP_U_SHR:
+    case IL_OP_U_DIV:
+    case IL_OP_U_MOD:
+    case IL_OP_U_MAD:
+    case IL_OP_U_MAX:
+    case IL_OP_U_MIN:
+    case IL_OP_U_LT:
+    case IL_OP_U_GE:
+    case IL_OP_U_MUL:
+    case IL_OP_U_MUL_HIGH:
+    case IL_OP_FTOI:
+    case IL_OP_FTOU:
+    case IL_OP_ITOF:
+    case IL_OP_UTOF:
+    case IL_OP_AND:
+    case IL_OP_CMOV_LOGICAL:
+    case IL_OP_I_COUNTBITS:
+    case IL_OP_I_FIRSTBIT:
+    case IL_OP_I_CARRY:
+    case IL_OP_I_BORROW:
+    case IL_OP_I_BIT_EXTRACT:
+    case IL_OP_U_BIT_EXTRACT:
+    case IL_OP_U_BIT_REVERSE:
+    case IL_OP_U_BIT_INSERT:
+    case IL_OP_BIT_ALIGN:
+    case IL_OP_BYTE_ALIGN:
+    case IL_OP_U_MAD24:
+    case IL_OP_U_MUL24:
+    case IL_OP_I_MAD24:
+    case IL_OP_I_MUL24:
+    case IL_OP_I_MUL24_HIGH:
+    case IL_OP_U_MUL24_HIGH:
+    case IL_OP_FTOI_RPI:
+    case IL_OP_FTOI_FLR:
+    case IL_OP_I_MIN3:
+    case IL_OP_I_MED3:
+    case IL_OP_I_MAX3:
+    case IL_OP_U_MIN3:
+    case IL_OP_U_MED3:
+    case IL_OP_U_MAX3:
+        return CATEGORY_INTEGER;
+    case IL_OP_LOAD:
+    case IL_OP_RESINFO:
+    case IL_OP_SAMPLE:
+    case IL_OP_SAMPLE_B:
+    case IL_OP_SAMPLE_G:
+    case IL_OP_SAMPLE_L:
+    case IL_OP_SAMPLE_C:
+    case IL_OP_SAMPLE_C_LZ:
+    case IL_OP_SAMPLE_C_L:
+    case IL_OP_SAMPLE_C_G:
+    case IL_OP_SAMPLE_C_B:
+    case IL_OP_FETCH4:
+    case IL_OP_FETCH4_C:
+    case IL_OP_FETCH4_PO:
+    case IL_OP_FETCH4_PO_C:
+    case IL_OP_SAMPLEINFO:
+    case IL_OP_SAMPLEPOS:
+    case IL_OP_GETLOD:
+    case IL_OP_BUFINFO:
+    case IL_OP_FENCE:
+    case IL_OP_UAV_LOAD:
+    case IL_OP_UAV_RAW_LOAD:
+    case IL_OP_UAV_STRUCT_LOAD:
+    case IL_OP_UAV_STORE:
+    case IL_OP_UAV_RAW_STORE:
+    case IL_OP_UAV_STRUCT_STORE:
+    case IL_OP_SRV_RAW_LOAD:
+    case IL_OP_SRV_STRUCT_LOAD:
+    case IL_OP_LDS_LOAD:
+    case IL_OP_LDS_STORE:
+    case IL_OP_LDS_LOAD_VEC:
+    case IL_OP_LDS_STORE_VEC:
+    case IL_OP_LDS_READ_VEC:
+    case IL_OP_LDS_WRITE_VEC:
+        return CATEGORY_MEMORY;
+    case IL_OP_UNKNOWN:
+    case IL_OP_COMMENT:
+    case IL_OP_NOP:
+        return CATEGORY_OTHER;
+    }
+
+    // Atomics
+    if ((opcode >= IL_OP_UAV_ADD && opcode <= IL_OP_APPEND_BUF_CONSUME) ||
+        (opcode >= IL_OP_LDS_ADD && opcode <= IL_OP_LDS_READ_CMP_XCHG) ||
+        (opcode >= IL_OP_GDS_LOAD && opcode <= IL_OP_GDS_READ_CMP_XCHG)) {
+        return CATEGORY_MEMORY;
+    }
+
+    return CATEGORY_FLOAT;
+}
+
+static int getControlFlowDepthChange(
+    uint16_t opcode)
+{
+    switch (opcode) {
+    case IL_OP_IFC:
+    case IL_OP_IFNZ:
+    case IL_OP_IF_LOGICALZ:
+    case IL_OP_IF_LOGICALNZ:
+    case IL_OP_LOOP:
+    case IL_OP_WHILE:
+    case IL_OP_SWITCH:
+        return 1;
+    case IL_OP_ENDIF:
+    case IL_OP_ENDLOOP:
+    case IL_OP_ENDSWITCH:
+        return -1;
+    }
+    return 0;
+}
+
+static void addRegister(
+    RegisterSet* set,
+    uint8_t registerType,
+    uint32_t registerNum)
+{
+    uint32_t reg = (registerType << 24) | (registerNum & 0xFFFFFF);
+
+    for (unsigned i = 0; i < set->count; i++) {
+        if (set->regs[i] == reg) {
+            return;
+        }
+    }
+
+    set->regs = realloc(set->regs, sizeof(uint32_t) * (set->count + 1));
+    set->regs[set->count++] = reg;
+}
+
+static void addSlot(
+    GR_DESCRIPTOR_SET_MAPPING* mapping,
+    GR_ENUM slotObjectType,
+    unsigned shaderEntityIndex)
+{
+    for (unsigned i = 0; i < mapping->descriptorCount; i++) {
+        if (mapping->pDescriptorInfo[i].slotObjectType == slotObjectType &&
+            mapping->pDescriptorInfo[i].shaderEntityIndex == shaderEntityIndex) {
+            return;
+        }
+    }
+
+    GR_DESCRIPTOR_SLOT_INFO* slotInfos = realloc((void*)mapping->pDescriptorInfo,
+                                                 sizeof(GR_DESCRIPTOR_SLOT_INFO) *
+                                                 (mapping->descriptorCount + 1));
+    slotInfos[mapping->descriptorCount] = (GR_DESCRIPTOR_SLOT_INFO) {
+        .slotObjectType = slotObjectType,
+        .shaderEntityIndex = shaderEntityIndex,
+    };
+    mapping->pDescriptorInfo = slotInfos;
+    mapping->descriptorCount++;
+}
+
+static bool isSampleInstruction(
+    uint16_t opcode)
+{
+    switch (opcode) {
+    case IL_OP_SAMPLE:
+    case IL_OP_SAMPLE_B:
+    case IL_OP_SAMPLE_G:
+    case IL_OP_SAMPLE_L:
+    case IL_OP_SAMPLE_C:
+    case IL_OP_SAMPLE_C_LZ:
+    case IL_OP_SAMPLE_C_L:
+    case IL_OP_SAMPLE_C_G:
+    case IL_OP_SAMPLE_C_B:
+    case IL_OP_FETCH4:
+    case IL_OP_FETCH4_C:
+    case IL_OP_FETCH4_PO:
+    case IL_OP_FETCH4_PO_C:
+        return true;
+    }
+    return false;
+}
+
+void ilcGetShaderStats(
+    IlcShaderStats* stats,
+    const void* code,
+    unsigned size)
+{
+    Kernel* kernel = ilcDecodeStream((Token*)code, size / sizeof(Token));
+    RegisterSet declaredRegs = { 0 };
+    RegisterSet usedRegs = { 0 };
+    bool usedSamplers[MAX_SAMPLER_COUNT] = { false };
+    int depth = 0;
+
+    // Identity mapping of the declared resources, so that they all resolve during translation
+    GR_PIPELINE_SHADER mappings = {
+        .descriptorSetMapping = { { 0 } },
+        .dynamicMemoryViewMapping = {
+            .slotObjectType = GR_SLOT_UNUSED,
+            .shaderEntityIndex = 0,
+        },
+    };
+    GR_DESCRIPTOR_SET_MAPPING* mapping = &mappings.descriptorSetMapping[0];
+
+    *stats = (IlcShaderStats) { 0 };
+    stats->instrCount = kernel->instrCount;
+
+    for (int i = 0; i < kernel->instrCount; i++) {
+        const Instruction* instr = &kernel->instrs[i];
+        InstrCategory category = getInstrCategory(instr->opcode);
+        RegisterSet* regs = category == CATEGORY_DECLARATION ? &declaredRegs : &usedRegs;
+
+        switch (category) {
+        case CATEGORY_DECLARATION:
+            stats->declInstrCount++;
+            break;
+        case CATEGORY_FLOAT:
+            stats->floatInstrCount++;
+            break;
+        case CATEGORY_INTEGER:
+            stats->intInstrCount++;
+            break;
+        case CATEGORY_FLOW_CONTROL:
+            stats->flowControlInstrCount++;
+            break;
+        case CATEGORY_MEMORY:
+            stats->memoryInstrCount++;
+            break;
+        case CATEGORY_OTHER:
+            stats->otherInstrCount++;
+            break;
+        }
+
+        depth += getControlFlowDepthChange(instr->opcode);
+        if (depth > (int)stats->maxControlFlowDepth) {
+            stats->maxControlFlowDepth = depth;
+        }
+
+        for (unsigned j = 0; j < instr->dstCount; j++) {
+            addRegister(regs, instr->dsts[j].registerType, instr->dsts[j].registerNum);
+        }
+        for (unsigned j = 0; j < instr->srcCount; j++) {
+            addRegister(regs, instr->srcs[j].registerType, instr->srcs[j].registerNum);
+        }
+
+        switch (instr->opcode) {
+        case IL_DCL_RESOURCE:
+            stats->resourceCount++;
+            addSlot(mapping, GR_SLOT_SHADER_RESOURCE, GET_BITS(instr->control, 0, 7));
+            break;
+        case IL_OP_DCL_RAW_SRV:
+        case IL_OP_DCL_STRUCT_SRV:
+            stats->resourceCount++;
+            addSlot(mapping, GR_SLOT_SHADER_RESOURCE, GET_BITS(instr->control, 0, 13));
+            break;
+        case IL_OP_DCL_UAV:
+            stats->uavCount++;
+            addSlot(mapping, GR_SLOT_SHADER_UAV, GET_BITS(instr->control, 0, 3));
+            break;
+        case IL_OP_DCL_RAW_UAV:
+        case IL_OP_DCL_STRUCT_UAV:
+        case IL_OP_DCL_TYPED_UAV:
+        case IL_OP_DCL_TYPELESS_UAV:
+            stats->uavCount++;
+            addSlot(mapping, GR_SLOT_SHADER_UAV, GET_BITS(instr->control, 0, 13));
+            break;
+        }
+
+        if (isSampleInstruction(instr->opcode)) {
+            uint8_t samplerId = GET_BITS(instr->control, 8, 11);
+
+            if (!usedSamplers[samplerId]) {
+                usedSamplers[samplerId] = true;
+                stats->samplerCount++;
+                addSlot(mapping, GR_SLOT_SHADER_SAMPLER, samplerId);
+            }
+        }
+    }
+
+    stats->declaredRegisterCount = declaredRegs.count;
+    stats->usedRegisterCount = usedRegs.count;
+    for (unsigned i = 0; i < usedRegs.count; i++) {
+        if ((usedRegs.regs[i] >> 24) == IL_REGTYPE_TEMP) {
+            stats->tempRegisterCount++;
+        }
+    }
+
+    uint64_t timestamp = ilcGetTimestamp();
+    unsigned compiledSize = 0;
+    uint32_t* compiledCode = ilcCompileKernel(&compiledSize, &mappings, kernel, NULL);
+
+    stats->translationTime = ilcGetElapsedMicroseconds(timestamp);
+    stats->spirvWordCount = compiledSize / sizeof(uint32_t);
+
+    free(compiledCode);
+    free((void*)mapping->pDescriptorInfo);
+    free(declaredRegs.regs);
+    free(usedRegs.regs);
+    ilcFreeKernel(kernel);
+}
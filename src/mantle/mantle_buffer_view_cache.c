@@ -0,0 +1,119 @@
+#include "mantle_internal.h"
+
+static uint32_t hashBufferViewKey(
+    const GrBufferViewKey* key)
+{
+    const uint8_t* bytes = (const uint8_t*)key;
+    uint32_t hash = 2166136261u; // FNV-1a
+
+    for (unsigned i = 0; i < sizeof(GrBufferViewKey); i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+GrBufferViewEntry* getBufferViewEntry(
+    GrBufferViewCache* grBufferViewCache,
+    VkDevice device,
+    const GrBufferViewKey* key)
+{
+    unsigned bucket = hashBufferViewKey(key) % BUFFER_VIEW_BUCKET_COUNT;
+
+    for (unsigned index = grBufferViewCache->buckets[bucket]; index != 0;) {
+        GrBufferViewEntry* entry = &grBufferViewCache->entries[index - 1];
+
+        if (memcmp(&entry->key, key, sizeof(GrBufferViewKey)) == 0) {
+            entry->isUsed = true;
+            return entry;
+        }
+        index = entry->next;
+    }
+
+    const VkBufferViewCreateInfo createInfo = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_VIEW_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .buffer = key->buffer,
+        .format = key->format,
+        .offset = key->offset,
+        .range = key->range,
+    };
+
+    VkBufferView bufferView = VK_NULL_HANDLE;
+    if (vki.vkCreateBufferView(device, &createInfo, NULL, &bufferView) != VK_SUCCESS) {
+        LOGE("vkCreateBufferView failed\n");
+        return NULL;
+    }
+
+    if (grBufferViewCache->entryCount == grBufferViewCache->entryCapacity) {
+        grBufferViewCache->entryCapacity = MAX(2 * grBufferViewCache->entryCapacity, 16);
+        grBufferViewCache->entries = realloc(grBufferViewCache->entries, sizeof(GrBufferViewEntry) *
+                                             grBufferViewCache->entryCapacity);
+    }
+
+    GrBufferViewEntry* entry = &grBufferViewCache->entries[grBufferViewCache->entryCount++];
+    *entry = (GrBufferViewEntry) {
+        .key = *key,
+        .bufferView = bufferView,
+        .descriptorSets = { VK_NULL_HANDLE, VK_NULL_HANDLE },
+        .isUsed = true,
+        .next = grBufferViewCache->buckets[bucket],
+    };
+    grBufferViewCache->buckets[bucket] = grBufferViewCache->entryCount;
+
+    return entry;
+}
+
+// Drops the views the last recording didn't use, returns true if the descriptor sets of the
+// remaining views were dropped as well and the descriptor pools can be reset
+bool resetBufferViewCache(
+    GrBufferViewCache* grBufferViewCache,
+    VkDevice device)
+{
+    unsigned keptCount = 0;
+
+    for (unsigned i = 0; i < grBufferViewCache->entryCount; i++) {
+        GrBufferViewEntry* entry = &grBufferViewCache->entries[i];
+
+        if (entry->isUsed) {
+            entry->isUsed = false;
+            grBufferViewCache->entries[keptCount++] = *entry;
+        } else {
+            vki.vkDestroyBufferView(device, entry->bufferView, NULL);
+        }
+    }
+
+    // Keep everything as is if the same views keep getting used
+    if (keptCount == grBufferViewCache->entryCount) {
+        return false;
+    }
+
+    // Sets of dropped views can't be freed individually, reallocate all of them from reset pools
+    grBufferViewCache->entryCount = keptCount;
+    memset(grBufferViewCache->buckets, 0, sizeof(grBufferViewCache->buckets));
+    for (unsigned i = 0; i < keptCount; i++) {
+        GrBufferViewEntry* entry = &grBufferViewCache->entries[i];
+        unsigned bucket = hashBufferViewKey(&entry->key) % BUFFER_VIEW_BUCKET_COUNT;
+
+        entry->descriptorSets[0] = VK_NULL_HANDLE;
+        entry->descriptorSets[1] = VK_NULL_HANDLE;
+        entry->next = grBufferViewCache->buckets[bucket];
+        grBufferViewCache->buckets[bucket] = i + 1;
+    }
+
+    return true;
+}
+
+void destroyBufferViewCache(
+    GrBufferViewCache* grBufferViewCache,
+    VkDevice device)
+{
+    for (unsigned i = 0; i < grBufferViewCache->entryCount; i++) {
+        vki.vkDestroyBufferView(device, grBufferViewCache->entries[i].bufferView, NULL);
+    }
+    free(grBufferViewCache->entries);
+
+    grBufferViewCache->entries = NULL;
+    grBufferViewCache->entryCount = 0;
+    grBufferViewCache->entryCapacity = 0;
+}
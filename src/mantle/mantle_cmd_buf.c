@@ -1,5 +1,28 @@
 #include "mantle_internal.h"
 
+#define DYNAMIC_STATE_VIEWPORT                      (1 << 0)
+#define DYNAMIC_STATE_SCISSOR                       (1 << 1)
+#define DYNAMIC_STATE_CULL_MODE                     (1 << 2)
+#define DYNAMIC_STATE_FRONT_FACE                    (1 << 3)
+#define DYNAMIC_STATE_DEPTH_BIAS                    (1 << 4)
+#define DYNAMIC_STATE_DEPTH_TEST_ENABLE             (1 << 5)
+#define DYNAMIC_STATE_DEPTH_WRITE_ENABLE            (1 << 6)
+#define DYNAMIC_STATE_DEPTH_COMPARE_OP              (1 << 7)
+#define DYNAMIC_STATE_DEPTH_BOUNDS_TEST_ENABLE      (1 << 8)
+#define DYNAMIC_STATE_STENCIL_TEST_ENABLE           (1 << 9)
+#define DYNAMIC_STATE_STENCIL_OP_FRONT              (1 << 10)
+#define DYNAMIC_STATE_STENCIL_OP_BACK               (1 << 11)
+#define DYNAMIC_STATE_STENCIL_COMPARE_MASK_FRONT    (1 << 12)
+#define DYNAMIC_STATE_STENCIL_COMPARE_MASK_BACK     (1 << 13)
+#define DYNAMIC_STATE_STENCIL_WRITE_MASK_FRONT      (1 << 14)
+#define DYNAMIC_STATE_STENCIL_WRITE_MASK_BACK       (1 << 15)
+#define DYNAMIC_STATE_STENCIL_REFERENCE_FRONT       (1 << 16)
+#define DYNAMIC_STATE_STENCIL_REFERENCE_BACK        (1 << 17)
+#define DYNAMIC_STATE_DEPTH_BOUNDS                  (1 << 18)
+#define DYNAMIC_STATE_BLEND_CONSTANTS               (1 << 19)
+
+#define TIMESTAMP_QUERY_COUNT                       256
+
 static VkImageSubresourceRange getVkImageSubresourceRange(
     const GR_IMAGE_SUBRESOURCE_RANGE* range)
 {
@@ -14,106 +37,679 @@ static VkImageSubresourceRange getVkImageSubresourceRange(
     };
 }
 
-static VkFramebuffer getVkFramebuffer(
-    VkDevice device,
-    VkRenderPass renderPass,
-    unsigned attachmentCount,
-    const VkImageView* attachments,
-    VkExtent2D extent,
-    unsigned layerCount
-    )
+static VkPipelineStageFlags getQueueStageFlags(
+    const GrCmdBuffer* grCmdBuffer,
+    VkPipelineStageFlags stageMask)
 {
-    VkFramebuffer framebuffer = VK_NULL_HANDLE;
+    if (grCmdBuffer->queueType != GR_QUEUE_COMPUTE) {
+        return stageMask;
+    }
 
-    const VkFramebufferCreateInfo framebufferCreateInfo = {
-        .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
-        .pNext = NULL,
-        .flags = 0,
-        .renderPass = renderPass,
-        .attachmentCount = attachmentCount,
-        .pAttachments = attachments,
-        .width = extent.width,
-        .height = extent.height,
-        .layers = layerCount,
-    };
+    // Graphics stages aren't supported on compute queues
+    stageMask &= VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT |
+                 VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+                 VK_PIPELINE_STAGE_TRANSFER_BIT |
+                 VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT |
+                 VK_PIPELINE_STAGE_HOST_BIT |
+                 VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+
+    return stageMask != 0 ? stageMask : VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+}
+
+void endRenderPass(
+    GrCmdBuffer* grCmdBuffer)
+{
+    if (grCmdBuffer->hasActiveRenderPass) {
+        vki.vkCmdEndRenderPass(grCmdBuffer->commandBuffer);
+        grCmdBuffer->hasActiveRenderPass = false;
+    }
+}
+
+// Pipelines can render into any compatible render pass as long as it stores every target they write
+static bool isRenderPassReusable(
+    const GrRenderPassKey* activeKey,
+    const GrRenderPassKey* key)
+{
+    return memcmp(activeKey->colorFormats, key->colorFormats, sizeof(key->colorFormats)) == 0 &&
+           activeKey->depthStencilFormat == key->depthStencilFormat &&
+           activeKey->depthStencilAspects == key->depthStencilAspects &&
+           (key->colorStoreMask & ~activeKey->colorStoreMask) == 0;
+}
+
+// Render pass variants are compatible with the pipeline ones and share their framebuffers
+static VkRenderPass acquireRenderPassVariant(
+    GrCmdBuffer* grCmdBuffer,
+    const GrRenderPassKey* key)
+{
+    GrDevice* grDevice = grCmdBuffer->grDevice;
+    VkRenderPass renderPass = acquireRenderPass(&grDevice->renderPassCache, grDevice->device, key);
 
-    if (vki.vkCreateFramebuffer(device, &framebufferCreateInfo, NULL,
-                                &framebuffer) != VK_SUCCESS) {
-        LOGE("vkCreateFramebuffer failed\n");
+    if (renderPass == VK_NULL_HANDLE) {
         return VK_NULL_HANDLE;
     }
 
-    return framebuffer;
+    for (unsigned i = 0; i < grCmdBuffer->renderPassKeyCount; i++) {
+        if (memcmp(&grCmdBuffer->renderPassKeys[i], key, sizeof(GrRenderPassKey)) == 0) {
+            // Already referenced by this command buffer
+            releaseRenderPass(&grDevice->renderPassCache, grDevice->device, key);
+            return renderPass;
+        }
+    }
+
+    if (grCmdBuffer->renderPassKeyCount == grCmdBuffer->renderPassKeyCapacity) {
+        grCmdBuffer->renderPassKeyCapacity = MAX(2 * grCmdBuffer->renderPassKeyCount, 4);
+        grCmdBuffer->renderPassKeys = realloc(grCmdBuffer->renderPassKeys,
+                                              sizeof(GrRenderPassKey) *
+                                              grCmdBuffer->renderPassKeyCapacity);
+    }
+    grCmdBuffer->renderPassKeys[grCmdBuffer->renderPassKeyCount] = *key;
+    grCmdBuffer->renderPassKeyCount++;
+
+    return renderPass;
 }
 
-static void initCmdBufferResources(
+// Records the clears folded into a render pass that didn't begin. Their targets are in the
+// layout the render pass would have rendered them in.
+void flushLoadOpClears(
     GrCmdBuffer* grCmdBuffer)
 {
-    const GrPipeline* grPipeline = grCmdBuffer->grPipeline;
-    VkPipelineBindPoint bindPoint = getVkPipelineBindPoint(GR_PIPELINE_BIND_POINT_GRAPHICS);
+    unsigned clearCount = grCmdBuffer->loadOpClearCount;
+    VkImageMemoryBarrier barriers[GR_MAX_COLOR_TARGETS];
 
-    vki.vkCmdBindPipeline(grCmdBuffer->commandBuffer, bindPoint, grPipeline->pipeline);
+    if (clearCount == 0) {
+        return;
+    }
 
-    vki.vkCmdBindDescriptorSets(grCmdBuffer->commandBuffer, bindPoint,
-                                grPipeline->pipelineLayout, 0, 1,
-                                &grCmdBuffer->grDevice->globalDescriptorSet.descriptorTable, 0, NULL);
-    unsigned size = sizeof(uint64_t) * 2;
-    uint64_t descSetBuffer[2] = {
-        grCmdBuffer->graphicsDescriptorSets[0] == NULL ? 0 : (grCmdBuffer->graphicsDescriptorSets[0]->bufferDevicePtr + sizeof(uint64_t) * grCmdBuffer->graphicsDescriptorSetOffsets[0]),
-        grCmdBuffer->graphicsDescriptorSets[1] == NULL ? 0 : (grCmdBuffer->graphicsDescriptorSets[1]->bufferDevicePtr + sizeof(uint64_t) * grCmdBuffer->graphicsDescriptorSetOffsets[1])
-    };
-    vki.vkCmdPushConstants(grCmdBuffer->commandBuffer, grPipeline->pipelineLayout, VK_SHADER_STAGE_ALL_GRAPHICS, 0, size, descSetBuffer);
-    VkFramebuffer framebuffer =
-        getVkFramebuffer(grCmdBuffer->grDevice->device, grPipeline->renderPass,
-                         grCmdBuffer->attachmentCount, grCmdBuffer->attachments,
-                         grCmdBuffer->minExtent2D, grCmdBuffer->minLayerCount);
+    endRenderPass(grCmdBuffer);
+
+    for (unsigned i = 0; i < clearCount; i++) {
+        const GrColorTargetView* grColorTargetView = grCmdBuffer->loadOpClearViews[i];
+
+        barriers[i] = (VkImageMemoryBarrier) {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .pNext = NULL,
+            .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+            .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = grColorTargetView->grImage->image,
+            .subresourceRange = {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .baseMipLevel = grColorTargetView->mipLevel,
+                .levelCount = 1,
+                .baseArrayLayer = grColorTargetView->baseArraySlice,
+                .layerCount = grColorTargetView->layerCount,
+            },
+        };
+    }
+
+    vki.vkCmdPipelineBarrier(grCmdBuffer->commandBuffer,
+                             VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL,
+                             clearCount, barriers);
+
+    for (unsigned i = 0; i < clearCount; i++) {
+        vki.vkCmdClearColorImage(grCmdBuffer->commandBuffer, barriers[i].image,
+                                 VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                 &grCmdBuffer->loadOpClearColors[i], 1,
+                                 &barriers[i].subresourceRange);
+
+        barriers[i].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barriers[i].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+                                    VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        barriers[i].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barriers[i].newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    }
+
+    vki.vkCmdPipelineBarrier(grCmdBuffer->commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0, 0, NULL, 0, NULL,
+                             clearCount, barriers);
+
+    grCmdBuffer->loadOpClearCount = 0;
+}
+
+bool beginRenderPass(
+    GrCmdBuffer* grCmdBuffer,
+    const GrPipeline* grPipeline,
+    VkSubpassContents contents)
+{
+    GrRenderPassKey renderPassKey = grPipeline->renderPassKey;
+    VkRenderPass renderPass = grPipeline->renderPass;
+    VkClearValue clearValues[GR_MAX_COLOR_TARGETS];
+    unsigned clearValueCount = 0;
+    VkFramebuffer framebuffer = VK_NULL_HANDLE;
+    const void* beginInfoNext = NULL;
+    VkRenderPassAttachmentBeginInfo attachmentBeginInfo;
+
+    GrFramebufferKey key;
+    memset(&key, 0, sizeof(key));
+    key.renderPassKey = grPipeline->renderPassKey;
+    key.attachmentCount = grCmdBuffer->attachmentCount;
+    key.width = grCmdBuffer->minExtent2D.width;
+    key.height = grCmdBuffer->minExtent2D.height;
+    key.layerCount = grCmdBuffer->minLayerCount;
+
+    if (grCmdBuffer->grDevice->imagelessFramebufferSupported) {
+        // Views are supplied at begin time, the framebuffer itself only depends on their description
+        key.flags = VK_FRAMEBUFFER_CREATE_IMAGELESS_BIT;
+        memcpy(key.attachmentInfos, grCmdBuffer->attachmentInfos,
+               grCmdBuffer->attachmentCount * sizeof(GrFramebufferAttachment));
+
+        attachmentBeginInfo = (VkRenderPassAttachmentBeginInfo) {
+            .sType = VK_STRUCTURE_TYPE_RENDER_PASS_ATTACHMENT_BEGIN_INFO,
+            .pNext = NULL,
+            .attachmentCount = grCmdBuffer->attachmentCount,
+            .pAttachments = grCmdBuffer->attachments,
+        };
+        beginInfoNext = &attachmentBeginInfo;
+    } else {
+        memcpy(key.attachments, grCmdBuffer->attachments,
+               grCmdBuffer->attachmentCount * sizeof(VkImageView));
+    }
+
+    GrFramebuffer* grFramebuffer = acquireFramebuffer(&grCmdBuffer->grDevice->framebufferCache,
+                                                      grCmdBuffer->grDevice->device,
+                                                      grPipeline->renderPass, &key);
+
+    if (grFramebuffer != NULL) {
+        unsigned count = grCmdBuffer->framebufferCount;
+
+        if (count > 0 && grCmdBuffer->framebuffers[count - 1] == grFramebuffer) {
+            // Already referenced by this command buffer
+            releaseFramebuffer(grFramebuffer, grCmdBuffer->grDevice->device);
+        } else {
+            if (count == grCmdBuffer->framebufferCapacity) {
+                grCmdBuffer->framebufferCapacity = MAX(2 * count, 8);
+                grCmdBuffer->framebuffers = realloc(grCmdBuffer->framebuffers,
+                                                    sizeof(GrFramebuffer*) *
+                                                    grCmdBuffer->framebufferCapacity);
+            }
+            grCmdBuffer->framebuffers[count] = grFramebuffer;
+            grCmdBuffer->framebufferCount++;
+        }
+        framebuffer = grFramebuffer->framebuffer;
+    }
+
+    if (framebuffer == VK_NULL_HANDLE) {
+        LOGW("skipping draw without framebuffer\n");
+        flushLoadOpClears(grCmdBuffer);
+        return false;
+    }
+
+    // Store whatever the following draws write as well, so they don't restart the render pass
+    renderPassKey.colorStoreMask |= getCmdStreamColorStoreMask(grCmdBuffer,
+                                                               &grPipeline->renderPassKey);
+
+    // Attachments follow the slot order of the render pass targets
+    memset(clearValues, 0, sizeof(clearValues));
+    unsigned attachmentIndex = 0;
+    uint32_t foldedClearMask = 0;
+    for (unsigned i = 0; i < GR_MAX_COLOR_TARGETS &&
+                         attachmentIndex < grCmdBuffer->attachmentCount; i++) {
+        if (renderPassKey.colorFormats[i] == VK_FORMAT_UNDEFINED) {
+            continue;
+        }
+
+        for (unsigned j = 0; j < grCmdBuffer->loadOpClearCount; j++) {
+            if (grCmdBuffer->loadOpClearViews[j]->imageView ==
+                grCmdBuffer->attachments[attachmentIndex]) {
+                renderPassKey.colorClearMask |= 1 << i;
+                renderPassKey.colorStoreMask |= 1 << i;
+                clearValues[attachmentIndex].color = grCmdBuffer->loadOpClearColors[j];
+                clearValueCount = attachmentIndex + 1;
+                foldedClearMask |= 1 << j;
+            }
+        }
+        attachmentIndex++;
+    }
+
+    if (memcmp(&renderPassKey, &grPipeline->renderPassKey, sizeof(GrRenderPassKey)) != 0) {
+        renderPass = acquireRenderPassVariant(grCmdBuffer, &renderPassKey);
+        if (renderPass == VK_NULL_HANDLE) {
+            LOGE("failed to create render pass variant\n");
+            flushLoadOpClears(grCmdBuffer);
+            return false;
+        }
+    }
+
+    // Clears of targets that aren't bound anymore are recorded on their own
+    unsigned unfoldedClearCount = 0;
+    for (unsigned j = 0; j < grCmdBuffer->loadOpClearCount; j++) {
+        if ((foldedClearMask & (1 << j)) == 0) {
+            grCmdBuffer->loadOpClearViews[unfoldedClearCount] = grCmdBuffer->loadOpClearViews[j];
+            grCmdBuffer->loadOpClearColors[unfoldedClearCount] =
+                grCmdBuffer->loadOpClearColors[j];
+            unfoldedClearCount++;
+        }
+    }
+    grCmdBuffer->loadOpClearCount = unfoldedClearCount;
+    flushLoadOpClears(grCmdBuffer);
 
     const VkRenderPassBeginInfo beginInfo = {
         .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
-        .pNext = NULL,
-        .renderPass = grPipeline->renderPass,
+        .pNext = beginInfoNext,
+        .renderPass = renderPass,
         .framebuffer = framebuffer,
         .renderArea = (VkRect2D) {
             .offset = { 0, 0 },
             .extent = grCmdBuffer->minExtent2D,
         },
-        .clearValueCount = 0,
-        .pClearValues = NULL,
+        .clearValueCount = clearValueCount,
+        .pClearValues = clearValues,
     };
 
-    if (grCmdBuffer->hasActiveRenderPass) {
-        vki.vkCmdEndRenderPass(grCmdBuffer->commandBuffer);
-    }
-    //TODO: cache renderpass calls
-    vki.vkCmdBeginRenderPass(grCmdBuffer->commandBuffer, &beginInfo, VK_SUBPASS_CONTENTS_INLINE);
+    endRenderPass(grCmdBuffer);
+    vki.vkCmdBeginRenderPass(grCmdBuffer->commandBuffer, &beginInfo, contents);
     grCmdBuffer->hasActiveRenderPass = true;
+    grCmdBuffer->renderPassKey = renderPassKey;
+    grCmdBuffer->dirtyFlags &= ~DIRTY_RENDER_TARGETS;
+    return true;
+}
+
+// Returned storage is only valid until the next call
+void* getCmdBufferScratch(
+    GrCmdBuffer* grCmdBuffer,
+    size_t size)
+{
+    if (size > grCmdBuffer->scratchSize) {
+        grCmdBuffer->scratchSize = MAX(size, 4096);
+        free(grCmdBuffer->scratch);
+        grCmdBuffer->scratch = malloc(grCmdBuffer->scratchSize);
+    }
+
+    return grCmdBuffer->scratch;
+}
 
-    grCmdBuffer->isDirty = false;
+void resetTimestampQueries(
+    GrCmdBuffer* grCmdBuffer)
+{
+    if (grCmdBuffer->timestampQueryPool != VK_NULL_HANDLE) {
+        vki.vkCmdResetQueryPool(grCmdBuffer->commandBuffer, grCmdBuffer->timestampQueryPool, 0,
+                                TIMESTAMP_QUERY_COUNT);
+    }
+}
+
+// Must be called outside of a render pass
+void flushTimestampCopies(
+    GrCmdBuffer* grCmdBuffer)
+{
+    if (grCmdBuffer->timestampCopyQueryCount == 0) {
+        return;
+    }
+
+    // The timestamps may not have been written yet when the copy executes
+    vki.vkCmdCopyQueryPoolResults(grCmdBuffer->commandBuffer, grCmdBuffer->timestampQueryPool,
+                                  grCmdBuffer->timestampCopyFirstQuery,
+                                  grCmdBuffer->timestampCopyQueryCount,
+                                  grCmdBuffer->timestampCopyBuffer,
+                                  grCmdBuffer->timestampCopyOffset, sizeof(uint64_t),
+                                  VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+    grCmdBuffer->timestampCopyQueryCount = 0;
+}
+
+// Returns whether the shadowed value changed, and updates it
+static bool updateDynamicState(
+    GrDynamicState* dynamicState,
+    uint32_t stateBit,
+    void* shadowValue,
+    const void* value,
+    size_t size)
+{
+    if ((dynamicState->validMask & stateBit) != 0 && memcmp(shadowValue, value, size) == 0) {
+        return false;
+    }
+
+    memcpy(shadowValue, value, size);
+    dynamicState->validMask |= stateBit;
+    return true;
+}
+
+static void applyStencilFaceState(
+    GrCmdBuffer* grCmdBuffer,
+    const VkStencilOpState* front,
+    const VkStencilOpState* back)
+{
+    GrDynamicState* dynamicState = &grCmdBuffer->dynamicState;
+    VkCommandBuffer commandBuffer = grCmdBuffer->commandBuffer;
+    bool isSameOp = memcmp(front, back, offsetof(VkStencilOpState, compareMask)) == 0;
+    bool isFrontOpChanged = updateDynamicState(dynamicState, DYNAMIC_STATE_STENCIL_OP_FRONT,
+                                               &dynamicState->front, front,
+                                               offsetof(VkStencilOpState, compareMask));
+    bool isBackOpChanged = updateDynamicState(dynamicState, DYNAMIC_STATE_STENCIL_OP_BACK,
+                                              &dynamicState->back, back,
+                                              offsetof(VkStencilOpState, compareMask));
+
+    // Set both faces at once when they match
+    if (isFrontOpChanged && isBackOpChanged && isSameOp) {
+        vki.vkCmdSetStencilOpEXT(commandBuffer, VK_STENCIL_FACE_FRONT_AND_BACK, front->failOp,
+                                 front->passOp, front->depthFailOp, front->compareOp);
+    } else {
+        if (isFrontOpChanged) {
+            vki.vkCmdSetStencilOpEXT(commandBuffer, VK_STENCIL_FACE_FRONT_BIT, front->failOp,
+                                     front->passOp, front->depthFailOp, front->compareOp);
+        }
+        if (isBackOpChanged) {
+            vki.vkCmdSetStencilOpEXT(commandBuffer, VK_STENCIL_FACE_BACK_BIT, back->failOp,
+                                     back->passOp, back->depthFailOp, back->compareOp);
+        }
+    }
+
+    bool isFrontChanged = updateDynamicState(dynamicState, DYNAMIC_STATE_STENCIL_COMPARE_MASK_FRONT,
+                                             &dynamicState->front.compareMask,
+                                             &front->compareMask, sizeof(uint32_t));
+    bool isBackChanged = updateDynamicState(dynamicState, DYNAMIC_STATE_STENCIL_COMPARE_MASK_BACK,
+                                            &dynamicState->back.compareMask,
+                                            &back->compareMask, sizeof(uint32_t));
+    if (isFrontChanged && isBackChanged && front->compareMask == back->compareMask) {
+        vki.vkCmdSetStencilCompareMask(commandBuffer, VK_STENCIL_FACE_FRONT_AND_BACK,
+                                       front->compareMask);
+    } else {
+        if (isFrontChanged) {
+            vki.vkCmdSetStencilCompareMask(commandBuffer, VK_STENCIL_FACE_FRONT_BIT,
+                                           front->compareMask);
+        }
+        if (isBackChanged) {
+            vki.vkCmdSetStencilCompareMask(commandBuffer, VK_STENCIL_FACE_BACK_BIT,
+                                           back->compareMask);
+        }
+    }
+
+    isFrontChanged = updateDynamicState(dynamicState, DYNAMIC_STATE_STENCIL_WRITE_MASK_FRONT,
+                                        &dynamicState->front.writeMask, &front->writeMask,
+                                        sizeof(uint32_t));
+    isBackChanged = updateDynamicState(dynamicState, DYNAMIC_STATE_STENCIL_WRITE_MASK_BACK,
+                                       &dynamicState->back.writeMask, &back->writeMask,
+                                       sizeof(uint32_t));
+    if (isFrontChanged && isBackChanged && front->writeMask == back->writeMask) {
+        vki.vkCmdSetStencilWriteMask(commandBuffer, VK_STENCIL_FACE_FRONT_AND_BACK,
+                                     front->writeMask);
+    } else {
+        if (isFrontChanged) {
+            vki.vkCmdSetStencilWriteMask(commandBuffer, VK_STENCIL_FACE_FRONT_BIT,
+                                         front->writeMask);
+        }
+        if (isBackChanged) {
+            vki.vkCmdSetStencilWriteMask(commandBuffer, VK_STENCIL_FACE_BACK_BIT,
+                                         back->writeMask);
+        }
+    }
+
+    isFrontChanged = updateDynamicState(dynamicState, DYNAMIC_STATE_STENCIL_REFERENCE_FRONT,
+                                        &dynamicState->front.reference, &front->reference,
+                                        sizeof(uint32_t));
+    isBackChanged = updateDynamicState(dynamicState, DYNAMIC_STATE_STENCIL_REFERENCE_BACK,
+                                       &dynamicState->back.reference, &back->reference,
+                                       sizeof(uint32_t));
+    if (isFrontChanged && isBackChanged && front->reference == back->reference) {
+        vki.vkCmdSetStencilReference(commandBuffer, VK_STENCIL_FACE_FRONT_AND_BACK,
+                                     front->reference);
+    } else {
+        if (isFrontChanged) {
+            vki.vkCmdSetStencilReference(commandBuffer, VK_STENCIL_FACE_FRONT_BIT,
+                                         front->reference);
+        }
+        if (isBackChanged) {
+            vki.vkCmdSetStencilReference(commandBuffer, VK_STENCIL_FACE_BACK_BIT,
+                                         back->reference);
+        }
+    }
+}
+
+static void applyDynamicState(
+    GrCmdBuffer* grCmdBuffer)
+{
+    GrDynamicState* dynamicState = &grCmdBuffer->dynamicState;
+    VkCommandBuffer commandBuffer = grCmdBuffer->commandBuffer;
+    const GrViewportStateObject* viewportState = grCmdBuffer->viewportState;
+    const GrRasterStateObject* rasterState = grCmdBuffer->rasterState;
+    const GrDepthStencilStateObject* depthStencilState = grCmdBuffer->depthStencilState;
+    const GrColorBlendStateObject* colorBlendState = grCmdBuffer->colorBlendState;
+
+    if (viewportState != NULL) {
+        // The count is compared first so that only the used entries are compared after it
+        if (updateDynamicState(dynamicState, DYNAMIC_STATE_VIEWPORT, &dynamicState->viewportCount,
+                               &viewportState->viewportCount, sizeof(unsigned)) |
+            updateDynamicState(dynamicState, DYNAMIC_STATE_VIEWPORT, dynamicState->viewports,
+                               viewportState->viewports,
+                               sizeof(VkViewport) * viewportState->viewportCount)) {
+            vki.vkCmdSetViewportWithCountEXT(commandBuffer, viewportState->viewportCount,
+                                             viewportState->viewports);
+        }
+        if (updateDynamicState(dynamicState, DYNAMIC_STATE_SCISSOR, &dynamicState->scissorCount,
+                               &viewportState->scissorCount, sizeof(unsigned)) |
+            updateDynamicState(dynamicState, DYNAMIC_STATE_SCISSOR, dynamicState->scissors,
+                               viewportState->scissors,
+                               sizeof(VkRect2D) * viewportState->scissorCount)) {
+            vki.vkCmdSetScissorWithCountEXT(commandBuffer, viewportState->scissorCount,
+                                            viewportState->scissors);
+        }
+    }
+
+    if (rasterState != NULL) {
+        const float depthBias[3] = {
+            rasterState->depthBiasConstantFactor,
+            rasterState->depthBiasClamp,
+            rasterState->depthBiasSlopeFactor,
+        };
+
+        if (updateDynamicState(dynamicState, DYNAMIC_STATE_CULL_MODE, &dynamicState->cullMode,
+                               &rasterState->cullMode, sizeof(VkCullModeFlags))) {
+            vki.vkCmdSetCullModeEXT(commandBuffer, rasterState->cullMode);
+        }
+        if (updateDynamicState(dynamicState, DYNAMIC_STATE_FRONT_FACE, &dynamicState->frontFace,
+                               &rasterState->frontFace, sizeof(VkFrontFace))) {
+            vki.vkCmdSetFrontFaceEXT(commandBuffer, rasterState->frontFace);
+        }
+        if (updateDynamicState(dynamicState, DYNAMIC_STATE_DEPTH_BIAS, dynamicState->depthBias,
+                               depthBias, sizeof(depthBias))) {
+            vki.vkCmdSetDepthBias(commandBuffer, depthBias[0], depthBias[1], depthBias[2]);
+        }
+    }
+
+    if (depthStencilState != NULL) {
+        const float depthBounds[2] = {
+            depthStencilState->minDepthBounds,
+            depthStencilState->maxDepthBounds,
+        };
+
+        if (updateDynamicState(dynamicState, DYNAMIC_STATE_DEPTH_TEST_ENABLE,
+                               &dynamicState->depthTestEnable,
+                               &depthStencilState->depthTestEnable, sizeof(VkBool32))) {
+            vki.vkCmdSetDepthTestEnableEXT(commandBuffer, depthStencilState->depthTestEnable);
+        }
+        if (updateDynamicState(dynamicState, DYNAMIC_STATE_DEPTH_WRITE_ENABLE,
+                               &dynamicState->depthWriteEnable,
+                               &depthStencilState->depthWriteEnable, sizeof(VkBool32))) {
+            vki.vkCmdSetDepthWriteEnableEXT(commandBuffer, depthStencilState->depthWriteEnable);
+        }
+        if (updateDynamicState(dynamicState, DYNAMIC_STATE_DEPTH_COMPARE_OP,
+                               &dynamicState->depthCompareOp,
+                               &depthStencilState->depthCompareOp, sizeof(VkCompareOp))) {
+            vki.vkCmdSetDepthCompareOpEXT(commandBuffer, depthStencilState->depthCompareOp);
+        }
+        if (updateDynamicState(dynamicState, DYNAMIC_STATE_DEPTH_BOUNDS_TEST_ENABLE,
+                               &dynamicState->depthBoundsTestEnable,
+                               &depthStencilState->depthBoundsTestEnable, sizeof(VkBool32))) {
+            vki.vkCmdSetDepthBoundsTestEnableEXT(commandBuffer,
+                                                 depthStencilState->depthBoundsTestEnable);
+        }
+        if (updateDynamicState(dynamicState, DYNAMIC_STATE_STENCIL_TEST_ENABLE,
+                               &dynamicState->stencilTestEnable,
+                               &depthStencilState->stencilTestEnable, sizeof(VkBool32))) {
+            vki.vkCmdSetStencilTestEnableEXT(commandBuffer, depthStencilState->stencilTestEnable);
+        }
+        applyStencilFaceState(grCmdBuffer, &depthStencilState->front, &depthStencilState->back);
+        if (updateDynamicState(dynamicState, DYNAMIC_STATE_DEPTH_BOUNDS, dynamicState->depthBounds,
+                               depthBounds, sizeof(depthBounds))) {
+            vki.vkCmdSetDepthBounds(commandBuffer, depthBounds[0], depthBounds[1]);
+        }
+    }
+
+    if (colorBlendState != NULL) {
+        if (updateDynamicState(dynamicState, DYNAMIC_STATE_BLEND_CONSTANTS,
+                               dynamicState->blendConstants, colorBlendState->blendConstants,
+                               sizeof(colorBlendState->blendConstants))) {
+            vki.vkCmdSetBlendConstants(commandBuffer, colorBlendState->blendConstants);
+        }
+    }
+
+    grCmdBuffer->dirtyFlags &= ~DIRTY_DYNAMIC_STATE;
 }
 
-static VkDescriptorSet allocateDynamicBindingSet(GrCmdBuffer* grCmdBuffer, VkPipelineBindPoint bindPoint) {
+static void bindDescriptorSets(
+    GrCmdBuffer* grCmdBuffer,
+    VkPipelineBindPoint bindPoint,
+    VkPipelineLayout pipelineLayout,
+    GrDescriptorSet* const* grDescriptorSets,
+    const unsigned* slotOffsets)
+{
+    uint64_t descSetBuffer[2];
+
+    for (unsigned i = 0; i < 2; i++) {
+        descSetBuffer[i] = grDescriptorSets[i] == NULL ? 0 :
+                           grDescriptorSets[i]->bufferDevicePtr + sizeof(uint64_t) * slotOffsets[i];
+    }
+
+    vki.vkCmdPushConstants(grCmdBuffer->commandBuffer, pipelineLayout,
+                           bindPoint == VK_PIPELINE_BIND_POINT_COMPUTE ?
+                           VK_SHADER_STAGE_COMPUTE_BIT : VK_SHADER_STAGE_ALL_GRAPHICS,
+                           0, sizeof(descSetBuffer), descSetBuffer);
+}
+
+static void initDynamicBuffers(GrCmdBuffer* grCmdBuffer, VkPipelineBindPoint bindPoint);
+
+static bool initCmdBufferResources(
+    GrCmdBuffer* grCmdBuffer)
+{
+    GrPipeline* grPipeline = grCmdBuffer->grPipeline;
+    VkPipelineBindPoint bindPoint = getVkPipelineBindPoint(GR_PIPELINE_BIND_POINT_GRAPHICS);
+    const uint32_t drawDirtyFlags = DIRTY_GRAPHICS_PIPELINE | DIRTY_GRAPHICS_DESCRIPTOR_TABLE |
+                                    DIRTY_GRAPHICS_DESCRIPTOR_SETS |
+                                    DIRTY_GRAPHICS_DYNAMIC_MEMORY_VIEW | DIRTY_RENDER_TARGETS |
+                                    DIRTY_DYNAMIC_STATE;
+
+    if ((grCmdBuffer->dirtyFlags & drawDirtyFlags) == 0 && grCmdBuffer->hasActiveRenderPass) {
+        return true;
+    }
+
+    if (grCmdBuffer->dirtyFlags & DIRTY_DYNAMIC_STATE) {
+        applyDynamicState(grCmdBuffer);
+    }
+
+    // Asynchronously created pipelines are only waited on when a draw needs them
+    if (!waitForPipeline(grPipeline)) {
+        LOGW("skipping draw with unavailable pipeline %p\n", grPipeline);
+        return false;
+    }
+
+    // Restarting the render pass stores and reloads every attachment, only do it when needed
+    if ((grCmdBuffer->dirtyFlags & DIRTY_RENDER_TARGETS) || !grCmdBuffer->hasActiveRenderPass ||
+        !isRenderPassReusable(&grCmdBuffer->renderPassKey, &grPipeline->renderPassKey)) {
+        if (!beginRenderPass(grCmdBuffer, grPipeline, VK_SUBPASS_CONTENTS_INLINE)) {
+            return false;
+        }
+    }
+
+    // All graphics pipelines share a layout, descriptors stay bound when the pipeline changes
+    if (grCmdBuffer->dirtyFlags & DIRTY_GRAPHICS_PIPELINE) {
+        vki.vkCmdBindPipeline(grCmdBuffer->commandBuffer, bindPoint, getVkPipeline(grPipeline));
+    }
+    if (grCmdBuffer->dirtyFlags & DIRTY_GRAPHICS_DESCRIPTOR_TABLE) {
+        vki.vkCmdBindDescriptorSets(grCmdBuffer->commandBuffer, bindPoint,
+                                    grPipeline->pipelineLayout, 0, 1,
+                                    &grCmdBuffer->grDevice->globalDescriptorSet.descriptorTable,
+                                    0, NULL);
+    }
+    if (grCmdBuffer->dirtyFlags & DIRTY_GRAPHICS_DESCRIPTOR_SETS) {
+        bindDescriptorSets(grCmdBuffer, bindPoint, grPipeline->pipelineLayout,
+                           grCmdBuffer->graphicsDescriptorSets,
+                           grCmdBuffer->graphicsDescriptorSetOffsets);
+    }
+    if (grCmdBuffer->dirtyFlags & DIRTY_GRAPHICS_DYNAMIC_MEMORY_VIEW) {
+        initDynamicBuffers(grCmdBuffer, bindPoint);
+    }
+
+    grCmdBuffer->dirtyFlags &= ~(DIRTY_GRAPHICS_PIPELINE | DIRTY_GRAPHICS_DESCRIPTOR_TABLE |
+                                 DIRTY_GRAPHICS_DESCRIPTOR_SETS |
+                                 DIRTY_GRAPHICS_DYNAMIC_MEMORY_VIEW);
+    return true;
+}
+
+static bool initComputeResources(
+    GrCmdBuffer* grCmdBuffer)
+{
+    GrPipeline* grPipeline = grCmdBuffer->grComputePipeline;
+    VkPipelineBindPoint bindPoint = getVkPipelineBindPoint(GR_PIPELINE_BIND_POINT_COMPUTE);
+    const uint32_t dispatchDirtyFlags = DIRTY_COMPUTE_PIPELINE | DIRTY_COMPUTE_DESCRIPTOR_TABLE |
+                                        DIRTY_COMPUTE_DESCRIPTOR_SETS |
+                                        DIRTY_COMPUTE_DYNAMIC_MEMORY_VIEW;
+
+    if ((grCmdBuffer->dirtyFlags & dispatchDirtyFlags) == 0) {
+        return true;
+    }
+
+    if (!waitForPipeline(grPipeline)) {
+        LOGW("skipping dispatch with unavailable pipeline %p\n", grPipeline);
+        return false;
+    }
+
+    if (grCmdBuffer->dirtyFlags & DIRTY_COMPUTE_PIPELINE) {
+        vki.vkCmdBindPipeline(grCmdBuffer->commandBuffer, bindPoint, getVkPipeline(grPipeline));
+    }
+    if (grCmdBuffer->dirtyFlags & DIRTY_COMPUTE_DESCRIPTOR_TABLE) {
+        vki.vkCmdBindDescriptorSets(grCmdBuffer->commandBuffer, bindPoint,
+                                    grPipeline->pipelineLayout, 0, 1,
+                                    &grCmdBuffer->grDevice->globalDescriptorSet.descriptorTable,
+                                    0, NULL);
+    }
+    if (grCmdBuffer->dirtyFlags & DIRTY_COMPUTE_DESCRIPTOR_SETS) {
+        bindDescriptorSets(grCmdBuffer, bindPoint, grPipeline->pipelineLayout,
+                           grCmdBuffer->computeDescriptorSets,
+                           grCmdBuffer->computeDescriptorSetOffsets);
+    }
+    if (grCmdBuffer->dirtyFlags & DIRTY_COMPUTE_DYNAMIC_MEMORY_VIEW) {
+        initDynamicBuffers(grCmdBuffer, bindPoint);
+    }
+
+    grCmdBuffer->dirtyFlags &= ~dispatchDirtyFlags;
+    return true;
+}
+
+static VkDescriptorSet allocateDynamicBindingSet(
+    GrCmdBuffer* grCmdBuffer,
+    VkPipelineBindPoint bindPoint)
+{
+    const GrGlobalDescriptorSet* globalDescriptorSet = &grCmdBuffer->grDevice->globalDescriptorSet;
+    VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
     VkDescriptorSetAllocateInfo allocInfo = {
         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .pNext = NULL,
+        .descriptorPool = VK_NULL_HANDLE,
         .descriptorSetCount = 1,
-        .pSetLayouts = bindPoint == VK_PIPELINE_BIND_POINT_GRAPHICS ? &grCmdBuffer->grDevice->globalDescriptorSet.graphicsDynamicMemoryLayout : &grCmdBuffer->grDevice->globalDescriptorSet.computeDynamicMemoryLayout, 
+        .pSetLayouts = bindPoint == VK_PIPELINE_BIND_POINT_GRAPHICS ?
+                       &globalDescriptorSet->graphicsDynamicMemoryLayout :
+                       &globalDescriptorSet->computeDynamicMemoryLayout,
     };
-    VkDescriptorSet outSet;
-    if (grCmdBuffer->dynamicBindingPools == NULL || grCmdBuffer->descriptorPoolCount == 0) {
-        goto pool_allocation;
-    }
-    allocInfo.descriptorPool = grCmdBuffer->dynamicBindingPools[grCmdBuffer->descriptorPoolCount - 1];
-    VkResult allocResult = vki.vkAllocateDescriptorSets(grCmdBuffer->grDevice->device, &allocInfo, &outSet);
-    if (allocResult == VK_SUCCESS) {
-        return outSet;
-    }
-    else if (allocResult != VK_ERROR_FRAGMENTED_POOL && allocResult != VK_ERROR_OUT_OF_POOL_MEMORY) {
-        LOGE("failed to properly allocate descriptor sets for dynamic binding: %d\n", allocResult);
-        assert(false);
-    }
-pool_allocation:
-    LOGT("Allocating a new descriptor pool for dynamic binding for buffer %p\n", grCmdBuffer);
-    // TODO: make "vector" more efficient
-    grCmdBuffer->dynamicBindingPools = (VkDescriptorPool*)realloc(grCmdBuffer->dynamicBindingPools, sizeof(VkDescriptorPool) * grCmdBuffer->descriptorPoolCount);
+
+    // Pools are reset when the command buffer is recorded again, fill them in order
+    while (grCmdBuffer->activeDescriptorPool < grCmdBuffer->descriptorPoolCount) {
+        allocInfo.descriptorPool = grCmdBuffer->dynamicBindingPools[grCmdBuffer->activeDescriptorPool];
+
+        VkResult res = vki.vkAllocateDescriptorSets(grCmdBuffer->grDevice->device, &allocInfo,
+                                                    &descriptorSet);
+        if (res == VK_SUCCESS) {
+            return descriptorSet;
+        } else if (res != VK_ERROR_FRAGMENTED_POOL && res != VK_ERROR_OUT_OF_POOL_MEMORY) {
+            LOGE("vkAllocateDescriptorSets failed (%d)\n", res);
+            return VK_NULL_HANDLE;
+        }
+        grCmdBuffer->activeDescriptorPool++;
+    }
+
+    LOGT("allocating a new dynamic binding descriptor pool for command buffer %p\n", grCmdBuffer);
     const unsigned dynamicDescriptorCount = 128;
     const VkDescriptorPoolSize poolSizes[2] = {
         {
@@ -133,38 +729,71 @@ pool_allocation:
         .poolSizeCount = 2,
         .pPoolSizes = poolSizes,
     };
-    VkDescriptorPool tempPool;
+
+    VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
     if (vki.vkCreateDescriptorPool(grCmdBuffer->grDevice->device, &poolCreateInfo, NULL,
-                                   &tempPool) != VK_SUCCESS) {
-        LOGE("vkCreateDescriptorPool for dynamic binding failed\n");
-        assert(false);
+                                   &descriptorPool) != VK_SUCCESS) {
+        LOGE("vkCreateDescriptorPool failed\n");
+        return VK_NULL_HANDLE;
     }
-    grCmdBuffer->dynamicBindingPools[grCmdBuffer->descriptorPoolCount++] = tempPool;
-    allocInfo.descriptorPool = tempPool;
-    if (vki.vkAllocateDescriptorSets(grCmdBuffer->grDevice->device, &allocInfo, &outSet) != VK_SUCCESS) {
-        LOGE("vkAllocateDescriptorSets failed for created descriptor pool\n");
-        assert(false);
+
+    grCmdBuffer->dynamicBindingPools = realloc(grCmdBuffer->dynamicBindingPools,
+                                               sizeof(VkDescriptorPool) *
+                                               (grCmdBuffer->descriptorPoolCount + 1));
+    grCmdBuffer->dynamicBindingPools[grCmdBuffer->descriptorPoolCount++] = descriptorPool;
+
+    allocInfo.descriptorPool = descriptorPool;
+    if (vki.vkAllocateDescriptorSets(grCmdBuffer->grDevice->device, &allocInfo,
+                                     &descriptorSet) != VK_SUCCESS) {
+        LOGE("vkAllocateDescriptorSets failed\n");
+        return VK_NULL_HANDLE;
     }
-    return outSet;
+    return descriptorSet;
 }
 
 static void initDynamicBuffers(GrCmdBuffer* grCmdBuffer, VkPipelineBindPoint bindPoint)
 {
-    grCmdBuffer->dynamicMemoryViews = (VkBufferView*)realloc(grCmdBuffer->dynamicMemoryViews, sizeof(VkBufferView) * (1 + grCmdBuffer->dynamicBufferViewsCount));
-    const VkBufferViewCreateInfo createInfo = {
-        .sType = VK_STRUCTURE_TYPE_BUFFER_VIEW_CREATE_INFO,
-        .pNext = NULL,
-        .buffer = ((GrGpuMemory*)(grCmdBuffer->graphicsBufferInfo.mem))->buffer,
-         .format = getVkFormat(grCmdBuffer->graphicsBufferInfo.format),
-         .offset = grCmdBuffer->graphicsBufferInfo.offset,
-         .range = grCmdBuffer->graphicsBufferInfo.range,
-    };
-    VkBufferView bufferView;
-    assert(vki.vkCreateBufferView(grCmdBuffer->grDevice->device, &createInfo, NULL, &bufferView) == VK_SUCCESS);
-    grCmdBuffer->dynamicMemoryViews[grCmdBuffer->dynamicBufferViewsCount] = bufferView;
+    const GR_MEMORY_VIEW_ATTACH_INFO* bufferInfo = bindPoint == VK_PIPELINE_BIND_POINT_GRAPHICS ?
+                                                   &grCmdBuffer->graphicsBufferInfo :
+                                                   &grCmdBuffer->computeBufferInfo;
+    GrBufferViewKey key;
+
+    // Constant updates tend to cycle through a few ranges, reuse their views
+    memset(&key, 0, sizeof(key));
+    key.memoryId = ((GrGpuMemory*)(bufferInfo->mem))->id;
+    key.buffer = ((GrGpuMemory*)(bufferInfo->mem))->buffer;
+    key.offset = bufferInfo->offset;
+    key.range = bufferInfo->range;
+    key.format = getVkFormat(bufferInfo->format);
+
+    GrBufferViewEntry* entry = getBufferViewEntry(&grCmdBuffer->bufferViewCache,
+                                                  grCmdBuffer->grDevice->device, &key);
+    if (entry == NULL) {
+        return;
+    }
 
     bool pushDescriptorsSupported = grCmdBuffer->grDevice->pushDescriptorSetSupported;
-    VkDescriptorSet writeSet = pushDescriptorsSupported ? VK_NULL_HANDLE : allocateDynamicBindingSet(grCmdBuffer, bindPoint);
+    VkPipelineLayout layout = bindPoint == VK_PIPELINE_BIND_POINT_GRAPHICS ?
+        grCmdBuffer->grDevice->pipelineLayouts.graphicsPipelineLayout :
+        grCmdBuffer->grDevice->pipelineLayouts.computePipelineLayout;
+    VkDescriptorSet writeSet = VK_NULL_HANDLE;
+
+    if (!pushDescriptorsSupported) {
+        // Sets only ever hold the view they were written with
+        writeSet = entry->descriptorSets[bindPoint];
+        if (writeSet != VK_NULL_HANDLE) {
+            vki.vkCmdBindDescriptorSets(grCmdBuffer->commandBuffer, bindPoint,
+                                        layout, 1, 1, &writeSet, 0, NULL);
+            return;
+        }
+
+        writeSet = allocateDynamicBindingSet(grCmdBuffer, bindPoint);
+        if (writeSet == VK_NULL_HANDLE) {
+            return;
+        }
+        entry->descriptorSets[bindPoint] = writeSet;
+    }
+
     VkWriteDescriptorSet writeDescriptorSet[2] = {
         {
             .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
@@ -176,7 +805,7 @@ static void initDynamicBuffers(GrCmdBuffer* grCmdBuffer, VkPipelineBindPoint bin
             .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER,
             .pImageInfo = NULL,
             .pBufferInfo = NULL,
-            .pTexelBufferView = &bufferView,
+            .pTexelBufferView = &entry->bufferView,
         },
         {
             .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
@@ -188,10 +817,9 @@ static void initDynamicBuffers(GrCmdBuffer* grCmdBuffer, VkPipelineBindPoint bin
             .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER,
             .pImageInfo = NULL,
             .pBufferInfo = NULL,
-            .pTexelBufferView = &bufferView,
+            .pTexelBufferView = &entry->bufferView,
         }
     };
-    VkPipelineLayout layout = bindPoint == VK_PIPELINE_BIND_POINT_GRAPHICS ? grCmdBuffer->grDevice->pipelineLayouts.graphicsPipelineLayout : grCmdBuffer->grDevice->pipelineLayouts.computePipelineLayout;
     if (pushDescriptorsSupported) {
         vki.vkCmdPushDescriptorSetKHR(grCmdBuffer->commandBuffer, bindPoint,
                                       layout,
@@ -203,8 +831,6 @@ static void initDynamicBuffers(GrCmdBuffer* grCmdBuffer, VkPipelineBindPoint bin
         vki.vkCmdBindDescriptorSets(grCmdBuffer->commandBuffer, bindPoint,
                                     layout, 1, 1, &writeSet, 0, NULL);
     }
-    grCmdBuffer->dynamicBufferViewsCount++;
-    grCmdBuffer->isDynamicBufferDirty = false;//TODO:change different flags for compute pipeline
 }
 
 // Command Buffer Building Functions
@@ -218,12 +844,19 @@ GR_VOID grCmdBindPipeline(
     GrCmdBuffer* grCmdBuffer = (GrCmdBuffer*)cmdBuffer;
     GrPipeline* grPipeline = (GrPipeline*)pipeline;
 
-    if (pipelineBindPoint != GR_PIPELINE_BIND_POINT_GRAPHICS) {
-        LOGW("unsupported bind point 0x%x\n", pipelineBindPoint);
+    if (recordCmdBindPipeline(grCmdBuffer, pipelineBindPoint, pipeline)) {
+        return;
     }
 
-    grCmdBuffer->grPipeline = grPipeline;
-    grCmdBuffer->isDirty = true;
+    if (pipelineBindPoint == GR_PIPELINE_BIND_POINT_COMPUTE) {
+        if (grPipeline != grCmdBuffer->grComputePipeline) {
+            grCmdBuffer->grComputePipeline = grPipeline;
+            grCmdBuffer->dirtyFlags |= DIRTY_COMPUTE_PIPELINE;
+        }
+    } else if (grPipeline != grCmdBuffer->grPipeline) {
+        grCmdBuffer->grPipeline = grPipeline;
+        grCmdBuffer->dirtyFlags |= DIRTY_GRAPHICS_PIPELINE;
+    }
 }
 
 GR_VOID grCmdBindStateObject(
@@ -233,67 +866,31 @@ GR_VOID grCmdBindStateObject(
 {
     LOGT("%p 0x%X %p\n", cmdBuffer, stateBindPoint, state);
     GrCmdBuffer* grCmdBuffer = (GrCmdBuffer*)cmdBuffer;
-    GrViewportStateObject* viewportState = (GrViewportStateObject*)state;
-    GrRasterStateObject* rasterState = (GrRasterStateObject*)state;
-    GrDepthStencilStateObject* depthStencilState = (GrDepthStencilStateObject*)state;
-    GrColorBlendStateObject* colorBlendState = (GrColorBlendStateObject*)state;
 
+    if (recordCmdBindStateObject(grCmdBuffer, stateBindPoint, state)) {
+        return;
+    }
+
+    // Recorded on the next draw, so that only the values that changed are set
     switch ((GR_STATE_BIND_POINT)stateBindPoint) {
     case GR_STATE_BIND_VIEWPORT:
-        vki.vkCmdSetViewportWithCountEXT(grCmdBuffer->commandBuffer,
-                                         viewportState->viewportCount, viewportState->viewports);
-        vki.vkCmdSetScissorWithCountEXT(grCmdBuffer->commandBuffer, viewportState->scissorCount,
-                                        viewportState->scissors);
+        grCmdBuffer->viewportState = (GrViewportStateObject*)state;
         break;
     case GR_STATE_BIND_RASTER:
-        vki.vkCmdSetCullModeEXT(grCmdBuffer->commandBuffer, rasterState->cullMode);
-        vki.vkCmdSetFrontFaceEXT(grCmdBuffer->commandBuffer, rasterState->frontFace);
-        vki.vkCmdSetDepthBias(grCmdBuffer->commandBuffer, rasterState->depthBiasConstantFactor,
-                              rasterState->depthBiasClamp, rasterState->depthBiasSlopeFactor);
+        grCmdBuffer->rasterState = (GrRasterStateObject*)state;
         break;
     case GR_STATE_BIND_DEPTH_STENCIL:
-        vki.vkCmdSetDepthTestEnableEXT(grCmdBuffer->commandBuffer,
-                                       depthStencilState->depthTestEnable);
-        vki.vkCmdSetDepthWriteEnableEXT(grCmdBuffer->commandBuffer,
-                                        depthStencilState->depthWriteEnable);
-        vki.vkCmdSetDepthCompareOpEXT(grCmdBuffer->commandBuffer,
-                                      depthStencilState->depthCompareOp);
-        vki.vkCmdSetDepthBoundsTestEnableEXT(grCmdBuffer->commandBuffer,
-                                             depthStencilState->depthBoundsTestEnable);
-        vki.vkCmdSetStencilTestEnableEXT(grCmdBuffer->commandBuffer,
-                                         depthStencilState->stencilTestEnable);
-        vki.vkCmdSetStencilOpEXT(grCmdBuffer->commandBuffer, VK_STENCIL_FACE_FRONT_BIT,
-                                 depthStencilState->front.failOp,
-                                 depthStencilState->front.passOp,
-                                 depthStencilState->front.depthFailOp,
-                                 depthStencilState->front.compareOp);
-        vki.vkCmdSetStencilCompareMask(grCmdBuffer->commandBuffer, VK_STENCIL_FACE_FRONT_BIT,
-                                       depthStencilState->front.compareMask);
-        vki.vkCmdSetStencilWriteMask(grCmdBuffer->commandBuffer, VK_STENCIL_FACE_FRONT_BIT,
-                                     depthStencilState->front.writeMask);
-        vki.vkCmdSetStencilReference(grCmdBuffer->commandBuffer, VK_STENCIL_FACE_FRONT_BIT,
-                                     depthStencilState->front.reference);
-        vki.vkCmdSetStencilOpEXT(grCmdBuffer->commandBuffer, VK_STENCIL_FACE_BACK_BIT,
-                                 depthStencilState->back.failOp,
-                                 depthStencilState->back.passOp,
-                                 depthStencilState->back.depthFailOp,
-                                 depthStencilState->back.compareOp);
-        vki.vkCmdSetStencilCompareMask(grCmdBuffer->commandBuffer, VK_STENCIL_FACE_BACK_BIT,
-                                       depthStencilState->back.compareMask);
-        vki.vkCmdSetStencilWriteMask(grCmdBuffer->commandBuffer, VK_STENCIL_FACE_BACK_BIT,
-                                     depthStencilState->back.writeMask);
-        vki.vkCmdSetStencilReference(grCmdBuffer->commandBuffer, VK_STENCIL_FACE_BACK_BIT,
-                                     depthStencilState->back.reference);
-        vki.vkCmdSetDepthBounds(grCmdBuffer->commandBuffer,
-                                depthStencilState->minDepthBounds, depthStencilState->maxDepthBounds);
+        grCmdBuffer->depthStencilState = (GrDepthStencilStateObject*)state;
         break;
     case GR_STATE_BIND_COLOR_BLEND:
-        vki.vkCmdSetBlendConstants(grCmdBuffer->commandBuffer, colorBlendState->blendConstants);
+        grCmdBuffer->colorBlendState = (GrColorBlendStateObject*)state;
         break;
     case GR_STATE_BIND_MSAA:
         // TODO
-        break;
+        return;
     }
+
+    grCmdBuffer->dirtyFlags |= DIRTY_DYNAMIC_STATE;
 }
 
 GR_VOID grCmdBindDescriptorSet(
@@ -306,14 +903,21 @@ GR_VOID grCmdBindDescriptorSet(
     LOGT("%p 0x%X %u %p %u\n", cmdBuffer, pipelineBindPoint, index,  descriptorSet, slotOffset);
     GrCmdBuffer* grCmdBuffer = (GrCmdBuffer*)cmdBuffer;
     GrDescriptorSet* grDescriptorSet = (GrDescriptorSet*)descriptorSet;
+
+    if (recordCmdBindDescriptorSet(grCmdBuffer, pipelineBindPoint, index, descriptorSet,
+                                   slotOffset)) {
+        return;
+    }
+
     assert(index < 2);
     if (pipelineBindPoint == GR_PIPELINE_BIND_POINT_GRAPHICS) {
         grCmdBuffer->graphicsDescriptorSetOffsets[index] = slotOffset;
         grCmdBuffer->graphicsDescriptorSets[index] = grDescriptorSet;
-        grCmdBuffer->isDirty = true;
+        grCmdBuffer->dirtyFlags |= DIRTY_GRAPHICS_DESCRIPTOR_SETS;
     } else {
         grCmdBuffer->computeDescriptorSetOffsets[index] = slotOffset;
         grCmdBuffer->computeDescriptorSets[index] = grDescriptorSet;
+        grCmdBuffer->dirtyFlags |= DIRTY_COMPUTE_DESCRIPTOR_SETS;
     }
 
 }
@@ -325,13 +929,19 @@ GR_VOID grCmdBindDynamicMemoryView(
 {
     LOGT("%p 0x%X %p\n", cmdBuffer, pipelineBindPoint, pMemView);
     GrCmdBuffer* grCmdBuffer = (GrCmdBuffer*)cmdBuffer;
-    if (pipelineBindPoint == GR_PIPELINE_BIND_POINT_GRAPHICS && memcmp(pMemView, &grCmdBuffer->graphicsBufferInfo, sizeof(GR_MEMORY_VIEW_ATTACH_INFO)) != 0) {
-        memcpy(&grCmdBuffer->graphicsBufferInfo, pMemView, sizeof(GR_MEMORY_VIEW_ATTACH_INFO));
-        grCmdBuffer->isDynamicBufferDirty = true;
+
+    if (recordCmdBindDynamicMemoryView(grCmdBuffer, pipelineBindPoint, pMemView)) {
+        return;
     }
-    else if (memcmp(pMemView, &grCmdBuffer->computeBufferInfo, sizeof(GR_MEMORY_VIEW_ATTACH_INFO)) != 0) {
+
+    if (pipelineBindPoint == GR_PIPELINE_BIND_POINT_GRAPHICS) {
+        if (memcmp(pMemView, &grCmdBuffer->graphicsBufferInfo, sizeof(GR_MEMORY_VIEW_ATTACH_INFO)) != 0) {
+            memcpy(&grCmdBuffer->graphicsBufferInfo, pMemView, sizeof(GR_MEMORY_VIEW_ATTACH_INFO));
+            grCmdBuffer->dirtyFlags |= DIRTY_GRAPHICS_DYNAMIC_MEMORY_VIEW;
+        }
+    } else if (memcmp(pMemView, &grCmdBuffer->computeBufferInfo, sizeof(GR_MEMORY_VIEW_ATTACH_INFO)) != 0) {
         memcpy(&grCmdBuffer->computeBufferInfo, pMemView, sizeof(GR_MEMORY_VIEW_ATTACH_INFO));
-        //TODO: add dirty flag
+        grCmdBuffer->dirtyFlags |= DIRTY_COMPUTE_DYNAMIC_MEMORY_VIEW;
     }
 }
 
@@ -342,24 +952,73 @@ GR_VOID grCmdPrepareMemoryRegions(
 {
     LOGT("%p %u %p\n", cmdBuffer, transitionCount, pStateTransitions);
     GrCmdBuffer* grCmdBuffer = (GrCmdBuffer*)cmdBuffer;
+    VkPipelineStageFlags srcStageMask = 0;
+    VkPipelineStageFlags dstStageMask = 0;
+    unsigned bufferBarrierCount = 0;
+    VkMemoryBarrier memoryBarrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .pNext = NULL,
+        .srcAccessMask = 0,
+        .dstAccessMask = 0,
+    };
+
+    if (recordCmdPrepareMemoryRegions(grCmdBuffer, transitionCount, pStateTransitions)) {
+        return;
+    }
 
-    for (int i = 0; i < transitionCount; i++) {
+    if (transitionCount == 0) {
+        return;
+    }
+
+    endRenderPass(grCmdBuffer);
+    // Results have to be written before the barrier makes them visible
+    flushTimestampCopies(grCmdBuffer);
+
+    if (transitionCount > grCmdBuffer->bufferBarrierCapacity) {
+        grCmdBuffer->bufferBarrierCapacity = MAX(transitionCount, 16);
+        grCmdBuffer->bufferBarriers = realloc(grCmdBuffer->bufferBarriers,
+                                              sizeof(VkBufferMemoryBarrier) *
+                                              grCmdBuffer->bufferBarrierCapacity);
+    }
+    VkBufferMemoryBarrier* bufferBarriers = grCmdBuffer->bufferBarriers;
+
+    for (GR_UINT i = 0; i < transitionCount; i++) {
         const GR_MEMORY_STATE_TRANSITION* stateTransition = &pStateTransitions[i];
+        const GrGpuMemory* grGpuMemory = (GrGpuMemory*)stateTransition->mem;
+        VkAccessFlags srcAccessMask = getVkAccessFlagsMemory(stateTransition->oldState);
+        VkAccessFlags dstAccessMask = getVkAccessFlagsMemory(stateTransition->newState);
+
+        srcStageMask |= getVkPipelineStageFlagsMemory(stateTransition->oldState);
+        dstStageMask |= getVkPipelineStageFlagsMemory(stateTransition->newState);
 
-        // TODO use buffer memory barrier
-        const VkMemoryBarrier memoryBarrier = {
-            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        if (grGpuMemory->buffer == VK_NULL_HANDLE) {
+            // No buffer to scope the barrier to, fall back to a global one
+            memoryBarrier.srcAccessMask |= srcAccessMask;
+            memoryBarrier.dstAccessMask |= dstAccessMask;
+            continue;
+        }
+
+        bufferBarriers[bufferBarrierCount++] = (VkBufferMemoryBarrier) {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
             .pNext = NULL,
-            .srcAccessMask = getVkAccessFlagsMemory(stateTransition->oldState),
-            .dstAccessMask = getVkAccessFlagsMemory(stateTransition->newState),
+            .srcAccessMask = srcAccessMask,
+            .dstAccessMask = dstAccessMask,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .buffer = grGpuMemory->buffer,
+            .offset = stateTransition->offset,
+            .size = stateTransition->regionSize != 0 ? stateTransition->regionSize : VK_WHOLE_SIZE,
         };
-
-        // TODO batch
-        vki.vkCmdPipelineBarrier(grCmdBuffer->commandBuffer,
-                                 VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, // TODO optimize
-                                 VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, // TODO optimize
-                                 0, 1, &memoryBarrier, 0, NULL, 0, NULL);
     }
+
+    bool hasMemoryBarrier = memoryBarrier.srcAccessMask != 0 || memoryBarrier.dstAccessMask != 0;
+
+    vki.vkCmdPipelineBarrier(grCmdBuffer->commandBuffer,
+                             getQueueStageFlags(grCmdBuffer, srcStageMask),
+                             getQueueStageFlags(grCmdBuffer, dstStageMask),
+                             0, hasMemoryBarrier ? 1 : 0, &memoryBarrier,
+                             bufferBarrierCount, bufferBarriers, 0, NULL);
+    grCmdBuffer->barrierCount++;
 }
 
 // FIXME what are target states for?
@@ -373,10 +1032,19 @@ GR_VOID grCmdBindTargets(
     LOGT("%p %u %p %p\n", cmdBuffer, colorTargetCount, pColorTargets, pDepthTarget);
     GrCmdBuffer* grCmdBuffer = (GrCmdBuffer*)cmdBuffer;
 
+    if (recordCmdBindTargets(grCmdBuffer, colorTargetCount, pColorTargets, pDepthTarget)) {
+        return;
+    }
+
     if (pDepthTarget != NULL) {
         LOGW("unhandled depth target\n");
     }
 
+    // Extent and layer count derive from the views, comparing these is enough
+    unsigned oldAttachmentCount = grCmdBuffer->attachmentCount;
+    VkImageView oldAttachments[GR_MAX_COLOR_TARGETS + 1];
+    memcpy(oldAttachments, grCmdBuffer->attachments, sizeof(oldAttachments));
+
     // Find minimum extent and layer count
     grCmdBuffer->minExtent2D = (VkExtent2D) { UINT32_MAX, UINT32_MAX };
     grCmdBuffer->minLayerCount = UINT32_MAX;
@@ -396,15 +1064,32 @@ GR_VOID grCmdBindTargets(
 
     // Copy attachments
     grCmdBuffer->attachmentCount = 0;
+    memset(grCmdBuffer->colorTargetViews, 0, sizeof(grCmdBuffer->colorTargetViews));
 
     for (int i = 0; i < colorTargetCount; i++) {
         const GrColorTargetView* grColorTargetView = (GrColorTargetView*)pColorTargets[i].view;
 
+        grCmdBuffer->colorTargetViews[i] = grColorTargetView;
         if (grColorTargetView != NULL) {
             grCmdBuffer->attachments[grCmdBuffer->attachmentCount] = grColorTargetView->imageView;
+            grCmdBuffer->attachmentInfos[grCmdBuffer->attachmentCount] = (GrFramebufferAttachment) {
+                .usage = grColorTargetView->usage,
+                .format = grColorTargetView->format,
+                .viewFormatCount = grColorTargetView->grImage->viewFormatCount,
+                .width = grColorTargetView->extent.width,
+                .height = grColorTargetView->extent.height,
+                .layerCount = grColorTargetView->layerCount,
+            };
             grCmdBuffer->attachmentCount++;
         }
     }
+
+    // Rebinding the same targets keeps the current render pass going
+    if (grCmdBuffer->attachmentCount != oldAttachmentCount ||
+        memcmp(grCmdBuffer->attachments, oldAttachments,
+               sizeof(VkImageView) * oldAttachmentCount) != 0) {
+        grCmdBuffer->dirtyFlags |= DIRTY_RENDER_TARGETS;
+    }
 }
 
 GR_VOID grCmdPrepareImages(
@@ -413,31 +1098,37 @@ GR_VOID grCmdPrepareImages(
     const GR_IMAGE_STATE_TRANSITION* pStateTransitions)
 {
     LOGT("%p %u %p\n", cmdBuffer, transitionCount, pStateTransitions);
-    const GrCmdBuffer* grCmdBuffer = (GrCmdBuffer*)cmdBuffer;
+    GrCmdBuffer* grCmdBuffer = (GrCmdBuffer*)cmdBuffer;
 
-    for (int i = 0; i < transitionCount; i++) {
-        const GR_IMAGE_STATE_TRANSITION* stateTransition = &pStateTransitions[i];
-        const GR_IMAGE_SUBRESOURCE_RANGE* range = &stateTransition->subresourceRange;
-        GrImage* grImage = (GrImage*)stateTransition->image;
+    if (recordCmdPrepareImages(grCmdBuffer, transitionCount, pStateTransitions)) {
+        return;
+    }
 
-        const VkImageMemoryBarrier imageMemoryBarrier = {
-            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-            .pNext = NULL,
-            .srcAccessMask = getVkAccessFlagsImage(stateTransition->oldState),
-            .dstAccessMask = getVkAccessFlagsImage(stateTransition->newState),
-            .oldLayout = getVkImageLayout(stateTransition->oldState),
-            .newLayout = getVkImageLayout(stateTransition->newState),
-            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-            .image = grImage->image,
-            .subresourceRange = getVkImageSubresourceRange(range),
-        };
+    // Transitions repeating a subresource go in a separate barrier
+    for (unsigned i = 0; i < transitionCount;) {
+        VkPipelineStageFlags srcStageMask = 0;
+        VkPipelineStageFlags dstStageMask = 0;
+        unsigned barrierCount = 0;
+        unsigned batchTransitionCount = 0;
+
+        const VkImageMemoryBarrier* barriers =
+            getImageTransitionBarriers(&barrierCount, &batchTransitionCount, &srcStageMask,
+                                       &dstStageMask, grCmdBuffer, transitionCount - i,
+                                       &pStateTransitions[i]);
+        i += batchTransitionCount;
+
+        if (barrierCount == 0) {
+            // Redundant transitions don't need to interrupt the render pass
+            continue;
+        }
+
+        endRenderPass(grCmdBuffer);
 
-        // TODO batch
         vki.vkCmdPipelineBarrier(grCmdBuffer->commandBuffer,
-                                 VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, // TODO optimize
-                                 VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, // TODO optimize
-                                 0, 0, NULL, 0, NULL, 1, &imageMemoryBarrier);
+                                 getQueueStageFlags(grCmdBuffer, srcStageMask),
+                                 getQueueStageFlags(grCmdBuffer, dstStageMask),
+                                 0, 0, NULL, 0, NULL, barrierCount, barriers);
+        grCmdBuffer->barrierCount++;
     }
 }
 
@@ -451,11 +1142,12 @@ GR_VOID grCmdDraw(
     LOGT("%p %u %u %u %u\n", cmdBuffer, firstVertex, vertexCount, firstInstance, instanceCount);
     GrCmdBuffer* grCmdBuffer = (GrCmdBuffer*)cmdBuffer;
 
-    if (grCmdBuffer->isDirty) {
-        initCmdBufferResources(grCmdBuffer);
+    if (recordCmdDraw(grCmdBuffer, firstVertex, vertexCount, firstInstance, instanceCount)) {
+        return;
     }
-    if (grCmdBuffer->isDynamicBufferDirty) {
-        initDynamicBuffers(grCmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS);
+
+    if (!initCmdBufferResources(grCmdBuffer)) {
+        return;
     }
     vki.vkCmdDraw(grCmdBuffer->commandBuffer,
                   vertexCount, instanceCount, firstVertex, firstInstance);
@@ -473,16 +1165,65 @@ GR_VOID grCmdDrawIndexed(
          cmdBuffer, firstIndex, indexCount, vertexOffset, firstInstance, instanceCount);
     GrCmdBuffer* grCmdBuffer = (GrCmdBuffer*)cmdBuffer;
 
-    if (grCmdBuffer->isDirty) {
-        initCmdBufferResources(grCmdBuffer);
+    if (recordCmdDrawIndexed(grCmdBuffer, firstIndex, indexCount, vertexOffset, firstInstance,
+                             instanceCount)) {
+        return;
     }
-    if (grCmdBuffer->isDynamicBufferDirty) {
-        initDynamicBuffers(grCmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS);
+
+    if (!initCmdBufferResources(grCmdBuffer)) {
+        return;
     }
     vki.vkCmdDrawIndexed(grCmdBuffer->commandBuffer,
                          indexCount, instanceCount, firstIndex, vertexOffset, firstInstance);
 }
 
+static bool prepareDispatch(
+    GrCmdBuffer* grCmdBuffer)
+{
+    // Dispatches aren't allowed inside a render pass, the next draw begins a new one
+    endRenderPass(grCmdBuffer);
+
+    return initComputeResources(grCmdBuffer);
+}
+
+GR_VOID grCmdDispatch(
+    GR_CMD_BUFFER cmdBuffer,
+    GR_UINT x,
+    GR_UINT y,
+    GR_UINT z)
+{
+    LOGT("%p %u %u %u\n", cmdBuffer, x, y, z);
+    GrCmdBuffer* grCmdBuffer = (GrCmdBuffer*)cmdBuffer;
+
+    if (recordCmdDispatch(grCmdBuffer, x, y, z)) {
+        return;
+    }
+
+    if (!prepareDispatch(grCmdBuffer)) {
+        return;
+    }
+    vki.vkCmdDispatch(grCmdBuffer->commandBuffer, x, y, z);
+}
+
+GR_VOID grCmdDispatchIndirect(
+    GR_CMD_BUFFER cmdBuffer,
+    GR_GPU_MEMORY mem,
+    GR_GPU_SIZE offset)
+{
+    LOGT("%p %p %llu\n", cmdBuffer, mem, (unsigned long long)offset);
+    GrCmdBuffer* grCmdBuffer = (GrCmdBuffer*)cmdBuffer;
+    GrGpuMemory* grGpuMemory = (GrGpuMemory*)mem;
+
+    if (recordCmdDispatchIndirect(grCmdBuffer, mem, offset)) {
+        return;
+    }
+
+    if (!prepareDispatch(grCmdBuffer)) {
+        return;
+    }
+    vki.vkCmdDispatchIndirect(grCmdBuffer->commandBuffer, grGpuMemory->buffer, offset);
+}
+
 GR_VOID grCmdClearColorImage(
     GR_CMD_BUFFER cmdBuffer,
     GR_IMAGE image,
@@ -495,11 +1236,18 @@ GR_VOID grCmdClearColorImage(
     GrCmdBuffer* grCmdBuffer = (GrCmdBuffer*)cmdBuffer;
     GrImage* grImage = (GrImage*)image;
 
+    if (recordCmdClearColorImage(grCmdBuffer, image, color, rangeCount, pRanges)) {
+        return;
+    }
+
+    endRenderPass(grCmdBuffer);
+
     const VkClearColorValue vkColor = {
         .float32 = { color[0], color[1], color[2], color[3] },
     };
 
-    VkImageSubresourceRange* vkRanges = malloc(rangeCount * sizeof(VkImageSubresourceRange));
+    VkImageSubresourceRange* vkRanges =
+        getCmdBufferScratch(grCmdBuffer, rangeCount * sizeof(VkImageSubresourceRange));
     for (int i = 0; i < rangeCount; i++) {
         vkRanges[i] = getVkImageSubresourceRange(&pRanges[i]);
     }
@@ -507,8 +1255,6 @@ GR_VOID grCmdClearColorImage(
     vki.vkCmdClearColorImage(grCmdBuffer->commandBuffer, grImage->image,
                              getVkImageLayout(GR_IMAGE_STATE_CLEAR),
                              &vkColor, rangeCount, vkRanges);
-
-    free(vkRanges);
 }
 
 GR_VOID grCmdClearColorImageRaw(
@@ -523,11 +1269,18 @@ GR_VOID grCmdClearColorImageRaw(
     GrCmdBuffer* grCmdBuffer = (GrCmdBuffer*)cmdBuffer;
     GrImage* grImage = (GrImage*)image;
 
+    if (recordCmdClearColorImageRaw(grCmdBuffer, image, color, rangeCount, pRanges)) {
+        return;
+    }
+
+    endRenderPass(grCmdBuffer);
+
     const VkClearColorValue vkColor = {
         .uint32 = { color[0], color[1], color[2], color[3] },
     };
 
-    VkImageSubresourceRange* vkRanges = malloc(rangeCount * sizeof(VkImageSubresourceRange));
+    VkImageSubresourceRange* vkRanges =
+        getCmdBufferScratch(grCmdBuffer, rangeCount * sizeof(VkImageSubresourceRange));
     for (int i = 0; i < rangeCount; i++) {
         vkRanges[i] = getVkImageSubresourceRange(&pRanges[i]);
     }
@@ -535,8 +1288,6 @@ GR_VOID grCmdClearColorImageRaw(
     vki.vkCmdClearColorImage(grCmdBuffer->commandBuffer, grImage->image,
                              getVkImageLayout(GR_IMAGE_STATE_CLEAR),
                              &vkColor, rangeCount, vkRanges);
-
-    free(vkRanges);
 }
 
 GR_VOID grCmdClearDepthStencil(
@@ -551,16 +1302,22 @@ GR_VOID grCmdClearDepthStencil(
     GrCmdBuffer* grCmdBuffer = (GrCmdBuffer*)cmdBuffer;
     GrImage* grImage = (GrImage*)image;
 
+    if (recordCmdClearDepthStencil(grCmdBuffer, image, depth, stencil, rangeCount, pRanges)) {
+        return;
+    }
+
+    endRenderPass(grCmdBuffer);
+
     VkClearDepthStencilValue depthStencil = {
         .depth = depth,
         .stencil = (uint32_t) stencil,
     };
-    VkImageSubresourceRange *vkRanges = (VkImageSubresourceRange*)malloc(sizeof(VkImageSubresourceRange) * rangeCount);
+    VkImageSubresourceRange* vkRanges =
+        getCmdBufferScratch(grCmdBuffer, rangeCount * sizeof(VkImageSubresourceRange));
     for (GR_UINT i = 0; i < rangeCount; ++i) {
         vkRanges[i] = getVkImageSubresourceRange(&pRanges[i]);
     }
     vki.vkCmdClearDepthStencilImage(grCmdBuffer->commandBuffer, grImage->image, getVkImageLayout(GR_IMAGE_STATE_CLEAR), &depthStencil, rangeCount, vkRanges);
-    free(vkRanges);
 }
 
 GR_VOID grCmdSetEvent(
@@ -570,6 +1327,9 @@ GR_VOID grCmdSetEvent(
     LOGT("%p %p\n", cmdBuffer, event);
     GrCmdBuffer* grCmdBuffer = (GrCmdBuffer*)cmdBuffer;
     GrEvent* grEvent = (GrEvent*)event;
+
+    flushCmdStream(grCmdBuffer);
+    endRenderPass(grCmdBuffer);
     vki.vkCmdSetEvent(grCmdBuffer->commandBuffer, grEvent->event, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
 }
 
@@ -580,6 +1340,9 @@ GR_VOID grCmdResetEvent(
     LOGT("%p %p\n", cmdBuffer, event);
     GrCmdBuffer* grCmdBuffer = (GrCmdBuffer*)cmdBuffer;
     GrEvent* grEvent = (GrEvent*)event;
+
+    flushCmdStream(grCmdBuffer);
+    endRenderPass(grCmdBuffer);
     vki.vkCmdResetEvent(grCmdBuffer->commandBuffer, grEvent->event, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
 }
 
@@ -592,6 +1355,11 @@ GR_VOID grCmdBeginQuery(
     LOGT("%p %p %u 0x%X\n", cmdBuffer, queryPool, slot, flags);
     GrCmdBuffer* grCmdBuffer = (GrCmdBuffer*)cmdBuffer;
     GrQueryPool* grQueryPool = (GrQueryPool*)queryPool;
+
+    flushCmdStream(grCmdBuffer);
+
+    // Queries must begin and end on the same side of a render pass, keep them outside
+    endRenderPass(grCmdBuffer);
     vki.vkCmdBeginQuery(grCmdBuffer->commandBuffer, grQueryPool->pool, slot, (GR_QUERY_IMPRECISE_DATA & flags) ? 0 : VK_QUERY_CONTROL_PRECISE_BIT); // basically inverse of vulkan
 }
 
@@ -603,6 +1371,9 @@ GR_VOID grCmdEndQuery(
     LOGT("%p %p %u\n", cmdBuffer, queryPool, slot);
     GrCmdBuffer* grCmdBuffer = (GrCmdBuffer*)cmdBuffer;
     GrQueryPool* grQueryPool = (GrQueryPool*)queryPool;
+
+    flushCmdStream(grCmdBuffer);
+    endRenderPass(grCmdBuffer);
     vki.vkCmdEndQuery(grCmdBuffer->commandBuffer, grQueryPool->pool, slot);
 }
 
@@ -615,6 +1386,9 @@ GR_VOID grCmdResetQueryPool(
     LOGT("%p %p %u %u\n", cmdBuffer, queryPool, startQuery, queryCount);
     GrCmdBuffer* grCmdBuffer = (GrCmdBuffer*)cmdBuffer;
     GrQueryPool* grQueryPool = (GrQueryPool*)queryPool;
+
+    flushCmdStream(grCmdBuffer);
+    endRenderPass(grCmdBuffer);
     vki.vkCmdResetQueryPool(grCmdBuffer->commandBuffer, grQueryPool->pool, startQuery, queryCount);
 }
 
@@ -627,27 +1401,66 @@ GR_VOID grCmdWriteTimestamp(
     LOGT("%p 0x%X %p %lu\n", cmdBuffer, timestampType, destMem, destOffset);
     GrCmdBuffer* grCmdBuffer = (GrCmdBuffer*)cmdBuffer;
     GrGpuMemory* grMemory = (GrGpuMemory*)destMem;
+
+    flushCmdStream(grCmdBuffer);
+
     if (grCmdBuffer->timestampQueryPool == VK_NULL_HANDLE) {
-        // create a new one lazily
-         VkQueryPoolCreateInfo createInfo = {
-             .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
-             .pNext = NULL,
-             .flags = 0,
-             .queryType = VK_QUERY_TYPE_TIMESTAMP,
-             .queryCount = 1,
-             .pipelineStatistics = 0,
-         };
-         VkResult res = vki.vkCreateQueryPool(grMemory->device, &createInfo, NULL, &grCmdBuffer->timestampQueryPool);
-         if (res != VK_SUCCESS) {
-             LOGE("Failed to create a VkQueryPool for command buffer %p\n", cmdBuffer);
-             grCmdBuffer->timestampQueryPool = VK_NULL_HANDLE;
-         }
+        const VkQueryPoolCreateInfo createInfo = {
+            .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+            .pNext = NULL,
+            .flags = 0,
+            .queryType = VK_QUERY_TYPE_TIMESTAMP,
+            .queryCount = TIMESTAMP_QUERY_COUNT,
+            .pipelineStatistics = 0,
+        };
+
+        if (vki.vkCreateQueryPool(grCmdBuffer->grDevice->device, &createInfo, NULL,
+                                  &grCmdBuffer->timestampQueryPool) != VK_SUCCESS) {
+            LOGE("vkCreateQueryPool failed\n");
+            grCmdBuffer->timestampQueryPool = VK_NULL_HANDLE;
+            return;
+        }
+
+        // Later recordings reset the pool as soon as they begin
+        endRenderPass(grCmdBuffer);
+        resetTimestampQueries(grCmdBuffer);
+    } else if (grCmdBuffer->timestampQueryCount == TIMESTAMP_QUERY_COUNT) {
+        // Wrap around once the pending copy is done reading from the queries
+        endRenderPass(grCmdBuffer);
+        flushTimestampCopies(grCmdBuffer);
+        vki.vkCmdPipelineBarrier(grCmdBuffer->commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                 VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 0, NULL);
+        grCmdBuffer->barrierCount++;
+        resetTimestampQueries(grCmdBuffer);
+        grCmdBuffer->timestampQueryCount = 0;
     }
-    if (grCmdBuffer->timestampQueryPool == VK_NULL_HANDLE) {
-        // do nothing for now (could have crash the program as well heh)
+
+    unsigned query = grCmdBuffer->timestampQueryCount++;
+    VkPipelineStageFlags stageFlag = timestampType == GR_TIMESTAMP_TOP ?
+                                     VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT :
+                                     VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+
+    // Timestamps can be written inside the render pass, only the copy has to be outside of it
+    vki.vkCmdWriteTimestamp(grCmdBuffer->commandBuffer, stageFlag,
+                            grCmdBuffer->timestampQueryPool, query);
+
+    if (grCmdBuffer->timestampCopyQueryCount > 0 &&
+        grCmdBuffer->timestampCopyBuffer == grMemory->buffer &&
+        grCmdBuffer->timestampCopyOffset +
+        grCmdBuffer->timestampCopyQueryCount * sizeof(uint64_t) == destOffset &&
+        grCmdBuffer->timestampCopyFirstQuery + grCmdBuffer->timestampCopyQueryCount == query) {
+        // Lands right after the previous result, copy both at once
+        grCmdBuffer->timestampCopyQueryCount++;
         return;
     }
-    VkPipelineStageFlags stageFlag = timestampType == GR_TIMESTAMP_TOP ? VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-    vki.vkCmdWriteTimestamp( grCmdBuffer->commandBuffer, stageFlag, grCmdBuffer->timestampQueryPool, 0);
-    vki.vkCmdCopyQueryPoolResults( grCmdBuffer->commandBuffer, grCmdBuffer->timestampQueryPool, 0, 1, grMemory->buffer, destOffset, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+
+    if (grCmdBuffer->timestampCopyQueryCount > 0) {
+        endRenderPass(grCmdBuffer);
+        flushTimestampCopies(grCmdBuffer);
+    }
+
+    grCmdBuffer->timestampCopyBuffer = grMemory->buffer;
+    grCmdBuffer->timestampCopyOffset = destOffset;
+    grCmdBuffer->timestampCopyFirstQuery = query;
+    grCmdBuffer->timestampCopyQueryCount = 1;
 }
@@ -2,73 +2,301 @@
 
 // Command Buffer Management Functions
 
-GR_RESULT grCreateCommandBuffer(
-    GR_DEVICE device,
-    const GR_CMD_BUFFER_CREATE_INFO* pCreateInfo,
-    GR_CMD_BUFFER* pCmdBuffer)
+// Recycles everything the previous recording used, which must be done executing
+static void resetCmdBufferState(
+    GrCmdBuffer* grCmdBuffer)
 {
-    LOGT("%p %p %p\n", device, pCreateInfo, pCmdBuffer);
-    GrDevice* grDevice = (GrDevice*)device;
+    // Drop the framebuffers the previous recording used
+    for (unsigned i = 0; i < grCmdBuffer->framebufferCount; i++) {
+        releaseFramebuffer(grCmdBuffer->framebuffers[i], grCmdBuffer->grDevice->device);
+    }
+    grCmdBuffer->framebufferCount = 0;
+
+    for (unsigned i = 0; i < grCmdBuffer->renderPassKeyCount; i++) {
+        releaseRenderPass(&grCmdBuffer->grDevice->renderPassCache, grCmdBuffer->grDevice->device,
+                          &grCmdBuffer->renderPassKeys[i]);
+    }
+    grCmdBuffer->renderPassKeyCount = 0;
+
+    resetImageStates(grCmdBuffer);
+
+    // Dynamic memory views keep their descriptor sets while the same ones keep getting used
+    if (resetBufferViewCache(&grCmdBuffer->bufferViewCache, grCmdBuffer->grDevice->device)) {
+        for (unsigned i = 0; i < grCmdBuffer->descriptorPoolCount; i++) {
+            vki.vkResetDescriptorPool(grCmdBuffer->grDevice->device,
+                                      grCmdBuffer->dynamicBindingPools[i], 0);
+        }
+        grCmdBuffer->activeDescriptorPool = 0;
+    }
+
+    // Dynamic state doesn't carry over between recordings
+    grCmdBuffer->viewportState = NULL;
+    grCmdBuffer->rasterState = NULL;
+    grCmdBuffer->depthStencilState = NULL;
+    grCmdBuffer->colorBlendState = NULL;
+    grCmdBuffer->dynamicState.validMask = 0;
+
+    // Nothing is bound in a fresh recording, the shared pipeline layouts keep descriptors
+    // bound across pipeline changes so they only need to be bound once per recording
+    grCmdBuffer->graphicsBufferInfo = (GR_MEMORY_VIEW_ATTACH_INFO) { 0 };
+    grCmdBuffer->computeBufferInfo = (GR_MEMORY_VIEW_ATTACH_INFO) { 0 };
+    grCmdBuffer->dirtyFlags = DIRTY_GRAPHICS_PIPELINE | DIRTY_GRAPHICS_DESCRIPTOR_TABLE |
+                              DIRTY_GRAPHICS_DESCRIPTOR_SETS | DIRTY_COMPUTE_PIPELINE |
+                              DIRTY_COMPUTE_DESCRIPTOR_TABLE | DIRTY_COMPUTE_DESCRIPTOR_SETS |
+                              DIRTY_RENDER_TARGETS;
+    grCmdBuffer->barrierCount = 0;
+    grCmdBuffer->elidedTransitionCount = 0;
+    grCmdBuffer->hasActiveRenderPass = false;
+    memset(grCmdBuffer->colorTargetViews, 0, sizeof(grCmdBuffer->colorTargetViews));
+    grCmdBuffer->loadOpClearCount = 0;
+    grCmdBuffer->timestampQueryCount = 0;
+    grCmdBuffer->timestampCopyQueryCount = 0;
+
+    resetCmdStream(&grCmdBuffer->cmdStream);
+    grCmdBuffer->secondaryCmdBufferCount = 0;
+}
+
+static GR_RESULT createCmdBuffer(
+    GrCmdBuffer** pGrCmdBuffer,
+    GrDevice* grDevice,
+    GR_ENUM queueType,
+    VkCommandBufferLevel level)
+{
+    GrCommandPoolSet* grCommandPoolSet = NULL;
     VkCommandPool vkCommandPool = VK_NULL_HANDLE;
     VkCommandBuffer vkCommandBuffer = VK_NULL_HANDLE;
 
-    if (pCreateInfo->queueType == GR_QUEUE_UNIVERSAL) {
-        vkCommandPool = grDevice->universalCommandPool;
-    } else if (pCreateInfo->queueType == GR_QUEUE_COMPUTE) {
-        vkCommandPool = grDevice->computeCommandPool;
+    if (queueType == GR_QUEUE_UNIVERSAL) {
+        grCommandPoolSet = &grDevice->universalCommandPools;
+    } else if (queueType == GR_QUEUE_COMPUTE) {
+        grCommandPoolSet = &grDevice->computeCommandPools;
     }
 
-    if (vkCommandPool == VK_NULL_HANDLE) {
+    if (grCommandPoolSet == NULL || grCommandPoolSet->queueIndex == INVALID_QUEUE_INDEX) {
         return GR_ERROR_INVALID_QUEUE_TYPE;
     }
 
+    // Recording only touches the command buffer's own pool and needs no locking
+    vkCommandPool = acquireCommandPool(grCommandPoolSet, grDevice->device);
+    if (vkCommandPool == VK_NULL_HANDLE) {
+        return GR_ERROR_OUT_OF_MEMORY;
+    }
+
     const VkCommandBufferAllocateInfo allocateInfo = {
         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
         .pNext = NULL,
         .commandPool = vkCommandPool,
-        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .level = level,
         .commandBufferCount = 1,
     };
 
     if (vki.vkAllocateCommandBuffers(grDevice->device, &allocateInfo,
                                      &vkCommandBuffer) != VK_SUCCESS) {
         LOGE("vkAllocateCommandBuffers failed\n");
+        releaseCommandPool(grCommandPoolSet, grDevice->device, vkCommandPool);
         return GR_ERROR_OUT_OF_MEMORY;
     }
 
     GrCmdBuffer* grCmdBuffer = malloc(sizeof(GrCmdBuffer));
     if (grCmdBuffer == NULL) {
+        releaseCommandPool(grCommandPoolSet, grDevice->device, vkCommandPool);
         return GR_ERROR_OUT_OF_MEMORY;
     }
     *grCmdBuffer = (GrCmdBuffer) {
         .sType = GR_STRUCT_TYPE_COMMAND_BUFFER,
         .grDevice = grDevice,
+        .queueType = queueType,
+        .commandPool = vkCommandPool,
         .commandBuffer = vkCommandBuffer,
+        .usageFlags = 0,
         .timestampQueryPool = VK_NULL_HANDLE,
+        .timestampQueryCount = 0,
+        .timestampCopyBuffer = VK_NULL_HANDLE,
+        .timestampCopyOffset = 0,
+        .timestampCopyFirstQuery = 0,
+        .timestampCopyQueryCount = 0,
         .grPipeline = NULL,
+        .grComputePipeline = NULL,
+        .viewportState = NULL,
+        .rasterState = NULL,
+        .depthStencilState = NULL,
+        .colorBlendState = NULL,
+        .dynamicState = { 0 },
         .graphicsDescriptorSets = {NULL, NULL},
         .graphicsDescriptorSetOffsets = {0, 0},
         .computeDescriptorSets = {NULL, NULL},
         .computeDescriptorSetOffsets = {0, 0},
         .attachmentCount = 0,
         .attachments = { NULL },
+        .colorTargetViews = { NULL },
+        .loadOpClearCount = 0,
         .minExtent2D = { 0, 0 },
-        .dynamicMemoryViews = NULL,
-        .dynamicBufferViewsCount = 0,
+        .bufferViewCache = { 0 },
+        .scratch = NULL,
+        .scratchSize = 0,
         .dynamicBindingPools = NULL,
         .descriptorPoolCount = 0,
+        .activeDescriptorPool = 0,
+        .framebuffers = NULL,
+        .framebufferCount = 0,
+        .framebufferCapacity = 0,
+        .renderPassKeys = NULL,
+        .renderPassKeyCount = 0,
+        .renderPassKeyCapacity = 0,
+        .imageStateTrackers = NULL,
+        .imageStateTrackerCount = 0,
+        .imageStateTrackerCapacity = 0,
+        .imageStateTable = NULL,
+        .imageStateTableSize = 0,
+        .imageBarrierBatch = 0,
+        .imageBarriers = NULL,
+        .imageBarrierCapacity = 0,
+        .bufferBarriers = NULL,
+        .bufferBarrierCapacity = 0,
+        .barrierCount = 0,
+        .elidedTransitionCount = 0,
+        .cmdStream = { 0 },
+        .secondaryCmdBuffers = NULL,
+        .secondaryCmdBufferCount = 0,
+        .secondaryCmdBufferCapacity = 0,
         .graphicsBufferInfo = {},
         .computeBufferInfo = {},
         .minLayerCount = 0,
+        .renderPassKey = { { 0 } },
         .hasActiveRenderPass = false,
-        .isDirty = false,
-        .isDynamicBufferDirty = false,
+        .dirtyFlags = 0,
     };
 
-    *pCmdBuffer = (GR_CMD_BUFFER)grCmdBuffer;
+    *pGrCmdBuffer = grCmdBuffer;
     return GR_SUCCESS;
 }
 
+GrCmdBuffer* acquireSecondaryCmdBuffer(
+    GrCmdBuffer* grCmdBuffer,
+    VkRenderPass renderPass)
+{
+    GrDevice* grDevice = grCmdBuffer->grDevice;
+    GrCmdBuffer* grSecondaryCmdBuffer = NULL;
+
+    if (grCmdBuffer->secondaryCmdBufferCount < grCmdBuffer->secondaryCmdBufferCapacity) {
+        grSecondaryCmdBuffer =
+            grCmdBuffer->secondaryCmdBuffers[grCmdBuffer->secondaryCmdBufferCount];
+    } else {
+        if (createCmdBuffer(&grSecondaryCmdBuffer, grDevice, grCmdBuffer->queueType,
+                            VK_COMMAND_BUFFER_LEVEL_SECONDARY) != GR_SUCCESS) {
+            return NULL;
+        }
+
+        grCmdBuffer->secondaryCmdBufferCapacity++;
+        grCmdBuffer->secondaryCmdBuffers =
+            realloc(grCmdBuffer->secondaryCmdBuffers,
+                    sizeof(GrCmdBuffer*) * grCmdBuffer->secondaryCmdBufferCapacity);
+        grCmdBuffer->secondaryCmdBuffers[grCmdBuffer->secondaryCmdBufferCount] =
+            grSecondaryCmdBuffer;
+    }
+
+    // The framebuffer isn't known until the primary begins its render pass
+    const VkCommandBufferInheritanceInfo inheritanceInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+        .pNext = NULL,
+        .renderPass = renderPass,
+        .subpass = 0,
+        .framebuffer = VK_NULL_HANDLE,
+        .occlusionQueryEnable = VK_FALSE,
+        .queryFlags = 0,
+        .pipelineStatistics = 0,
+    };
+
+    // Secondaries get submitted as many times as the primary they are executed from
+    const VkCommandBufferUsageFlags usageFlags =
+        (grCmdBuffer->usageFlags & VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT) |
+        VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+
+    const VkCommandBufferBeginInfo beginInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .pNext = NULL,
+        .flags = usageFlags,
+        .pInheritanceInfo = &inheritanceInfo,
+    };
+
+    if (vki.vkResetCommandPool(grDevice->device, grSecondaryCmdBuffer->commandPool,
+                               0) != VK_SUCCESS) {
+        LOGE("vkResetCommandPool failed\n");
+        return NULL;
+    }
+
+    if (vki.vkBeginCommandBuffer(grSecondaryCmdBuffer->commandBuffer,
+                                 &beginInfo) != VK_SUCCESS) {
+        LOGE("vkBeginCommandBuffer failed\n");
+        return NULL;
+    }
+
+    resetCmdBufferState(grSecondaryCmdBuffer);
+    grSecondaryCmdBuffer->usageFlags = usageFlags;
+    // Commands are replayed into it directly and must not be deferred again
+    grSecondaryCmdBuffer->cmdStream.isTranslating = true;
+
+    grCmdBuffer->secondaryCmdBufferCount++;
+    return grSecondaryCmdBuffer;
+}
+
+void destroyCmdBuffer(
+    GrCmdBuffer* grCmdBuffer)
+{
+    GrDevice* grDevice = grCmdBuffer->grDevice;
+
+    for (unsigned i = 0; i < grCmdBuffer->secondaryCmdBufferCapacity; i++) {
+        destroyCmdBuffer(grCmdBuffer->secondaryCmdBuffers[i]);
+    }
+    for (unsigned i = 0; i < grCmdBuffer->framebufferCount; i++) {
+        releaseFramebuffer(grCmdBuffer->framebuffers[i], grDevice->device);
+    }
+    for (unsigned i = 0; i < grCmdBuffer->renderPassKeyCount; i++) {
+        releaseRenderPass(&grDevice->renderPassCache, grDevice->device,
+                          &grCmdBuffer->renderPassKeys[i]);
+    }
+    for (unsigned i = 0; i < grCmdBuffer->imageStateTrackerCapacity; i++) {
+        free(grCmdBuffer->imageStateTrackers[i].subresourceStates);
+    }
+    for (unsigned i = 0; i < grCmdBuffer->descriptorPoolCount; i++) {
+        vki.vkDestroyDescriptorPool(grDevice->device, grCmdBuffer->dynamicBindingPools[i], NULL);
+    }
+    destroyBufferViewCache(&grCmdBuffer->bufferViewCache, grDevice->device);
+    destroyCmdStream(&grCmdBuffer->cmdStream);
+    if (grCmdBuffer->timestampQueryPool != VK_NULL_HANDLE) {
+        vki.vkDestroyQueryPool(grDevice->device, grCmdBuffer->timestampQueryPool, NULL);
+    }
+
+    vki.vkFreeCommandBuffers(grDevice->device, grCmdBuffer->commandPool, 1,
+                             &grCmdBuffer->commandBuffer);
+    releaseCommandPool(grCmdBuffer->queueType == GR_QUEUE_UNIVERSAL ?
+                       &grDevice->universalCommandPools : &grDevice->computeCommandPools,
+                       grDevice->device, grCmdBuffer->commandPool);
+
+    free(grCmdBuffer->secondaryCmdBuffers);
+    free(grCmdBuffer->scratch);
+    free(grCmdBuffer->framebuffers);
+    free(grCmdBuffer->renderPassKeys);
+    free(grCmdBuffer->imageStateTrackers);
+    free(grCmdBuffer->imageStateTable);
+    free(grCmdBuffer->imageBarriers);
+    free(grCmdBuffer->bufferBarriers);
+    free(grCmdBuffer->dynamicBindingPools);
+    free(grCmdBuffer);
+}
+
+GR_RESULT grCreateCommandBuffer(
+    GR_DEVICE device,
+    const GR_CMD_BUFFER_CREATE_INFO* pCreateInfo,
+    GR_CMD_BUFFER* pCmdBuffer)
+{
+    LOGT("%p %p %p\n", device, pCreateInfo, pCmdBuffer);
+    GrDevice* grDevice = (GrDevice*)device;
+
+    return createCmdBuffer((GrCmdBuffer**)pCmdBuffer, grDevice, pCreateInfo->queueType,
+                           VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+}
+
 GR_RESULT grBeginCommandBuffer(
     GR_CMD_BUFFER cmdBuffer,
     GR_FLAGS flags)
@@ -88,11 +316,22 @@ GR_RESULT grBeginCommandBuffer(
         .pInheritanceInfo = NULL,
     };
 
+    // Pools aren't created with individual reset support, the whole pool is reset instead
+    if (vki.vkResetCommandPool(grCmdBuffer->grDevice->device, grCmdBuffer->commandPool,
+                               0) != VK_SUCCESS) {
+        LOGE("vkResetCommandPool failed\n");
+        return GR_ERROR_OUT_OF_MEMORY;
+    }
+
     if (vki.vkBeginCommandBuffer(grCmdBuffer->commandBuffer, &beginInfo) != VK_SUCCESS) {
         LOGE("vkBeginCommandBuffer failed\n");
         return GR_ERROR_OUT_OF_MEMORY;
     }
 
+    resetCmdBufferState(grCmdBuffer);
+    resetTimestampQueries(grCmdBuffer);
+    grCmdBuffer->usageFlags = vkUsageFlags;
+
     return GR_SUCCESS;
 }
 
@@ -102,9 +341,10 @@ GR_RESULT grEndCommandBuffer(
     LOGT("%p\n", cmdBuffer);
     GrCmdBuffer* grCmdBuffer = (GrCmdBuffer*)cmdBuffer;
 
-    if (grCmdBuffer->hasActiveRenderPass) {
-        vki.vkCmdEndRenderPass(grCmdBuffer->commandBuffer);
-    }
+    // Deferred commands are translated now that the whole recording is known
+    flushCmdStream(grCmdBuffer);
+    endRenderPass(grCmdBuffer);
+    flushTimestampCopies(grCmdBuffer);
 
     if (vki.vkEndCommandBuffer(grCmdBuffer->commandBuffer) != VK_SUCCESS) {
         LOGE("vkEndCommandBuffer failed\n");
@@ -113,3 +353,28 @@ GR_RESULT grEndCommandBuffer(
 
     return GR_SUCCESS;
 }
+
+GR_RESULT grResetCommandBuffer(
+    GR_CMD_BUFFER cmdBuffer)
+{
+    LOGT("%p\n", cmdBuffer);
+    GrCmdBuffer* grCmdBuffer = (GrCmdBuffer*)cmdBuffer;
+
+    if (grCmdBuffer == NULL) {
+        return GR_ERROR_INVALID_HANDLE;
+    }
+    if (grCmdBuffer->sType != GR_STRUCT_TYPE_COMMAND_BUFFER) {
+        return GR_ERROR_INVALID_OBJECT_TYPE;
+    }
+
+    // The pool only holds this command buffer, keep its memory around for the next recording
+    if (vki.vkResetCommandPool(grCmdBuffer->grDevice->device, grCmdBuffer->commandPool,
+                               0) != VK_SUCCESS) {
+        LOGE("vkResetCommandPool failed\n");
+        return GR_ERROR_OUT_OF_MEMORY;
+    }
+
+    resetCmdBufferState(grCmdBuffer);
+
+    return GR_SUCCESS;
+}
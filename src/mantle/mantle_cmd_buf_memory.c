@@ -22,8 +22,11 @@ GR_VOID grCmdCopyMemory(
     GrCmdBuffer* grCmdBuffer = (GrCmdBuffer*)cmdBuffer;
     GrGpuMemory* grSrcMemory = (GrGpuMemory*)srcMem;
     GrGpuMemory* grDestMemory = (GrGpuMemory*)srcMem;
-    //TODO: avoid unnecessary allocation as VkBufferCopy is completely identical to GR_MEMORY_COPY
-    VkBufferCopy *pVkRegions = (VkBufferCopy*)malloc(sizeof(VkBufferCopy) * regionCount);
+    flushCmdStream(grCmdBuffer);
+    endRenderPass(grCmdBuffer);
+    // Keep the pending timestamp results ordered with other accesses to the memory
+    flushTimestampCopies(grCmdBuffer);
+    VkBufferCopy* pVkRegions = getCmdBufferScratch(grCmdBuffer, sizeof(VkBufferCopy) * regionCount);
     for (GR_UINT i = 0; i < regionCount; ++i) {
         pVkRegions[i] = (VkBufferCopy){
             .srcOffset = pRegions[i].srcOffset,
@@ -32,7 +35,6 @@ GR_VOID grCmdCopyMemory(
         };
     }
     vki.vkCmdCopyBuffer(grCmdBuffer->commandBuffer, grSrcMemory->buffer, grDestMemory->buffer, regionCount, pVkRegions);
-    free(pVkRegions);
 }
 
 GR_VOID grCmdCopyImage(
@@ -46,7 +48,9 @@ GR_VOID grCmdCopyImage(
     GrCmdBuffer* grCmdBuffer = (GrCmdBuffer*)cmdBuffer;
     GrImage* grSrcImage  = (GrImage*)srcImage;
     GrImage* grDestImage = (GrImage*)destImage;
-    VkImageCopy *pVkRegions = (VkImageCopy*)malloc(sizeof(VkImageCopy) * regionCount);
+    flushCmdStream(grCmdBuffer);
+    endRenderPass(grCmdBuffer);
+    VkImageCopy* pVkRegions = getCmdBufferScratch(grCmdBuffer, sizeof(VkImageCopy) * regionCount);
     for (GR_UINT i = 0; i < regionCount; ++i) {
         pVkRegions[i] = (VkImageCopy){
             .srcSubresource = getVkImageSubresourceLayers(&pRegions[i].srcSubresource),
@@ -69,7 +73,6 @@ GR_VOID grCmdCopyImage(
         };
     }
     vki.vkCmdCopyImage(grCmdBuffer->commandBuffer, grSrcImage->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, grDestImage->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, regionCount, pVkRegions);
-    free(pVkRegions);
 }
 
 static void mapBufferCopyRanges(GR_UINT regionCount, const GR_MEMORY_IMAGE_COPY* pRegions, VkBufferImageCopy * pVkRegions)
@@ -104,10 +107,13 @@ GR_VOID grCmdCopyMemoryToImage(
     GrCmdBuffer* grCmdBuffer = (GrCmdBuffer*)cmdBuffer;
     GrGpuMemory* grMemory = (GrGpuMemory*)srcMem;
     GrImage* grImage = (GrImage*)destImage;
-    VkBufferImageCopy* vkRegions = (VkBufferImageCopy*)malloc(sizeof(VkBufferImageCopy) * regionCount);
+    flushCmdStream(grCmdBuffer);
+    endRenderPass(grCmdBuffer);
+    flushTimestampCopies(grCmdBuffer);
+    VkBufferImageCopy* vkRegions =
+        getCmdBufferScratch(grCmdBuffer, sizeof(VkBufferImageCopy) * regionCount);
     mapBufferCopyRanges(regionCount, pRegions, vkRegions);
     vki.vkCmdCopyBufferToImage(grCmdBuffer->commandBuffer, grMemory->buffer, grImage->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, regionCount, vkRegions);
-    free(vkRegions);
 }
 
 GR_VOID grCmdCopyImageToMemory(
@@ -121,10 +127,13 @@ GR_VOID grCmdCopyImageToMemory(
     GrCmdBuffer* grCmdBuffer = (GrCmdBuffer*)cmdBuffer;
     GrGpuMemory* grMemory = (GrGpuMemory*)destMem;
     GrImage* grImage = (GrImage*)srcImage;
-    VkBufferImageCopy* vkRegions = (VkBufferImageCopy*)malloc(sizeof(VkBufferImageCopy) * regionCount);
+    flushCmdStream(grCmdBuffer);
+    endRenderPass(grCmdBuffer);
+    flushTimestampCopies(grCmdBuffer);
+    VkBufferImageCopy* vkRegions =
+        getCmdBufferScratch(grCmdBuffer, sizeof(VkBufferImageCopy) * regionCount);
     mapBufferCopyRanges(regionCount, pRegions, vkRegions);
     vki.vkCmdCopyImageToBuffer(grCmdBuffer->commandBuffer, grImage->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, grMemory->buffer, regionCount, vkRegions);
-    free(vkRegions);
 }
 
 GR_VOID grCmdUpdateMemory(
@@ -137,6 +146,9 @@ GR_VOID grCmdUpdateMemory(
     LOGT("%p %p 0x%lX 0x%lX %p\n", cmdBuffer, destMem, destOffset, dataSize, pData);
     GrCmdBuffer* grCmdBuffer = (GrCmdBuffer*)cmdBuffer;
     GrGpuMemory* grMemory = (GrGpuMemory*)destMem;
+    flushCmdStream(grCmdBuffer);
+    endRenderPass(grCmdBuffer);
+    flushTimestampCopies(grCmdBuffer);
     vki.vkCmdUpdateBuffer(grCmdBuffer->commandBuffer, grMemory->buffer, destOffset, dataSize, pData);
 }
 
@@ -151,7 +163,10 @@ GR_VOID grCmdResolveImage(
     GrCmdBuffer* grCmdBuffer = (GrCmdBuffer*)cmdBuffer;
     GrImage* grSrcImage = (GrImage*)srcImage;
     GrImage* grDstImage = (GrImage*)destImage;
-    VkImageResolve* pVkRegions = (VkImageResolve*)malloc(sizeof(VkImageResolve) * regionCount);
+    flushCmdStream(grCmdBuffer);
+    endRenderPass(grCmdBuffer);
+    VkImageResolve* pVkRegions =
+        getCmdBufferScratch(grCmdBuffer, sizeof(VkImageResolve) * regionCount);
     for (GR_UINT i = 0; i < regionCount; ++i) {
         pVkRegions[i] = (VkImageResolve) {
             .srcSubresource = getVkImageSubresourceLayers(&pRegions[i].srcSubresource),
@@ -176,7 +191,6 @@ GR_VOID grCmdResolveImage(
                           grDstImage->image,
                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
                           regionCount, pVkRegions);
-    free(pVkRegions);
 }
 
 GR_VOID grCmdFillMemory(
@@ -189,5 +203,8 @@ GR_VOID grCmdFillMemory(
     LOGT("%p %p 0x%lX 0x%lX %u\n", cmdBuffer, destMem, destOffset, fillSize, data);
     GrCmdBuffer* grCmdBuffer = (GrCmdBuffer*)cmdBuffer;
     GrGpuMemory* grMemory = (GrGpuMemory*)destMem;
+    flushCmdStream(grCmdBuffer);
+    endRenderPass(grCmdBuffer);
+    flushTimestampCopies(grCmdBuffer);
     vki.vkCmdFillBuffer(grCmdBuffer->commandBuffer, grMemory->buffer, destOffset, fillSize, data);
 }
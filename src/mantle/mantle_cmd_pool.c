@@ -0,0 +1,101 @@
+#include "mantle_internal.h"
+
+void initCommandPoolSet(
+    GrCommandPoolSet* grCommandPoolSet,
+    unsigned queueIndex)
+{
+    *grCommandPoolSet = (GrCommandPoolSet) {
+        .lock = SRWLOCK_INIT,
+        .queueIndex = queueIndex,
+        .pools = NULL,
+        .poolCount = 0,
+        .poolCapacity = 0,
+        .freePools = NULL,
+        .freePoolCount = 0,
+        .freePoolCapacity = 0,
+    };
+}
+
+VkCommandPool acquireCommandPool(
+    GrCommandPoolSet* grCommandPoolSet,
+    VkDevice device)
+{
+    VkCommandPool commandPool = VK_NULL_HANDLE;
+
+    AcquireSRWLockExclusive(&grCommandPoolSet->lock);
+    if (grCommandPoolSet->freePoolCount > 0) {
+        commandPool = grCommandPoolSet->freePools[--grCommandPoolSet->freePoolCount];
+    }
+    ReleaseSRWLockExclusive(&grCommandPoolSet->lock);
+
+    if (commandPool != VK_NULL_HANDLE) {
+        return commandPool;
+    }
+
+    // Each command buffer owns its pool so that recording never needs external synchronization,
+    // and the whole pool can be reset instead of the individual command buffer
+    const VkCommandPoolCreateInfo poolCreateInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .queueFamilyIndex = grCommandPoolSet->queueIndex,
+    };
+
+    if (vki.vkCreateCommandPool(device, &poolCreateInfo, NULL, &commandPool) != VK_SUCCESS) {
+        LOGE("vkCreateCommandPool failed\n");
+        return VK_NULL_HANDLE;
+    }
+
+    // Track it so that pools still owned by command buffers get destroyed with the device
+    AcquireSRWLockExclusive(&grCommandPoolSet->lock);
+
+    if (grCommandPoolSet->poolCount == grCommandPoolSet->poolCapacity) {
+        grCommandPoolSet->poolCapacity = MAX(2 * grCommandPoolSet->poolCapacity, 8);
+        grCommandPoolSet->pools = realloc(grCommandPoolSet->pools, sizeof(VkCommandPool) *
+                                          grCommandPoolSet->poolCapacity);
+    }
+    grCommandPoolSet->pools[grCommandPoolSet->poolCount++] = commandPool;
+
+    ReleaseSRWLockExclusive(&grCommandPoolSet->lock);
+
+    return commandPool;
+}
+
+void releaseCommandPool(
+    GrCommandPoolSet* grCommandPoolSet,
+    VkDevice device,
+    VkCommandPool commandPool)
+{
+    // Keep the pool memory for the next owner
+    vki.vkResetCommandPool(device, commandPool, 0);
+
+    AcquireSRWLockExclusive(&grCommandPoolSet->lock);
+
+    if (grCommandPoolSet->freePoolCount == grCommandPoolSet->freePoolCapacity) {
+        grCommandPoolSet->freePoolCapacity = MAX(2 * grCommandPoolSet->freePoolCapacity, 8);
+        grCommandPoolSet->freePools = realloc(grCommandPoolSet->freePools, sizeof(VkCommandPool) *
+                                              grCommandPoolSet->freePoolCapacity);
+    }
+    grCommandPoolSet->freePools[grCommandPoolSet->freePoolCount++] = commandPool;
+
+    ReleaseSRWLockExclusive(&grCommandPoolSet->lock);
+}
+
+void destroyCommandPoolSet(
+    GrCommandPoolSet* grCommandPoolSet,
+    VkDevice device)
+{
+    // Destroying a pool also frees the command buffers allocated from it
+    for (unsigned i = 0; i < grCommandPoolSet->poolCount; i++) {
+        vki.vkDestroyCommandPool(device, grCommandPoolSet->pools[i], NULL);
+    }
+    free(grCommandPoolSet->pools);
+    free(grCommandPoolSet->freePools);
+
+    grCommandPoolSet->pools = NULL;
+    grCommandPoolSet->poolCount = 0;
+    grCommandPoolSet->poolCapacity = 0;
+    grCommandPoolSet->freePools = NULL;
+    grCommandPoolSet->freePoolCount = 0;
+    grCommandPoolSet->freePoolCapacity = 0;
+}
@@ -0,0 +1,1201 @@
+#include "mantle_internal.h"
+
+#define CMD_STREAM_BLOCK_SIZE   (64 * 1024)
+
+// Shorter draw runs are translated inline, splitting them wouldn't pay for the extra render pass
+#define PARALLEL_CHUNK_MIN_DRAWS    128
+#define MAX_PARALLEL_CHUNKS         16
+
+// Bind slots, a bind is only useful if a draw or dispatch sees it before it's overwritten
+#define SLOT_GRAPHICS_PIPELINE          (1 << 0)
+#define SLOT_COMPUTE_PIPELINE           (1 << 1)
+#define SLOT_STATE_OBJECT(bindPoint)    (1 << (2 + (bindPoint) - GR_STATE_BIND_VIEWPORT))
+#define SLOT_GRAPHICS_DESCRIPTOR_SET(i) (1 << (7 + (i)))
+#define SLOT_COMPUTE_DESCRIPTOR_SET(i)  (1 << (9 + (i)))
+#define SLOT_GRAPHICS_MEMORY_VIEW       (1 << 11)
+#define SLOT_COMPUTE_MEMORY_VIEW        (1 << 12)
+#define SLOT_TARGETS                    (1 << 13)
+
+#define GRAPHICS_SLOTS  (SLOT_GRAPHICS_PIPELINE | (0x1F << 2) | SLOT_GRAPHICS_DESCRIPTOR_SET(0) | \
+                         SLOT_GRAPHICS_DESCRIPTOR_SET(1) | SLOT_GRAPHICS_MEMORY_VIEW | SLOT_TARGETS)
+#define COMPUTE_SLOTS   (SLOT_COMPUTE_PIPELINE | SLOT_COMPUTE_DESCRIPTOR_SET(0) | \
+                         SLOT_COMPUTE_DESCRIPTOR_SET(1) | SLOT_COMPUTE_MEMORY_VIEW)
+
+typedef enum _GrCmdStreamCommandType {
+    CMD_NONE, // Dropped by an optimization
+    CMD_BIND_PIPELINE,
+    CMD_BIND_STATE_OBJECT,
+    CMD_BIND_DESCRIPTOR_SET,
+    CMD_BIND_DYNAMIC_MEMORY_VIEW,
+    CMD_BIND_TARGETS,
+    CMD_PREPARE_MEMORY_REGIONS,
+    CMD_PREPARE_IMAGES,
+    CMD_DRAW,
+    CMD_DRAW_INDEXED,
+    CMD_DISPATCH,
+    CMD_DISPATCH_INDIRECT,
+    CMD_CLEAR_COLOR_IMAGE,
+    CMD_CLEAR_COLOR_IMAGE_RAW,
+    CMD_CLEAR_DEPTH_STENCIL,
+} GrCmdStreamCommandType;
+
+struct _GrCmdStreamBlock {
+    GrCmdStreamBlock* next;
+    size_t size;
+    size_t offset;
+    uint64_t data[];
+};
+
+// Arrays passed to the entry points are copied to the stream arena
+struct _GrCmdStreamCommand {
+    GrCmdStreamCommandType type;
+    union {
+        struct {
+            GR_ENUM bindPoint;
+            GR_PIPELINE pipeline;
+        } bindPipeline;
+        struct {
+            GR_ENUM bindPoint;
+            GR_STATE_OBJECT state;
+        } bindStateObject;
+        struct {
+            GR_ENUM bindPoint;
+            GR_UINT index;
+            GR_DESCRIPTOR_SET descriptorSet;
+            GR_UINT slotOffset;
+        } bindDescriptorSet;
+        struct {
+            GR_ENUM bindPoint;
+            GR_MEMORY_VIEW_ATTACH_INFO memView;
+        } bindDynamicMemoryView;
+        struct {
+            GR_UINT colorTargetCount;
+            GR_COLOR_TARGET_BIND_INFO* colorTargets;
+            GR_DEPTH_STENCIL_BIND_INFO* depthTarget;
+        } bindTargets;
+        struct {
+            GR_UINT transitionCount;
+            GR_MEMORY_STATE_TRANSITION* transitions;
+        } prepareMemoryRegions;
+        struct {
+            GR_UINT transitionCount;
+            GR_IMAGE_STATE_TRANSITION* transitions;
+        } prepareImages;
+        struct {
+            GR_UINT firstVertex;
+            GR_UINT vertexCount;
+            GR_UINT firstInstance;
+            GR_UINT instanceCount;
+        } draw;
+        struct {
+            GR_UINT firstIndex;
+            GR_UINT indexCount;
+            GR_INT vertexOffset;
+            GR_UINT firstInstance;
+            GR_UINT instanceCount;
+        } drawIndexed;
+        struct {
+            GR_UINT x;
+            GR_UINT y;
+            GR_UINT z;
+        } dispatch;
+        struct {
+            GR_GPU_MEMORY mem;
+            GR_GPU_SIZE offset;
+        } dispatchIndirect;
+        struct {
+            GR_IMAGE image;
+            union {
+                GR_FLOAT color[4];
+                GR_UINT32 rawColor[4];
+            };
+            GR_UINT rangeCount;
+            GR_IMAGE_SUBRESOURCE_RANGE* ranges;
+        } clearColorImage;
+        struct {
+            GR_IMAGE image;
+            GR_FLOAT depth;
+            GR_UINT8 stencil;
+            GR_UINT rangeCount;
+            GR_IMAGE_SUBRESOURCE_RANGE* ranges;
+        } clearDepthStencil;
+    };
+};
+
+// Part of a draw run, translated into its own secondary command buffer
+typedef struct _GrCmdStreamChunk {
+    GrCmdBuffer* grCmdBuffer;
+    const GrCmdStreamCommand* commands;
+    unsigned commandCount;
+} GrCmdStreamChunk;
+
+static bool isDeferringCommands(
+    const GrCmdBuffer* grCmdBuffer)
+{
+    // Commands replayed by the translation go straight to Vulkan
+    return grCmdBuffer->grDevice->deferredCommandsEnabled && !grCmdBuffer->cmdStream.isTranslating;
+}
+
+static void* allocateCommandData(
+    GrCmdStream* grCmdStream,
+    size_t size)
+{
+    size_t alignedSize = (size + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+
+    // Blocks past the active one are empty, reuse them before allocating new ones
+    GrCmdStreamBlock* block = grCmdStream->activeBlock;
+    while (block != NULL && block->offset + alignedSize > block->size) {
+        block = block->next;
+    }
+
+    if (block == NULL) {
+        size_t blockSize = MAX(alignedSize, CMD_STREAM_BLOCK_SIZE);
+
+        block = malloc(sizeof(GrCmdStreamBlock) + blockSize);
+        block->next = NULL;
+        block->size = blockSize;
+        block->offset = 0;
+
+        if (grCmdStream->lastBlock != NULL) {
+            grCmdStream->lastBlock->next = block;
+        } else {
+            grCmdStream->blocks = block;
+        }
+        grCmdStream->lastBlock = block;
+    }
+
+    void* ptr = (uint8_t*)block->data + block->offset;
+    block->offset += alignedSize;
+    grCmdStream->activeBlock = block;
+
+    return ptr;
+}
+
+static void* copyCommandData(
+    GrCmdStream* grCmdStream,
+    const void* data,
+    size_t size)
+{
+    if (data == NULL || size == 0) {
+        return NULL;
+    }
+
+    void* ptr = allocateCommandData(grCmdStream, size);
+    memcpy(ptr, data, size);
+    return ptr;
+}
+
+static GrCmdStreamCommand* addCommand(
+    GrCmdStream* grCmdStream,
+    GrCmdStreamCommandType type)
+{
+    if (grCmdStream->commandCount == grCmdStream->commandCapacity) {
+        grCmdStream->commandCapacity = MAX(2 * grCmdStream->commandCapacity, 256);
+        grCmdStream->commands = realloc(grCmdStream->commands, sizeof(GrCmdStreamCommand) *
+                                        grCmdStream->commandCapacity);
+    }
+
+    GrCmdStreamCommand* command = &grCmdStream->commands[grCmdStream->commandCount++];
+    command->type = type;
+    return command;
+}
+
+static bool isBindCommand(
+    const GrCmdStreamCommand* command)
+{
+    return command->type >= CMD_BIND_PIPELINE && command->type <= CMD_BIND_TARGETS;
+}
+
+static uint32_t getBindSlot(
+    const GrCmdStreamCommand* command)
+{
+    switch (command->type) {
+    case CMD_BIND_PIPELINE:
+        return command->bindPipeline.bindPoint == GR_PIPELINE_BIND_POINT_COMPUTE ?
+               SLOT_COMPUTE_PIPELINE : SLOT_GRAPHICS_PIPELINE;
+    case CMD_BIND_STATE_OBJECT:
+        if (command->bindStateObject.bindPoint < GR_STATE_BIND_VIEWPORT ||
+            command->bindStateObject.bindPoint > GR_STATE_BIND_MSAA) {
+            return 0;
+        }
+        return SLOT_STATE_OBJECT(command->bindStateObject.bindPoint);
+    case CMD_BIND_DESCRIPTOR_SET:
+        if (command->bindDescriptorSet.index >= 2) {
+            return 0;
+        }
+        return command->bindDescriptorSet.bindPoint == GR_PIPELINE_BIND_POINT_GRAPHICS ?
+               SLOT_GRAPHICS_DESCRIPTOR_SET(command->bindDescriptorSet.index) :
+               SLOT_COMPUTE_DESCRIPTOR_SET(command->bindDescriptorSet.index);
+    case CMD_BIND_DYNAMIC_MEMORY_VIEW:
+        return command->bindDynamicMemoryView.bindPoint == GR_PIPELINE_BIND_POINT_GRAPHICS ?
+               SLOT_GRAPHICS_MEMORY_VIEW : SLOT_COMPUTE_MEMORY_VIEW;
+    case CMD_BIND_TARGETS:
+        return SLOT_TARGETS;
+    default:
+        return 0;
+    }
+}
+
+static void dropEmptyWork(
+    GrCmdStream* grCmdStream)
+{
+    for (unsigned i = 0; i < grCmdStream->commandCount; i++) {
+        GrCmdStreamCommand* command = &grCmdStream->commands[i];
+
+        if ((command->type == CMD_DRAW &&
+             (command->draw.vertexCount == 0 || command->draw.instanceCount == 0)) ||
+            (command->type == CMD_DRAW_INDEXED &&
+             (command->drawIndexed.indexCount == 0 || command->drawIndexed.instanceCount == 0)) ||
+            (command->type == CMD_DISPATCH &&
+             (command->dispatch.x == 0 || command->dispatch.y == 0 || command->dispatch.z == 0)) ||
+            (command->type == CMD_PREPARE_MEMORY_REGIONS &&
+             command->prepareMemoryRegions.transitionCount == 0) ||
+            (command->type == CMD_PREPARE_IMAGES &&
+             command->prepareImages.transitionCount == 0)) {
+            command->type = CMD_NONE;
+        }
+    }
+}
+
+static void dropUnusedState(
+    GrCmdStream* grCmdStream)
+{
+    // Walk backwards, state bound at the end may still be used after the next flush
+    uint32_t overwrittenSlots = 0;
+
+    for (int i = grCmdStream->commandCount - 1; i >= 0; i--) {
+        GrCmdStreamCommand* command = &grCmdStream->commands[i];
+
+        switch (command->type) {
+        case CMD_DRAW:
+        case CMD_DRAW_INDEXED:
+            overwrittenSlots &= ~GRAPHICS_SLOTS;
+            break;
+        case CMD_DISPATCH:
+        case CMD_DISPATCH_INDIRECT:
+            overwrittenSlots &= ~COMPUTE_SLOTS;
+            break;
+        default:
+            if (isBindCommand(command)) {
+                uint32_t slot = getBindSlot(command);
+
+                if ((overwrittenSlots & slot) != 0) {
+                    command->type = CMD_NONE;
+                }
+                overwrittenSlots |= slot;
+            }
+            break;
+        }
+    }
+}
+
+static bool hasCommonImage(
+    const GR_IMAGE_STATE_TRANSITION* transitions,
+    unsigned transitionCount,
+    const GR_IMAGE_STATE_TRANSITION* otherTransitions,
+    unsigned otherTransitionCount)
+{
+    for (unsigned i = 0; i < transitionCount; i++) {
+        for (unsigned j = 0; j < otherTransitionCount; j++) {
+            if (transitions[i].image == otherTransitions[j].image) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static bool hasCommonMemory(
+    const GR_MEMORY_STATE_TRANSITION* transitions,
+    unsigned transitionCount,
+    const GR_MEMORY_STATE_TRANSITION* otherTransitions,
+    unsigned otherTransitionCount)
+{
+    for (unsigned i = 0; i < transitionCount; i++) {
+        for (unsigned j = 0; j < otherTransitionCount; j++) {
+            if (transitions[i].mem == otherTransitions[j].mem) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static void mergeBarriers(
+    GrCmdStream* grCmdStream)
+{
+    for (unsigned i = 0; i < grCmdStream->commandCount; i++) {
+        GrCmdStreamCommand* command = &grCmdStream->commands[i];
+
+        if (command->type != CMD_PREPARE_IMAGES && command->type != CMD_PREPARE_MEMORY_REGIONS) {
+            continue;
+        }
+
+        // Binds don't record anything by themselves, later barriers can be hoisted over them.
+        // Transitions of the same resource stay in separate barriers to keep them ordered.
+        for (unsigned j = i + 1; j < grCmdStream->commandCount; j++) {
+            GrCmdStreamCommand* nextCommand = &grCmdStream->commands[j];
+
+            if (nextCommand->type == CMD_NONE || isBindCommand(nextCommand)) {
+                continue;
+            } else if (nextCommand->type != command->type) {
+                break;
+            }
+
+            if (command->type == CMD_PREPARE_IMAGES) {
+                unsigned count = command->prepareImages.transitionCount;
+                unsigned nextCount = nextCommand->prepareImages.transitionCount;
+
+                if (hasCommonImage(command->prepareImages.transitions, count,
+                                   nextCommand->prepareImages.transitions, nextCount)) {
+                    break;
+                }
+
+                GR_IMAGE_STATE_TRANSITION* transitions =
+                    allocateCommandData(grCmdStream,
+                                        sizeof(GR_IMAGE_STATE_TRANSITION) * (count + nextCount));
+                memcpy(transitions, command->prepareImages.transitions,
+                       sizeof(GR_IMAGE_STATE_TRANSITION) * count);
+                memcpy(&transitions[count], nextCommand->prepareImages.transitions,
+                       sizeof(GR_IMAGE_STATE_TRANSITION) * nextCount);
+                command->prepareImages.transitions = transitions;
+                command->prepareImages.transitionCount = count + nextCount;
+            } else {
+                unsigned count = command->prepareMemoryRegions.transitionCount;
+                unsigned nextCount = nextCommand->prepareMemoryRegions.transitionCount;
+
+                if (hasCommonMemory(command->prepareMemoryRegions.transitions, count,
+                                    nextCommand->prepareMemoryRegions.transitions, nextCount)) {
+                    break;
+                }
+
+                GR_MEMORY_STATE_TRANSITION* transitions =
+                    allocateCommandData(grCmdStream,
+                                        sizeof(GR_MEMORY_STATE_TRANSITION) * (count + nextCount));
+                memcpy(transitions, command->prepareMemoryRegions.transitions,
+                       sizeof(GR_MEMORY_STATE_TRANSITION) * count);
+                memcpy(&transitions[count], nextCommand->prepareMemoryRegions.transitions,
+                       sizeof(GR_MEMORY_STATE_TRANSITION) * nextCount);
+                command->prepareMemoryRegions.transitions = transitions;
+                command->prepareMemoryRegions.transitionCount = count + nextCount;
+            }
+
+            nextCommand->type = CMD_NONE;
+        }
+    }
+}
+
+static bool isDrawCommand(
+    const GrCmdStreamCommand* command)
+{
+    return command->type == CMD_DRAW || command->type == CMD_DRAW_INDEXED;
+}
+
+static bool isClearCommand(
+    const GrCmdStreamCommand* command)
+{
+    return command->type >= CMD_CLEAR_COLOR_IMAGE && command->type <= CMD_CLEAR_DEPTH_STENCIL;
+}
+
+static GR_IMAGE getClearedImage(
+    const GrCmdStreamCommand* command)
+{
+    return command->type == CMD_CLEAR_DEPTH_STENCIL ? command->clearDepthStencil.image :
+                                                      command->clearColorImage.image;
+}
+
+static void getColorTargetViews(
+    const GrColorTargetView** colorTargetViews,
+    const GrCmdStreamCommand* command)
+{
+    for (unsigned i = 0; i < GR_MAX_COLOR_TARGETS; i++) {
+        colorTargetViews[i] = i < command->bindTargets.colorTargetCount ?
+                              (GrColorTargetView*)command->bindTargets.colorTargets[i].view : NULL;
+    }
+}
+
+static bool hasSameRenderPassFormats(
+    const GrRenderPassKey* key,
+    const GrRenderPassKey* otherKey)
+{
+    return memcmp(key->colorFormats, otherKey->colorFormats, sizeof(key->colorFormats)) == 0 &&
+           key->depthStencilFormat == otherKey->depthStencilFormat &&
+           key->depthStencilAspects == otherKey->depthStencilAspects;
+}
+
+// Whether the clear covers exactly the subresources of the view
+static bool isViewCleared(
+    const GrColorTargetView* grColorTargetView,
+    const GrCmdStreamCommand* command)
+{
+    const GrImage* grImage = grColorTargetView->grImage;
+
+    if (command->clearColorImage.rangeCount != 1) {
+        return false;
+    }
+
+    const GR_IMAGE_SUBRESOURCE_RANGE* range = &command->clearColorImage.ranges[0];
+    unsigned mipEnd = range->mipLevels == GR_LAST_MIP_OR_SLICE ?
+                      grImage->mipLevels : range->baseMipLevel + range->mipLevels;
+    unsigned sliceEnd = range->arraySize == GR_LAST_MIP_OR_SLICE ?
+                        grImage->layerCount : range->baseArraySlice + range->arraySize;
+
+    return range->aspect == GR_IMAGE_ASPECT_COLOR &&
+           range->baseMipLevel == grColorTargetView->mipLevel &&
+           mipEnd == grColorTargetView->mipLevel + 1 &&
+           range->baseArraySlice == grColorTargetView->baseArraySlice &&
+           sliceEnd == grColorTargetView->baseArraySlice + grColorTargetView->layerCount;
+}
+
+// Turns the clear into a load op of the render pass begun by the next draw. Only binds, barriers
+// and clears of other images may come in between, and the draw has to render to the whole view.
+static bool foldClearIntoRenderPass(
+    GrCmdBuffer* grCmdBuffer,
+    const GrCmdStreamCommand* command)
+{
+    const GrCmdStream* grCmdStream = &grCmdBuffer->cmdStream;
+    const GrPipeline* grPipeline = grCmdBuffer->grPipeline;
+    const GrColorTargetView* colorTargetViews[GR_MAX_COLOR_TARGETS];
+    const GrCmdStreamCommand* drawCommand = NULL;
+
+    if (grCmdBuffer->loadOpClearCount == GR_MAX_COLOR_TARGETS) {
+        return false;
+    }
+
+    memcpy(colorTargetViews, grCmdBuffer->colorTargetViews, sizeof(colorTargetViews));
+
+    for (unsigned i = grCmdStream->translateIndex + 1; i < grCmdStream->commandCount; i++) {
+        const GrCmdStreamCommand* nextCommand = &grCmdStream->commands[i];
+
+        if (nextCommand->type == CMD_BIND_PIPELINE &&
+            nextCommand->bindPipeline.bindPoint == GR_PIPELINE_BIND_POINT_GRAPHICS) {
+            grPipeline = (GrPipeline*)nextCommand->bindPipeline.pipeline;
+        } else if (nextCommand->type == CMD_BIND_TARGETS) {
+            getColorTargetViews(colorTargetViews, nextCommand);
+        } else if (isDrawCommand(nextCommand)) {
+            drawCommand = nextCommand;
+            break;
+        } else if (isClearCommand(nextCommand)) {
+            if (getClearedImage(nextCommand) == command->clearColorImage.image) {
+                break;
+            }
+        } else if (nextCommand->type != CMD_NONE && !isBindCommand(nextCommand) &&
+                   nextCommand->type != CMD_PREPARE_IMAGES &&
+                   nextCommand->type != CMD_PREPARE_MEMORY_REGIONS) {
+            break;
+        }
+    }
+
+    if (drawCommand == NULL || grPipeline == NULL) {
+        return false;
+    }
+
+    // The render area is limited to the smallest target
+    const GrColorTargetView* clearedView = NULL;
+    VkExtent2D minExtent = { UINT32_MAX, UINT32_MAX };
+    uint32_t minLayerCount = UINT32_MAX;
+
+    for (unsigned i = 0; i < GR_MAX_COLOR_TARGETS; i++) {
+        const GrColorTargetView* grColorTargetView = colorTargetViews[i];
+
+        if (grColorTargetView == NULL) {
+            continue;
+        }
+
+        minExtent.width = MIN(minExtent.width, grColorTargetView->extent.width);
+        minExtent.height = MIN(minExtent.height, grColorTargetView->extent.height);
+        minLayerCount = MIN(minLayerCount, grColorTargetView->layerCount);
+
+        if ((GR_IMAGE)grColorTargetView->grImage == command->clearColorImage.image &&
+            grPipeline->renderPassKey.colorFormats[i] != VK_FORMAT_UNDEFINED &&
+            isViewCleared(grColorTargetView, command)) {
+            clearedView = grColorTargetView;
+        }
+    }
+
+    if (clearedView == NULL || clearedView->extent.width != minExtent.width ||
+        clearedView->extent.height != minExtent.height ||
+        clearedView->layerCount != minLayerCount) {
+        return false;
+    }
+
+    // The draw has to begin a new render pass
+    endRenderPass(grCmdBuffer);
+
+    unsigned index = grCmdBuffer->loadOpClearCount;
+    grCmdBuffer->loadOpClearViews[index] = clearedView;
+    memcpy(grCmdBuffer->loadOpClearColors[index].float32, command->clearColorImage.color,
+           sizeof(command->clearColorImage.color));
+    grCmdBuffer->loadOpClearCount++;
+    return true;
+}
+
+static void translateCommand(
+    GrCmdBuffer* grCmdBuffer,
+    const GrCmdStreamCommand* command)
+{
+    GR_CMD_BUFFER cmdBuffer = (GR_CMD_BUFFER)grCmdBuffer;
+
+    switch (command->type) {
+    case CMD_NONE:
+        break;
+    case CMD_BIND_PIPELINE:
+        grCmdBindPipeline(cmdBuffer, command->bindPipeline.bindPoint,
+                          command->bindPipeline.pipeline);
+        break;
+    case CMD_BIND_STATE_OBJECT:
+        grCmdBindStateObject(cmdBuffer, command->bindStateObject.bindPoint,
+                             command->bindStateObject.state);
+        break;
+    case CMD_BIND_DESCRIPTOR_SET:
+        grCmdBindDescriptorSet(cmdBuffer, command->bindDescriptorSet.bindPoint,
+                               command->bindDescriptorSet.index,
+                               command->bindDescriptorSet.descriptorSet,
+                               command->bindDescriptorSet.slotOffset);
+        break;
+    case CMD_BIND_DYNAMIC_MEMORY_VIEW:
+        grCmdBindDynamicMemoryView(cmdBuffer, command->bindDynamicMemoryView.bindPoint,
+                                   &command->bindDynamicMemoryView.memView);
+        break;
+    case CMD_BIND_TARGETS:
+        grCmdBindTargets(cmdBuffer, command->bindTargets.colorTargetCount,
+                         command->bindTargets.colorTargets, command->bindTargets.depthTarget);
+        break;
+    case CMD_PREPARE_MEMORY_REGIONS:
+        grCmdPrepareMemoryRegions(cmdBuffer, command->prepareMemoryRegions.transitionCount,
+                                  command->prepareMemoryRegions.transitions);
+        break;
+    case CMD_PREPARE_IMAGES:
+        grCmdPrepareImages(cmdBuffer, command->prepareImages.transitionCount,
+                           command->prepareImages.transitions);
+        break;
+    case CMD_DRAW:
+        grCmdDraw(cmdBuffer, command->draw.firstVertex, command->draw.vertexCount,
+                  command->draw.firstInstance, command->draw.instanceCount);
+        break;
+    case CMD_DRAW_INDEXED:
+        grCmdDrawIndexed(cmdBuffer, command->drawIndexed.firstIndex,
+                         command->drawIndexed.indexCount, command->drawIndexed.vertexOffset,
+                         command->drawIndexed.firstInstance, command->drawIndexed.instanceCount);
+        break;
+    case CMD_DISPATCH:
+        grCmdDispatch(cmdBuffer, command->dispatch.x, command->dispatch.y, command->dispatch.z);
+        break;
+    case CMD_DISPATCH_INDIRECT:
+        grCmdDispatchIndirect(cmdBuffer, command->dispatchIndirect.mem,
+                              command->dispatchIndirect.offset);
+        break;
+    case CMD_CLEAR_COLOR_IMAGE:
+        if (foldClearIntoRenderPass(grCmdBuffer, command)) {
+            LOGV("folded clear of %p into a render pass\n", command->clearColorImage.image);
+            break;
+        }
+        grCmdClearColorImage(cmdBuffer, command->clearColorImage.image,
+                             command->clearColorImage.color, command->clearColorImage.rangeCount,
+                             command->clearColorImage.ranges);
+        break;
+    case CMD_CLEAR_COLOR_IMAGE_RAW:
+        grCmdClearColorImageRaw(cmdBuffer, command->clearColorImage.image,
+                                command->clearColorImage.rawColor,
+                                command->clearColorImage.rangeCount,
+                                command->clearColorImage.ranges);
+        break;
+    case CMD_CLEAR_DEPTH_STENCIL:
+        grCmdClearDepthStencil(cmdBuffer, command->clearDepthStencil.image,
+                               command->clearDepthStencil.depth, command->clearDepthStencil.stencil,
+                               command->clearDepthStencil.rangeCount,
+                               command->clearDepthStencil.ranges);
+        break;
+    }
+}
+
+// Returns the end of the binds and draws starting at the given command that fit in one render pass
+static unsigned findDrawRun(
+    const GrCmdStream* grCmdStream,
+    unsigned start,
+    GrPipeline* grPipeline,
+    GrPipeline** pRunPipeline,
+    unsigned* pDrawCount)
+{
+    GrPipeline* runPipeline = NULL;
+    unsigned end = start;
+    unsigned drawCount = 0;
+
+    for (unsigned i = start; i < grCmdStream->commandCount; i++) {
+        const GrCmdStreamCommand* command = &grCmdStream->commands[i];
+
+        if (command->type == CMD_BIND_PIPELINE &&
+            command->bindPipeline.bindPoint == GR_PIPELINE_BIND_POINT_GRAPHICS) {
+            grPipeline = (GrPipeline*)command->bindPipeline.pipeline;
+        } else if (isDrawCommand(command)) {
+            if (grPipeline == NULL) {
+                break;
+            } else if (runPipeline == NULL) {
+                runPipeline = grPipeline;
+            } else if (memcmp(&grPipeline->renderPassKey, &runPipeline->renderPassKey,
+                              sizeof(GrRenderPassKey)) != 0) {
+                break;
+            }
+
+            drawCount++;
+            end = i + 1;
+        } else if (command->type != CMD_NONE &&
+                   (!isBindCommand(command) || command->type == CMD_BIND_TARGETS)) {
+            break;
+        }
+    }
+
+    *pRunPipeline = runPipeline;
+    *pDrawCount = drawCount;
+    return end;
+}
+
+static void applyBinds(
+    GrCmdBuffer* grCmdBuffer,
+    const GrCmdStreamCommand* commands,
+    unsigned commandCount)
+{
+    for (unsigned i = 0; i < commandCount; i++) {
+        if (isBindCommand(&commands[i])) {
+            translateCommand(grCmdBuffer, &commands[i]);
+        }
+    }
+}
+
+static void copyGraphicsState(
+    GrCmdBuffer* dst,
+    const GrCmdBuffer* src)
+{
+    dst->grPipeline = src->grPipeline;
+    dst->viewportState = src->viewportState;
+    dst->rasterState = src->rasterState;
+    dst->depthStencilState = src->depthStencilState;
+    dst->colorBlendState = src->colorBlendState;
+    memcpy(dst->graphicsDescriptorSets, src->graphicsDescriptorSets,
+           sizeof(dst->graphicsDescriptorSets));
+    memcpy(dst->graphicsDescriptorSetOffsets, src->graphicsDescriptorSetOffsets,
+           sizeof(dst->graphicsDescriptorSetOffsets));
+    dst->graphicsBufferInfo = src->graphicsBufferInfo;
+}
+
+// Everything has to be bound again, the Vulkan state doesn't carry over between command buffers
+static void invalidateState(
+    GrCmdBuffer* grCmdBuffer)
+{
+    grCmdBuffer->dirtyFlags |= DIRTY_GRAPHICS_PIPELINE | DIRTY_GRAPHICS_DESCRIPTOR_TABLE |
+                               DIRTY_GRAPHICS_DESCRIPTOR_SETS | DIRTY_COMPUTE_PIPELINE |
+                               DIRTY_COMPUTE_DESCRIPTOR_TABLE | DIRTY_COMPUTE_DESCRIPTOR_SETS |
+                               DIRTY_DYNAMIC_STATE;
+    if (grCmdBuffer->graphicsBufferInfo.mem != NULL) {
+        grCmdBuffer->dirtyFlags |= DIRTY_GRAPHICS_DYNAMIC_MEMORY_VIEW;
+    }
+    if (grCmdBuffer->computeBufferInfo.mem != NULL) {
+        grCmdBuffer->dirtyFlags |= DIRTY_COMPUTE_DYNAMIC_MEMORY_VIEW;
+    }
+    grCmdBuffer->dynamicState.validMask = 0;
+}
+
+static void translateChunk(
+    void* data)
+{
+    GrCmdStreamChunk* chunk = (GrCmdStreamChunk*)data;
+
+    for (unsigned i = 0; i < chunk->commandCount; i++) {
+        translateCommand(chunk->grCmdBuffer, &chunk->commands[i]);
+    }
+
+    if (vki.vkEndCommandBuffer(chunk->grCmdBuffer->commandBuffer) != VK_SUCCESS) {
+        LOGE("vkEndCommandBuffer failed\n");
+    }
+}
+
+// Splits the draw run into secondary command buffers recorded by the worker threads,
+// returns false if the run has to be translated inline instead
+static bool translateDrawRunInParallel(
+    GrCmdBuffer* grCmdBuffer,
+    GrPipeline* grPipeline,
+    const GrCmdStreamCommand* commands,
+    unsigned commandCount,
+    unsigned drawCount)
+{
+    GrWorkerPool* grWorkerPool = &grCmdBuffer->grDevice->translationWorkerPool;
+    GrCmdStreamChunk chunks[MAX_PARALLEL_CHUNKS];
+    VkCommandBuffer vkCommandBuffers[MAX_PARALLEL_CHUNKS];
+    GrWorkerBatch grWorkerBatch = { 0 };
+    unsigned chunkCount = MIN(MIN(drawCount / PARALLEL_CHUNK_MIN_DRAWS,
+                                  grWorkerPool->threadCount + 1), MAX_PARALLEL_CHUNKS);
+
+    if (chunkCount < 2 || !waitForPipeline(grPipeline)) {
+        return false;
+    }
+
+    // Split on draw boundaries, binds in between go to the chunk that needs them
+    unsigned start = 0;
+    unsigned drawIndex = 0;
+    for (unsigned i = 0; i < chunkCount; i++) {
+        unsigned chunkEnd = i + 1 == chunkCount ? drawCount : (drawCount * (i + 1)) / chunkCount;
+        unsigned end = start;
+
+        while (drawIndex < chunkEnd) {
+            if (isDrawCommand(&commands[end])) {
+                drawIndex++;
+            }
+            end++;
+        }
+
+        chunks[i] = (GrCmdStreamChunk) {
+            .grCmdBuffer = NULL,
+            .commands = &commands[start],
+            .commandCount = (i + 1 == chunkCount ? commandCount : end) - start,
+        };
+        start = end;
+    }
+
+    // Begin first so that nothing is fanned out when the draws would be skipped anyway
+    if (!beginRenderPass(grCmdBuffer, grPipeline, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS)) {
+        return false;
+    }
+
+    // Binds are CPU-only, so the state each chunk starts with is known up front
+    for (unsigned i = 0; i < chunkCount; i++) {
+        GrCmdBuffer* grSecondaryCmdBuffer = acquireSecondaryCmdBuffer(grCmdBuffer,
+                                                                      grPipeline->renderPass);
+        if (grSecondaryCmdBuffer == NULL) {
+            // Give back the chunks set up so far. The render pass still applies its clears,
+            // and the inline translation loads them.
+            for (unsigned j = 0; j < i; j++) {
+                vki.vkEndCommandBuffer(chunks[j].grCmdBuffer->commandBuffer);
+            }
+            grCmdBuffer->secondaryCmdBufferCount -= i;
+            endRenderPass(grCmdBuffer);
+            return false;
+        }
+
+        if (i == 0) {
+            copyGraphicsState(grSecondaryCmdBuffer, grCmdBuffer);
+        } else {
+            copyGraphicsState(grSecondaryCmdBuffer, chunks[i - 1].grCmdBuffer);
+            applyBinds(grSecondaryCmdBuffer, chunks[i - 1].commands, chunks[i - 1].commandCount);
+        }
+
+        grSecondaryCmdBuffer->hasActiveRenderPass = true;
+        grSecondaryCmdBuffer->renderPassKey = grPipeline->renderPassKey;
+        grSecondaryCmdBuffer->dirtyFlags = 0;
+        invalidateState(grSecondaryCmdBuffer);
+
+        chunks[i].grCmdBuffer = grSecondaryCmdBuffer;
+        vkCommandBuffers[i] = grSecondaryCmdBuffer->commandBuffer;
+    }
+
+    for (unsigned i = 0; i < chunkCount; i++) {
+        queueWorkerJob(grWorkerPool, &grWorkerBatch, translateChunk, &chunks[i]);
+    }
+    waitForWorkerBatch(grWorkerPool, &grWorkerBatch);
+
+    vki.vkCmdExecuteCommands(grCmdBuffer->commandBuffer, chunkCount, vkCommandBuffers);
+    endRenderPass(grCmdBuffer);
+
+    applyBinds(grCmdBuffer, commands, commandCount);
+    invalidateState(grCmdBuffer);
+
+    LOGV("translated %u draws in %u secondary command buffers\n", drawCount, chunkCount);
+    return true;
+}
+
+// Returns the targets stored by the draws from the one being translated on that can share its
+// render pass, so that switching to a pipeline writing more targets doesn't restart it
+uint32_t getCmdStreamColorStoreMask(
+    const GrCmdBuffer* grCmdBuffer,
+    const GrRenderPassKey* renderPassKey)
+{
+    const GrCmdStream* grCmdStream = &grCmdBuffer->cmdStream;
+    const GrPipeline* grPipeline = grCmdBuffer->grPipeline;
+    uint32_t storeMask = 0;
+
+    if (!grCmdStream->isTranslating) {
+        return 0;
+    }
+
+    for (unsigned i = grCmdStream->translateIndex; i < grCmdStream->commandCount; i++) {
+        const GrCmdStreamCommand* command = &grCmdStream->commands[i];
+
+        if (command->type == CMD_BIND_PIPELINE &&
+            command->bindPipeline.bindPoint == GR_PIPELINE_BIND_POINT_GRAPHICS) {
+            grPipeline = (GrPipeline*)command->bindPipeline.pipeline;
+        } else if (command->type == CMD_BIND_TARGETS) {
+            const GrColorTargetView* colorTargetViews[GR_MAX_COLOR_TARGETS];
+
+            getColorTargetViews(colorTargetViews, command);
+            if (memcmp(colorTargetViews, grCmdBuffer->colorTargetViews,
+                       sizeof(colorTargetViews)) != 0) {
+                break;
+            }
+        } else if (isDrawCommand(command)) {
+            if (grPipeline == NULL ||
+                !hasSameRenderPassFormats(&grPipeline->renderPassKey, renderPassKey)) {
+                break;
+            }
+            storeMask |= grPipeline->renderPassKey.colorStoreMask;
+        } else if (command->type != CMD_NONE && !isBindCommand(command)) {
+            break;
+        }
+    }
+
+    return storeMask;
+}
+
+void flushCmdStream(
+    GrCmdBuffer* grCmdBuffer)
+{
+    GrCmdStream* grCmdStream = &grCmdBuffer->cmdStream;
+
+    if (grCmdStream->commandCount == 0) {
+        return;
+    }
+
+    dropEmptyWork(grCmdStream);
+    dropUnusedState(grCmdStream);
+    mergeBarriers(grCmdStream);
+
+    // Commands before this one are known not to start a long enough draw run
+    unsigned inlineEnd = 0;
+
+    grCmdStream->isTranslating = true;
+    for (unsigned i = 0; i < grCmdStream->commandCount; i++) {
+        const GrCmdStreamCommand* command = &grCmdStream->commands[i];
+
+        if (command->type == CMD_NONE) {
+            continue;
+        }
+
+        grCmdStream->translateIndex = i;
+
+        if (grCmdBuffer->grDevice->translationWorkerPool.threadCount > 0 && i >= inlineEnd &&
+            (isBindCommand(command) || isDrawCommand(command))) {
+            GrPipeline* runPipeline = NULL;
+            unsigned drawCount = 0;
+            unsigned end = findDrawRun(grCmdStream, i, grCmdBuffer->grPipeline, &runPipeline,
+                                       &drawCount);
+
+            if (drawCount >= 2 * PARALLEL_CHUNK_MIN_DRAWS &&
+                translateDrawRunInParallel(grCmdBuffer, runPipeline, command, end - i,
+                                           drawCount)) {
+                for (; i < end; i++) {
+                    if (grCmdStream->commands[i].type != CMD_NONE) {
+                        grCmdStream->translatedCount++;
+                    }
+                }
+                i--;
+                continue;
+            }
+
+            inlineEnd = end;
+        }
+
+        translateCommand(grCmdBuffer, command);
+        grCmdStream->translatedCount++;
+
+        if (isDrawCommand(command)) {
+            // The draw was skipped without beginning the render pass
+            flushLoadOpClears(grCmdBuffer);
+        }
+    }
+    grCmdStream->isTranslating = false;
+
+    grCmdStream->recordedCount += grCmdStream->commandCount;
+    grCmdStream->commandCount = 0;
+
+    // Translated commands don't reference the arena anymore
+    for (GrCmdStreamBlock* block = grCmdStream->blocks; block != NULL; block = block->next) {
+        block->offset = 0;
+    }
+    grCmdStream->activeBlock = grCmdStream->blocks;
+}
+
+void resetCmdStream(
+    GrCmdStream* grCmdStream)
+{
+    // Pending commands belong to the discarded recording
+    for (GrCmdStreamBlock* block = grCmdStream->blocks; block != NULL; block = block->next) {
+        block->offset = 0;
+    }
+    grCmdStream->activeBlock = grCmdStream->blocks;
+    grCmdStream->translateIndex = 0;
+    grCmdStream->commandCount = 0;
+    grCmdStream->recordedCount = 0;
+    grCmdStream->translatedCount = 0;
+}
+
+void destroyCmdStream(
+    GrCmdStream* grCmdStream)
+{
+    GrCmdStreamBlock* block = grCmdStream->blocks;
+    while (block != NULL) {
+        GrCmdStreamBlock* next = block->next;
+
+        free(block);
+        block = next;
+    }
+    free(grCmdStream->commands);
+
+    *grCmdStream = (GrCmdStream) { 0 };
+}
+
+bool recordCmdBindPipeline(
+    GrCmdBuffer* grCmdBuffer,
+    GR_ENUM pipelineBindPoint,
+    GR_PIPELINE pipeline)
+{
+    if (!isDeferringCommands(grCmdBuffer)) {
+        return false;
+    }
+
+    GrCmdStreamCommand* command = addCommand(&grCmdBuffer->cmdStream, CMD_BIND_PIPELINE);
+    command->bindPipeline.bindPoint = pipelineBindPoint;
+    command->bindPipeline.pipeline = pipeline;
+    return true;
+}
+
+bool recordCmdBindStateObject(
+    GrCmdBuffer* grCmdBuffer,
+    GR_ENUM stateBindPoint,
+    GR_STATE_OBJECT state)
+{
+    if (!isDeferringCommands(grCmdBuffer)) {
+        return false;
+    }
+
+    GrCmdStreamCommand* command = addCommand(&grCmdBuffer->cmdStream, CMD_BIND_STATE_OBJECT);
+    command->bindStateObject.bindPoint = stateBindPoint;
+    command->bindStateObject.state = state;
+    return true;
+}
+
+bool recordCmdBindDescriptorSet(
+    GrCmdBuffer* grCmdBuffer,
+    GR_ENUM pipelineBindPoint,
+    GR_UINT index,
+    GR_DESCRIPTOR_SET descriptorSet,
+    GR_UINT slotOffset)
+{
+    if (!isDeferringCommands(grCmdBuffer)) {
+        return false;
+    }
+
+    GrCmdStreamCommand* command = addCommand(&grCmdBuffer->cmdStream, CMD_BIND_DESCRIPTOR_SET);
+    command->bindDescriptorSet.bindPoint = pipelineBindPoint;
+    command->bindDescriptorSet.index = index;
+    command->bindDescriptorSet.descriptorSet = descriptorSet;
+    command->bindDescriptorSet.slotOffset = slotOffset;
+    return true;
+}
+
+bool recordCmdBindDynamicMemoryView(
+    GrCmdBuffer* grCmdBuffer,
+    GR_ENUM pipelineBindPoint,
+    const GR_MEMORY_VIEW_ATTACH_INFO* pMemView)
+{
+    if (!isDeferringCommands(grCmdBuffer)) {
+        return false;
+    }
+
+    GrCmdStreamCommand* command = addCommand(&grCmdBuffer->cmdStream,
+                                             CMD_BIND_DYNAMIC_MEMORY_VIEW);
+    command->bindDynamicMemoryView.bindPoint = pipelineBindPoint;
+    command->bindDynamicMemoryView.memView = *pMemView;
+    return true;
+}
+
+bool recordCmdBindTargets(
+    GrCmdBuffer* grCmdBuffer,
+    GR_UINT colorTargetCount,
+    const GR_COLOR_TARGET_BIND_INFO* pColorTargets,
+    const GR_DEPTH_STENCIL_BIND_INFO* pDepthTarget)
+{
+    if (!isDeferringCommands(grCmdBuffer)) {
+        return false;
+    }
+
+    GrCmdStream* grCmdStream = &grCmdBuffer->cmdStream;
+    GrCmdStreamCommand* command = addCommand(grCmdStream, CMD_BIND_TARGETS);
+    command->bindTargets.colorTargetCount = colorTargetCount;
+    command->bindTargets.colorTargets =
+        copyCommandData(grCmdStream, pColorTargets,
+                        sizeof(GR_COLOR_TARGET_BIND_INFO) * colorTargetCount);
+    command->bindTargets.depthTarget =
+        copyCommandData(grCmdStream, pDepthTarget, sizeof(GR_DEPTH_STENCIL_BIND_INFO));
+    return true;
+}
+
+bool recordCmdPrepareMemoryRegions(
+    GrCmdBuffer* grCmdBuffer,
+    GR_UINT transitionCount,
+    const GR_MEMORY_STATE_TRANSITION* pStateTransitions)
+{
+    if (!isDeferringCommands(grCmdBuffer)) {
+        return false;
+    }
+
+    GrCmdStream* grCmdStream = &grCmdBuffer->cmdStream;
+    GrCmdStreamCommand* command = addCommand(grCmdStream, CMD_PREPARE_MEMORY_REGIONS);
+    command->prepareMemoryRegions.transitionCount = transitionCount;
+    command->prepareMemoryRegions.transitions =
+        copyCommandData(grCmdStream, pStateTransitions,
+                        sizeof(GR_MEMORY_STATE_TRANSITION) * transitionCount);
+    return true;
+}
+
+bool recordCmdPrepareImages(
+    GrCmdBuffer* grCmdBuffer,
+    GR_UINT transitionCount,
+    const GR_IMAGE_STATE_TRANSITION* pStateTransitions)
+{
+    if (!isDeferringCommands(grCmdBuffer)) {
+        return false;
+    }
+
+    GrCmdStream* grCmdStream = &grCmdBuffer->cmdStream;
+    GrCmdStreamCommand* command = addCommand(grCmdStream, CMD_PREPARE_IMAGES);
+    command->prepareImages.transitionCount = transitionCount;
+    command->prepareImages.transitions =
+        copyCommandData(grCmdStream, pStateTransitions,
+                        sizeof(GR_IMAGE_STATE_TRANSITION) * transitionCount);
+    return true;
+}
+
+bool recordCmdDraw(
+    GrCmdBuffer* grCmdBuffer,
+    GR_UINT firstVertex,
+    GR_UINT vertexCount,
+    GR_UINT firstInstance,
+    GR_UINT instanceCount)
+{
+    if (!isDeferringCommands(grCmdBuffer)) {
+        return false;
+    }
+
+    GrCmdStreamCommand* command = addCommand(&grCmdBuffer->cmdStream, CMD_DRAW);
+    command->draw.firstVertex = firstVertex;
+    command->draw.vertexCount = vertexCount;
+    command->draw.firstInstance = firstInstance;
+    command->draw.instanceCount = instanceCount;
+    return true;
+}
+
+bool recordCmdDrawIndexed(
+    GrCmdBuffer* grCmdBuffer,
+    GR_UINT firstIndex,
+    GR_UINT indexCount,
+    GR_INT vertexOffset,
+    GR_UINT firstInstance,
+    GR_UINT instanceCount)
+{
+    if (!isDeferringCommands(grCmdBuffer)) {
+        return false;
+    }
+
+    GrCmdStreamCommand* command = addCommand(&grCmdBuffer->cmdStream, CMD_DRAW_INDEXED);
+    command->drawIndexed.firstIndex = firstIndex;
+    command->drawIndexed.indexCount = indexCount;
+    command->drawIndexed.vertexOffset = vertexOffset;
+    command->drawIndexed.firstInstance = firstInstance;
+    command->drawIndexed.instanceCount = instanceCount;
+    return true;
+}
+
+bool recordCmdDispatch(
+    GrCmdBuffer* grCmdBuffer,
+    GR_UINT x,
+    GR_UINT y,
+    GR_UINT z)
+{
+    if (!isDeferringCommands(grCmdBuffer)) {
+        return false;
+    }
+
+    GrCmdStreamCommand* command = addCommand(&grCmdBuffer->cmdStream, CMD_DISPATCH);
+    command->dispatch.x = x;
+    command->dispatch.y = y;
+    command->dispatch.z = z;
+    return true;
+}
+
+bool recordCmdDispatchIndirect(
+    GrCmdBuffer* grCmdBuffer,
+    GR_GPU_MEMORY mem,
+    GR_GPU_SIZE offset)
+{
+    if (!isDeferringCommands(grCmdBuffer)) {
+        return false;
+    }
+
+    GrCmdStreamCommand* command = addCommand(&grCmdBuffer->cmdStream, CMD_DISPATCH_INDIRECT);
+    command->dispatchIndirect.mem = mem;
+    command->dispatchIndirect.offset = offset;
+    return true;
+}
+
+bool recordCmdClearColorImage(
+    GrCmdBuffer* grCmdBuffer,
+    GR_IMAGE image,
+    const GR_FLOAT color[4],
+    GR_UINT rangeCount,
+    const GR_IMAGE_SUBRESOURCE_RANGE* pRanges)
+{
+    if (!isDeferringCommands(grCmdBuffer)) {
+        return false;
+    }
+
+    GrCmdStream* grCmdStream = &grCmdBuffer->cmdStream;
+    GrCmdStreamCommand* command = addCommand(grCmdStream, CMD_CLEAR_COLOR_IMAGE);
+    command->clearColorImage.image = image;
+    memcpy(command->clearColorImage.color, color, sizeof(command->clearColorImage.color));
+    command->clearColorImage.rangeCount = rangeCount;
+    command->clearColorImage.ranges =
+        copyCommandData(grCmdStream, pRanges, sizeof(GR_IMAGE_SUBRESOURCE_RANGE) * rangeCount);
+    return true;
+}
+
+bool recordCmdClearColorImageRaw(
+    GrCmdBuffer* grCmdBuffer,
+    GR_IMAGE image,
+    const GR_UINT32 color[4],
+    GR_UINT rangeCount,
+    const GR_IMAGE_SUBRESOURCE_RANGE* pRanges)
+{
+    if (!isDeferringCommands(grCmdBuffer)) {
+        return false;
+    }
+
+    GrCmdStream* grCmdStream = &grCmdBuffer->cmdStream;
+    GrCmdStreamCommand* command = addCommand(grCmdStream, CMD_CLEAR_COLOR_IMAGE_RAW);
+    command->clearColorImage.image = image;
+    memcpy(command->clearColorImage.rawColor, color, sizeof(command->clearColorImage.rawColor));
+    command->clearColorImage.rangeCount = rangeCount;
+    command->clearColorImage.ranges =
+        copyCommandData(grCmdStream, pRanges, sizeof(GR_IMAGE_SUBRESOURCE_RANGE) * rangeCount);
+    return true;
+}
+
+bool recordCmdClearDepthStencil(
+    GrCmdBuffer* grCmdBuffer,
+    GR_IMAGE image,
+    GR_FLOAT depth,
+    GR_UINT8 stencil,
+    GR_UINT rangeCount,
+    const GR_IMAGE_SUBRESOURCE_RANGE* pRanges)
+{
+    if (!isDeferringCommands(grCmdBuffer)) {
+        return false;
+    }
+
+    GrCmdStream* grCmdStream = &grCmdBuffer->cmdStream;
+    GrCmdStreamCommand* command = addCommand(grCmdStream, CMD_CLEAR_DEPTH_STENCIL);
+    command->clearDepthStencil.image = image;
+    command->clearDepthStencil.depth = depth;
+    command->clearDepthStencil.stencil = stencil;
+    command->clearDepthStencil.rangeCount = rangeCount;
+    command->clearDepthStencil.ranges =
+        copyCommandData(grCmdStream, pRanges, sizeof(GR_IMAGE_SUBRESOURCE_RANGE) * rangeCount);
+    return true;
+}
@@ -0,0 +1,261 @@
+#include "mantle_internal.h"
+
+static uint32_t hashKey(
+    const void* key,
+    unsigned size)
+{
+    const uint8_t* bytes = (const uint8_t*)key;
+    uint32_t hash = 2166136261u; // FNV-1a
+
+    for (unsigned i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static VkFramebuffer createFramebuffer(
+    VkDevice device,
+    VkRenderPass renderPass,
+    const GrFramebufferKey* key)
+{
+    VkFramebuffer framebuffer = VK_NULL_HANDLE;
+    VkFramebufferAttachmentImageInfo imageInfos[GR_MAX_COLOR_TARGETS + 1];
+    const void* next = NULL;
+    VkFramebufferAttachmentsCreateInfo attachmentsCreateInfo;
+
+    if ((key->flags & VK_FRAMEBUFFER_CREATE_IMAGELESS_BIT) != 0) {
+        for (unsigned i = 0; i < key->attachmentCount; i++) {
+            const GrFramebufferAttachment* attachment = &key->attachmentInfos[i];
+
+            imageInfos[i] = (VkFramebufferAttachmentImageInfo) {
+                .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_ATTACHMENT_IMAGE_INFO,
+                .pNext = NULL,
+                .flags = 0,
+                .usage = attachment->usage,
+                .width = attachment->width,
+                .height = attachment->height,
+                .layerCount = attachment->layerCount,
+                .viewFormatCount = attachment->viewFormatCount,
+                .pViewFormats = &attachment->format,
+            };
+        }
+
+        attachmentsCreateInfo = (VkFramebufferAttachmentsCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_ATTACHMENTS_CREATE_INFO,
+            .pNext = NULL,
+            .attachmentImageInfoCount = key->attachmentCount,
+            .pAttachmentImageInfos = imageInfos,
+        };
+        next = &attachmentsCreateInfo;
+    }
+
+    const VkFramebufferCreateInfo framebufferCreateInfo = {
+        .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+        .pNext = next,
+        .flags = key->flags,
+        .renderPass = renderPass,
+        .attachmentCount = key->attachmentCount,
+        .pAttachments = next != NULL ? NULL : key->attachments,
+        .width = key->width,
+        .height = key->height,
+        .layers = key->layerCount,
+    };
+
+    if (vki.vkCreateFramebuffer(device, &framebufferCreateInfo, NULL,
+                                &framebuffer) != VK_SUCCESS) {
+        LOGE("vkCreateFramebuffer failed\n");
+        return VK_NULL_HANDLE;
+    }
+
+    return framebuffer;
+}
+
+static GrFramebuffer* findFramebuffer(
+    GrFramebufferCache* grFramebufferCache,
+    const GrFramebufferKey* key,
+    uint32_t hash)
+{
+    GrFramebuffer* entry = grFramebufferCache->buckets[hash % FRAMEBUFFER_BUCKET_COUNT];
+
+    while (entry != NULL) {
+        if (entry->hash == hash && memcmp(&entry->key, key, sizeof(GrFramebufferKey)) == 0) {
+            return entry;
+        }
+        entry = entry->next;
+    }
+    return NULL;
+}
+
+static void touchFramebuffer(
+    GrFramebufferCache* grFramebufferCache,
+    GrFramebuffer* entry)
+{
+    InterlockedIncrement(&entry->refCount);
+    InterlockedExchange(&entry->lastUse, InterlockedIncrement(&grFramebufferCache->useCounter));
+}
+
+// Expects the cache to be locked exclusively, drops the reference held by the cache
+static void unlinkFramebuffer(
+    GrFramebufferCache* grFramebufferCache,
+    VkDevice device,
+    GrFramebuffer** entryPtr)
+{
+    GrFramebuffer* entry = *entryPtr;
+
+    *entryPtr = entry->next;
+    grFramebufferCache->entryCount--;
+    releaseFramebuffer(entry, device);
+}
+
+static void evictFramebuffer(
+    GrFramebufferCache* grFramebufferCache,
+    VkDevice device)
+{
+    GrFramebuffer** oldestEntryPtr = NULL;
+    uint32_t oldestAge = 0;
+
+    for (unsigned i = 0; i < FRAMEBUFFER_BUCKET_COUNT; i++) {
+        for (GrFramebuffer** entryPtr = &grFramebufferCache->buckets[i]; *entryPtr != NULL;
+             entryPtr = &(*entryPtr)->next) {
+            // Unsigned difference, the counter is allowed to wrap around
+            uint32_t age = (uint32_t)grFramebufferCache->useCounter -
+                           (uint32_t)(*entryPtr)->lastUse;
+
+            if (oldestEntryPtr == NULL || age > oldestAge) {
+                oldestEntryPtr = entryPtr;
+                oldestAge = age;
+            }
+        }
+    }
+
+    if (oldestEntryPtr != NULL) {
+        unlinkFramebuffer(grFramebufferCache, device, oldestEntryPtr);
+    }
+}
+
+// The returned framebuffer stays valid until it's released, even if it gets evicted meanwhile.
+// The key holds the render pass key rather than the handle, so that any compatible render pass
+// can reuse the framebuffer regardless of the pipeline it came from.
+GrFramebuffer* acquireFramebuffer(
+    GrFramebufferCache* grFramebufferCache,
+    VkDevice device,
+    VkRenderPass renderPass,
+    const GrFramebufferKey* key)
+{
+    uint32_t hash = hashKey(key, sizeof(GrFramebufferKey));
+
+    AcquireSRWLockShared(&grFramebufferCache->lock);
+
+    GrFramebuffer* entry = findFramebuffer(grFramebufferCache, key, hash);
+    if (entry != NULL) {
+        touchFramebuffer(grFramebufferCache, entry);
+    }
+
+    ReleaseSRWLockShared(&grFramebufferCache->lock);
+
+    if (entry != NULL) {
+        return entry;
+    }
+
+    VkFramebuffer framebuffer = createFramebuffer(device, renderPass, key);
+    if (framebuffer == VK_NULL_HANDLE) {
+        return NULL;
+    }
+
+    AcquireSRWLockExclusive(&grFramebufferCache->lock);
+
+    // Another thread may have inserted the same framebuffer in the meantime
+    entry = findFramebuffer(grFramebufferCache, key, hash);
+    if (entry != NULL) {
+        touchFramebuffer(grFramebufferCache, entry);
+        ReleaseSRWLockExclusive(&grFramebufferCache->lock);
+
+        vki.vkDestroyFramebuffer(device, framebuffer, NULL);
+        return entry;
+    }
+
+    if (grFramebufferCache->entryCount >= FRAMEBUFFER_CACHE_CAPACITY) {
+        evictFramebuffer(grFramebufferCache, device);
+    }
+
+    unsigned bucket = hash % FRAMEBUFFER_BUCKET_COUNT;
+
+    entry = malloc(sizeof(GrFramebuffer));
+    *entry = (GrFramebuffer) {
+        .key = *key,
+        .hash = hash,
+        .framebuffer = framebuffer,
+        .refCount = 2, // Cache and caller
+        .lastUse = InterlockedIncrement(&grFramebufferCache->useCounter),
+        .next = grFramebufferCache->buckets[bucket],
+    };
+    grFramebufferCache->buckets[bucket] = entry;
+    grFramebufferCache->entryCount++;
+
+    ReleaseSRWLockExclusive(&grFramebufferCache->lock);
+
+    return entry;
+}
+
+void releaseFramebuffer(
+    GrFramebuffer* grFramebuffer,
+    VkDevice device)
+{
+    if (InterlockedDecrement(&grFramebuffer->refCount) == 0) {
+        vki.vkDestroyFramebuffer(device, grFramebuffer->framebuffer, NULL);
+        free(grFramebuffer);
+    }
+}
+
+// Called when a view gets destroyed, framebuffers using it can never be hit again
+void invalidateFramebuffers(
+    GrFramebufferCache* grFramebufferCache,
+    VkDevice device,
+    VkImageView imageView)
+{
+    AcquireSRWLockExclusive(&grFramebufferCache->lock);
+
+    for (unsigned i = 0; i < FRAMEBUFFER_BUCKET_COUNT; i++) {
+        GrFramebuffer** entryPtr = &grFramebufferCache->buckets[i];
+
+        while (*entryPtr != NULL) {
+            const GrFramebufferKey* key = &(*entryPtr)->key;
+            bool usesView = false;
+
+            for (unsigned j = 0; j < key->attachmentCount; j++) {
+                if (key->attachments[j] == imageView) {
+                    usesView = true;
+                    break;
+                }
+            }
+
+            if (usesView) {
+                unlinkFramebuffer(grFramebufferCache, device, entryPtr);
+            } else {
+                entryPtr = &(*entryPtr)->next;
+            }
+        }
+    }
+
+    ReleaseSRWLockExclusive(&grFramebufferCache->lock);
+}
+
+void destroyFramebufferCache(
+    GrFramebufferCache* grFramebufferCache,
+    VkDevice device)
+{
+    // Command buffers can't outlive the device, ignore their references
+    for (unsigned i = 0; i < FRAMEBUFFER_BUCKET_COUNT; i++) {
+        GrFramebuffer* entry = grFramebufferCache->buckets[i];
+
+        while (entry != NULL) {
+            GrFramebuffer* next = entry->next;
+
+            vki.vkDestroyFramebuffer(device, entry->framebuffer, NULL);
+            free(entry);
+            entry = next;
+        }
+        grFramebufferCache->buckets[i] = NULL;
+    }
+    grFramebufferCache->entryCount = 0;
+}
@@ -33,9 +33,17 @@ GR_RESULT grCreateImage(
     if ((pCreateInfo->usage & (GR_IMAGE_USAGE_COLOR_TARGET | GR_IMAGE_USAGE_DEPTH_STENCIL)) == (GR_IMAGE_USAGE_COLOR_TARGET | GR_IMAGE_USAGE_DEPTH_STENCIL)) {
         return GR_ERROR_INVALID_FLAGS;
     }
+    const VkFormat viewFormat = getVkFormat(pCreateInfo->format);
+    // Imageless framebuffers describe the attachments with the view formats of their images
+    const VkImageFormatListCreateInfo formatListCreateInfo = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_FORMAT_LIST_CREATE_INFO,
+        .pNext = NULL,
+        .viewFormatCount = 1,
+        .pViewFormats = &viewFormat,
+    };
     const VkImageCreateInfo createInfo = {
         .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
-        .pNext = NULL,
+        .pNext = grDevice->imagelessFramebufferSupported ? &formatListCreateInfo : NULL,
         .flags = 0,//TODO: add flags
         .imageType = getImageType(pCreateInfo->imageType),
         .format = getVkFormat(pCreateInfo->format),
@@ -87,6 +95,11 @@ GR_RESULT grCreateImage(
         },
         .layerCount = pCreateInfo->arraySize,
         .format = createInfo.format,
+        .usage = createInfo.usage,
+        .mipLevels = createInfo.mipLevels,
+        .subresourceStates = NULL,
+        .viewFormatCount = grDevice->imagelessFramebufferSupported ?
+                           formatListCreateInfo.viewFormatCount : 0,
     };
     *pImage = (GR_IMAGE)grImage;
     return GR_SUCCESS;
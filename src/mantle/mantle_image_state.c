@@ -0,0 +1,357 @@
+#include "mantle_internal.h"
+
+static unsigned getSubresourceCount(
+    const GrImage* grImage)
+{
+    // Stencil gets its own plane
+    return 2 * grImage->mipLevels * grImage->layerCount;
+}
+
+static unsigned getSubresourceIndex(
+    const GrImage* grImage,
+    unsigned plane,
+    unsigned mipLevel,
+    unsigned arraySlice)
+{
+    return (plane * grImage->mipLevels + mipLevel) * grImage->layerCount + arraySlice;
+}
+
+static bool isReadOnlyState(
+    GR_IMAGE_STATE imageState)
+{
+    const VkAccessFlags writeAccessMask = VK_ACCESS_SHADER_WRITE_BIT |
+                                          VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+                                          VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+                                          VK_ACCESS_TRANSFER_WRITE_BIT |
+                                          VK_ACCESS_HOST_WRITE_BIT;
+
+    return imageState != GR_IMAGE_STATE_UNINITIALIZED && imageState != GR_IMAGE_STATE_DISCARD &&
+           (getVkAccessFlagsImage(imageState) & writeAccessMask) == 0;
+}
+
+static unsigned getImageHash(
+    const GrImage* grImage)
+{
+    // Fibonacci hashing, allocations are aligned so the low bits are mostly zero
+    return (unsigned)(((uintptr_t)grImage >> 4) * 2654435769u);
+}
+
+static void insertImageStateTableEntry(
+    GrCmdBuffer* grCmdBuffer,
+    unsigned trackerIndex)
+{
+    unsigned mask = grCmdBuffer->imageStateTableSize - 1;
+    unsigned i = getImageHash(grCmdBuffer->imageStateTrackers[trackerIndex].grImage) & mask;
+
+    while (grCmdBuffer->imageStateTable[i] != 0) {
+        i = (i + 1) & mask;
+    }
+    grCmdBuffer->imageStateTable[i] = trackerIndex + 1;
+}
+
+static GrSubresourceState* getSubresourceStates(
+    GrCmdBuffer* grCmdBuffer,
+    GrImage* grImage)
+{
+    if (grCmdBuffer->imageStateTableSize > 0) {
+        unsigned mask = grCmdBuffer->imageStateTableSize - 1;
+
+        for (unsigned i = getImageHash(grImage) & mask; grCmdBuffer->imageStateTable[i] != 0;
+             i = (i + 1) & mask) {
+            GrImageStateTracker* tracker =
+                &grCmdBuffer->imageStateTrackers[grCmdBuffer->imageStateTable[i] - 1];
+
+            if (tracker->grImage == grImage) {
+                return tracker->subresourceStates;
+            }
+        }
+    }
+
+    unsigned count = grCmdBuffer->imageStateTrackerCount;
+    if (count == grCmdBuffer->imageStateTrackerCapacity) {
+        grCmdBuffer->imageStateTrackerCapacity = MAX(2 * count, 8);
+        grCmdBuffer->imageStateTrackers = realloc(grCmdBuffer->imageStateTrackers,
+                                                  sizeof(GrImageStateTracker) *
+                                                  grCmdBuffer->imageStateTrackerCapacity);
+        for (unsigned i = count; i < grCmdBuffer->imageStateTrackerCapacity; i++) {
+            grCmdBuffer->imageStateTrackers[i] = (GrImageStateTracker) {
+                .grImage = NULL,
+                .subresourceStates = NULL,
+                .subresourceCapacity = 0,
+            };
+        }
+    }
+
+    // Reuse the storage of trackers from previous recordings
+    GrImageStateTracker* tracker = &grCmdBuffer->imageStateTrackers[count];
+    unsigned subresourceCount = getSubresourceCount(grImage);
+    if (subresourceCount > tracker->subresourceCapacity) {
+        free(tracker->subresourceStates);
+        tracker->subresourceStates = malloc(sizeof(GrSubresourceState) * subresourceCount);
+        tracker->subresourceCapacity = subresourceCount;
+    }
+    memset(tracker->subresourceStates, 0, sizeof(GrSubresourceState) * subresourceCount);
+    tracker->grImage = grImage;
+    grCmdBuffer->imageStateTrackerCount++;
+
+    // Keep the load factor under 50%
+    if (2 * grCmdBuffer->imageStateTrackerCount > grCmdBuffer->imageStateTableSize) {
+        free(grCmdBuffer->imageStateTable);
+        grCmdBuffer->imageStateTableSize = MAX(2 * grCmdBuffer->imageStateTableSize, 64);
+        grCmdBuffer->imageStateTable = calloc(grCmdBuffer->imageStateTableSize, sizeof(unsigned));
+
+        for (unsigned i = 0; i < grCmdBuffer->imageStateTrackerCount; i++) {
+            insertImageStateTableEntry(grCmdBuffer, i);
+        }
+    } else {
+        insertImageStateTableEntry(grCmdBuffer, count);
+    }
+
+    return tracker->subresourceStates;
+}
+
+// Whether a barrier of the current batch already transitions part of the range
+static bool hasBatchedBarrier(
+    const GrCmdBuffer* grCmdBuffer,
+    const GrImage* grImage,
+    const GrSubresourceState* subresourceStates,
+    const GR_IMAGE_SUBRESOURCE_RANGE* range,
+    unsigned mipEnd,
+    unsigned sliceEnd)
+{
+    unsigned plane = range->aspect == GR_IMAGE_ASPECT_STENCIL ? 1 : 0;
+
+    for (unsigned mip = range->baseMipLevel; mip < mipEnd; mip++) {
+        for (unsigned slice = range->baseArraySlice; slice < sliceEnd; slice++) {
+            const GrSubresourceState* subresourceState =
+                &subresourceStates[getSubresourceIndex(grImage, plane, mip, slice)];
+
+            if (subresourceState->barrierBatch == grCmdBuffer->imageBarrierBatch) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+static void addImageBarrier(
+    GrCmdBuffer* grCmdBuffer,
+    unsigned* barrierCount,
+    const VkImageMemoryBarrier* barrier)
+{
+    if (*barrierCount > 0) {
+        VkImageMemoryBarrier* prev = &grCmdBuffer->imageBarriers[*barrierCount - 1];
+
+        // Merge with the same layers of the previous mip level
+        if (prev->image == barrier->image &&
+            prev->oldLayout == barrier->oldLayout && prev->newLayout == barrier->newLayout &&
+            prev->srcAccessMask == barrier->srcAccessMask &&
+            prev->dstAccessMask == barrier->dstAccessMask &&
+            prev->subresourceRange.aspectMask == barrier->subresourceRange.aspectMask &&
+            prev->subresourceRange.baseArrayLayer == barrier->subresourceRange.baseArrayLayer &&
+            prev->subresourceRange.layerCount == barrier->subresourceRange.layerCount &&
+            prev->subresourceRange.baseMipLevel + prev->subresourceRange.levelCount ==
+            barrier->subresourceRange.baseMipLevel) {
+            prev->subresourceRange.levelCount += barrier->subresourceRange.levelCount;
+            return;
+        }
+    }
+
+    if (*barrierCount == grCmdBuffer->imageBarrierCapacity) {
+        grCmdBuffer->imageBarrierCapacity = MAX(2 * grCmdBuffer->imageBarrierCapacity, 16);
+        grCmdBuffer->imageBarriers = realloc(grCmdBuffer->imageBarriers,
+                                             sizeof(VkImageMemoryBarrier) *
+                                             grCmdBuffer->imageBarrierCapacity);
+    }
+    grCmdBuffer->imageBarriers[(*barrierCount)++] = *barrier;
+}
+
+// Returns the barriers needed for the transitions, valid until the next call. A subresource can
+// only be transitioned once per batch, the batch ends before the transition that would repeat it.
+const VkImageMemoryBarrier* getImageTransitionBarriers(
+    unsigned* barrierCount,
+    unsigned* batchTransitionCount,
+    VkPipelineStageFlags* srcStageMask,
+    VkPipelineStageFlags* dstStageMask,
+    GrCmdBuffer* grCmdBuffer,
+    unsigned transitionCount,
+    const GR_IMAGE_STATE_TRANSITION* pStateTransitions)
+{
+    *barrierCount = 0;
+    *srcStageMask = 0;
+    *dstStageMask = 0;
+
+    // Trackers are cleared on first use, so zero never matches a batch
+    grCmdBuffer->imageBarrierBatch++;
+    if (grCmdBuffer->imageBarrierBatch == 0) {
+        grCmdBuffer->imageBarrierBatch = 1;
+    }
+
+    unsigned i;
+    for (i = 0; i < transitionCount; i++) {
+        const GR_IMAGE_STATE_TRANSITION* stateTransition = &pStateTransitions[i];
+        const GR_IMAGE_SUBRESOURCE_RANGE* range = &stateTransition->subresourceRange;
+        GrImage* grImage = (GrImage*)stateTransition->image;
+        GrSubresourceState* subresourceStates = getSubresourceStates(grCmdBuffer, grImage);
+        GR_IMAGE_STATE newState = stateTransition->newState;
+        unsigned plane = range->aspect == GR_IMAGE_ASPECT_STENCIL ? 1 : 0;
+        unsigned mipEnd = range->mipLevels == GR_LAST_MIP_OR_SLICE ?
+                          grImage->mipLevels : MIN(range->baseMipLevel + range->mipLevels,
+                                                   grImage->mipLevels);
+        unsigned sliceEnd = range->arraySize == GR_LAST_MIP_OR_SLICE ?
+                            grImage->layerCount : MIN(range->baseArraySlice + range->arraySize,
+                                                      grImage->layerCount);
+        bool isElided = true;
+
+        if (hasBatchedBarrier(grCmdBuffer, grImage, subresourceStates, range, mipEnd, sliceEnd)) {
+            break;
+        }
+
+        for (unsigned mip = range->baseMipLevel; mip < mipEnd; mip++) {
+            GR_IMAGE_STATE runState = 0;
+            unsigned runStart = 0;
+
+            // Build barriers from runs of slices that are in the same state
+            for (unsigned slice = range->baseArraySlice; slice <= sliceEnd; slice++) {
+                GrSubresourceState* subresourceState = NULL;
+                GR_IMAGE_STATE oldState = 0;
+                bool needsBarrier = false;
+
+                if (slice < sliceEnd) {
+                    subresourceState =
+                        &subresourceStates[getSubresourceIndex(grImage, plane, mip, slice)];
+
+                    if (subresourceState->firstState == 0) {
+                        // Whatever transitioned it into the old state made it visible to it
+                        subresourceState->firstState = stateTransition->oldState;
+                        subresourceState->state = stateTransition->oldState;
+                        subresourceState->visibleStages =
+                            getVkPipelineStageFlagsImage(stateTransition->oldState);
+                        subresourceState->visibleAccessMask =
+                            getVkAccessFlagsImage(stateTransition->oldState);
+                    }
+                    oldState = subresourceState->state;
+
+                    VkPipelineStageFlags newStages = getVkPipelineStageFlagsImage(newState);
+                    VkAccessFlags newAccessMask = getVkAccessFlagsImage(newState);
+
+                    bool isReadOnlyTransition =
+                        isReadOnlyState(oldState) && isReadOnlyState(newState) &&
+                        getVkImageLayout(oldState) == getVkImageLayout(newState);
+
+                    if (isReadOnlyTransition &&
+                        (newStages & ~subresourceState->visibleStages) == 0 &&
+                        (newAccessMask & ~subresourceState->visibleAccessMask) == 0) {
+                        // Reads don't need to be ordered, later writes wait for them instead.
+                        // Reads from other stages still need the last write made visible to them.
+                        subresourceState->pendingReadStages |=
+                            getVkPipelineStageFlagsImage(oldState);
+                    } else {
+                        *srcStageMask |= getVkPipelineStageFlagsImage(oldState) |
+                                         subresourceState->pendingReadStages;
+                        subresourceState->pendingReadStages = 0;
+                        if (isReadOnlyTransition) {
+                            // Nothing was written since, earlier visibility still holds
+                            subresourceState->visibleStages |= newStages;
+                            subresourceState->visibleAccessMask |= newAccessMask;
+                        } else {
+                            subresourceState->visibleStages = newStages;
+                            subresourceState->visibleAccessMask = newAccessMask;
+                        }
+                        subresourceState->barrierBatch = grCmdBuffer->imageBarrierBatch;
+                        needsBarrier = true;
+                        isElided = false;
+                    }
+                    subresourceState->state = newState;
+                }
+
+                if (runState != 0 && (!needsBarrier || oldState != runState)) {
+                    const VkImageMemoryBarrier barrier = {
+                        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+                        .pNext = NULL,
+                        .srcAccessMask = getVkAccessFlagsImage(runState),
+                        .dstAccessMask = getVkAccessFlagsImage(newState),
+                        .oldLayout = getVkImageLayout(runState),
+                        .newLayout = getVkImageLayout(newState),
+                        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                        .image = grImage->image,
+                        .subresourceRange = {
+                            .aspectMask = getVkImageAspectFlags(range->aspect),
+                            .baseMipLevel = mip,
+                            .levelCount = 1,
+                            .baseArrayLayer = runStart,
+                            .layerCount = slice - runStart,
+                        },
+                    };
+
+                    addImageBarrier(grCmdBuffer, barrierCount, &barrier);
+                    runState = 0;
+                }
+                if (needsBarrier && runState == 0) {
+                    runState = oldState;
+                    runStart = slice;
+                }
+            }
+        }
+
+        if (isElided) {
+            grCmdBuffer->elidedTransitionCount++;
+        } else {
+            *dstStageMask |= getVkPipelineStageFlagsImage(newState);
+        }
+    }
+
+    *batchTransitionCount = i;
+    return grCmdBuffer->imageBarriers;
+}
+
+void resetImageStates(
+    GrCmdBuffer* grCmdBuffer)
+{
+    // Tracker storage is recycled by the next recording
+    if (grCmdBuffer->imageStateTrackerCount > 0) {
+        memset(grCmdBuffer->imageStateTable, 0,
+               grCmdBuffer->imageStateTableSize * sizeof(unsigned));
+    }
+    grCmdBuffer->imageStateTrackerCount = 0;
+}
+
+// Called at submission when debugging, checks the states declared by the transitions against
+// the ones left by previous submissions
+void checkImageStates(
+    GrDevice* grDevice,
+    const GrCmdBuffer* grCmdBuffer)
+{
+    AcquireSRWLockExclusive(&grDevice->imageStateLock);
+
+    for (unsigned i = 0; i < grCmdBuffer->imageStateTrackerCount; i++) {
+        const GrImageStateTracker* tracker = &grCmdBuffer->imageStateTrackers[i];
+        GrImage* grImage = tracker->grImage;
+        unsigned subresourceCount = getSubresourceCount(grImage);
+
+        if (grImage->subresourceStates == NULL) {
+            grImage->subresourceStates = calloc(subresourceCount, sizeof(GR_IMAGE_STATE));
+        }
+
+        for (unsigned j = 0; j < subresourceCount; j++) {
+            const GrSubresourceState* subresourceState = &tracker->subresourceStates[j];
+            GR_IMAGE_STATE currentState = grImage->subresourceStates[j];
+
+            if (subresourceState->firstState == 0) {
+                continue;
+            }
+
+            if (currentState != 0 && subresourceState->firstState != GR_IMAGE_STATE_UNINITIALIZED &&
+                subresourceState->firstState != GR_IMAGE_STATE_DISCARD &&
+                getVkImageLayout(currentState) != getVkImageLayout(subresourceState->firstState)) {
+                LOGW("image %p subresource %u was transitioned from state 0x%X, but is in 0x%X\n",
+                     grImage, j, subresourceState->firstState, currentState);
+            }
+            grImage->subresourceStates[j] = subresourceState->state;
+        }
+    }
+
+    ReleaseSRWLockExclusive(&grDevice->imageStateLock);
+}
@@ -77,9 +77,19 @@ GR_RESULT grCreateColorTargetView(
     }
     *grColorTargetView = (GrColorTargetView) {
         .sType = GR_STRUCT_TYPE_COLOR_TARGET_VIEW,
+        .grDevice = (GrDevice*)grDevice,
         .imageView = vkImageView,
-        .extent = { grImage->extent.width, grImage->extent.height, 1 },
+        .extent = {
+            MAX(grImage->extent.width >> pCreateInfo->mipLevel, 1),
+            MAX(grImage->extent.height >> pCreateInfo->mipLevel, 1),
+            1,
+        },
         .layerCount = pCreateInfo->arraySize,
+        .format = createInfo.format,
+        .usage = grImage->usage,
+        .grImage = grImage,
+        .mipLevel = pCreateInfo->mipLevel,
+        .baseArraySlice = pCreateInfo->baseArraySlice,
     };
 
     *pView = (GR_COLOR_TARGET_VIEW)grColorTargetView;
@@ -180,9 +190,16 @@ GR_RESULT grCreateDepthStencilView(
 
     *grDepthTargetView = (GrDepthTargetView) {
         .sType = GR_STRUCT_TYPE_DEPTH_STENCIL_TARGET_VIEW,
+        .grDevice = (GrDevice*)grDevice,
         .imageView = vkImageView,
-        .extent = { grImage->extent.width, grImage->extent.height, 1 },
+        .extent = {
+            MAX(grImage->extent.width >> pCreateInfo->mipLevel, 1),
+            MAX(grImage->extent.height >> pCreateInfo->mipLevel, 1),
+            1,
+        },
         .layerCount = pCreateInfo->arraySize,
+        .format = createInfo.format,
+        .usage = grImage->usage,
     };
 
     *pView = (GR_DEPTH_STENCIL_VIEW)grDepthTargetView;
@@ -1,7 +1,12 @@
 #include <stdio.h>
 #include "mantle_internal.h"
+#include "amdilc.h"
 
 #define NVIDIA_VENDOR_ID 0x10de
+#define DEFAULT_SHADER_CACHE_SIZE_MB 1024
+#define MAX_SHADER_CACHE_SIZE_MB 4095
+#define MAX_PIPELINE_COMPILER_THREADS 4
+#define MAX_TRANSLATION_THREADS 8
 
 static char* getGrvkEngineName(
     const GR_CHAR* engineName)
@@ -19,6 +24,70 @@ static char* getGrvkEngineName(
     return grvkEngineName;
 }
 
+static const char* getShaderCachePath()
+{
+    const char* envValue = getenv("GRVK_SHADER_CACHE_PATH");
+
+    // Caches on disk are opt-in
+    if (envValue == NULL || strlen(envValue) == 0) {
+        return NULL;
+    }
+    return envValue;
+}
+
+static unsigned getShaderCacheMaxSize()
+{
+    const char* envValue = getenv("GRVK_SHADER_CACHE_SIZE");
+    unsigned sizeMb = DEFAULT_SHADER_CACHE_SIZE_MB;
+
+    if (envValue != NULL) {
+        sizeMb = MIN(strtoul(envValue, NULL, 10), MAX_SHADER_CACHE_SIZE_MB);
+    }
+    return sizeMb * 1024 * 1024;
+}
+
+static bool isShaderCacheCompressionEnabled()
+{
+    const char* envValue = getenv("GRVK_SHADER_CACHE_COMPRESSION");
+
+    return envValue != NULL && strcmp(envValue, "1") == 0;
+}
+
+static bool isFastPipelineCompileEnabled()
+{
+    const char* envValue = getenv("GRVK_FAST_PIPELINE_COMPILE");
+
+    return envValue != NULL && strcmp(envValue, "1") == 0;
+}
+
+static bool isAsyncPipelineCreationEnabled()
+{
+    const char* envValue = getenv("GRVK_ASYNC_PIPELINES");
+
+    return envValue != NULL && strcmp(envValue, "1") == 0;
+}
+
+static bool isFrameStatsEnabled()
+{
+    const char* envValue = getenv("GRVK_FRAME_STATS");
+
+    return envValue != NULL && strcmp(envValue, "1") == 0;
+}
+
+static bool isImageStateCheckEnabled()
+{
+    const char* envValue = getenv("GRVK_CHECK_IMAGE_STATES");
+
+    return envValue != NULL && strcmp(envValue, "1") == 0;
+}
+
+static bool isDeferredCommandsEnabled()
+{
+    const char* envValue = getenv("GRVK_DEFERRED_COMMANDS");
+
+    return envValue != NULL && strcmp(envValue, "1") == 0;
+}
+
 // Initialization and Device Functions
 
 GR_RESULT grInitAndEnumerateGpus(
@@ -256,7 +325,6 @@ GR_RESULT grCreateDevice(
     unsigned computeQueueIndex = INVALID_QUEUE_INDEX;
     unsigned computeQueueCount = 0;
     bool computeQueueRequested = false;
-    VkCommandPool computeCommandPool = VK_NULL_HANDLE;
 
     VkPhysicalDeviceProperties physicalDeviceProps;
     vki.vkGetPhysicalDeviceProperties(grPhysicalGpu->physicalDevice, &physicalDeviceProps);
@@ -346,10 +414,27 @@ GR_RESULT grCreateDevice(
         goto bail;
     }
 
+    VkPhysicalDeviceVulkan12Features supportedVk12Features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+        .pNext = NULL,
+    };
+    VkPhysicalDeviceFeatures2 supportedFeatures = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &supportedVk12Features,
+    };
+    vki.vkGetPhysicalDeviceFeatures2(grPhysicalGpu->physicalDevice, &supportedFeatures);
+
+    // Lets render passes begin without creating a framebuffer per set of bound targets
+    bool imagelessFramebufferSupported = supportedVk12Features.imagelessFramebuffer == VK_TRUE;
+    if (!imagelessFramebufferSupported) {
+        LOGW("imageless framebuffers are not supported, falling back to per-draw framebuffers\n");
+    }
+
     const VkPhysicalDeviceVulkan12Features vk12DeviceFeatures = {
         .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
         .pNext = NULL,
         .descriptorBindingPartiallyBound = VK_TRUE,
+        .imagelessFramebuffer = imagelessFramebufferSupported,
         .bufferDeviceAddress = VK_TRUE,
         .descriptorIndexing = VK_TRUE,
     };
@@ -386,26 +471,41 @@ GR_RESULT grCreateDevice(
         res = GR_ERROR_INITIALIZATION_FAILED;
         goto bail;
     }
-    const char *deviceExtensions[4] = {
+    const char *deviceExtensions[5] = {
         VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME,
         VK_KHR_SWAPCHAIN_EXTENSION_NAME,
         VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME,
         NULL,
+        NULL,
     };
     unsigned deviceExtensionCount = 3;
     bool pushDescriptorsSupported = false;
+    bool pipelineCreationCacheControlSupported = false;
     for (unsigned i = 0; i < extensionCount; ++i) {
         if (strcmp(extensionProperties[i].extensionName, VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME) == 0) {
             deviceExtensions[deviceExtensionCount++] = VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME;
             pushDescriptorsSupported = true;
             LOGT("push descriptor set is supported\n");
-            break;
+        } else if (strcmp(extensionProperties[i].extensionName,
+                          VK_EXT_PIPELINE_CREATION_CACHE_CONTROL_EXTENSION_NAME) == 0) {
+            deviceExtensions[deviceExtensionCount++] =
+                VK_EXT_PIPELINE_CREATION_CACHE_CONTROL_EXTENSION_NAME;
+            pipelineCreationCacheControlSupported = true;
+            LOGT("pipeline creation cache control is supported\n");
         }
     }
 
+    // Lets pipeline creation check for a cached optimized pipeline without compiling it
+    const VkPhysicalDevicePipelineCreationCacheControlFeaturesEXT cacheControlFeatures = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PIPELINE_CREATION_CACHE_CONTROL_FEATURES_EXT,
+        .pNext = &extendedDynamicState,
+        .pipelineCreationCacheControl = VK_TRUE,
+    };
+
     const VkDeviceCreateInfo createInfo = {
         .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-        .pNext = &extendedDynamicState,
+        .pNext = pipelineCreationCacheControlSupported ?
+                 (const void*)&cacheControlFeatures : (const void*)&extendedDynamicState,
         .flags = 0,
         .queueCreateInfoCount = pCreateInfo->queueRecordCount,
         .pQueueCreateInfos = queueCreateInfos,
@@ -444,21 +544,6 @@ GR_RESULT grCreateDevice(
             goto bail;
         }
     }
-    if (computeQueueRequested && computeQueueIndex != INVALID_QUEUE_INDEX) {
-        const VkCommandPoolCreateInfo poolCreateInfo = {
-            .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
-            .pNext = NULL,
-            .flags = 0,
-            .queueFamilyIndex = computeQueueIndex,
-        };
-
-        if (vki.vkCreateCommandPool(vkDevice, &poolCreateInfo, NULL,
-                                    &computeCommandPool) != VK_SUCCESS) {
-            LOGE("vkCreateCommandPool failed\n");
-            res = GR_ERROR_INITIALIZATION_FAILED;
-            goto bail;
-        }
-    }
     unsigned descriptorCount = 10240;
     const VkDescriptorSetLayoutBinding globalLayoutBindings[5] = {
         {
@@ -633,7 +718,6 @@ GR_RESULT grCreateDevice(
         .universalQueueIndex = universalQueueIndex,
         .universalCommandPool = universalCommandPool,
         .computeQueueIndex = computeQueueIndex,
-        .computeCommandPool = computeCommandPool,
         .globalDescriptorSet = {
             .descriptorTableLayout = globalLayout,
             .graphicsDynamicMemoryLayout = graphicsDynamicMemoryLayout,
@@ -651,11 +735,57 @@ GR_RESULT grCreateDevice(
         .pipelineLayouts = globalPipelineLayouts,
         .vDescriptorSetMemoryTypeIndex = 2,
         .pushDescriptorSetSupported = pushDescriptorsSupported,
+        .imagelessFramebufferSupported = imagelessFramebufferSupported,
+        .pipelineCreationCacheControlSupported = pipelineCreationCacheControlSupported,
+        .fastPipelineCompileEnabled = isFastPipelineCompileEnabled(),
+        .asyncPipelineCreationEnabled = isAsyncPipelineCreationEnabled(),
+        .frameStatsEnabled = isFrameStatsEnabled(),
+        .deferredCommandsEnabled = isDeferredCommandsEnabled(),
+        .imageStateCheckEnabled = isImageStateCheckEnabled(),
+        .imageStateLock = SRWLOCK_INIT,
+        .frameBarrierCount = 0,
+        .frameElidedTransitionCount = 0,
+        .frameRecordedCommandCount = 0,
+        .frameTranslatedCommandCount = 0,
+        .frameIndex = 0,
     };
     vki.vkGetPhysicalDeviceMemoryProperties(
         grPhysicalGpu->physicalDevice,
         &grDevice->memoryProperties);
+    // Command buffers can only be created for the requested queues
+    initCommandPoolSet(&grDevice->universalCommandPools,
+                       universalQueueRequested ? universalQueueIndex : INVALID_QUEUE_INDEX);
+    initCommandPoolSet(&grDevice->computeCommandPools,
+                       computeQueueRequested ? computeQueueIndex : INVALID_QUEUE_INDEX);
     grDevice->vDescriptorSetMemoryTypeIndex = getVirtualDescriptorSetBufferMemoryType(&grDevice->memoryProperties);
+    ilcOpenShaderCache(getShaderCachePath(), getShaderCacheMaxSize(), isShaderCacheCompressionEnabled());
+    // Pipeline cache blobs are stored alongside the shader cache
+    initPipelineCache(&grDevice->pipelineCache, vkDevice, &physicalDeviceProps, getShaderCachePath());
+    if (grDevice->asyncPipelineCreationEnabled) {
+        // Draws may wait on these threads, so leave one core for the application
+        SYSTEM_INFO systemInfo;
+        GetSystemInfo(&systemInfo);
+        unsigned threadCount = MIN(systemInfo.dwNumberOfProcessors - 1,
+                                   MAX_PIPELINE_COMPILER_THREADS);
+
+        initPipelineCompiler(&grDevice->pipelineCompiler, MAX(threadCount, 1),
+                             THREAD_PRIORITY_NORMAL);
+    } else if (grDevice->fastPipelineCompileEnabled) {
+        // Optimized pipelines aren't urgent, don't compete with the application's own threads
+        initPipelineCompiler(&grDevice->pipelineCompiler, 1, THREAD_PRIORITY_BELOW_NORMAL);
+    } else {
+        initPipelineCompiler(&grDevice->pipelineCompiler, 0, THREAD_PRIORITY_NORMAL);
+    }
+    if (grDevice->deferredCommandsEnabled) {
+        // The recording thread translates a share of the commands itself
+        SYSTEM_INFO systemInfo;
+        GetSystemInfo(&systemInfo);
+        unsigned threadCount = MIN(systemInfo.dwNumberOfProcessors - 1, MAX_TRANSLATION_THREADS);
+
+        initWorkerPool(&grDevice->translationWorkerPool, threadCount);
+    } else {
+        initWorkerPool(&grDevice->translationWorkerPool, 0);
+    }
     *pDevice = (GR_DEVICE)grDevice;
 
 bail:
@@ -681,9 +811,6 @@ bail:
         if (universalCommandPool != VK_NULL_HANDLE) {
             vki.vkDestroyCommandPool(vkDevice, universalCommandPool, NULL);
         }
-        if (computeCommandPool != VK_NULL_HANDLE) {
-            vki.vkDestroyCommandPool(vkDevice, computeCommandPool, NULL);
-        }
         if (vkDevice != VK_NULL_HANDLE) {
             vki.vkDestroyDevice(vkDevice, NULL);
         }
@@ -711,12 +838,17 @@ GR_RESULT grDestroyDevice(GR_DEVICE device)
     if (grDevice->sType != GR_STRUCT_TYPE_DEVICE) {
         return GR_ERROR_INVALID_OBJECT_TYPE;
     }
+    destroyPipelineCompiler(&grDevice->pipelineCompiler);
+    destroyWorkerPool(&grDevice->translationWorkerPool);
+    destroySharedPipelines(grDevice);
+    destroyPipelineCache(&grDevice->pipelineCache);
+    destroyFramebufferCache(&grDevice->framebufferCache, grDevice->device);
+    destroyRenderPassCache(&grDevice->renderPassCache, grDevice->device);
     if (grDevice->universalCommandPool != VK_NULL_HANDLE) {
         vki.vkDestroyCommandPool(grDevice->device, grDevice->universalCommandPool, NULL);
     }
-    if (grDevice->computeCommandPool != VK_NULL_HANDLE) {
-        vki.vkDestroyCommandPool(grDevice->device, grDevice->computeCommandPool, NULL);
-    }
+    destroyCommandPoolSet(&grDevice->universalCommandPools, grDevice->device);
+    destroyCommandPoolSet(&grDevice->computeCommandPools, grDevice->device);
     if (grDevice->pipelineLayouts.graphicsPipelineLayout != VK_NULL_HANDLE) {
         vki.vkDestroyPipelineLayout(grDevice->device, grDevice->pipelineLayouts.graphicsPipelineLayout, NULL);
     }
@@ -739,6 +871,7 @@ GR_RESULT grDestroyDevice(GR_DEVICE device)
         free(grDevice->globalDescriptorSet.samplerPtr); // single allocation, samplers are first in the buffer
     }
     vki.vkDestroyDevice(grDevice->device, NULL);
+    ilcCloseShaderCache();
     free(grDevice);
     return GR_SUCCESS;
 }
@@ -15,6 +15,9 @@
 #define MIN(a, b) \
     ((a) < (b) ? (a) : (b))
 
+#define MAX(a, b) \
+    ((a) > (b) ? (a) : (b))
+
 GR_PHYSICAL_GPU_TYPE getGrPhysicalGpuType(
     VkPhysicalDeviceType type);
 
@@ -39,6 +42,12 @@ VkAccessFlags getVkAccessFlagsImage(
 VkAccessFlags getVkAccessFlagsMemory(
     GR_MEMORY_STATE memoryState);
 
+VkPipelineStageFlags getVkPipelineStageFlagsImage(
+    GR_IMAGE_STATE imageState);
+
+VkPipelineStageFlags getVkPipelineStageFlagsMemory(
+    GR_MEMORY_STATE memoryState);
+
 VkImageAspectFlags getVkImageAspectFlags(
     GR_IMAGE_ASPECT imageAspect);
 
@@ -96,4 +105,269 @@ VkSamplerAddressMode getVkSamplerAddressMode(
 VkBorderColor getVkBorderColor(
     GR_BORDER_COLOR_TYPE borderColorType);
 
+void initPipelineCache(
+    GrPipelineCache* grPipelineCache,
+    VkDevice device,
+    const VkPhysicalDeviceProperties* physicalDeviceProps,
+    const char* dirPath);
+
+void markPipelineCacheDirty(
+    GrPipelineCache* grPipelineCache);
+
+void destroyPipelineCache(
+    GrPipelineCache* grPipelineCache);
+
+void getRenderPassKey(
+    GrRenderPassKey* key,
+    const GR_PIPELINE_CB_TARGET_STATE* cbTargets,
+    const GR_PIPELINE_DB_STATE* dbTarget);
+
+VkRenderPass acquireRenderPass(
+    GrRenderPassCache* grRenderPassCache,
+    VkDevice device,
+    const GrRenderPassKey* key);
+
+void releaseRenderPass(
+    GrRenderPassCache* grRenderPassCache,
+    VkDevice device,
+    const GrRenderPassKey* key);
+
+void destroyRenderPassCache(
+    GrRenderPassCache* grRenderPassCache,
+    VkDevice device);
+
+void endRenderPass(
+    GrCmdBuffer* grCmdBuffer);
+
+void flushLoadOpClears(
+    GrCmdBuffer* grCmdBuffer);
+
+bool beginRenderPass(
+    GrCmdBuffer* grCmdBuffer,
+    const GrPipeline* grPipeline,
+    VkSubpassContents contents);
+
+void* getCmdBufferScratch(
+    GrCmdBuffer* grCmdBuffer,
+    size_t size);
+
+void resetTimestampQueries(
+    GrCmdBuffer* grCmdBuffer);
+
+void flushTimestampCopies(
+    GrCmdBuffer* grCmdBuffer);
+
+GrCmdBuffer* acquireSecondaryCmdBuffer(
+    GrCmdBuffer* grCmdBuffer,
+    VkRenderPass renderPass);
+
+void destroyCmdBuffer(
+    GrCmdBuffer* grCmdBuffer);
+
+GrFramebuffer* acquireFramebuffer(
+    GrFramebufferCache* grFramebufferCache,
+    VkDevice device,
+    VkRenderPass renderPass,
+    const GrFramebufferKey* key);
+
+void releaseFramebuffer(
+    GrFramebuffer* grFramebuffer,
+    VkDevice device);
+
+void invalidateFramebuffers(
+    GrFramebufferCache* grFramebufferCache,
+    VkDevice device,
+    VkImageView imageView);
+
+void destroyFramebufferCache(
+    GrFramebufferCache* grFramebufferCache,
+    VkDevice device);
+
+GrBufferViewEntry* getBufferViewEntry(
+    GrBufferViewCache* grBufferViewCache,
+    VkDevice device,
+    const GrBufferViewKey* key);
+
+bool resetBufferViewCache(
+    GrBufferViewCache* grBufferViewCache,
+    VkDevice device);
+
+void destroyBufferViewCache(
+    GrBufferViewCache* grBufferViewCache,
+    VkDevice device);
+
+const VkImageMemoryBarrier* getImageTransitionBarriers(
+    unsigned* barrierCount,
+    unsigned* batchTransitionCount,
+    VkPipelineStageFlags* srcStageMask,
+    VkPipelineStageFlags* dstStageMask,
+    GrCmdBuffer* grCmdBuffer,
+    unsigned transitionCount,
+    const GR_IMAGE_STATE_TRANSITION* pStateTransitions);
+
+void resetImageStates(
+    GrCmdBuffer* grCmdBuffer);
+
+void checkImageStates(
+    GrDevice* grDevice,
+    const GrCmdBuffer* grCmdBuffer);
+
+void flushCmdStream(
+    GrCmdBuffer* grCmdBuffer);
+
+uint32_t getCmdStreamColorStoreMask(
+    const GrCmdBuffer* grCmdBuffer,
+    const GrRenderPassKey* renderPassKey);
+
+void resetCmdStream(
+    GrCmdStream* grCmdStream);
+
+void destroyCmdStream(
+    GrCmdStream* grCmdStream);
+
+bool recordCmdBindPipeline(
+    GrCmdBuffer* grCmdBuffer,
+    GR_ENUM pipelineBindPoint,
+    GR_PIPELINE pipeline);
+
+bool recordCmdBindStateObject(
+    GrCmdBuffer* grCmdBuffer,
+    GR_ENUM stateBindPoint,
+    GR_STATE_OBJECT state);
+
+bool recordCmdBindDescriptorSet(
+    GrCmdBuffer* grCmdBuffer,
+    GR_ENUM pipelineBindPoint,
+    GR_UINT index,
+    GR_DESCRIPTOR_SET descriptorSet,
+    GR_UINT slotOffset);
+
+bool recordCmdBindDynamicMemoryView(
+    GrCmdBuffer* grCmdBuffer,
+    GR_ENUM pipelineBindPoint,
+    const GR_MEMORY_VIEW_ATTACH_INFO* pMemView);
+
+bool recordCmdBindTargets(
+    GrCmdBuffer* grCmdBuffer,
+    GR_UINT colorTargetCount,
+    const GR_COLOR_TARGET_BIND_INFO* pColorTargets,
+    const GR_DEPTH_STENCIL_BIND_INFO* pDepthTarget);
+
+bool recordCmdPrepareMemoryRegions(
+    GrCmdBuffer* grCmdBuffer,
+    GR_UINT transitionCount,
+    const GR_MEMORY_STATE_TRANSITION* pStateTransitions);
+
+bool recordCmdPrepareImages(
+    GrCmdBuffer* grCmdBuffer,
+    GR_UINT transitionCount,
+    const GR_IMAGE_STATE_TRANSITION* pStateTransitions);
+
+bool recordCmdDraw(
+    GrCmdBuffer* grCmdBuffer,
+    GR_UINT firstVertex,
+    GR_UINT vertexCount,
+    GR_UINT firstInstance,
+    GR_UINT instanceCount);
+
+bool recordCmdDrawIndexed(
+    GrCmdBuffer* grCmdBuffer,
+    GR_UINT firstIndex,
+    GR_UINT indexCount,
+    GR_INT vertexOffset,
+    GR_UINT firstInstance,
+    GR_UINT instanceCount);
+
+bool recordCmdDispatch(
+    GrCmdBuffer* grCmdBuffer,
+    GR_UINT x,
+    GR_UINT y,
+    GR_UINT z);
+
+bool recordCmdDispatchIndirect(
+    GrCmdBuffer* grCmdBuffer,
+    GR_GPU_MEMORY mem,
+    GR_GPU_SIZE offset);
+
+bool recordCmdClearColorImage(
+    GrCmdBuffer* grCmdBuffer,
+    GR_IMAGE image,
+    const GR_FLOAT color[4],
+    GR_UINT rangeCount,
+    const GR_IMAGE_SUBRESOURCE_RANGE* pRanges);
+
+bool recordCmdClearColorImageRaw(
+    GrCmdBuffer* grCmdBuffer,
+    GR_IMAGE image,
+    const GR_UINT32 color[4],
+    GR_UINT rangeCount,
+    const GR_IMAGE_SUBRESOURCE_RANGE* pRanges);
+
+bool recordCmdClearDepthStencil(
+    GrCmdBuffer* grCmdBuffer,
+    GR_IMAGE image,
+    GR_FLOAT depth,
+    GR_UINT8 stencil,
+    GR_UINT rangeCount,
+    const GR_IMAGE_SUBRESOURCE_RANGE* pRanges);
+
+void initWorkerPool(
+    GrWorkerPool* grWorkerPool,
+    unsigned threadCount);
+
+void queueWorkerJob(
+    GrWorkerPool* grWorkerPool,
+    GrWorkerBatch* grWorkerBatch,
+    GrWorkerJobProc proc,
+    void* data);
+
+void waitForWorkerBatch(
+    GrWorkerPool* grWorkerPool,
+    GrWorkerBatch* grWorkerBatch);
+
+void destroyWorkerPool(
+    GrWorkerPool* grWorkerPool);
+
+void initCommandPoolSet(
+    GrCommandPoolSet* grCommandPoolSet,
+    unsigned queueIndex);
+
+VkCommandPool acquireCommandPool(
+    GrCommandPoolSet* grCommandPoolSet,
+    VkDevice device);
+
+void releaseCommandPool(
+    GrCommandPoolSet* grCommandPoolSet,
+    VkDevice device,
+    VkCommandPool commandPool);
+
+void destroyCommandPoolSet(
+    GrCommandPoolSet* grCommandPoolSet,
+    VkDevice device);
+
+void initPipelineCompiler(
+    GrPipelineCompiler* grPipelineCompiler,
+    unsigned threadCount,
+    int threadPriority);
+
+bool queuePipelineJob(
+    GrPipelineCompiler* grPipelineCompiler,
+    GrPipelineJobProc proc,
+    GrPipeline* grPipeline);
+
+void destroyPipelineCompiler(
+    GrPipelineCompiler* grPipelineCompiler);
+
+bool waitForPipeline(
+    GrPipeline* grPipeline);
+
+VkPipeline getVkPipeline(
+    const GrPipeline* grPipeline);
+
+void releasePipeline(
+    GrPipeline* grPipeline);
+
+void destroySharedPipelines(
+    GrDevice* grDevice);
+
 #endif // MANTLE_INTERNAL_H_
@@ -1,5 +1,7 @@
 #include "mantle_internal.h"
 
+static volatile LONG64 mNextMemoryId = 0;
+
 // Memory Management Functions
 
 GR_RESULT grGetMemoryHeapCount(
@@ -161,6 +163,7 @@ GR_RESULT grAllocMemory(
         .deviceMemory = vkMemory,
         .device = grDevice->device,
         .buffer = vkBuffer,
+        .id = InterlockedIncrement64(&mNextMemoryId),
     };
 
     *pMem = (GR_GPU_MEMORY)grGpuMemory;
@@ -1,6 +1,7 @@
 #ifndef GR_OBJECT_H_
 #define GR_OBJECT_H_
 
+#include <windows.h>
 #include "mantle/mantle.h"
 #define VK_NO_PROTOTYPES
 #include "vulkan/vulkan.h"
@@ -32,6 +33,7 @@ typedef enum _GrStructType {
     GR_STRUCT_TYPE_QUERY_POOL,
 } GrStructType;
 
+typedef struct _GrCmdBuffer GrCmdBuffer;
 typedef struct _GrColorTargetView GrColorTargetView;
 typedef struct _GrDescriptorSet GrDescriptorSet;
 typedef struct _GrPipeline GrPipeline;
@@ -41,29 +43,194 @@ typedef struct _GrObject {
     GrStructType sType;
 } GrObject;
 
+// Everything the render pass attachments depend on, kept free of padding for hashing
+typedef struct _GrRenderPassKey {
+    VkFormat colorFormats[GR_MAX_COLOR_TARGETS];
+    uint32_t colorStoreMask;
+    uint32_t colorClearMask; // Cleared on load instead, never set for pipelines
+    VkFormat depthStencilFormat;
+    VkImageAspectFlags depthStencilAspects;
+} GrRenderPassKey;
+
+// Describes a bound target without referencing its view, kept free of padding for hashing
+typedef struct _GrFramebufferAttachment {
+    VkImageUsageFlags usage;
+    VkFormat format;
+    uint32_t viewFormatCount; // Listed when the image was created, only ever its own format
+    uint32_t width;
+    uint32_t height;
+    uint32_t layerCount;
+} GrFramebufferAttachment;
+
+typedef struct _GrFramebuffer GrFramebuffer;
+typedef struct _GrImage GrImage;
+
+typedef struct _GrSubresourceState {
+    GR_IMAGE_STATE firstState; // Declared by the first transition, zero if untouched
+    GR_IMAGE_STATE state;
+    VkPipelineStageFlags pendingReadStages; // Of elided read-only transitions
+    VkPipelineStageFlags visibleStages; // That the last write was made visible to
+    VkAccessFlags visibleAccessMask;
+    unsigned barrierBatch; // Last batch of barriers that transitioned it
+} GrSubresourceState;
+
+typedef struct _GrImageStateTracker {
+    GrImage* grImage;
+    GrSubresourceState* subresourceStates;
+    unsigned subresourceCapacity; // Kept across recordings
+} GrImageStateTracker;
+
+// Dynamic state as last recorded, values are only meaningful if their bit is in validMask
+typedef struct _GrDynamicState {
+    uint32_t validMask;
+    unsigned viewportCount;
+    VkViewport viewports[GR_MAX_VIEWPORTS];
+    unsigned scissorCount;
+    VkRect2D scissors[GR_MAX_VIEWPORTS];
+    VkCullModeFlags cullMode;
+    VkFrontFace frontFace;
+    float depthBias[3]; // Constant factor, clamp and slope factor
+    VkBool32 depthTestEnable;
+    VkBool32 depthWriteEnable;
+    VkCompareOp depthCompareOp;
+    VkBool32 depthBoundsTestEnable;
+    VkBool32 stencilTestEnable;
+    VkStencilOpState front;
+    VkStencilOpState back;
+    float depthBounds[2];
+    float blendConstants[4];
+} GrDynamicState;
+
+// Identifies a dynamic memory view, kept free of padding for hashing
+typedef struct _GrBufferViewKey {
+    uint64_t memoryId; // Buffer handles may be reused once the memory is freed
+    VkBuffer buffer;
+    VkDeviceSize offset;
+    VkDeviceSize range;
+    VkFormat format;
+    uint32_t reserved;
+} GrBufferViewKey;
+
+typedef struct _GrBufferViewEntry {
+    GrBufferViewKey key;
+    VkBufferView bufferView;
+    VkDescriptorSet descriptorSets[2]; // Per bind point, unused with push descriptors
+    bool isUsed; // By the current recording
+    unsigned next; // Index of the next entry in the bucket plus one, zero ends the chain
+} GrBufferViewEntry;
+
+#define BUFFER_VIEW_BUCKET_COUNT 64
+
+// Views created by a command buffer, kept as long as every recording uses them
+typedef struct _GrBufferViewCache {
+    GrBufferViewEntry* entries;
+    unsigned entryCount;
+    unsigned entryCapacity;
+    unsigned buckets[BUFFER_VIEW_BUCKET_COUNT]; // Index of the first entry plus one
+} GrBufferViewCache;
+
+// State that has to be recorded again before the next draw or dispatch
+typedef enum _GrDirtyFlags {
+    DIRTY_GRAPHICS_PIPELINE             = 1 << 0,
+    DIRTY_GRAPHICS_DESCRIPTOR_TABLE     = 1 << 1,
+    DIRTY_GRAPHICS_DESCRIPTOR_SETS      = 1 << 2, // Passed through push constants
+    DIRTY_GRAPHICS_DYNAMIC_MEMORY_VIEW  = 1 << 3,
+    DIRTY_COMPUTE_PIPELINE              = 1 << 4,
+    DIRTY_COMPUTE_DESCRIPTOR_TABLE      = 1 << 5,
+    DIRTY_COMPUTE_DESCRIPTOR_SETS       = 1 << 6,
+    DIRTY_COMPUTE_DYNAMIC_MEMORY_VIEW   = 1 << 7,
+    DIRTY_RENDER_TARGETS                = 1 << 8,
+    DIRTY_DYNAMIC_STATE                 = 1 << 9,
+} GrDirtyFlags;
+
+typedef struct _GrViewportStateObject GrViewportStateObject;
+typedef struct _GrRasterStateObject GrRasterStateObject;
+typedef struct _GrDepthStencilStateObject GrDepthStencilStateObject;
+typedef struct _GrColorBlendStateObject GrColorBlendStateObject;
+
+typedef struct _GrCmdStreamBlock GrCmdStreamBlock;
+typedef struct _GrCmdStreamCommand GrCmdStreamCommand;
+
+// Mantle commands deferred until the end of the recording, or until a command that isn't deferred
+typedef struct _GrCmdStream {
+    bool isTranslating;
+    unsigned translateIndex; // Of the command being translated
+    GrCmdStreamCommand* commands;
+    unsigned commandCount;
+    unsigned commandCapacity;
+    GrCmdStreamBlock* blocks; // Arena for command arguments, kept across recordings
+    GrCmdStreamBlock* activeBlock;
+    GrCmdStreamBlock* lastBlock;
+    unsigned recordedCount;
+    unsigned translatedCount;
+} GrCmdStream;
+
 typedef struct _GrCmdBuffer {
     GrStructType sType;
     GrDevice* grDevice;
+    GR_ENUM queueType;
+    VkCommandPool commandPool; // Owned
     VkCommandBuffer commandBuffer;
-    VkQueryPool timestampQueryPool;
+    VkCommandBufferUsageFlags usageFlags; // Of the current recording
+    VkQueryPool timestampQueryPool; // Ring of timestamp queries, reset when recording begins
+    unsigned timestampQueryCount; // Used by the current recording
+    VkBuffer timestampCopyBuffer; // Pending copy of consecutive timestamp results
+    VkDeviceSize timestampCopyOffset;
+    unsigned timestampCopyFirstQuery;
+    unsigned timestampCopyQueryCount;
     GrPipeline* grPipeline;
+    GrPipeline* grComputePipeline;
+    const GrViewportStateObject* viewportState;
+    const GrRasterStateObject* rasterState;
+    const GrDepthStencilStateObject* depthStencilState;
+    const GrColorBlendStateObject* colorBlendState;
+    GrDynamicState dynamicState;
     GrDescriptorSet* graphicsDescriptorSets[2];
     unsigned graphicsDescriptorSetOffsets[2];
     GrDescriptorSet* computeDescriptorSets[2];
     unsigned computeDescriptorSetOffsets[2];
     unsigned attachmentCount;
     VkImageView attachments[GR_MAX_COLOR_TARGETS + 1]; // Extra depth target
+    GrFramebufferAttachment attachmentInfos[GR_MAX_COLOR_TARGETS + 1];
+    const GrColorTargetView* colorTargetViews[GR_MAX_COLOR_TARGETS]; // Per slot, as bound
+    unsigned loadOpClearCount; // Clears for the load ops of the next render pass
+    const GrColorTargetView* loadOpClearViews[GR_MAX_COLOR_TARGETS];
+    VkClearColorValue loadOpClearColors[GR_MAX_COLOR_TARGETS];
     VkExtent2D minExtent2D;
     uint32_t minLayerCount;
-    VkBufferView *dynamicMemoryViews;
-    unsigned dynamicBufferViewsCount;
+    GrBufferViewCache bufferViewCache;
+    void* scratch; // Scratch storage for translated command arguments
+    size_t scratchSize;
     VkDescriptorPool* dynamicBindingPools;
     unsigned descriptorPoolCount;
+    unsigned activeDescriptorPool; // Pools past this one are empty
+    GrFramebuffer** framebuffers; // Referenced until the command buffer is recorded again
+    unsigned framebufferCount;
+    unsigned framebufferCapacity;
+    GrRenderPassKey* renderPassKeys; // Variants referenced until recorded again
+    unsigned renderPassKeyCount;
+    unsigned renderPassKeyCapacity;
+    GrImageStateTracker* imageStateTrackers;
+    unsigned imageStateTrackerCount;
+    unsigned imageStateTrackerCapacity;
+    unsigned* imageStateTable; // Tracker index + 1, 0 is an empty slot
+    unsigned imageStateTableSize;
+    unsigned imageBarrierBatch;
+    VkImageMemoryBarrier* imageBarriers; // Scratch storage
+    unsigned imageBarrierCapacity;
+    VkBufferMemoryBarrier* bufferBarriers; // Scratch storage
+    unsigned bufferBarrierCapacity;
+    unsigned barrierCount;
+    unsigned elidedTransitionCount;
+    GrCmdStream cmdStream;
+    GrCmdBuffer** secondaryCmdBuffers; // Kept across recordings
+    unsigned secondaryCmdBufferCount; // Used by the current recording
+    unsigned secondaryCmdBufferCapacity;
     GR_MEMORY_VIEW_ATTACH_INFO graphicsBufferInfo;
     GR_MEMORY_VIEW_ATTACH_INFO computeBufferInfo;
+    GrRenderPassKey renderPassKey; // Of the active render pass
     bool hasActiveRenderPass;
-    bool isDirty;
-    bool isDynamicBufferDirty;// TODO: make the same flag for compute
+    uint32_t dirtyFlags;
 } GrCmdBuffer;
 
 typedef struct _GrColorBlendStateObject {
@@ -80,16 +247,25 @@ typedef struct _GrImageView {
 
 typedef struct _GrColorTargetView {
     GrStructType sType;
+    GrDevice* grDevice;
     VkImageView imageView;
     VkExtent3D extent;
     uint32_t layerCount;
+    VkFormat format;
+    VkImageUsageFlags usage;
+    const GrImage* grImage;
+    uint32_t mipLevel;
+    uint32_t baseArraySlice;
 } GrColorTargetView;
 
 typedef struct _GrDepthTargetView {
     GrStructType sType;
+    GrDevice* grDevice;
     VkImageView imageView;
     VkExtent3D extent;
     uint32_t layerCount;
+    VkFormat format;
+    VkImageUsageFlags usage;
 } GrDepthTargetView;
 
 typedef struct _GrDepthStencilStateObject {
@@ -160,19 +336,165 @@ typedef struct _GrGlobalPipelineLayouts {
     VkPipelineLayout computePipelineLayout;
 } GrGlobalPipelineLayouts;
 
+typedef struct _GrRenderPassEntry GrRenderPassEntry;
+
+typedef struct _GrRenderPassEntry {
+    GrRenderPassKey key;
+    uint32_t hash;
+    VkRenderPass renderPass;
+    unsigned refCount;
+    GrRenderPassEntry* next;
+} GrRenderPassEntry;
+
+#define RENDER_PASS_BUCKET_COUNT 64
+
+typedef struct _GrRenderPassCache {
+    SRWLOCK lock;
+    GrRenderPassEntry* buckets[RENDER_PASS_BUCKET_COUNT];
+} GrRenderPassCache;
+
+// Imageless framebuffers only depend on the attachment descriptions, regular ones on the views
+typedef struct _GrFramebufferKey {
+    GrRenderPassKey renderPassKey;
+    VkFramebufferCreateFlags flags;
+    uint32_t attachmentCount;
+    VkImageView attachments[GR_MAX_COLOR_TARGETS + 1]; // Null for imageless framebuffers
+    GrFramebufferAttachment attachmentInfos[GR_MAX_COLOR_TARGETS + 1]; // Zero for regular ones
+    uint32_t width;
+    uint32_t height;
+    uint32_t layerCount;
+} GrFramebufferKey;
+
+typedef struct _GrFramebuffer {
+    GrFramebufferKey key;
+    uint32_t hash;
+    VkFramebuffer framebuffer;
+    volatile LONG refCount; // One for the cache while linked, one per referencing command buffer
+    volatile LONG lastUse;
+    GrFramebuffer* next;
+} GrFramebuffer;
+
+#define FRAMEBUFFER_BUCKET_COUNT 64
+#define FRAMEBUFFER_CACHE_CAPACITY 512
+
+typedef struct _GrFramebufferCache {
+    SRWLOCK lock;
+    volatile LONG useCounter;
+    unsigned entryCount;
+    GrFramebuffer* buckets[FRAMEBUFFER_BUCKET_COUNT];
+} GrFramebufferCache;
+
+#define PIPELINE_BUCKET_COUNT 256
+
+// Graphics and compute pipelines shared between identical create infos
+typedef struct _GrPipelineDedupCache {
+    SRWLOCK lock;
+    GrPipeline* buckets[PIPELINE_BUCKET_COUNT];
+} GrPipelineDedupCache;
+
+typedef struct _GrPipelineCache {
+    VkDevice device;
+    VkPipelineCache pipelineCache;
+    char* path;
+    volatile LONG isDirty;
+    volatile LONG64 dataSize; // As of the last pipeline creation
+    HANDLE saveThread;
+    HANDLE stopEvent;
+} GrPipelineCache;
+
+typedef void (*GrPipelineJobProc)(GrPipeline* grPipeline);
+
+typedef struct _GrPipelineJob GrPipelineJob;
+
+typedef struct _GrPipelineJob {
+    GrPipelineJobProc proc;
+    GrPipeline* grPipeline;
+    GrPipelineJob* next;
+} GrPipelineJob;
+
+// Worker threads running pipeline jobs in submission order
+typedef struct _GrPipelineCompiler {
+    SRWLOCK lock;
+    CONDITION_VARIABLE jobAvailable;
+    GrPipelineJob* head;
+    GrPipelineJob* tail;
+    bool isStopping;
+    unsigned threadCount;
+    HANDLE* threads;
+} GrPipelineCompiler;
+
+typedef void (*GrWorkerJobProc)(void* data);
+
+typedef struct _GrWorkerJob GrWorkerJob;
+
+// Jobs that are waited on together
+typedef struct _GrWorkerBatch {
+    unsigned pendingJobCount; // Protected by the pool lock
+} GrWorkerBatch;
+
+typedef struct _GrWorkerJob {
+    GrWorkerJobProc proc;
+    void* data;
+    GrWorkerBatch* batch;
+    GrWorkerJob* next;
+} GrWorkerJob;
+
+typedef struct _GrWorkerPool {
+    SRWLOCK lock;
+    CONDITION_VARIABLE jobAvailable;
+    CONDITION_VARIABLE batchDone;
+    GrWorkerJob* head;
+    GrWorkerJob* tail;
+    bool isStopping;
+    unsigned threadCount;
+    HANDLE* threads;
+} GrWorkerPool;
+
+// Recycled command pools of a queue family, only accessed on command buffer creation and destruction
+typedef struct _GrCommandPoolSet {
+    SRWLOCK lock;
+    unsigned queueIndex;
+    VkCommandPool* pools; // Every pool handed out, in use or not
+    unsigned poolCount;
+    unsigned poolCapacity;
+    VkCommandPool* freePools;
+    unsigned freePoolCount;
+    unsigned freePoolCapacity;
+} GrCommandPoolSet;
+
 typedef struct _GrDevice {
     GrStructType sType;
     VkDevice device;
     VkPhysicalDevice physicalDevice;
     VkPhysicalDeviceMemoryProperties memoryProperties;
     unsigned universalQueueIndex;
-    VkCommandPool universalCommandPool;
+    VkCommandPool universalCommandPool; // Internal use only
+    GrCommandPoolSet universalCommandPools;
     unsigned computeQueueIndex;
-    VkCommandPool computeCommandPool;
+    GrCommandPoolSet computeCommandPools;
     GrGlobalDescriptorSet globalDescriptorSet;
     GrGlobalPipelineLayouts pipelineLayouts;
+    GrPipelineCache pipelineCache;
+    GrPipelineCompiler pipelineCompiler;
+    GrWorkerPool translationWorkerPool; // Translates deferred commands in parallel
+    GrRenderPassCache renderPassCache;
+    GrFramebufferCache framebufferCache;
+    GrPipelineDedupCache pipelineDedupCache;
     unsigned vDescriptorSetMemoryTypeIndex;
     bool pushDescriptorSetSupported;// TODO: move this in separate struct
+    bool imagelessFramebufferSupported;
+    bool pipelineCreationCacheControlSupported;
+    bool fastPipelineCompileEnabled;
+    bool asyncPipelineCreationEnabled;
+    bool frameStatsEnabled;
+    bool deferredCommandsEnabled;
+    bool imageStateCheckEnabled;
+    SRWLOCK imageStateLock;
+    volatile LONG frameBarrierCount;
+    volatile LONG frameElidedTransitionCount;
+    volatile LONG frameRecordedCommandCount;
+    volatile LONG frameTranslatedCommandCount;
+    unsigned frameIndex;
 } GrDevice;
 
 typedef struct _GrFence {
@@ -197,6 +519,7 @@ typedef struct _GrGpuMemory {
     VkDeviceMemory deviceMemory;
     VkDevice device;
     VkBuffer buffer;
+    uint64_t id; // Unique for the lifetime of the process
 } GrGpuMemory;
 
 typedef struct _GrImage {
@@ -206,6 +529,10 @@ typedef struct _GrImage {
     VkExtent3D extent;
     uint32_t layerCount;
     VkFormat format;
+    VkImageUsageFlags usage;
+    uint32_t mipLevels;
+    GR_IMAGE_STATE* subresourceStates; // As left by the last submission, zero if unknown
+    uint32_t viewFormatCount; // Of the format list it was created with
 } GrImage;
 
 typedef struct _GrMsaaStateObject {
@@ -217,11 +544,62 @@ typedef struct _GrPhysicalGpu {
     VkPhysicalDevice physicalDevice;
 } GrPhysicalGpu;
 
+typedef struct _GrPipelineTargetState {
+    GR_BOOL blendEnable;
+    GR_FORMAT format;
+    GR_UINT8 channelWriteMask;
+} GrPipelineTargetState;
+
+// Fixed-function state of GR_GRAPHICS_PIPELINE_CREATE_INFO, without the shader pointers
+typedef struct _GrGraphicsPipelineState {
+    GR_ENUM topology;
+    GR_UINT patchControlPoints;
+    GR_BOOL depthClipEnable;
+    GR_BOOL alphaToCoverageEnable;
+    GR_BOOL dualSourceBlendEnable;
+    GR_ENUM logicOp;
+    GrPipelineTargetState targets[GR_MAX_COLOR_TARGETS];
+    GR_FORMAT dbFormat;
+    GR_FLAGS flags;
+} GrGraphicsPipelineState;
+
+typedef struct _GrPipelineStage {
+    VkShaderStageFlagBits flags;
+    uint32_t codeSize;
+    uint32_t* code; // SPIR-V
+} GrPipelineStage;
+
+// Shader inputs kept until an asynchronously created pipeline gets compiled
+typedef struct _GrPendingPipelineStage {
+    VkShaderStageFlagBits flags;
+    bool isPrecompiledSpv;
+    unsigned codeSize;
+    uint32_t* code;
+    GR_PIPELINE_SHADER* mappings;
+} GrPendingPipelineStage;
+
 typedef struct _GrPipeline {
     GrStructType sType;
+    GrDevice* grDevice;
+    volatile LONG refCount;
+    uint32_t hash;
+    unsigned keySize;
+    uint8_t* key; // NULL if the pipeline isn't shared
+    GrPipeline* next;
     VkPipeline pipeline;
+    VkPipeline optimizedPipeline; // Replaces pipeline once isOptimized is set
+    volatile LONG isOptimized;
+    HANDLE readyEvent; // Only set for asynchronously created pipelines
+    volatile LONG isPending;
+    unsigned pendingStageCount;
+    GrPendingPipelineStage* pendingStages;
+    VkPipelineBindPoint bindPoint;
     VkPipelineLayout pipelineLayout;
+    GrRenderPassKey renderPassKey;
     VkRenderPass renderPass;
+    GrGraphicsPipelineState state;
+    unsigned stageCount;
+    GrPipelineStage stages[MAX_STAGE_COUNT];
 } GrPipeline;
 
 typedef struct _GrRasterStateObject {
@@ -242,9 +620,9 @@ typedef struct _GrShader {
     GrStructType sType;
     GrDevice* device;
     bool isPrecompiledSpv;
-    VkShaderModule precompiledModule;
     uint32_t* code;
     uint32_t  codeSize;
+    uint64_t codeHash;
 } GrShader;
 
 typedef struct _GrQueue {
@@ -19,6 +19,63 @@ void getGrImageMemoryProperties(const GrImage* grImage, GR_MEMORY_REQUIREMENTS*
 
 // Generic API Object Management functions
 
+GR_RESULT grDestroyObject(
+    GR_OBJECT object)
+{
+    LOGT("%p\n", object);
+    GrObject* grObject = (GrObject*)object;
+    if (grObject == NULL) {
+        return GR_ERROR_INVALID_HANDLE;
+    }
+
+    switch (grObject->sType) {
+    case GR_STRUCT_TYPE_PIPELINE:
+        // Pipelines are shared between identical create infos
+        releasePipeline((GrPipeline*)grObject);
+        break;
+    case GR_STRUCT_TYPE_SHADER: {
+        GrShader* grShader = (GrShader*)grObject;
+
+        // Pipelines keep their own translated code
+        free(grShader->code);
+        free(grShader);
+    }   break;
+    case GR_STRUCT_TYPE_COMMAND_BUFFER:
+        destroyCmdBuffer((GrCmdBuffer*)grObject);
+        break;
+    case GR_STRUCT_TYPE_IMAGE: {
+        GrImage* grImage = (GrImage*)grObject;
+
+        vki.vkDestroyImage(grImage->device->device, grImage->image, NULL);
+        free(grImage->subresourceStates);
+        free(grImage);
+    }   break;
+    case GR_STRUCT_TYPE_COLOR_TARGET_VIEW: {
+        GrColorTargetView* grColorTargetView = (GrColorTargetView*)grObject;
+        GrDevice* grDevice = grColorTargetView->grDevice;
+
+        invalidateFramebuffers(&grDevice->framebufferCache, grDevice->device,
+                               grColorTargetView->imageView);
+        vki.vkDestroyImageView(grDevice->device, grColorTargetView->imageView, NULL);
+        free(grColorTargetView);
+    }   break;
+    case GR_STRUCT_TYPE_DEPTH_STENCIL_TARGET_VIEW: {
+        GrDepthTargetView* grDepthTargetView = (GrDepthTargetView*)grObject;
+        GrDevice* grDevice = grDepthTargetView->grDevice;
+
+        invalidateFramebuffers(&grDevice->framebufferCache, grDevice->device,
+                               grDepthTargetView->imageView);
+        vki.vkDestroyImageView(grDevice->device, grDepthTargetView->imageView, NULL);
+        free(grDepthTargetView);
+    }   break;
+    default:
+        LOGW("unsupported object type %d\n", grObject->sType);
+        return GR_UNSUPPORTED;
+    }
+
+    return GR_SUCCESS;
+}
+
 GR_RESULT grGetObjectInfo(
     GR_BASE_OBJECT object,
     GR_ENUM infoType,
@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include "mantle_internal.h"
+
+#define PATH_LEN                (MAX_PATH)
+#define SAVE_INTERVAL_MS        (30 * 1000)
+
+// Vulkan pipeline cache header, version one
+typedef struct {
+    uint32_t headerSize;
+    uint32_t headerVersion;
+    uint32_t vendorID;
+    uint32_t deviceID;
+    uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+} PipelineCacheHeader;
+
+static void* loadPipelineCacheData(
+    size_t* size,
+    const char* path,
+    const VkPhysicalDeviceProperties* physicalDeviceProps)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    *size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    void* data = malloc(*size);
+    if (fread(data, 1, *size, file) != *size) {
+        LOGW("failed to read %s\n", path);
+        free(data);
+        fclose(file);
+        return NULL;
+    }
+    fclose(file);
+
+    // Some drivers don't validate the blob thoroughly, discard it ourselves if it doesn't match
+    const PipelineCacheHeader* header = (PipelineCacheHeader*)data;
+    if (*size < sizeof(PipelineCacheHeader) ||
+        header->headerSize < sizeof(PipelineCacheHeader) || header->headerSize > *size ||
+        header->headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+        header->vendorID != physicalDeviceProps->vendorID ||
+        header->deviceID != physicalDeviceProps->deviceID ||
+        memcmp(header->pipelineCacheUUID, physicalDeviceProps->pipelineCacheUUID,
+               VK_UUID_SIZE) != 0) {
+        LOGW("discarding incompatible pipeline cache %s\n", path);
+        free(data);
+        return NULL;
+    }
+
+    return data;
+}
+
+static bool writePipelineCache(
+    GrPipelineCache* grPipelineCache)
+{
+    size_t size = 0;
+    if (vki.vkGetPipelineCacheData(grPipelineCache->device, grPipelineCache->pipelineCache,
+                                   &size, NULL) != VK_SUCCESS) {
+        LOGE("vkGetPipelineCacheData failed\n");
+        return false;
+    }
+
+    void* data = malloc(size);
+    if (vki.vkGetPipelineCacheData(grPipelineCache->device, grPipelineCache->pipelineCache,
+                                   &size, data) != VK_SUCCESS) {
+        LOGE("vkGetPipelineCacheData failed\n");
+        free(data);
+        return false;
+    }
+
+    // Write to a temporary file first so that a crash never leaves a truncated cache behind
+    char tempPath[PATH_LEN];
+    snprintf(tempPath, PATH_LEN, "%s.tmp", grPipelineCache->path);
+
+    FILE* file = fopen(tempPath, "wb");
+    if (file == NULL) {
+        LOGW("failed to open %s\n", tempPath);
+        free(data);
+        return false;
+    }
+
+    bool written = fwrite(data, 1, size, file) == size;
+    fclose(file);
+    free(data);
+
+    if (!written || !MoveFileEx(tempPath, grPipelineCache->path, MOVEFILE_REPLACE_EXISTING)) {
+        LOGW("failed to write %s\n", grPipelineCache->path);
+        remove(tempPath);
+        return false;
+    }
+
+    LOGV("saved %llu bytes of pipeline cache data\n", (unsigned long long)size);
+    return true;
+}
+
+static void savePipelineCache(
+    GrPipelineCache* grPipelineCache)
+{
+    if (InterlockedExchange(&grPipelineCache->isDirty, 0) == 0) {
+        return;
+    }
+
+    if (!writePipelineCache(grPipelineCache)) {
+        // Try again with the next save
+        InterlockedExchange(&grPipelineCache->isDirty, 1);
+    }
+}
+
+static DWORD WINAPI saveThreadProc(
+    LPVOID param)
+{
+    GrPipelineCache* grPipelineCache = (GrPipelineCache*)param;
+
+    while (WaitForSingleObject(grPipelineCache->stopEvent, SAVE_INTERVAL_MS) == WAIT_TIMEOUT) {
+        savePipelineCache(grPipelineCache);
+    }
+
+    return 0;
+}
+
+void initPipelineCache(
+    GrPipelineCache* grPipelineCache,
+    VkDevice device,
+    const VkPhysicalDeviceProperties* physicalDeviceProps,
+    const char* dirPath)
+{
+    void* initialData = NULL;
+    size_t initialSize = 0;
+
+    *grPipelineCache = (GrPipelineCache) {
+        .device = device,
+        .pipelineCache = VK_NULL_HANDLE,
+        .path = NULL,
+        .isDirty = 0,
+        .dataSize = 0,
+        .saveThread = NULL,
+        .stopEvent = NULL,
+    };
+
+    if (dirPath != NULL) {
+        // Blobs are only valid for the exact device and driver that produced them
+        char* path = malloc(PATH_LEN);
+        int offset = snprintf(path, PATH_LEN, "%s\\pipelines_", dirPath);
+        for (unsigned i = 0; i < VK_UUID_SIZE && offset < PATH_LEN; i++) {
+            offset += snprintf(&path[offset], PATH_LEN - offset, "%02x",
+                               physicalDeviceProps->pipelineCacheUUID[i]);
+        }
+        if (offset < PATH_LEN) {
+            snprintf(&path[offset], PATH_LEN - offset, "_%08x.bin",
+                     physicalDeviceProps->driverVersion);
+        }
+
+        grPipelineCache->path = path;
+        initialData = loadPipelineCacheData(&initialSize, path, physicalDeviceProps);
+        if (initialData != NULL) {
+            LOGV("loaded %llu bytes of pipeline cache data\n", (unsigned long long)initialSize);
+        }
+    }
+
+    VkPipelineCacheCreateInfo createInfo = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .initialDataSize = initialSize,
+        .pInitialData = initialData,
+    };
+
+    VkResult res = vki.vkCreatePipelineCache(device, &createInfo, NULL,
+                                             &grPipelineCache->pipelineCache);
+    if (res != VK_SUCCESS && initialData != NULL) {
+        LOGW("vkCreatePipelineCache failed with initial data (%d), starting empty\n", res);
+        createInfo.initialDataSize = 0;
+        createInfo.pInitialData = NULL;
+        res = vki.vkCreatePipelineCache(device, &createInfo, NULL, &grPipelineCache->pipelineCache);
+    }
+    free(initialData);
+
+    if (res != VK_SUCCESS) {
+        // Pipelines are still created without a cache
+        LOGE("vkCreatePipelineCache failed (%d)\n", res);
+        grPipelineCache->pipelineCache = VK_NULL_HANDLE;
+        return;
+    }
+
+    size_t dataSize = 0;
+    if (vki.vkGetPipelineCacheData(device, grPipelineCache->pipelineCache, &dataSize,
+                                   NULL) == VK_SUCCESS) {
+        grPipelineCache->dataSize = dataSize;
+    }
+
+    if (grPipelineCache->path != NULL) {
+        grPipelineCache->stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        grPipelineCache->saveThread = CreateThread(NULL, 0, saveThreadProc, grPipelineCache, 0,
+                                                   NULL);
+    }
+}
+
+void markPipelineCacheDirty(
+    GrPipelineCache* grPipelineCache)
+{
+    size_t size = 0;
+
+    if (grPipelineCache->pipelineCache == VK_NULL_HANDLE) {
+        return;
+    }
+
+    // Pipelines the driver found in the cache don't add any data, skip rewriting the file for them
+    if (vki.vkGetPipelineCacheData(grPipelineCache->device, grPipelineCache->pipelineCache,
+                                   &size, NULL) != VK_SUCCESS) {
+        return;
+    }
+    if (InterlockedExchange64(&grPipelineCache->dataSize, size) != (LONG64)size) {
+        InterlockedExchange(&grPipelineCache->isDirty, 1);
+    }
+}
+
+void destroyPipelineCache(
+    GrPipelineCache* grPipelineCache)
+{
+    if (grPipelineCache->saveThread != NULL) {
+        SetEvent(grPipelineCache->stopEvent);
+        WaitForSingleObject(grPipelineCache->saveThread, INFINITE);
+        CloseHandle(grPipelineCache->saveThread);
+        CloseHandle(grPipelineCache->stopEvent);
+    }
+
+    if (grPipelineCache->pipelineCache != VK_NULL_HANDLE) {
+        if (grPipelineCache->path != NULL) {
+            savePipelineCache(grPipelineCache);
+        }
+        vki.vkDestroyPipelineCache(grPipelineCache->device, grPipelineCache->pipelineCache, NULL);
+    }
+
+    free(grPipelineCache->path);
+}
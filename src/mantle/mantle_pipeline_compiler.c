@@ -0,0 +1,126 @@
+#include "mantle_internal.h"
+
+static DWORD WINAPI compilerThreadProc(
+    LPVOID param)
+{
+    GrPipelineCompiler* grPipelineCompiler = (GrPipelineCompiler*)param;
+
+    AcquireSRWLockExclusive(&grPipelineCompiler->lock);
+
+    for (;;) {
+        while (grPipelineCompiler->head == NULL && !grPipelineCompiler->isStopping) {
+            SleepConditionVariableSRW(&grPipelineCompiler->jobAvailable, &grPipelineCompiler->lock,
+                                      INFINITE, 0);
+        }
+        if (grPipelineCompiler->isStopping) {
+            break;
+        }
+
+        GrPipelineJob* job = grPipelineCompiler->head;
+        grPipelineCompiler->head = job->next;
+        if (grPipelineCompiler->head == NULL) {
+            grPipelineCompiler->tail = NULL;
+        }
+
+        ReleaseSRWLockExclusive(&grPipelineCompiler->lock);
+
+        job->proc(job->grPipeline);
+        releasePipeline(job->grPipeline);
+        free(job);
+
+        AcquireSRWLockExclusive(&grPipelineCompiler->lock);
+    }
+
+    ReleaseSRWLockExclusive(&grPipelineCompiler->lock);
+
+    return 0;
+}
+
+void initPipelineCompiler(
+    GrPipelineCompiler* grPipelineCompiler,
+    unsigned threadCount,
+    int threadPriority)
+{
+    *grPipelineCompiler = (GrPipelineCompiler) {
+        .lock = SRWLOCK_INIT,
+        .jobAvailable = CONDITION_VARIABLE_INIT,
+        .head = NULL,
+        .tail = NULL,
+        .isStopping = false,
+        .threadCount = 0,
+        .threads = malloc(sizeof(HANDLE) * threadCount),
+    };
+
+    for (unsigned i = 0; i < threadCount; i++) {
+        HANDLE thread = CreateThread(NULL, 0, compilerThreadProc, grPipelineCompiler, 0, NULL);
+        if (thread == NULL) {
+            LOGW("failed to create pipeline compiler thread\n");
+            break;
+        }
+
+        SetThreadPriority(thread, threadPriority);
+        grPipelineCompiler->threads[grPipelineCompiler->threadCount++] = thread;
+    }
+}
+
+bool queuePipelineJob(
+    GrPipelineCompiler* grPipelineCompiler,
+    GrPipelineJobProc proc,
+    GrPipeline* grPipeline)
+{
+    if (grPipelineCompiler->threadCount == 0) {
+        return false;
+    }
+
+    GrPipelineJob* job = malloc(sizeof(GrPipelineJob));
+    *job = (GrPipelineJob) {
+        .proc = proc,
+        .grPipeline = grPipeline,
+        .next = NULL,
+    };
+
+    // Keep the pipeline alive until the job is done
+    InterlockedIncrement(&grPipeline->refCount);
+
+    AcquireSRWLockExclusive(&grPipelineCompiler->lock);
+
+    if (grPipelineCompiler->tail != NULL) {
+        grPipelineCompiler->tail->next = job;
+    } else {
+        grPipelineCompiler->head = job;
+    }
+    grPipelineCompiler->tail = job;
+
+    ReleaseSRWLockExclusive(&grPipelineCompiler->lock);
+
+    WakeConditionVariable(&grPipelineCompiler->jobAvailable);
+    return true;
+}
+
+void destroyPipelineCompiler(
+    GrPipelineCompiler* grPipelineCompiler)
+{
+    AcquireSRWLockExclusive(&grPipelineCompiler->lock);
+    grPipelineCompiler->isStopping = true;
+    ReleaseSRWLockExclusive(&grPipelineCompiler->lock);
+
+    WakeAllConditionVariable(&grPipelineCompiler->jobAvailable);
+
+    for (unsigned i = 0; i < grPipelineCompiler->threadCount; i++) {
+        WaitForSingleObject(grPipelineCompiler->threads[i], INFINITE);
+        CloseHandle(grPipelineCompiler->threads[i]);
+    }
+    free(grPipelineCompiler->threads);
+
+    // Drop jobs that haven't started
+    GrPipelineJob* job = grPipelineCompiler->head;
+    while (job != NULL) {
+        GrPipelineJob* next = job->next;
+
+        releasePipeline(job->grPipeline);
+        free(job);
+        job = next;
+    }
+    grPipelineCompiler->head = NULL;
+    grPipelineCompiler->tail = NULL;
+}
@@ -71,7 +71,20 @@ GR_RESULT grQueueSubmit(
 
     VkCommandBuffer* vkCommandBuffers = malloc(sizeof(VkCommandBuffer) * cmdBufferCount);
     for (int i = 0; i < cmdBufferCount; i++) {
-        vkCommandBuffers[i] = ((GrCmdBuffer*)pCmdBuffers[i])->commandBuffer;
+        GrCmdBuffer* grCmdBuffer = (GrCmdBuffer*)pCmdBuffers[i];
+
+        if (grQueue->grDevice->imageStateCheckEnabled) {
+            checkImageStates(grQueue->grDevice, grCmdBuffer);
+        }
+        InterlockedExchangeAdd(&grQueue->grDevice->frameBarrierCount, grCmdBuffer->barrierCount);
+        InterlockedExchangeAdd(&grQueue->grDevice->frameElidedTransitionCount,
+                               grCmdBuffer->elidedTransitionCount);
+        InterlockedExchangeAdd(&grQueue->grDevice->frameRecordedCommandCount,
+                               grCmdBuffer->cmdStream.recordedCount);
+        InterlockedExchangeAdd(&grQueue->grDevice->frameTranslatedCommandCount,
+                               grCmdBuffer->cmdStream.translatedCount);
+
+        vkCommandBuffers[i] = grCmdBuffer->commandBuffer;
     }
 
     const VkSubmitInfo submitInfo = {
@@ -0,0 +1,251 @@
+#include "mantle_internal.h"
+
+static uint32_t hashRenderPassKey(
+    const GrRenderPassKey* key)
+{
+    const uint8_t* bytes = (const uint8_t*)key;
+    uint32_t hash = 2166136261u; // FNV-1a
+
+    for (unsigned i = 0; i < sizeof(GrRenderPassKey); i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static VkRenderPass createRenderPass(
+    VkDevice vkDevice,
+    const GrRenderPassKey* key)
+{
+    VkRenderPass renderPass = VK_NULL_HANDLE;
+    VkAttachmentDescription descriptions[GR_MAX_COLOR_TARGETS + 1];
+    VkAttachmentReference colorReferences[GR_MAX_COLOR_TARGETS];
+    VkAttachmentReference depthStencilReference;
+    unsigned descriptionCount = 0;
+    unsigned colorReferenceCount = 0;
+    bool hasDepthStencil = false;
+
+    for (int i = 0; i < GR_MAX_COLOR_TARGETS; i++) {
+        if (key->colorFormats[i] == VK_FORMAT_UNDEFINED) {
+            continue;
+        }
+
+        descriptions[descriptionCount] = (VkAttachmentDescription) {
+            .flags = 0,
+            .format = key->colorFormats[i],
+            .samples = VK_SAMPLE_COUNT_1_BIT,
+            .loadOp = (key->colorClearMask & (1 << i)) != 0 ?
+                      VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_LOAD,
+            .storeOp = (key->colorStoreMask & (1 << i)) != 0 ?
+                       VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE,
+            .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+            .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+            .initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+            .finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+        };
+
+        colorReferences[colorReferenceCount] = (VkAttachmentReference) {
+            .attachment = descriptionCount,
+            .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+        };
+
+        descriptionCount++;
+        colorReferenceCount++;
+    }
+
+    if (key->depthStencilFormat != VK_FORMAT_UNDEFINED) {
+        bool hasDepth = (key->depthStencilAspects & VK_IMAGE_ASPECT_DEPTH_BIT) != 0;
+        bool hasStencil = (key->depthStencilAspects & VK_IMAGE_ASPECT_STENCIL_BIT) != 0;
+
+        VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        if (hasDepth && hasStencil) {
+            layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+        } else if (hasDepth && !hasStencil) {
+            layout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL;
+        } else if (!hasDepth && hasStencil) {
+            layout = VK_IMAGE_LAYOUT_STENCIL_ATTACHMENT_OPTIMAL;
+        }
+
+        descriptions[descriptionCount] = (VkAttachmentDescription) {
+            .flags = 0,
+            .format = key->depthStencilFormat,
+            .samples = VK_SAMPLE_COUNT_1_BIT,
+            .loadOp = hasDepth ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+            .storeOp = hasDepth ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE,
+            .stencilLoadOp = hasStencil ?
+                             VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+            .stencilStoreOp = hasStencil ?
+                             VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE,
+            .initialLayout = layout,
+            .finalLayout = layout,
+        };
+
+        depthStencilReference = (VkAttachmentReference) {
+            .attachment = descriptionCount,
+            .layout = layout,
+        };
+
+        descriptionCount++;
+        hasDepthStencil = true;
+    }
+
+    const VkSubpassDescription subpass = {
+        .flags = 0,
+        .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+        .inputAttachmentCount = 0,
+        .pInputAttachments = NULL,
+        .colorAttachmentCount = colorReferenceCount,
+        .pColorAttachments = colorReferences,
+        .pResolveAttachments = NULL,
+        .pDepthStencilAttachment = hasDepthStencil ? &depthStencilReference : NULL,
+        .preserveAttachmentCount = 0,
+        .pPreserveAttachments = NULL,
+    };
+
+    const VkRenderPassCreateInfo renderPassCreateInfo = {
+        .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .attachmentCount = descriptionCount,
+        .pAttachments = descriptions,
+        .subpassCount = 1,
+        .pSubpasses = &subpass,
+        .dependencyCount = 0,
+        .pDependencies = NULL,
+    };
+
+    if (vki.vkCreateRenderPass(vkDevice, &renderPassCreateInfo, NULL, &renderPass) != VK_SUCCESS) {
+        LOGE("vkCreateRenderPass failed\n");
+        return VK_NULL_HANDLE;
+    }
+
+    return renderPass;
+}
+
+static GrRenderPassEntry* findRenderPassEntry(
+    GrRenderPassCache* grRenderPassCache,
+    const GrRenderPassKey* key,
+    uint32_t hash)
+{
+    GrRenderPassEntry* entry = grRenderPassCache->buckets[hash % RENDER_PASS_BUCKET_COUNT];
+
+    while (entry != NULL) {
+        if (entry->hash == hash && memcmp(&entry->key, key, sizeof(GrRenderPassKey)) == 0) {
+            return entry;
+        }
+        entry = entry->next;
+    }
+    return NULL;
+}
+
+void getRenderPassKey(
+    GrRenderPassKey* key,
+    const GR_PIPELINE_CB_TARGET_STATE* cbTargets,
+    const GR_PIPELINE_DB_STATE* dbTarget)
+{
+    memset(key, 0, sizeof(GrRenderPassKey));
+
+    for (int i = 0; i < GR_MAX_COLOR_TARGETS; i++) {
+        key->colorFormats[i] = getVkFormat(cbTargets[i].format);
+        if (key->colorFormats[i] != VK_FORMAT_UNDEFINED && (cbTargets[i].channelWriteMask & 0xF) != 0) {
+            key->colorStoreMask |= 1 << i;
+        }
+    }
+
+    key->depthStencilFormat = getVkFormat(dbTarget->format);
+    if (key->depthStencilFormat != VK_FORMAT_UNDEFINED) {
+        // Table 10 in the API reference
+        if (dbTarget->format.channelFormat == GR_CH_FMT_R16 ||
+            dbTarget->format.channelFormat == GR_CH_FMT_R32 ||
+            dbTarget->format.channelFormat == GR_CH_FMT_R16G8 ||
+            dbTarget->format.channelFormat == GR_CH_FMT_R32G8) {
+            key->depthStencilAspects |= VK_IMAGE_ASPECT_DEPTH_BIT;
+        }
+        if (dbTarget->format.channelFormat == GR_CH_FMT_R8 ||
+            dbTarget->format.channelFormat == GR_CH_FMT_R16G8 ||
+            dbTarget->format.channelFormat == GR_CH_FMT_R32G8) {
+            key->depthStencilAspects |= VK_IMAGE_ASPECT_STENCIL_BIT;
+        }
+    }
+}
+
+VkRenderPass acquireRenderPass(
+    GrRenderPassCache* grRenderPassCache,
+    VkDevice device,
+    const GrRenderPassKey* key)
+{
+    uint32_t hash = hashRenderPassKey(key);
+    VkRenderPass renderPass = VK_NULL_HANDLE;
+
+    AcquireSRWLockExclusive(&grRenderPassCache->lock);
+
+    GrRenderPassEntry* entry = findRenderPassEntry(grRenderPassCache, key, hash);
+    if (entry != NULL) {
+        entry->refCount++;
+        renderPass = entry->renderPass;
+    } else {
+        renderPass = createRenderPass(device, key);
+        if (renderPass != VK_NULL_HANDLE) {
+            unsigned bucket = hash % RENDER_PASS_BUCKET_COUNT;
+
+            entry = malloc(sizeof(GrRenderPassEntry));
+            *entry = (GrRenderPassEntry) {
+                .key = *key,
+                .hash = hash,
+                .renderPass = renderPass,
+                .refCount = 1,
+                .next = grRenderPassCache->buckets[bucket],
+            };
+            grRenderPassCache->buckets[bucket] = entry;
+        }
+    }
+
+    ReleaseSRWLockExclusive(&grRenderPassCache->lock);
+
+    return renderPass;
+}
+
+void releaseRenderPass(
+    GrRenderPassCache* grRenderPassCache,
+    VkDevice device,
+    const GrRenderPassKey* key)
+{
+    uint32_t hash = hashRenderPassKey(key);
+
+    AcquireSRWLockExclusive(&grRenderPassCache->lock);
+
+    GrRenderPassEntry** entryPtr = &grRenderPassCache->buckets[hash % RENDER_PASS_BUCKET_COUNT];
+    while (*entryPtr != NULL) {
+        GrRenderPassEntry* entry = *entryPtr;
+
+        if (entry->hash == hash && memcmp(&entry->key, key, sizeof(GrRenderPassKey)) == 0) {
+            entry->refCount--;
+            if (entry->refCount == 0) {
+                vki.vkDestroyRenderPass(device, entry->renderPass, NULL);
+                *entryPtr = entry->next;
+                free(entry);
+            }
+            break;
+        }
+        entryPtr = &entry->next;
+    }
+
+    ReleaseSRWLockExclusive(&grRenderPassCache->lock);
+}
+
+void destroyRenderPassCache(
+    GrRenderPassCache* grRenderPassCache,
+    VkDevice device)
+{
+    for (unsigned i = 0; i < RENDER_PASS_BUCKET_COUNT; i++) {
+        GrRenderPassEntry* entry = grRenderPassCache->buckets[i];
+
+        while (entry != NULL) {
+            GrRenderPassEntry* next = entry->next;
+
+            vki.vkDestroyRenderPass(device, entry->renderPass, NULL);
+            free(entry);
+            entry = next;
+        }
+        grRenderPassCache->buckets[i] = NULL;
+    }
+}
@@ -1,128 +1,190 @@
 #include "mantle_internal.h"
 #include "amdilc.h"
 
+#define PIPELINE_BLOB_MAGIC     (0x50565247) // "GRVP"
+#define PIPELINE_BLOB_VERSION   (3)
+#define FNV_OFFSET_BASIS        (14695981039346656037ull)
+#define FNV_PRIME               (1099511628211ull)
+
 typedef struct _Stage {
     const GR_PIPELINE_SHADER* shader;
     VkShaderStageFlagBits flags;
 } Stage;
 
-static VkRenderPass getVkRenderPass(
-    const VkDevice vkDevice,
-    const GR_PIPELINE_CB_TARGET_STATE* cbTargets,
-    const GR_PIPELINE_DB_STATE* dbTarget)
+// Serialized pipeline layout: header, then each stage header followed by its SPIR-V
+typedef struct _PipelineBlobHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    uint32_t stageCount;
+    uint32_t bindPoint;
+    GrGraphicsPipelineState state;
+    GrRenderPassKey renderPassKey;
+} PipelineBlobHeader;
+
+typedef struct _PipelineBlobStage {
+    uint32_t flags;
+    uint32_t codeSize;
+} PipelineBlobStage;
+
+static uint64_t hashData(
+    uint64_t hash,
+    const void* data,
+    unsigned size)
 {
-    VkRenderPass renderPass = VK_NULL_HANDLE;
-    VkAttachmentDescription descriptions[GR_MAX_COLOR_TARGETS + 1];
-    VkAttachmentReference colorReferences[GR_MAX_COLOR_TARGETS];
-    VkAttachmentReference depthStencilReference;
-    unsigned descriptionCount = 0;
-    unsigned colorReferenceCount = 0;
-    bool hasDepthStencil = false;
+    const uint8_t* bytes = (const uint8_t*)data;
 
-    for (int i = 0; i < GR_MAX_COLOR_TARGETS; i++) {
-        const GR_PIPELINE_CB_TARGET_STATE* target = &cbTargets[i];
-        VkFormat vkFormat = getVkFormat(target->format);
+    // FNV-1a
+    for (unsigned i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * FNV_PRIME;
+    }
+    return hash;
+}
 
-        if (vkFormat == VK_FORMAT_UNDEFINED) {
-            continue;
-        }
+static void appendKeyData(
+    uint8_t** key,
+    unsigned* keySize,
+    const void* data,
+    unsigned size)
+{
+    *key = realloc(*key, *keySize + size);
+    memcpy(&(*key)[*keySize], data, size);
+    *keySize += size;
+}
 
-        descriptions[descriptionCount] = (VkAttachmentDescription) {
-            .flags = 0,
-            .format = vkFormat,
-            .samples = VK_SAMPLE_COUNT_1_BIT,
-            .loadOp = VK_ATTACHMENT_LOAD_OP_LOAD,
-            .storeOp = (target->channelWriteMask & 0xF) != 0 ?
-                       VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE,
-            .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
-            .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
-            .initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-            .finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-        };
+// Identifies everything that affects the compiled pipeline: fixed-function state, shader code
+// and descriptor mappings
+static uint8_t* getPipelineKey(
+    unsigned* keySize,
+    const GrGraphicsPipelineState* state,
+    unsigned stageCount,
+    const Stage* stages)
+{
+    uint8_t* key = NULL;
+
+    *keySize = 0;
+    appendKeyData(&key, keySize, state, sizeof(GrGraphicsPipelineState));
 
-        colorReferences[colorReferenceCount] = (VkAttachmentReference) {
-            .attachment = descriptionCount,
-            .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+    for (unsigned i = 0; i < stageCount; i++) {
+        const GrShader* grShader = (GrShader*)stages[i].shader->shader;
+        unsigned mappingSize = 0;
+        uint32_t* mappingData = ilcSerializeMappings(&mappingSize, stages[i].shader);
+
+        const uint64_t stageKey[] = {
+            stages[i].flags,
+            grShader->isPrecompiledSpv,
+            grShader->codeSize,
+            grShader->codeHash,
+            mappingSize,
         };
+        appendKeyData(&key, keySize, stageKey, sizeof(stageKey));
+        appendKeyData(&key, keySize, mappingData, mappingSize);
+        // Compare the code itself so that a hash collision can't share a pipeline
+        appendKeyData(&key, keySize, grShader->code, grShader->codeSize);
+        free(mappingData);
+    }
+
+    return key;
+}
 
-        descriptionCount++;
-        colorReferenceCount++;
-    }
-
-    VkFormat dbVkFormat = getVkFormat(dbTarget->format);
-    if (dbVkFormat != VK_FORMAT_UNDEFINED) {
-        // Table 10 in the API reference
-        bool hasDepth = dbTarget->format.channelFormat == GR_CH_FMT_R16 ||
-                        dbTarget->format.channelFormat == GR_CH_FMT_R32 ||
-                        dbTarget->format.channelFormat == GR_CH_FMT_R16G8 ||
-                        dbTarget->format.channelFormat == GR_CH_FMT_R32G8;
-        bool hasStencil = dbTarget->format.channelFormat == GR_CH_FMT_R8 ||
-                          dbTarget->format.channelFormat == GR_CH_FMT_R16G8 ||
-                          dbTarget->format.channelFormat == GR_CH_FMT_R32G8;
-
-        VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
-        if (hasDepth && hasStencil) {
-            layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-        } else if (hasDepth && !hasStencil) {
-            layout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL;
-        } else if (!hasDepth && hasStencil) {
-            layout = VK_IMAGE_LAYOUT_STENCIL_ATTACHMENT_OPTIMAL;
+static GrPipeline* findSharedPipeline(
+    GrPipelineDedupCache* grPipelineDedupCache,
+    const uint8_t* key,
+    unsigned keySize,
+    uint32_t hash)
+{
+    GrPipeline* grPipeline = grPipelineDedupCache->buckets[hash % PIPELINE_BUCKET_COUNT];
+
+    while (grPipeline != NULL) {
+        if (grPipeline->hash == hash && grPipeline->keySize == keySize &&
+            memcmp(grPipeline->key, key, keySize) == 0) {
+            return grPipeline;
         }
+        grPipeline = grPipeline->next;
+    }
+    return NULL;
+}
 
-        descriptions[descriptionCount] = (VkAttachmentDescription) {
-            .flags = 0,
-            .format = dbVkFormat,
-            .samples = VK_SAMPLE_COUNT_1_BIT,
-            .loadOp = hasDepth ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_DONT_CARE,
-            .storeOp = hasDepth ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE,
-            .stencilLoadOp = hasStencil ?
-                             VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_DONT_CARE,
-            .stencilStoreOp = hasStencil ?
-                             VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE,
-            .initialLayout = layout,
-            .finalLayout = layout,
-        };
+static GrPipeline* acquireSharedPipeline(
+    GrPipelineDedupCache* grPipelineDedupCache,
+    const uint8_t* key,
+    unsigned keySize,
+    uint32_t hash)
+{
+    AcquireSRWLockExclusive(&grPipelineDedupCache->lock);
 
-        depthStencilReference = (VkAttachmentReference) {
-            .attachment = descriptionCount,
-            .layout = layout,
-        };
+    GrPipeline* grPipeline = findSharedPipeline(grPipelineDedupCache, key, keySize, hash);
+    if (grPipeline != NULL) {
+        InterlockedIncrement(&grPipeline->refCount);
+    }
+
+    ReleaseSRWLockExclusive(&grPipelineDedupCache->lock);
 
-        descriptionCount++;
-        hasDepthStencil = true;
+    return grPipeline;
+}
+
+static void destroyPipeline(
+    GrPipeline* grPipeline)
+{
+    GrDevice* grDevice = grPipeline->grDevice;
+
+    vki.vkDestroyPipeline(grDevice->device, grPipeline->pipeline, NULL);
+    if (grPipeline->optimizedPipeline != VK_NULL_HANDLE) {
+        vki.vkDestroyPipeline(grDevice->device, grPipeline->optimizedPipeline, NULL);
+    }
+    if (grPipeline->renderPass != VK_NULL_HANDLE) {
+        releaseRenderPass(&grDevice->renderPassCache, grDevice->device,
+                          &grPipeline->renderPassKey);
+    }
+    for (unsigned i = 0; i < grPipeline->stageCount; i++) {
+        free(grPipeline->stages[i].code);
+    }
+    // Left over if the device was destroyed before the pipeline got compiled
+    for (unsigned i = 0; i < grPipeline->pendingStageCount; i++) {
+        free(grPipeline->pendingStages[i].code);
+        ilcFreeMappings(grPipeline->pendingStages[i].mappings);
     }
+    free(grPipeline->pendingStages);
+    if (grPipeline->readyEvent != NULL) {
+        CloseHandle(grPipeline->readyEvent);
+    }
+    free(grPipeline->key);
+    free(grPipeline);
+}
 
-    const VkSubpassDescription subpass = {
-        .flags = 0,
-        .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
-        .inputAttachmentCount = 0,
-        .pInputAttachments = NULL,
-        .colorAttachmentCount = colorReferenceCount,
-        .pColorAttachments = colorReferences,
-        .pResolveAttachments = NULL,
-        .pDepthStencilAttachment = hasDepthStencil ? &depthStencilReference : NULL,
-        .preserveAttachmentCount = 0,
-        .pPreserveAttachments = NULL,
-    };
+// Takes ownership of the key, returns the pipeline that ended up shared
+static GrPipeline* insertSharedPipeline(
+    GrPipelineDedupCache* grPipelineDedupCache,
+    GrPipeline* grPipeline,
+    uint8_t* key,
+    unsigned keySize,
+    uint32_t hash)
+{
+    AcquireSRWLockExclusive(&grPipelineDedupCache->lock);
 
-    const VkRenderPassCreateInfo renderPassCreateInfo = {
-        .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
-        .pNext = NULL,
-        .flags = 0,
-        .attachmentCount = descriptionCount,
-        .pAttachments = descriptions,
-        .subpassCount = 1,
-        .pSubpasses = &subpass,
-        .dependencyCount = 0,
-        .pDependencies = NULL,
-    };
+    // Another thread may have created the same pipeline in the meantime
+    GrPipeline* existingPipeline = findSharedPipeline(grPipelineDedupCache, key, keySize, hash);
+    if (existingPipeline != NULL) {
+        InterlockedIncrement(&existingPipeline->refCount);
+    } else {
+        unsigned bucket = hash % PIPELINE_BUCKET_COUNT;
 
-    if (vki.vkCreateRenderPass(vkDevice, &renderPassCreateInfo, NULL, &renderPass) != VK_SUCCESS) {
-        LOGE("vkCreateRenderPass failed\n");
-        return VK_NULL_HANDLE;
+        grPipeline->hash = hash;
+        grPipeline->keySize = keySize;
+        grPipeline->key = key;
+        grPipeline->next = grPipelineDedupCache->buckets[bucket];
+        grPipelineDedupCache->buckets[bucket] = grPipeline;
     }
 
-    return renderPass;
+    ReleaseSRWLockExclusive(&grPipelineDedupCache->lock);
+
+    if (existingPipeline != NULL) {
+        // A background job may still hold a reference
+        free(key);
+        releasePipeline(grPipeline);
+        return existingPipeline;
+    }
+    return grPipeline;
 }
 
 // Shader and Pipeline Functions
@@ -151,30 +213,17 @@ GR_RESULT grCreateShader(
     if (grShader == NULL) {
         return GR_ERROR_OUT_OF_MEMORY;
     }
+    // SPIR-V shaders are kept as is, IL is translated at pipeline creation
     grShader->isPrecompiledSpv = (pCreateInfo->flags & GR_SHADER_CREATE_SPIRV) != 0;
-    if (grShader->isPrecompiledSpv) {
-        const VkShaderModuleCreateInfo createInfo = {
-            .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-            .pNext = NULL,
-            .flags = 0,
-            .codeSize = pCreateInfo->codeSize,
-            .pCode = (uint32_t*)pCreateInfo->pCode,
-        };
-        // idk whether to free spirvCode in case if shader compiles correctly
-        if (vki.vkCreateShaderModule(grDevice->device, &createInfo, NULL, &grShader->precompiledModule)) {
-            free(grShader);
-            LOGE("vkCreateShaderModule failed\n");
-            return GR_ERROR_OUT_OF_MEMORY;
-        }
-    } else {
-        grShader->codeSize = pCreateInfo->codeSize;
-        grShader->code = (uint32_t*)malloc(pCreateInfo->codeSize);
+    grShader->codeSize = pCreateInfo->codeSize;
+    grShader->code = (uint32_t*)malloc(pCreateInfo->codeSize);
 
-        if (grShader->code == NULL) {
-            return GR_ERROR_OUT_OF_MEMORY;
-        }
-        memcpy(grShader->code, pCreateInfo->pCode, pCreateInfo->codeSize);
+    if (grShader->code == NULL) {
+        free(grShader);
+        return GR_ERROR_OUT_OF_MEMORY;
     }
+    memcpy(grShader->code, pCreateInfo->pCode, pCreateInfo->codeSize);
+    grShader->codeHash = hashData(FNV_OFFSET_BASIS, grShader->code, grShader->codeSize);
 
     *pShader = (GR_SHADER)grShader;
     return GR_SUCCESS;
@@ -222,112 +271,80 @@ void calculateDescriptorSetBindingCount(const GR_DESCRIPTOR_SET_MAPPING** mappin
     }
 }
 
-GR_RESULT grCreateGraphicsPipeline(
-    GR_DEVICE device,
-    const GR_GRAPHICS_PIPELINE_CREATE_INFO* pCreateInfo,
-    GR_PIPELINE* pPipeline)
+static void getGraphicsPipelineState(
+    GrGraphicsPipelineState* state,
+    const GR_GRAPHICS_PIPELINE_CREATE_INFO* pCreateInfo)
 {
-    LOGT("%p %p %p\n", device, pCreateInfo, pPipeline);
-    GrDevice* grDevice = (GrDevice*)device;
+    // Copy field by field so that padding stays zeroed in serialized blobs
+    memset(state, 0, sizeof(GrGraphicsPipelineState));
 
-    // Ignored parameters:
-    // - iaState.disableVertexReuse (hint)
-    // - tessState.optimalTessFactor (hint)
-    Stage stages[MAX_STAGE_COUNT];
-    uint32_t stageCount = 0;
+    state->topology = pCreateInfo->iaState.topology;
+    state->patchControlPoints = pCreateInfo->tessState.patchControlPoints;
+    state->depthClipEnable = pCreateInfo->rsState.depthClipEnable;
+    state->alphaToCoverageEnable = pCreateInfo->cbState.alphaToCoverageEnable;
+    state->dualSourceBlendEnable = pCreateInfo->cbState.dualSourceBlendEnable;
+    state->logicOp = pCreateInfo->cbState.logicOp;
+    for (int i = 0; i < GR_MAX_COLOR_TARGETS; i++) {
+        const GR_PIPELINE_CB_TARGET_STATE* target = &pCreateInfo->cbState.target[i];
 
-    if (pCreateInfo->vs.shader != GR_NULL_HANDLE) {
-        stages[stageCount++] = (Stage){
-            .shader = &pCreateInfo->vs,
-            .flags = VK_SHADER_STAGE_VERTEX_BIT
-        };
-    }
-    if (pCreateInfo->hs.shader != GR_NULL_HANDLE) {
-        stages[stageCount++] = (Stage){
-            .shader = &pCreateInfo->hs,
-            .flags = VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT
-        };
-    }
-    if (pCreateInfo->ds.shader != GR_NULL_HANDLE) {
-        stages[stageCount++] = (Stage){
-            .shader = &pCreateInfo->ds,
-            .flags = VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT
-        };
-    }
-    if (pCreateInfo->gs.shader != GR_NULL_HANDLE) {
-        stages[stageCount++] = (Stage){
-            .shader = &pCreateInfo->gs,
-            .flags = VK_SHADER_STAGE_GEOMETRY_BIT,
-        };
+        state->targets[i].blendEnable = target->blendEnable;
+        state->targets[i].format = target->format;
+        state->targets[i].channelWriteMask = target->channelWriteMask;
     }
-    if (pCreateInfo->ps.shader != GR_NULL_HANDLE) {
-        stages[stageCount++] = (Stage){
-            .shader = &pCreateInfo->ps,
-            .flags = VK_SHADER_STAGE_FRAGMENT_BIT,
-        };
+    state->dbFormat = pCreateInfo->dbState.format;
+    state->flags = pCreateInfo->flags;
+}
+
+static void freePipelineStages(
+    unsigned stageCount,
+    GrPipelineStage* stages)
+{
+    for (unsigned i = 0; i < stageCount; i++) {
+        free(stages[i].code);
     }
+}
 
+static VkResult compileGraphicsPipeline(
+    VkPipeline* pipeline,
+    GrDevice* grDevice,
+    const GrGraphicsPipelineState* state,
+    VkRenderPass renderPass,
+    unsigned stageCount,
+    const GrPipelineStage* stages,
+    VkPipelineCreateFlags flags)
+{
     VkPipelineShaderStageCreateInfo shaderStageCreateInfo[MAX_STAGE_COUNT];
+    VkResult vkRes = VK_SUCCESS;
+    unsigned moduleCount = 0;
 
-    for (int i = 0; i < stageCount; i++) {
-        Stage* stage = &stages[i];
-
-        if (stage->shader->linkConstBufferCount > 0) {
-            // TODO implement
-            LOGW("link-time constant buffers are not implemented\n");
-        }
-
-        if (stage->shader->dynamicMemoryViewMapping.slotObjectType != GR_SLOT_UNUSED) {
-            // TODO implement
-            LOGW("dynamic memory view mapping is not implemented\n");
-        }
+    for (unsigned i = 0; i < stageCount; i++) {
+        const VkShaderModuleCreateInfo createInfo = {
+            .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+            .pNext = NULL,
+            .flags = 0,
+            .codeSize = stages[i].codeSize,
+            .pCode = stages[i].code,
+        };
 
-        GrShader* grShader = (GrShader*)stage->shader->shader;
-
-        if (grShader->isPrecompiledSpv) {
-            shaderStageCreateInfo[i] = (VkPipelineShaderStageCreateInfo) {
-                .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-                .pNext = NULL,
-                .flags = 0,
-                .stage = stage->flags,
-                .module = grShader->precompiledModule,
-                .pName = "main",
-                .pSpecializationInfo = NULL,
-            };
+        VkShaderModule module;
+        vkRes = vki.vkCreateShaderModule(grDevice->device, &createInfo, NULL, &module);
+        if (vkRes != VK_SUCCESS) {
+            LOGE("vkCreateShaderModule failed\n");
+            goto bail;
         }
-        else {
-            uint32_t codeSize;
-            uint32_t* codeCopy = ilcCompileShader(&codeSize, stage->shader, grShader->code, grShader->codeSize);
-            if (codeCopy == NULL) {
-                return GR_ERROR_OUT_OF_MEMORY;
-            }
 
-            const VkShaderModuleCreateInfo createInfo = {
-                .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-                .pNext = NULL,
-                .flags = 0,
-                .codeSize = codeSize,
-                .pCode = codeCopy
-            };
-            // idk whether to free spirvCode in case if shader compiles correctly
-            VkShaderModule module;
-            VkResult res = vki.vkCreateShaderModule(grDevice->device, &createInfo, NULL, &module);
-            free(codeCopy);
-            if (res != VK_SUCCESS) {
-                LOGE("vkCreateShaderModule failed\n");
-                return GR_ERROR_OUT_OF_MEMORY;
-            }
-            shaderStageCreateInfo[i] = (VkPipelineShaderStageCreateInfo) {
-                .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-                .pNext = NULL,
-                .flags = 0,
-                .stage = stage->flags,
-                .module = module,
-                .pName = "main",
-                .pSpecializationInfo = NULL,
-            };
-        }
+        shaderStageCreateInfo[i] = (VkPipelineShaderStageCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .pNext = NULL,
+            .flags = 0,
+            .stage = stages[i].flags,
+            .module = module,
+            .pName = "main",
+            .pSpecializationInfo = NULL,
+        };
+        moduleCount++;
     }
+
     const VkPipelineVertexInputStateCreateInfo vertexInputStateCreateInfo = {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
         .pNext = NULL,
@@ -342,7 +359,7 @@ GR_RESULT grCreateGraphicsPipeline(
         .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
         .pNext = NULL,
         .flags = 0,
-        .topology = getVkPrimitiveTopology(pCreateInfo->iaState.topology),
+        .topology = getVkPrimitiveTopology(state->topology),
         .primitiveRestartEnable = VK_FALSE,
     };
 
@@ -351,7 +368,7 @@ GR_RESULT grCreateGraphicsPipeline(
         .sType = VK_STRUCTURE_TYPE_PIPELINE_TESSELLATION_STATE_CREATE_INFO,
         .pNext = NULL,
         .flags = 0,
-        .patchControlPoints = pCreateInfo->tessState.patchControlPoints,
+        .patchControlPoints = state->patchControlPoints,
     };
 
     const VkPipelineViewportStateCreateInfo viewportStateCreateInfo = {
@@ -368,7 +385,7 @@ GR_RESULT grCreateGraphicsPipeline(
         .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_DEPTH_CLIP_STATE_CREATE_INFO_EXT,
         .pNext = NULL,
         .flags = 0,
-        .depthClipEnable = pCreateInfo->rsState.depthClipEnable,
+        .depthClipEnable = state->depthClipEnable,
     };
 
     const VkPipelineRasterizationStateCreateInfo rasterizationStateCreateInfo = {
@@ -395,7 +412,7 @@ GR_RESULT grCreateGraphicsPipeline(
         .sampleShadingEnable = VK_FALSE,
         .minSampleShading = 0.f,
         .pSampleMask = NULL, // TODO implement MSAA
-        .alphaToCoverageEnable = pCreateInfo->cbState.alphaToCoverageEnable ? VK_TRUE : VK_FALSE,
+        .alphaToCoverageEnable = state->alphaToCoverageEnable ? VK_TRUE : VK_FALSE,
         .alphaToOneEnable = VK_FALSE,
     };
 
@@ -415,7 +432,7 @@ GR_RESULT grCreateGraphicsPipeline(
     };
 
     // TODO implement
-    if (pCreateInfo->cbState.dualSourceBlendEnable) {
+    if (state->dualSourceBlendEnable) {
         LOGW("dual source blend is not implemented\n");
     }
 
@@ -423,7 +440,7 @@ GR_RESULT grCreateGraphicsPipeline(
     VkPipelineColorBlendAttachmentState attachments[GR_MAX_COLOR_TARGETS];
 
     for (int i = 0; i < GR_MAX_COLOR_TARGETS; i++) {
-        const GR_PIPELINE_CB_TARGET_STATE* target = &pCreateInfo->cbState.target[i];
+        const GrPipelineTargetState* target = &state->targets[i];
 
         if (!target->blendEnable &&
             target->format.channelFormat == GR_CH_FMT_UNDEFINED &&
@@ -465,7 +482,7 @@ GR_RESULT grCreateGraphicsPipeline(
         .pNext = NULL,
         .flags = 0,
         .logicOpEnable = VK_TRUE,
-        .logicOp = getVkLogicOp(pCreateInfo->cbState.logicOp),
+        .logicOp = getVkLogicOp(state->logicOp),
         .attachmentCount = attachmentCount,
         .pAttachments = attachments,
         .blendConstants = { 0.f }, // Dynamic state
@@ -498,21 +515,10 @@ GR_RESULT grCreateGraphicsPipeline(
         .pDynamicStates = dynamicStates,
     };
 
-    VkRenderPass renderPass = getVkRenderPass(grDevice->device,
-                                              pCreateInfo->cbState.target, &pCreateInfo->dbState);
-    if (renderPass == VK_NULL_HANDLE)
-    {
-        return GR_ERROR_OUT_OF_MEMORY;
-    }
-
-    VkPipeline vkPipeline = VK_NULL_HANDLE;
-    VkPipelineLayout layout = grDevice->pipelineLayouts.graphicsPipelineLayout;
-
     const VkGraphicsPipelineCreateInfo pipelineCreateInfo = {
         .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
         .pNext = NULL,
-        .flags = (pCreateInfo->flags & GR_PIPELINE_CREATE_DISABLE_OPTIMIZATION) != 0 ?
-                 VK_PIPELINE_CREATE_DISABLE_OPTIMIZATION_BIT : 0,
+        .flags = flags,
         .stageCount = stageCount,
         .pStages = shaderStageCreateInfo,
         .pVertexInputState = &vertexInputStateCreateInfo,
@@ -524,41 +530,820 @@ GR_RESULT grCreateGraphicsPipeline(
         .pDepthStencilState = &depthStencilStateCreateInfo,
         .pColorBlendState = &colorBlendStateCreateInfo,
         .pDynamicState = &dynamicStateCreateInfo,
-        .layout = layout,
+        .layout = grDevice->pipelineLayouts.graphicsPipelineLayout,
         .renderPass = renderPass,
         .subpass = 0,
         .basePipelineHandle = VK_NULL_HANDLE,
         .basePipelineIndex = -1,
     };
-    VkResult result = vki.vkCreateGraphicsPipelines(grDevice->device, VK_NULL_HANDLE, 1,
-                                                    &pipelineCreateInfo,
-                                                    NULL, &vkPipeline);
-    //free remaining shader modules, ""compiled"" only for this pipeline
-    for (unsigned i = 0; i < stageCount;++i) {
-        GrShader* grShader = (GrShader*)stages[i].shader->shader;
-        if (!grShader->isPrecompiledSpv) {
-            vki.vkDestroyShaderModule(grDevice->device, shaderStageCreateInfo[i].module, NULL);
+    vkRes = vki.vkCreateGraphicsPipelines(grDevice->device, grDevice->pipelineCache.pipelineCache,
+                                          1, &pipelineCreateInfo, NULL, pipeline);
+    if (vkRes != VK_SUCCESS && vkRes != VK_PIPELINE_COMPILE_REQUIRED_EXT) {
+        LOGE("vkCreateGraphicsPipelines failed (%d)\n", vkRes);
+    }
+
+bail:
+    // Shader modules are only needed for pipeline creation
+    for (unsigned i = 0; i < moduleCount; i++) {
+        vki.vkDestroyShaderModule(grDevice->device, shaderStageCreateInfo[i].module, NULL);
+    }
+    return vkRes;
+}
+
+static VkResult compileComputePipeline(
+    VkPipeline* pipeline,
+    GrDevice* grDevice,
+    const GrPipelineStage* stage,
+    VkPipelineCreateFlags flags)
+{
+    const VkShaderModuleCreateInfo moduleCreateInfo = {
+        .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .codeSize = stage->codeSize,
+        .pCode = stage->code,
+    };
+
+    VkShaderModule module;
+    VkResult vkRes = vki.vkCreateShaderModule(grDevice->device, &moduleCreateInfo, NULL, &module);
+    if (vkRes != VK_SUCCESS) {
+        LOGE("vkCreateShaderModule failed\n");
+        return vkRes;
+    }
+
+    const VkComputePipelineCreateInfo pipelineCreateInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .pNext = NULL,
+        .flags = flags,
+        .stage = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .pNext = NULL,
+            .flags = 0,
+            .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+            .module = module,
+            .pName = "main",
+            .pSpecializationInfo = NULL,
+        },
+        .layout = grDevice->pipelineLayouts.computePipelineLayout,
+        .basePipelineHandle = VK_NULL_HANDLE,
+        .basePipelineIndex = -1,
+    };
+    vkRes = vki.vkCreateComputePipelines(grDevice->device, grDevice->pipelineCache.pipelineCache,
+                                         1, &pipelineCreateInfo, NULL, pipeline);
+    if (vkRes != VK_SUCCESS && vkRes != VK_PIPELINE_COMPILE_REQUIRED_EXT) {
+        LOGE("vkCreateComputePipelines failed (%d)\n", vkRes);
+    }
+
+    vki.vkDestroyShaderModule(grDevice->device, module, NULL);
+    return vkRes;
+}
+
+static VkResult compilePipeline(
+    VkPipeline* pipeline,
+    const GrPipeline* grPipeline,
+    VkPipelineCreateFlags flags)
+{
+    if (grPipeline->bindPoint == VK_PIPELINE_BIND_POINT_COMPUTE) {
+        return compileComputePipeline(pipeline, grPipeline->grDevice, &grPipeline->stages[0],
+                                      flags);
+    }
+
+    return compileGraphicsPipeline(pipeline, grPipeline->grDevice, &grPipeline->state,
+                                   grPipeline->renderPass, grPipeline->stageCount,
+                                   grPipeline->stages, flags);
+}
+
+static void optimizePipeline(
+    GrPipeline* grPipeline)
+{
+    GrDevice* grDevice = grPipeline->grDevice;
+    VkPipeline vkPipeline = VK_NULL_HANDLE;
+
+    if (compilePipeline(&vkPipeline, grPipeline, 0) != VK_SUCCESS) {
+        LOGW("failed to compile optimized pipeline for %p\n", grPipeline);
+        return;
+    }
+
+    markPipelineCacheDirty(&grDevice->pipelineCache);
+
+    // Publish the handle before the flag, command buffers pick it up on their next bind.
+    // The unoptimized pipeline may still be in use and lives as long as the GrPipeline.
+    grPipeline->optimizedPipeline = vkPipeline;
+    InterlockedExchange(&grPipeline->isOptimized, 1);
+    LOGV("swapped in optimized pipeline for %p\n", grPipeline);
+}
+
+// Expects the bind point, state, render pass key and stages to be set
+static GR_RESULT buildPipeline(
+    GrPipeline* grPipeline)
+{
+    GrDevice* grDevice = grPipeline->grDevice;
+
+    if (grPipeline->bindPoint == VK_PIPELINE_BIND_POINT_GRAPHICS) {
+        grPipeline->renderPass = acquireRenderPass(&grDevice->renderPassCache, grDevice->device,
+                                                   &grPipeline->renderPassKey);
+        if (grPipeline->renderPass == VK_NULL_HANDLE) {
+            return GR_ERROR_OUT_OF_MEMORY;
+        }
+    }
+
+    VkPipeline vkPipeline = VK_NULL_HANDLE;
+    VkResult vkRes;
+    bool needsOptimization = false;
+
+    if ((grPipeline->state.flags & GR_PIPELINE_CREATE_DISABLE_OPTIMIZATION) != 0) {
+        vkRes = compilePipeline(&vkPipeline, grPipeline,
+                                VK_PIPELINE_CREATE_DISABLE_OPTIMIZATION_BIT);
+    } else if (grDevice->fastPipelineCompileEnabled) {
+        // Skip the unoptimized pipeline if the driver has the optimized one cached already
+        vkRes = VK_PIPELINE_COMPILE_REQUIRED_EXT;
+        if (grDevice->pipelineCreationCacheControlSupported) {
+            vkRes = compilePipeline(&vkPipeline, grPipeline,
+                                    VK_PIPELINE_CREATE_FAIL_ON_PIPELINE_COMPILE_REQUIRED_BIT_EXT);
+        }
+        if (vkRes == VK_PIPELINE_COMPILE_REQUIRED_EXT) {
+            vkRes = compilePipeline(&vkPipeline, grPipeline,
+                                    VK_PIPELINE_CREATE_DISABLE_OPTIMIZATION_BIT);
+            needsOptimization = true;
         }
+    } else {
+        vkRes = compilePipeline(&vkPipeline, grPipeline, 0);
     }
-    if (result != VK_SUCCESS) {
-        LOGE("vkCreateGraphicsPipelines failed\n");
-        if (renderPass != VK_NULL_HANDLE) {
-            vki.vkDestroyRenderPass(grDevice->device, renderPass, NULL);
+
+    if (vkRes != VK_SUCCESS) {
+        if (grPipeline->renderPass != VK_NULL_HANDLE) {
+            releaseRenderPass(&grDevice->renderPassCache, grDevice->device,
+                              &grPipeline->renderPassKey);
+            grPipeline->renderPass = VK_NULL_HANDLE;
         }
         return GR_ERROR_OUT_OF_MEMORY;
     }
 
+    markPipelineCacheDirty(&grDevice->pipelineCache);
+
+    grPipeline->pipeline = vkPipeline;
+
+    if (needsOptimization) {
+        queuePipelineJob(&grDevice->pipelineCompiler, optimizePipeline, grPipeline);
+    }
+
+    return GR_SUCCESS;
+}
+
+static GrPipeline* allocatePipeline(
+    GrDevice* grDevice,
+    VkPipelineBindPoint bindPoint,
+    const GrGraphicsPipelineState* state,
+    const GrRenderPassKey* renderPassKey)
+{
     GrPipeline* grPipeline = malloc(sizeof(GrPipeline));
     if (grPipeline == NULL) {
-        return GR_ERROR_OUT_OF_MEMORY;
+        return NULL;
     }
+
     *grPipeline = (GrPipeline) {
         .sType = GR_STRUCT_TYPE_PIPELINE,
-        .pipeline = vkPipeline,
-        .pipelineLayout = layout,
-        .renderPass = renderPass
+        .grDevice = grDevice,
+        .refCount = 1,
+        .hash = 0,
+        .keySize = 0,
+        .key = NULL,
+        .next = NULL,
+        .pipeline = VK_NULL_HANDLE,
+        .optimizedPipeline = VK_NULL_HANDLE,
+        .isOptimized = 0,
+        .readyEvent = NULL,
+        .isPending = 0,
+        .pendingStageCount = 0,
+        .pendingStages = NULL,
+        .bindPoint = bindPoint,
+        .pipelineLayout = bindPoint == VK_PIPELINE_BIND_POINT_COMPUTE ?
+                          grDevice->pipelineLayouts.computePipelineLayout :
+                          grDevice->pipelineLayouts.graphicsPipelineLayout,
+        .renderPassKey = *renderPassKey,
+        .renderPass = VK_NULL_HANDLE,
+        .state = *state,
+        .stageCount = 0,
+    };
+    return grPipeline;
+}
+
+// Takes ownership of the stage code, which is kept around for grStorePipeline
+static GR_RESULT createPipeline(
+    GR_PIPELINE* pPipeline,
+    GrDevice* grDevice,
+    VkPipelineBindPoint bindPoint,
+    const GrGraphicsPipelineState* state,
+    const GrRenderPassKey* renderPassKey,
+    unsigned stageCount,
+    GrPipelineStage* stages)
+{
+    GrPipeline* grPipeline = allocatePipeline(grDevice, bindPoint, state, renderPassKey);
+    if (grPipeline == NULL) {
+        freePipelineStages(stageCount, stages);
+        return GR_ERROR_OUT_OF_MEMORY;
+    }
+
+    grPipeline->stageCount = stageCount;
+    memcpy(grPipeline->stages, stages, sizeof(GrPipelineStage) * stageCount);
+
+    GR_RESULT res = buildPipeline(grPipeline);
+    if (res != GR_SUCCESS) {
+        freePipelineStages(stageCount, stages);
+        free(grPipeline);
+        return res;
+    }
+
+    *pPipeline = (GR_PIPELINE)grPipeline;
+    return GR_SUCCESS;
+}
+
+// Translates IL to SPIR-V if needed, the stage gets its own copy of the code
+static bool getPipelineStage(
+    GrPipelineStage* pipelineStage,
+    VkShaderStageFlagBits flags,
+    const GR_PIPELINE_SHADER* mappings,
+    bool isPrecompiledSpv,
+    const uint32_t* code,
+    unsigned codeSize)
+{
+    unsigned compiledSize = codeSize;
+    const uint32_t* compiledCode = code;
+
+    if (!isPrecompiledSpv) {
+        compiledCode = ilcCompileShader(&compiledSize, mappings, code, codeSize);
+        if (compiledCode == NULL) {
+            return false;
+        }
+    }
+
+    *pipelineStage = (GrPipelineStage) {
+        .flags = flags,
+        .codeSize = compiledSize,
+        .code = malloc(compiledSize),
     };
+    memcpy(pipelineStage->code, compiledCode, compiledSize);
+
+    if (!isPrecompiledSpv) {
+        ilcReleaseShader(compiledCode);
+    }
+    return true;
+}
+
+static void freePendingStages(
+    GrPipeline* grPipeline)
+{
+    for (unsigned i = 0; i < grPipeline->pendingStageCount; i++) {
+        free(grPipeline->pendingStages[i].code);
+        ilcFreeMappings(grPipeline->pendingStages[i].mappings);
+    }
+    free(grPipeline->pendingStages);
+    grPipeline->pendingStageCount = 0;
+    grPipeline->pendingStages = NULL;
+}
+
+static void createPendingPipeline(
+    GrPipeline* grPipeline)
+{
+    GrPipelineStage stages[MAX_STAGE_COUNT];
+    unsigned stageCount = 0;
+    GR_RESULT res = GR_SUCCESS;
+
+    for (; stageCount < grPipeline->pendingStageCount; stageCount++) {
+        const GrPendingPipelineStage* pendingStage = &grPipeline->pendingStages[stageCount];
+
+        if (!getPipelineStage(&stages[stageCount], pendingStage->flags, pendingStage->mappings,
+                              pendingStage->isPrecompiledSpv, pendingStage->code,
+                              pendingStage->codeSize)) {
+            res = GR_ERROR_OUT_OF_MEMORY;
+            break;
+        }
+    }
 
+    if (res == GR_SUCCESS) {
+        grPipeline->stageCount = stageCount;
+        memcpy(grPipeline->stages, stages, sizeof(GrPipelineStage) * stageCount);
+
+        res = buildPipeline(grPipeline);
+        if (res != GR_SUCCESS) {
+            grPipeline->stageCount = 0;
+        }
+    }
+
+    if (res != GR_SUCCESS) {
+        LOGE("asynchronous creation of pipeline %p failed (%d)\n", grPipeline, res);
+        freePipelineStages(stageCount, stages);
+    }
+
+    freePendingStages(grPipeline);
+
+    InterlockedExchange(&grPipeline->isPending, 0);
+    SetEvent(grPipeline->readyEvent);
+}
+
+// Copies everything the pipeline depends on, the create info may be gone by the time it's compiled
+static GrPipeline* queuePendingPipeline(
+    GrDevice* grDevice,
+    VkPipelineBindPoint bindPoint,
+    const GrGraphicsPipelineState* state,
+    const GrRenderPassKey* renderPassKey,
+    unsigned stageCount,
+    const Stage* stages)
+{
+    GrPipeline* grPipeline = allocatePipeline(grDevice, bindPoint, state, renderPassKey);
+    if (grPipeline == NULL) {
+        return NULL;
+    }
+
+    grPipeline->readyEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    grPipeline->isPending = 1;
+    grPipeline->pendingStageCount = stageCount;
+    grPipeline->pendingStages = malloc(sizeof(GrPendingPipelineStage) * stageCount);
+
+    for (unsigned i = 0; i < stageCount; i++) {
+        const GrShader* grShader = (GrShader*)stages[i].shader->shader;
+        unsigned mappingSize = 0;
+        uint32_t* mappingData = ilcSerializeMappings(&mappingSize, stages[i].shader);
+
+        grPipeline->pendingStages[i] = (GrPendingPipelineStage) {
+            .flags = stages[i].flags,
+            .isPrecompiledSpv = grShader->isPrecompiledSpv,
+            .codeSize = grShader->codeSize,
+            .code = malloc(grShader->codeSize),
+            .mappings = ilcDeserializeMappings(mappingData, mappingSize),
+        };
+        memcpy(grPipeline->pendingStages[i].code, grShader->code, grShader->codeSize);
+        free(mappingData);
+    }
+
+    if (!queuePipelineJob(&grDevice->pipelineCompiler, createPendingPipeline, grPipeline)) {
+        // No worker threads to hand it to
+        createPendingPipeline(grPipeline);
+    }
+    return grPipeline;
+}
+
+// Looks up an identical pipeline first, then creates one either inline or on the compiler threads
+static GR_RESULT createSharedPipeline(
+    GR_PIPELINE* pPipeline,
+    GrDevice* grDevice,
+    VkPipelineBindPoint bindPoint,
+    const GrGraphicsPipelineState* state,
+    const GrRenderPassKey* renderPassKey,
+    unsigned stageCount,
+    const Stage* stages)
+{
+    unsigned keySize = 0;
+    uint8_t* key = getPipelineKey(&keySize, state, stageCount, stages);
+    uint32_t hash = (uint32_t)hashData(FNV_OFFSET_BASIS, key, keySize);
+
+    GrPipeline* grPipeline = acquireSharedPipeline(&grDevice->pipelineDedupCache,
+                                                   key, keySize, hash);
+    if (grPipeline != NULL) {
+        free(key);
+        *pPipeline = (GR_PIPELINE)grPipeline;
+        return GR_SUCCESS;
+    }
+
+    for (uint32_t i = 0; i < stageCount; i++) {
+        if (stages[i].shader->linkConstBufferCount > 0) {
+            // TODO implement
+            LOGW("link-time constant buffers are not implemented\n");
+        }
+
+        if (stages[i].shader->dynamicMemoryViewMapping.slotObjectType != GR_SLOT_UNUSED) {
+            // TODO implement
+            LOGW("dynamic memory view mapping is not implemented\n");
+        }
+    }
+
+    if (grDevice->asyncPipelineCreationEnabled) {
+        grPipeline = queuePendingPipeline(grDevice, bindPoint, state, renderPassKey,
+                                          stageCount, stages);
+        if (grPipeline == NULL) {
+            free(key);
+            return GR_ERROR_OUT_OF_MEMORY;
+        }
+    } else {
+        GrPipelineStage pipelineStages[MAX_STAGE_COUNT];
+
+        for (uint32_t i = 0; i < stageCount; i++) {
+            const GrShader* grShader = (GrShader*)stages[i].shader->shader;
+
+            if (!getPipelineStage(&pipelineStages[i], stages[i].flags, stages[i].shader,
+                                  grShader->isPrecompiledSpv, grShader->code,
+                                  grShader->codeSize)) {
+                freePipelineStages(i, pipelineStages);
+                free(key);
+                return GR_ERROR_OUT_OF_MEMORY;
+            }
+        }
+
+        GR_PIPELINE pipeline = GR_NULL_HANDLE;
+        GR_RESULT res = createPipeline(&pipeline, grDevice, bindPoint, state, renderPassKey,
+                                       stageCount, pipelineStages);
+        if (res != GR_SUCCESS) {
+            free(key);
+            return res;
+        }
+        grPipeline = (GrPipeline*)pipeline;
+    }
+
+    grPipeline = insertSharedPipeline(&grDevice->pipelineDedupCache, grPipeline,
+                                      key, keySize, hash);
     *pPipeline = (GR_PIPELINE)grPipeline;
     return GR_SUCCESS;
 }
+
+GR_RESULT grCreateGraphicsPipeline(
+    GR_DEVICE device,
+    const GR_GRAPHICS_PIPELINE_CREATE_INFO* pCreateInfo,
+    GR_PIPELINE* pPipeline)
+{
+    LOGT("%p %p %p\n", device, pCreateInfo, pPipeline);
+    GrDevice* grDevice = (GrDevice*)device;
+
+    // Ignored parameters:
+    // - iaState.disableVertexReuse (hint)
+    // - tessState.optimalTessFactor (hint)
+    Stage stages[MAX_STAGE_COUNT];
+    uint32_t stageCount = 0;
+
+    if (pCreateInfo->vs.shader != GR_NULL_HANDLE) {
+        stages[stageCount++] = (Stage){
+            .shader = &pCreateInfo->vs,
+            .flags = VK_SHADER_STAGE_VERTEX_BIT
+        };
+    }
+    if (pCreateInfo->hs.shader != GR_NULL_HANDLE) {
+        stages[stageCount++] = (Stage){
+            .shader = &pCreateInfo->hs,
+            .flags = VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT
+        };
+    }
+    if (pCreateInfo->ds.shader != GR_NULL_HANDLE) {
+        stages[stageCount++] = (Stage){
+            .shader = &pCreateInfo->ds,
+            .flags = VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT
+        };
+    }
+    if (pCreateInfo->gs.shader != GR_NULL_HANDLE) {
+        stages[stageCount++] = (Stage){
+            .shader = &pCreateInfo->gs,
+            .flags = VK_SHADER_STAGE_GEOMETRY_BIT,
+        };
+    }
+    if (pCreateInfo->ps.shader != GR_NULL_HANDLE) {
+        stages[stageCount++] = (Stage){
+            .shader = &pCreateInfo->ps,
+            .flags = VK_SHADER_STAGE_FRAGMENT_BIT,
+        };
+    }
+
+    GrGraphicsPipelineState state;
+    getGraphicsPipelineState(&state, pCreateInfo);
+
+    GrRenderPassKey renderPassKey;
+    getRenderPassKey(&renderPassKey, pCreateInfo->cbState.target, &pCreateInfo->dbState);
+
+    return createSharedPipeline(pPipeline, grDevice, VK_PIPELINE_BIND_POINT_GRAPHICS, &state,
+                                &renderPassKey, stageCount, stages);
+}
+
+GR_RESULT grCreateComputePipeline(
+    GR_DEVICE device,
+    const GR_COMPUTE_PIPELINE_CREATE_INFO* pCreateInfo,
+    GR_PIPELINE* pPipeline)
+{
+    LOGT("%p %p %p\n", device, pCreateInfo, pPipeline);
+    GrDevice* grDevice = (GrDevice*)device;
+
+    if (grDevice == NULL) {
+        return GR_ERROR_INVALID_HANDLE;
+    } else if (grDevice->sType != GR_STRUCT_TYPE_DEVICE) {
+        return GR_ERROR_INVALID_OBJECT_TYPE;
+    } else if (pCreateInfo == NULL || pPipeline == NULL) {
+        return GR_ERROR_INVALID_POINTER;
+    } else if (pCreateInfo->cs.shader == GR_NULL_HANDLE) {
+        return GR_ERROR_INVALID_HANDLE;
+    }
+
+    const Stage stage = {
+        .shader = &pCreateInfo->cs,
+        .flags = VK_SHADER_STAGE_COMPUTE_BIT,
+    };
+
+    // Only the flags apply to compute pipelines, the rest stays zeroed for the pipeline key
+    GrGraphicsPipelineState state;
+    memset(&state, 0, sizeof(GrGraphicsPipelineState));
+    state.flags = pCreateInfo->flags;
+
+    GrRenderPassKey renderPassKey;
+    memset(&renderPassKey, 0, sizeof(GrRenderPassKey));
+
+    return createSharedPipeline(pPipeline, grDevice, VK_PIPELINE_BIND_POINT_COMPUTE, &state,
+                                &renderPassKey, 1, &stage);
+}
+
+GR_RESULT grStorePipeline(
+    GR_PIPELINE pipeline,
+    GR_SIZE* pDataSize,
+    GR_VOID* pData)
+{
+    LOGT("%p %p %p\n", pipeline, pDataSize, pData);
+    GrPipeline* grPipeline = (GrPipeline*)pipeline;
+
+    if (grPipeline == NULL) {
+        return GR_ERROR_INVALID_HANDLE;
+    } else if (grPipeline->sType != GR_STRUCT_TYPE_PIPELINE) {
+        return GR_ERROR_INVALID_OBJECT_TYPE;
+    } else if (pDataSize == NULL) {
+        return GR_ERROR_INVALID_POINTER;
+    } else if (!waitForPipeline(grPipeline)) {
+        return GR_ERROR_UNAVAILABLE;
+    }
+
+    GR_SIZE size = sizeof(PipelineBlobHeader);
+    for (unsigned i = 0; i < grPipeline->stageCount; i++) {
+        size += sizeof(PipelineBlobStage) + grPipeline->stages[i].codeSize;
+    }
+
+    if (pData == NULL) {
+        *pDataSize = size;
+        return GR_SUCCESS;
+    } else if (*pDataSize < size) {
+        return GR_ERROR_INVALID_MEMORY_SIZE;
+    }
+
+    uint8_t* ptr = pData;
+    PipelineBlobHeader* header = (PipelineBlobHeader*)ptr;
+    *header = (PipelineBlobHeader) {
+        .magic = PIPELINE_BLOB_MAGIC,
+        .version = PIPELINE_BLOB_VERSION,
+        .size = size,
+        .stageCount = grPipeline->stageCount,
+        .bindPoint = grPipeline->bindPoint,
+        .state = grPipeline->state,
+        .renderPassKey = grPipeline->renderPassKey,
+    };
+    ptr += sizeof(PipelineBlobHeader);
+
+    for (unsigned i = 0; i < grPipeline->stageCount; i++) {
+        const GrPipelineStage* stage = &grPipeline->stages[i];
+
+        *(PipelineBlobStage*)ptr = (PipelineBlobStage) {
+            .flags = stage->flags,
+            .codeSize = stage->codeSize,
+        };
+        ptr += sizeof(PipelineBlobStage);
+        memcpy(ptr, stage->code, stage->codeSize);
+        ptr += stage->codeSize;
+    }
+
+    *pDataSize = size;
+    return GR_SUCCESS;
+}
+
+static GR_RESULT checkPipelineBlobState(
+    const GrDevice* grDevice,
+    const PipelineBlobHeader* header)
+{
+    const GrGraphicsPipelineState* state = &header->state;
+    GrGraphicsPipelineState expectedState;
+    GrRenderPassKey expectedKey;
+
+    if (state->flags & ~GR_PIPELINE_CREATE_DISABLE_OPTIMIZATION) {
+        LOGE("invalid pipeline data flags 0x%X\n", state->flags);
+        return GR_ERROR_INVALID_MEMORY_SIZE;
+    }
+
+    if (header->bindPoint == VK_PIPELINE_BIND_POINT_COMPUTE) {
+        // Only the flags are set for compute pipelines, see grCreateComputePipeline
+        memset(&expectedState, 0, sizeof(GrGraphicsPipelineState));
+        expectedState.flags = state->flags;
+        memset(&expectedKey, 0, sizeof(GrRenderPassKey));
+
+        if (memcmp(state, &expectedState, sizeof(GrGraphicsPipelineState)) != 0 ||
+            memcmp(&header->renderPassKey, &expectedKey, sizeof(GrRenderPassKey)) != 0) {
+            LOGE("invalid compute pipeline data state\n");
+            return GR_ERROR_INVALID_MEMORY_SIZE;
+        }
+        return GR_SUCCESS;
+    }
+
+    // Vulkan guarantees a patch size of at least 32 control points
+    if (state->topology < GR_TOPOLOGY_POINT_LIST || state->topology > GR_TOPOLOGY_PATCH ||
+        (state->topology == GR_TOPOLOGY_PATCH &&
+         (state->patchControlPoints == 0 || state->patchControlPoints > 32)) ||
+        state->logicOp < GR_LOGIC_OP_COPY || state->logicOp > GR_LOGIC_OP_SET) {
+        LOGE("invalid graphics pipeline data state\n");
+        return GR_ERROR_INVALID_MEMORY_SIZE;
+    }
+
+    // The render pass key must be the one derived from the state, this also rejects clear masks
+    // which are never part of a pipeline key
+    GR_PIPELINE_CB_TARGET_STATE cbTargets[GR_MAX_COLOR_TARGETS];
+    for (int i = 0; i < GR_MAX_COLOR_TARGETS; i++) {
+        cbTargets[i] = (GR_PIPELINE_CB_TARGET_STATE) {
+            .blendEnable = state->targets[i].blendEnable,
+            .format = state->targets[i].format,
+            .channelWriteMask = state->targets[i].channelWriteMask,
+        };
+    }
+    const GR_PIPELINE_DB_STATE dbTarget = { .format = state->dbFormat };
+
+    getRenderPassKey(&expectedKey, cbTargets, &dbTarget);
+    if (memcmp(&header->renderPassKey, &expectedKey, sizeof(GrRenderPassKey)) != 0) {
+        LOGE("invalid graphics pipeline data render pass key\n");
+        return GR_ERROR_INVALID_MEMORY_SIZE;
+    }
+
+    // The blob may come from another GPU, make sure its attachments are usable on this one
+    for (int i = 0; i < GR_MAX_COLOR_TARGETS; i++) {
+        VkFormat vkFormat = expectedKey.colorFormats[i];
+        VkFormatFeatureFlags requiredFeatures = VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT;
+        VkFormatProperties formatProps;
+
+        if (vkFormat == VK_FORMAT_UNDEFINED) {
+            continue;
+        }
+        if (state->targets[i].blendEnable) {
+            requiredFeatures |= VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BLEND_BIT;
+        }
+
+        vki.vkGetPhysicalDeviceFormatProperties(grDevice->physicalDevice, vkFormat,
+                                                &formatProps);
+        if ((formatProps.optimalTilingFeatures & requiredFeatures) != requiredFeatures) {
+            LOGE("unsupported color target format %d in pipeline data\n", vkFormat);
+            return GR_ERROR_INCOMPATIBLE_DEVICE;
+        }
+    }
+
+    if (expectedKey.depthStencilFormat != VK_FORMAT_UNDEFINED) {
+        VkFormatProperties formatProps;
+
+        vki.vkGetPhysicalDeviceFormatProperties(grDevice->physicalDevice,
+                                                expectedKey.depthStencilFormat, &formatProps);
+        if (!(formatProps.optimalTilingFeatures &
+              VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT)) {
+            LOGE("unsupported depth target format %d in pipeline data\n",
+                 expectedKey.depthStencilFormat);
+            return GR_ERROR_INCOMPATIBLE_DEVICE;
+        }
+    }
+
+    return GR_SUCCESS;
+}
+
+GR_RESULT grLoadPipeline(
+    GR_DEVICE device,
+    GR_SIZE dataSize,
+    const GR_VOID* pData,
+    GR_PIPELINE* pPipeline)
+{
+    LOGT("%p %llu %p %p\n", device, (unsigned long long)dataSize, pData, pPipeline);
+    GrDevice* grDevice = (GrDevice*)device;
+
+    if (grDevice == NULL) {
+        return GR_ERROR_INVALID_HANDLE;
+    } else if (grDevice->sType != GR_STRUCT_TYPE_DEVICE) {
+        return GR_ERROR_INVALID_OBJECT_TYPE;
+    } else if (pData == NULL || pPipeline == NULL) {
+        return GR_ERROR_INVALID_POINTER;
+    }
+
+    const uint8_t* ptr = pData;
+    const PipelineBlobHeader* header = (const PipelineBlobHeader*)ptr;
+
+    if (dataSize < sizeof(PipelineBlobHeader) || header->magic != PIPELINE_BLOB_MAGIC ||
+        header->size > dataSize || header->stageCount > MAX_STAGE_COUNT ||
+        (header->bindPoint != VK_PIPELINE_BIND_POINT_GRAPHICS &&
+         header->bindPoint != VK_PIPELINE_BIND_POINT_COMPUTE) ||
+        (header->bindPoint == VK_PIPELINE_BIND_POINT_COMPUTE && header->stageCount != 1) ||
+        (header->bindPoint == VK_PIPELINE_BIND_POINT_GRAPHICS && header->stageCount == 0)) {
+        LOGE("invalid pipeline data\n");
+        return GR_ERROR_INVALID_MEMORY_SIZE;
+    } else if (header->version != PIPELINE_BLOB_VERSION) {
+        LOGE("incompatible pipeline data version %u\n", header->version);
+        return GR_ERROR_INCOMPATIBLE_DRIVER;
+    }
+
+    GR_RESULT res = checkPipelineBlobState(grDevice, header);
+    if (res != GR_SUCCESS) {
+        return res;
+    }
+
+    GrPipelineStage stages[MAX_STAGE_COUNT];
+    unsigned offset = sizeof(PipelineBlobHeader);
+    VkShaderStageFlags allowedStageFlags = header->bindPoint == VK_PIPELINE_BIND_POINT_COMPUTE ?
+                                           VK_SHADER_STAGE_COMPUTE_BIT :
+                                           VK_SHADER_STAGE_ALL_GRAPHICS;
+    VkShaderStageFlags usedStageFlags = 0;
+
+    for (unsigned i = 0; i < header->stageCount; i++) {
+        const PipelineBlobStage* blobStage = (const PipelineBlobStage*)&ptr[offset];
+
+        if (offset + sizeof(PipelineBlobStage) > header->size ||
+            blobStage->codeSize > header->size - offset - sizeof(PipelineBlobStage)) {
+            LOGE("truncated pipeline data\n");
+            freePipelineStages(i, stages);
+            return GR_ERROR_INVALID_MEMORY_SIZE;
+        }
+
+        // Each stage has to be a single stage of the bind point with valid SPIR-V words
+        VkShaderStageFlags stageFlags = blobStage->flags;
+        if (blobStage->codeSize == 0 || (blobStage->codeSize % sizeof(uint32_t)) != 0 ||
+            stageFlags == 0 || (stageFlags & (stageFlags - 1)) != 0 ||
+            (stageFlags & ~allowedStageFlags) != 0 || (stageFlags & usedStageFlags) != 0) {
+            LOGE("invalid pipeline stage data\n");
+            freePipelineStages(i, stages);
+            return GR_ERROR_INVALID_MEMORY_SIZE;
+        }
+        usedStageFlags |= stageFlags;
+        offset += sizeof(PipelineBlobStage);
+
+        stages[i] = (GrPipelineStage) {
+            .flags = blobStage->flags,
+            .codeSize = blobStage->codeSize,
+            .code = malloc(blobStage->codeSize),
+        };
+        memcpy(stages[i].code, &ptr[offset], blobStage->codeSize);
+        offset += blobStage->codeSize;
+    }
+
+    return createPipeline(pPipeline, grDevice, header->bindPoint, &header->state,
+                          &header->renderPassKey, header->stageCount, stages);
+}
+
+bool waitForPipeline(
+    GrPipeline* grPipeline)
+{
+    if (grPipeline->isPending) {
+        LARGE_INTEGER frequency, start, end;
+
+        QueryPerformanceFrequency(&frequency);
+        QueryPerformanceCounter(&start);
+        WaitForSingleObject(grPipeline->readyEvent, INFINITE);
+        QueryPerformanceCounter(&end);
+
+        LOGD("waited %.2f ms for pipeline %p\n",
+             1000.0 * (end.QuadPart - start.QuadPart) / frequency.QuadPart, grPipeline);
+    }
+
+    return grPipeline->pipeline != VK_NULL_HANDLE;
+}
+
+VkPipeline getVkPipeline(
+    const GrPipeline* grPipeline)
+{
+    return grPipeline->isOptimized ? grPipeline->optimizedPipeline : grPipeline->pipeline;
+}
+
+void releasePipeline(
+    GrPipeline* grPipeline)
+{
+    GrPipelineDedupCache* grPipelineDedupCache = &grPipeline->grDevice->pipelineDedupCache;
+    bool isUnused;
+
+    if (grPipeline->key == NULL) {
+        isUnused = InterlockedDecrement(&grPipeline->refCount) == 0;
+    } else {
+        // Unlink under the lock so that no other thread can pick it up again
+        AcquireSRWLockExclusive(&grPipelineDedupCache->lock);
+
+        isUnused = InterlockedDecrement(&grPipeline->refCount) == 0;
+        if (isUnused) {
+            GrPipeline** pipelinePtr =
+                &grPipelineDedupCache->buckets[grPipeline->hash % PIPELINE_BUCKET_COUNT];
+
+            while (*pipelinePtr != grPipeline) {
+                pipelinePtr = &(*pipelinePtr)->next;
+            }
+            *pipelinePtr = grPipeline->next;
+        }
+
+        ReleaseSRWLockExclusive(&grPipelineDedupCache->lock);
+    }
+
+    if (isUnused) {
+        destroyPipeline(grPipeline);
+    }
+}
+
+void destroySharedPipelines(
+    GrDevice* grDevice)
+{
+    GrPipelineDedupCache* grPipelineDedupCache = &grDevice->pipelineDedupCache;
+
+    for (unsigned i = 0; i < PIPELINE_BUCKET_COUNT; i++) {
+        GrPipeline* grPipeline = grPipelineDedupCache->buckets[i];
+
+        while (grPipeline != NULL) {
+            GrPipeline* next = grPipeline->next;
+
+            destroyPipeline(grPipeline);
+            grPipeline = next;
+        }
+        grPipelineDedupCache->buckets[i] = NULL;
+    }
+}
@@ -0,0 +1,138 @@
+#include "mantle_internal.h"
+
+// Must be called with the lock held, releases it while the job runs
+static void runWorkerJob(
+    GrWorkerPool* grWorkerPool)
+{
+    GrWorkerJob* job = grWorkerPool->head;
+    grWorkerPool->head = job->next;
+    if (grWorkerPool->head == NULL) {
+        grWorkerPool->tail = NULL;
+    }
+
+    ReleaseSRWLockExclusive(&grWorkerPool->lock);
+
+    job->proc(job->data);
+
+    AcquireSRWLockExclusive(&grWorkerPool->lock);
+
+    job->batch->pendingJobCount--;
+    if (job->batch->pendingJobCount == 0) {
+        WakeAllConditionVariable(&grWorkerPool->batchDone);
+    }
+    free(job);
+}
+
+static DWORD WINAPI workerThreadProc(
+    LPVOID param)
+{
+    GrWorkerPool* grWorkerPool = (GrWorkerPool*)param;
+
+    AcquireSRWLockExclusive(&grWorkerPool->lock);
+
+    for (;;) {
+        while (grWorkerPool->head == NULL && !grWorkerPool->isStopping) {
+            SleepConditionVariableSRW(&grWorkerPool->jobAvailable, &grWorkerPool->lock,
+                                      INFINITE, 0);
+        }
+        if (grWorkerPool->isStopping) {
+            break;
+        }
+
+        runWorkerJob(grWorkerPool);
+    }
+
+    ReleaseSRWLockExclusive(&grWorkerPool->lock);
+
+    return 0;
+}
+
+void initWorkerPool(
+    GrWorkerPool* grWorkerPool,
+    unsigned threadCount)
+{
+    *grWorkerPool = (GrWorkerPool) {
+        .lock = SRWLOCK_INIT,
+        .jobAvailable = CONDITION_VARIABLE_INIT,
+        .batchDone = CONDITION_VARIABLE_INIT,
+        .head = NULL,
+        .tail = NULL,
+        .isStopping = false,
+        .threadCount = 0,
+        .threads = malloc(sizeof(HANDLE) * MAX(threadCount, 1)),
+    };
+
+    for (unsigned i = 0; i < threadCount; i++) {
+        HANDLE thread = CreateThread(NULL, 0, workerThreadProc, grWorkerPool, 0, NULL);
+        if (thread == NULL) {
+            LOGW("failed to create worker thread\n");
+            break;
+        }
+
+        grWorkerPool->threads[grWorkerPool->threadCount++] = thread;
+    }
+}
+
+void queueWorkerJob(
+    GrWorkerPool* grWorkerPool,
+    GrWorkerBatch* grWorkerBatch,
+    GrWorkerJobProc proc,
+    void* data)
+{
+    GrWorkerJob* job = malloc(sizeof(GrWorkerJob));
+    *job = (GrWorkerJob) {
+        .proc = proc,
+        .data = data,
+        .batch = grWorkerBatch,
+        .next = NULL,
+    };
+
+    AcquireSRWLockExclusive(&grWorkerPool->lock);
+
+    grWorkerBatch->pendingJobCount++;
+    if (grWorkerPool->tail != NULL) {
+        grWorkerPool->tail->next = job;
+    } else {
+        grWorkerPool->head = job;
+    }
+    grWorkerPool->tail = job;
+
+    ReleaseSRWLockExclusive(&grWorkerPool->lock);
+
+    WakeConditionVariable(&grWorkerPool->jobAvailable);
+}
+
+void waitForWorkerBatch(
+    GrWorkerPool* grWorkerPool,
+    GrWorkerBatch* grWorkerBatch)
+{
+    AcquireSRWLockExclusive(&grWorkerPool->lock);
+
+    // Help out instead of idling, this also makes progress without any worker thread
+    while (grWorkerBatch->pendingJobCount > 0) {
+        if (grWorkerPool->head != NULL) {
+            runWorkerJob(grWorkerPool);
+        } else {
+            SleepConditionVariableSRW(&grWorkerPool->batchDone, &grWorkerPool->lock,
+                                      INFINITE, 0);
+        }
+    }
+
+    ReleaseSRWLockExclusive(&grWorkerPool->lock);
+}
+
+void destroyWorkerPool(
+    GrWorkerPool* grWorkerPool)
+{
+    AcquireSRWLockExclusive(&grWorkerPool->lock);
+    grWorkerPool->isStopping = true;
+    ReleaseSRWLockExclusive(&grWorkerPool->lock);
+
+    WakeAllConditionVariable(&grWorkerPool->jobAvailable);
+
+    for (unsigned i = 0; i < grWorkerPool->threadCount; i++) {
+        WaitForSingleObject(grWorkerPool->threads[i], INFINITE);
+        CloseHandle(grWorkerPool->threads[i]);
+    }
+    free(grWorkerPool->threads);
+}
@@ -366,6 +366,10 @@ GR_RESULT grWsiWinCreatePresentableImage(
         .extent = { createInfo.extent.width, createInfo.extent.height, 1 },
         .layerCount = 1,
         .format = format,
+        .usage = createInfo.usage,
+        .mipLevels = 1,
+        .subresourceStates = NULL,
+        .viewFormatCount = 0,
         .imageMemory = vkDeviceMemory,
         .fence = VK_NULL_HANDLE,
         .copyCmdBuf = cmdBuf,
@@ -468,6 +472,21 @@ GR_RESULT grWsiWinQueuePresent(
 
     wsiPresentBufferToHWND(pPresentInfo->hWndDest, srcGrImage->bufferMemoryPtr, srcGrImage->extent, srcGrImage->bufferRowPitch, srcGrImage->bufferSize, srcGrImage->format);
 
+    GrDevice* grDevice = grQueue->grDevice;
+    LONG barrierCount = InterlockedExchange(&grDevice->frameBarrierCount, 0);
+    LONG elidedTransitionCount = InterlockedExchange(&grDevice->frameElidedTransitionCount, 0);
+    LONG recordedCommandCount = InterlockedExchange(&grDevice->frameRecordedCommandCount, 0);
+    LONG translatedCommandCount = InterlockedExchange(&grDevice->frameTranslatedCommandCount, 0);
+    if (grDevice->frameStatsEnabled) {
+        LOGI("frame %u: %ld barriers, %ld image transitions elided\n",
+             grDevice->frameIndex, barrierCount, elidedTransitionCount);
+        if (grDevice->deferredCommandsEnabled) {
+            LOGI("frame %u: %ld deferred commands recorded, %ld after optimization\n",
+                 grDevice->frameIndex, recordedCommandCount, translatedCommandCount);
+        }
+    }
+    grDevice->frameIndex++;
+
     return GR_SUCCESS;
 fail_present:
     switch (vkRes) {
@@ -11,6 +11,10 @@ typedef struct _GrWsiImage {
     VkExtent3D extent;
     unsigned layerCount;
     VkFormat format;
+    VkImageUsageFlags usage;
+    uint32_t mipLevels;
+    GR_IMAGE_STATE* subresourceStates;
+    uint32_t viewFormatCount;
     VkDeviceMemory imageMemory;
 
     VkFence fence;
@@ -63,45 +63,8 @@ GR_RESULT grPinSystemMemory(
     return GR_UNSUPPORTED;
 }
 
-// Generic API Object Management functions
-
-GR_RESULT grDestroyObject(
-    GR_OBJECT object)
-{
-    LOGW("STUB\n");
-    return GR_UNSUPPORTED;
-}
-
 // Shader and Pipeline Functions
 
-GR_RESULT grCreateComputePipeline(
-    GR_DEVICE device,
-    const GR_COMPUTE_PIPELINE_CREATE_INFO* pCreateInfo,
-    GR_PIPELINE* pPipeline)
-{
-    LOGW("STUB\n");
-    return GR_UNSUPPORTED;
-}
-
-GR_RESULT grStorePipeline(
-    GR_PIPELINE pipeline,
-    GR_SIZE* pDataSize,
-    GR_VOID* pData)
-{
-    LOGW("STUB\n");
-    return GR_UNSUPPORTED;
-}
-
-GR_RESULT grLoadPipeline(
-    GR_DEVICE device,
-    GR_SIZE dataSize,
-    const GR_VOID* pData,
-    GR_PIPELINE* pPipeline)
-{
-    LOGW("STUB\n");
-    return GR_UNSUPPORTED;
-}
-
 // Multi-Device Management Functions
 
 GR_RESULT grGetMultiGpuCompatibility(
@@ -150,15 +113,6 @@ GR_RESULT grOpenPeerImage(
     return GR_UNSUPPORTED;
 }
 
-// Command Buffer Management Functions
-
-GR_RESULT grResetCommandBuffer(
-    GR_CMD_BUFFER cmdBuffer)
-{
-    LOGW("STUB\n");
-    return GR_UNSUPPORTED;
-}
-
 // Command Buffer Building Functions
 
 GR_VOID grCmdBindIndexData(
@@ -186,23 +140,6 @@ GR_VOID grCmdDrawIndexedIndirect(
     LOGW("STUB\n");
 }
 
-GR_VOID grCmdDispatch(
-    GR_CMD_BUFFER cmdBuffer,
-    GR_UINT x,
-    GR_UINT y,
-    GR_UINT z)
-{
-    LOGW("STUB\n");
-}
-
-GR_VOID grCmdDispatchIndirect(
-    GR_CMD_BUFFER cmdBuffer,
-    GR_GPU_MEMORY mem,
-    GR_GPU_SIZE offset)
-{
-    LOGW("STUB\n");
-}
-
 GR_VOID grCmdCloneImageData(
     GR_CMD_BUFFER cmdBuffer,
     GR_IMAGE srcImage,
@@ -4,6 +4,18 @@
 #define PACK_FORMAT(channel, numeric) \
     ((channel) << 16 | (numeric))
 
+#define GRAPHICS_SHADER_STAGES \
+    (VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | \
+     VK_PIPELINE_STAGE_TESSELLATION_CONTROL_SHADER_BIT | \
+     VK_PIPELINE_STAGE_TESSELLATION_EVALUATION_SHADER_BIT | \
+     VK_PIPELINE_STAGE_GEOMETRY_SHADER_BIT | \
+     VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT)
+
+#define TARGET_STAGES \
+    (VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | \
+     VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | \
+     VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT)
+
 GR_PHYSICAL_GPU_TYPE getGrPhysicalGpuType(
     VkPhysicalDeviceType type)
 {
@@ -190,11 +202,28 @@ VkImageLayout getVkImageLayout(
 {
     switch (imageState) {
     case GR_IMAGE_STATE_UNINITIALIZED:
+    case GR_IMAGE_STATE_DISCARD:
         return VK_IMAGE_LAYOUT_UNDEFINED;
     case GR_IMAGE_STATE_TARGET_RENDER_ACCESS_OPTIMAL:
         return VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
     case GR_IMAGE_STATE_CLEAR:
+    case GR_IMAGE_STATE_DATA_TRANSFER_DESTINATION:
+    case GR_IMAGE_STATE_RESOLVE_DESTINATION:
         return VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    case GR_IMAGE_STATE_DATA_TRANSFER_SOURCE:
+    case GR_IMAGE_STATE_RESOLVE_SOURCE:
+        return VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    case GR_IMAGE_STATE_GRAPHICS_SHADER_READ_ONLY:
+    case GR_IMAGE_STATE_COMPUTE_SHADER_READ_ONLY:
+    case GR_IMAGE_STATE_MULTI_SHADER_READ_ONLY:
+        return VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    case GR_IMAGE_STATE_GRAPHICS_SHADER_WRITE_ONLY:
+    case GR_IMAGE_STATE_GRAPHICS_SHADER_READ_WRITE:
+    case GR_IMAGE_STATE_COMPUTE_SHADER_WRITE_ONLY:
+    case GR_IMAGE_STATE_COMPUTE_SHADER_READ_WRITE:
+    case GR_IMAGE_STATE_TARGET_SHADER_ACCESS_OPTIMAL:
+    case GR_IMAGE_STATE_TARGET_AND_SHADER_READ_ONLY:
+        return VK_IMAGE_LAYOUT_GENERAL;
     default:
         break;
     }
@@ -219,7 +248,33 @@ VkAccessFlags getVkAccessFlagsImage(
         return VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
                VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
     case GR_IMAGE_STATE_CLEAR:
+    case GR_IMAGE_STATE_DATA_TRANSFER_DESTINATION:
+    case GR_IMAGE_STATE_RESOLVE_DESTINATION:
         return VK_ACCESS_TRANSFER_WRITE_BIT;
+    case GR_IMAGE_STATE_DATA_TRANSFER_SOURCE:
+    case GR_IMAGE_STATE_RESOLVE_SOURCE:
+        return VK_ACCESS_TRANSFER_READ_BIT;
+    case GR_IMAGE_STATE_DATA_TRANSFER:
+        return VK_ACCESS_TRANSFER_READ_BIT |
+               VK_ACCESS_TRANSFER_WRITE_BIT;
+    case GR_IMAGE_STATE_GRAPHICS_SHADER_READ_ONLY:
+    case GR_IMAGE_STATE_COMPUTE_SHADER_READ_ONLY:
+    case GR_IMAGE_STATE_MULTI_SHADER_READ_ONLY:
+        return VK_ACCESS_SHADER_READ_BIT;
+    case GR_IMAGE_STATE_GRAPHICS_SHADER_WRITE_ONLY:
+    case GR_IMAGE_STATE_COMPUTE_SHADER_WRITE_ONLY:
+        return VK_ACCESS_SHADER_WRITE_BIT;
+    case GR_IMAGE_STATE_GRAPHICS_SHADER_READ_WRITE:
+    case GR_IMAGE_STATE_COMPUTE_SHADER_READ_WRITE:
+    case GR_IMAGE_STATE_TARGET_SHADER_ACCESS_OPTIMAL:
+        return VK_ACCESS_SHADER_READ_BIT |
+               VK_ACCESS_SHADER_WRITE_BIT;
+    case GR_IMAGE_STATE_TARGET_AND_SHADER_READ_ONLY:
+        return VK_ACCESS_SHADER_READ_BIT |
+               VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+               VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+    case GR_IMAGE_STATE_DISCARD:
+        return 0;
     default:
         break;
     }
@@ -253,6 +308,22 @@ VkAccessFlags getVkAccessFlagsMemory(
     case GR_MEMORY_STATE_COMPUTE_SHADER_READ_WRITE:
         return VK_ACCESS_SHADER_READ_BIT |
                VK_ACCESS_SHADER_WRITE_BIT;
+    case GR_MEMORY_STATE_MULTI_USE_READ_ONLY:
+        return VK_ACCESS_INDIRECT_COMMAND_READ_BIT |
+               VK_ACCESS_INDEX_READ_BIT |
+               VK_ACCESS_SHADER_READ_BIT |
+               VK_ACCESS_TRANSFER_READ_BIT;
+    case GR_MEMORY_STATE_INDEX_DATA:
+        return VK_ACCESS_INDEX_READ_BIT;
+    case GR_MEMORY_STATE_INDIRECT_ARG:
+        return VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+    case GR_MEMORY_STATE_WRITE_TIMESTAMP:
+    case GR_MEMORY_STATE_DATA_TRANSFER_DESTINATION:
+        return VK_ACCESS_TRANSFER_WRITE_BIT;
+    case GR_MEMORY_STATE_DATA_TRANSFER_SOURCE:
+        return VK_ACCESS_TRANSFER_READ_BIT;
+    case GR_MEMORY_STATE_DISCARD:
+        return 0;
     default:
         break;
     }
@@ -261,6 +332,88 @@ VkAccessFlags getVkAccessFlagsMemory(
     return 0;
 }
 
+VkPipelineStageFlags getVkPipelineStageFlagsImage(
+    GR_IMAGE_STATE imageState)
+{
+    switch (imageState) {
+    case GR_IMAGE_STATE_UNINITIALIZED:
+    case GR_IMAGE_STATE_DISCARD:
+        return VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+    case GR_IMAGE_STATE_DATA_TRANSFER:
+    case GR_IMAGE_STATE_DATA_TRANSFER_SOURCE:
+    case GR_IMAGE_STATE_DATA_TRANSFER_DESTINATION:
+    case GR_IMAGE_STATE_CLEAR:
+    case GR_IMAGE_STATE_RESOLVE_SOURCE:
+    case GR_IMAGE_STATE_RESOLVE_DESTINATION:
+        return VK_PIPELINE_STAGE_TRANSFER_BIT;
+    case GR_IMAGE_STATE_GRAPHICS_SHADER_READ_ONLY:
+    case GR_IMAGE_STATE_GRAPHICS_SHADER_WRITE_ONLY:
+    case GR_IMAGE_STATE_GRAPHICS_SHADER_READ_WRITE:
+        return GRAPHICS_SHADER_STAGES;
+    case GR_IMAGE_STATE_COMPUTE_SHADER_READ_ONLY:
+    case GR_IMAGE_STATE_COMPUTE_SHADER_WRITE_ONLY:
+    case GR_IMAGE_STATE_COMPUTE_SHADER_READ_WRITE:
+        return VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    case GR_IMAGE_STATE_MULTI_SHADER_READ_ONLY:
+    case GR_IMAGE_STATE_TARGET_SHADER_ACCESS_OPTIMAL:
+        return GRAPHICS_SHADER_STAGES | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    case GR_IMAGE_STATE_TARGET_AND_SHADER_READ_ONLY:
+        return GRAPHICS_SHADER_STAGES | TARGET_STAGES;
+    case GR_IMAGE_STATE_TARGET_RENDER_ACCESS_OPTIMAL:
+        return TARGET_STAGES;
+    default:
+        break;
+    }
+
+    switch ((GR_WSI_WIN_IMAGE_STATE)imageState) {
+    case GR_WSI_WIN_IMAGE_STATE_PRESENT_WINDOWED:
+    case GR_WSI_WIN_IMAGE_STATE_PRESENT_FULLSCREEN:
+        return VK_PIPELINE_STAGE_TRANSFER_BIT;
+    }
+
+    LOGW("unsupported image state 0x%x\n", imageState);
+    return VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+}
+
+VkPipelineStageFlags getVkPipelineStageFlagsMemory(
+    GR_MEMORY_STATE memoryState)
+{
+    switch (memoryState) {
+    case GR_MEMORY_STATE_DATA_TRANSFER:
+        return VK_PIPELINE_STAGE_TRANSFER_BIT |
+               VK_PIPELINE_STAGE_HOST_BIT;
+    case GR_MEMORY_STATE_DATA_TRANSFER_SOURCE:
+    case GR_MEMORY_STATE_DATA_TRANSFER_DESTINATION:
+    case GR_MEMORY_STATE_WRITE_TIMESTAMP:
+        return VK_PIPELINE_STAGE_TRANSFER_BIT;
+    case GR_MEMORY_STATE_GRAPHICS_SHADER_READ_ONLY:
+    case GR_MEMORY_STATE_GRAPHICS_SHADER_WRITE_ONLY:
+    case GR_MEMORY_STATE_GRAPHICS_SHADER_READ_WRITE:
+        return GRAPHICS_SHADER_STAGES;
+    case GR_MEMORY_STATE_COMPUTE_SHADER_READ_ONLY:
+    case GR_MEMORY_STATE_COMPUTE_SHADER_WRITE_ONLY:
+    case GR_MEMORY_STATE_COMPUTE_SHADER_READ_WRITE:
+        return VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    case GR_MEMORY_STATE_MULTI_USE_READ_ONLY:
+        return VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+               VK_PIPELINE_STAGE_VERTEX_INPUT_BIT |
+               GRAPHICS_SHADER_STAGES |
+               VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+               VK_PIPELINE_STAGE_TRANSFER_BIT;
+    case GR_MEMORY_STATE_INDEX_DATA:
+        return VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+    case GR_MEMORY_STATE_INDIRECT_ARG:
+        return VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT;
+    case GR_MEMORY_STATE_DISCARD:
+        return VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+    default:
+        break;
+    }
+
+    LOGW("unsupported memory state 0x%x\n", memoryState);
+    return VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+}
+
 VkImageAspectFlags getVkImageAspectFlags(
     GR_IMAGE_ASPECT imageAspect)
 {
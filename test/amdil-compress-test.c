@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "amdilc_internal.h"
+
+// Larger than the match window and long enough for multi-byte length encodings
+#define LARGE_SIZE  (4 * 1024 * 1024)
+
+static unsigned mFailedCount = 0;
+
+static uint32_t nextRandom(
+    uint32_t* state)
+{
+    // xorshift32, deterministic so that failures are reproducible
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static void checkRoundTrip(
+    const char* name,
+    const uint8_t* data,
+    unsigned size)
+{
+    unsigned maxCompressedSize = ilcGetMaxCompressedSize(size);
+    uint8_t* compressed = malloc(maxCompressedSize);
+    uint8_t* decompressed = malloc(size + 1);
+    unsigned compressedSize = ilcCompress(compressed, data, size);
+    bool isPassed = true;
+
+    if (compressedSize > maxCompressedSize) {
+        printf("%s: compressed to %u bytes, over the %u bytes bound\n",
+               name, compressedSize, maxCompressedSize);
+        isPassed = false;
+    } else if (!ilcDecompress(decompressed, size, compressed, compressedSize)) {
+        printf("%s: decompression failed\n", name);
+        isPassed = false;
+    } else if (size > 0 && memcmp(decompressed, data, size) != 0) {
+        printf("%s: decompressed data doesn't match\n", name);
+        isPassed = false;
+    } else if (ilcDecompress(decompressed, size + 1, compressed, compressedSize)) {
+        printf("%s: decompression into a larger buffer succeeded\n", name);
+        isPassed = false;
+    } else if (compressedSize > 0 &&
+               ilcDecompress(decompressed, size, compressed, compressedSize - 1)) {
+        printf("%s: decompression of truncated data succeeded\n", name);
+        isPassed = false;
+    }
+
+    printf("%s: %u -> %u bytes, %s\n", name, size, compressedSize, isPassed ? "ok" : "FAILED");
+    if (!isPassed) {
+        mFailedCount++;
+    }
+
+    free(compressed);
+    free(decompressed);
+}
+
+int main(int argc, char *args[])
+{
+    uint8_t* data = malloc(LARGE_SIZE);
+    uint32_t state = 0x12345678;
+
+    checkRoundTrip("empty", data, 0);
+
+    // Below the minimum match length, only literals
+    memset(data, 0xAB, 3);
+    checkRoundTrip("tiny", data, 3);
+
+    for (unsigned i = 0; i < LARGE_SIZE; i++) {
+        data[i] = nextRandom(&state);
+    }
+    checkRoundTrip("incompressible", data, 4096);
+    checkRoundTrip("incompressible_large", data, LARGE_SIZE);
+
+    // A single match covering almost everything
+    memset(data, 0, LARGE_SIZE);
+    checkRoundTrip("zeros_large", data, LARGE_SIZE);
+
+    // Matches against a short repeating pattern with random literals in between
+    for (unsigned i = 0; i < LARGE_SIZE; i++) {
+        data[i] = (i % 509) < 500 ? (i % 7) : nextRandom(&state);
+    }
+    checkRoundTrip("mixed_large", data, LARGE_SIZE);
+
+    free(data);
+
+    return mFailedCount > 0 ? 1 : 0;
+}
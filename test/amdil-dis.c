@@ -1,30 +1,112 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "amdilc.h"
 
+static uint8_t* readFile(
+    unsigned* size,
+    const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    assert(file != NULL);
+
+    uint8_t* data;
+    fseek(file, 0, SEEK_END);
+    *size = ftell(file);
+    data = malloc(*size);
+    fseek(file, 0, SEEK_SET);
+    fread(data, 1, *size, file);
+    fclose(file);
+
+    return data;
+}
+
+static void printStats(
+    const char* path,
+    const IlcShaderStats* stats)
+{
+    printf("%s\n"
+           "  instructions:       %u\n"
+           "    declaration:      %u\n"
+           "    float:            %u\n"
+           "    integer:          %u\n"
+           "    flow control:     %u\n"
+           "    memory:           %u\n"
+           "    other:            %u\n"
+           "  declared registers: %u\n"
+           "  used registers:     %u (%u temps)\n"
+           "  resources:          %u\n"
+           "  UAVs:               %u\n"
+           "  samplers:           %u\n"
+           "  flow control depth: %u\n"
+           "  SPIR-V words:       %u\n"
+           "  translation time:   %.1f us\n",
+           path, stats->instrCount, stats->declInstrCount, stats->floatInstrCount,
+           stats->intInstrCount, stats->flowControlInstrCount, stats->memoryInstrCount,
+           stats->otherInstrCount, stats->declaredRegisterCount, stats->usedRegisterCount,
+           stats->tempRegisterCount, stats->resourceCount, stats->uavCount, stats->samplerCount,
+           stats->maxControlFlowDepth, stats->spirvWordCount, stats->translationTime);
+}
+
+static void printStatsCsvHeader()
+{
+    printf("file,instrs,decl,float,int,flow,memory,other,declared_regs,used_regs,temps,"
+           "resources,uavs,samplers,flow_depth,spv_words,time_us\n");
+}
+
+static void printStatsCsvRow(
+    const char* path,
+    const IlcShaderStats* stats)
+{
+    printf("%s,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%.1f\n",
+           path, stats->instrCount, stats->declInstrCount, stats->floatInstrCount,
+           stats->intInstrCount, stats->flowControlInstrCount, stats->memoryInstrCount,
+           stats->otherInstrCount, stats->declaredRegisterCount, stats->usedRegisterCount,
+           stats->tempRegisterCount, stats->resourceCount, stats->uavCount, stats->samplerCount,
+           stats->maxControlFlowDepth, stats->spirvWordCount, stats->translationTime);
+}
+
 int main(int argc, char *args[])
 {
+    if (argc >= 3 && strcmp(args[1], "--stats") == 0) {
+        // Several files are reported as CSV for easier comparison
+        bool csv = argc > 3;
+
+        if (csv) {
+            printStatsCsvHeader();
+        }
+
+        for (int i = 2; i < argc; i++) {
+            IlcShaderStats stats;
+            unsigned inSize;
+            uint8_t* inBuf = readFile(&inSize, args[i]);
+
+            ilcGetShaderStats(&stats, inBuf, inSize);
+            if (csv) {
+                printStatsCsvRow(args[i], &stats);
+            } else {
+                printStats(args[i], &stats);
+            }
+            free(inBuf);
+        }
+
+        return 0;
+    }
+
     if (argc < 3) {
-        printf("usage: %s il.bin il.txt\n", args[0]);
+        printf("usage: %s il.bin il.txt\n"
+               "       %s --stats il.bin...\n", args[0], args[0]);
         return 1;
     }
 
-    FILE* inFile = fopen(args[1], "rb");
-    assert(inFile != NULL);
-
     unsigned inSize;
-    uint8_t* inBuf;
-    fseek(inFile, 0, SEEK_END);
-    inSize = ftell(inFile);
-    inBuf = malloc(inSize);
-    fseek(inFile, 0, SEEK_SET);
-    fread(inBuf, 1, inSize, inFile);
-    fclose(inFile);
+    uint8_t* inBuf = readFile(&inSize, args[1]);
 
     FILE* outFile = fopen(args[2], "wb");
     ilcDisassembleShader(outFile, inBuf, inSize);
     fclose(outFile);
+    free(inBuf);
 
     return 0;
 }
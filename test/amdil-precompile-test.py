@@ -0,0 +1,41 @@
+#!/usr/bin/python
+
+import os
+import shutil
+import struct
+import subprocess
+import sys
+
+compress = len(sys.argv) > 1 and sys.argv[1] == '--compress'
+resPath = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'res')
+testPath = 'amdil_precompile{}'.format('_compressed' if compress else '')
+dumpPath = os.path.join(testPath, 'dump')
+cachePath = os.path.join(testPath, 'cache')
+
+shutil.rmtree(testPath, ignore_errors=True)
+os.makedirs(dumpPath)
+
+# Lay the corpus out like GRVK_DUMP_SHADERS, with a record of empty mappings for each shader
+mapping = struct.pack('<4I', 0, 0, 0, 0)
+for fileName in os.listdir(resPath):
+    if fileName.startswith('il_') and fileName.endswith('.bin'):
+        name = fileName[len('il_'):-len('.bin')]
+        shutil.copy(os.path.join(resPath, fileName), os.path.join(dumpPath, name + '_il.bin'))
+        with open(os.path.join(dumpPath, name + '_map.bin'), 'wb') as f:
+            f.write(struct.pack('<I', len(mapping)) + mapping)
+
+args = ['--compress'] if compress else []
+if subprocess.run(['wine', 'test/amdil-precompile'] + args + [dumpPath, cachePath]).returncode != 0:
+    print("precompilation failed")
+    exit(1)
+
+if not os.path.isfile(os.path.join(cachePath, 'shaders.pack')):
+    print("no shader pack produced")
+    exit(1)
+
+# Every shader has to be read back from the pack as it was compiled
+if subprocess.run(['wine', 'test/amdil-precompile', '--verify', dumpPath, cachePath]).returncode != 0:
+    print("cache verification failed")
+    exit(1)
+
+shutil.rmtree(testPath)
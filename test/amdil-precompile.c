@@ -0,0 +1,239 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include "amdilc_internal.h"
+
+#define PATH_LEN    (MAX_PATH)
+
+typedef struct {
+    char ilPath[PATH_LEN];
+    void* mappingData;
+    unsigned mappingSize;
+} Job;
+
+typedef struct {
+    Job* jobs;
+    unsigned jobCount;
+    bool verify;
+    volatile LONG nextJob;
+    volatile LONG compiledCount;
+    volatile LONG failedCount;
+} JobQueue;
+
+static void* readFile(
+    unsigned* size,
+    const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    *size = ftell(file);
+    void* data = malloc(*size);
+    fseek(file, 0, SEEK_SET);
+    if (fread(data, 1, *size, file) != *size) {
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+
+    return data;
+}
+
+static void addJobs(
+    JobQueue* queue,
+    const char* dumpDir,
+    const char* fileName)
+{
+    char ilPath[PATH_LEN];
+    char mapPath[PATH_LEN];
+    snprintf(ilPath, PATH_LEN, "%s\\%s", dumpDir, fileName);
+
+    // Mapping blobs are dumped next to the IL as "<name>_map.bin"
+    size_t nameLen = strlen(fileName) - strlen("_il.bin");
+    snprintf(mapPath, PATH_LEN, "%s\\%.*s_map.bin", dumpDir, (int)nameLen, fileName);
+
+    unsigned mapFileSize = 0;
+    uint8_t* mapFile = readFile(&mapFileSize, mapPath);
+    if (mapFile == NULL) {
+        printf("skipping %s, no mapping data\n", fileName);
+        return;
+    }
+
+    // Records are [size][mapping data], one per pipeline the shader was used with
+    unsigned offset = 0;
+    while (offset + sizeof(uint32_t) <= mapFileSize) {
+        uint32_t recordSize = *(uint32_t*)&mapFile[offset];
+        offset += sizeof(uint32_t);
+        if (recordSize > mapFileSize - offset) {
+            printf("truncated mapping data in %s\n", mapPath);
+            break;
+        }
+
+        queue->jobs = realloc(queue->jobs, sizeof(Job) * (queue->jobCount + 1));
+        Job* job = &queue->jobs[queue->jobCount];
+        strcpy(job->ilPath, ilPath);
+        job->mappingSize = recordSize;
+        job->mappingData = malloc(recordSize);
+        memcpy(job->mappingData, &mapFile[offset], recordSize);
+        queue->jobCount++;
+
+        offset += recordSize;
+    }
+
+    free(mapFile);
+}
+
+// Checks that the cache holds the same code as a fresh translation
+static bool isJobCached(
+    const Job* job,
+    const GR_PIPELINE_SHADER* mappings,
+    const void* ilCode,
+    unsigned ilSize)
+{
+    uint8_t key[ILC_CACHE_KEY_SIZE];
+    ilcGetCacheKey(key, ilCode, ilSize, job->mappingData, job->mappingSize);
+
+    unsigned cachedSize = 0;
+    uint32_t* cachedCode = ilcCacheLookup(&cachedSize, key);
+    if (cachedCode == NULL) {
+        return false;
+    }
+
+    Kernel* kernel = ilcDecodeStream((const Token*)ilCode, ilSize / sizeof(Token));
+    unsigned spvSize = 0;
+    uint32_t* spvCode = ilcCompileKernel(&spvSize, mappings, kernel, NULL);
+    bool isMatching = spvSize == cachedSize && memcmp(spvCode, cachedCode, spvSize) == 0;
+
+    free(spvCode);
+    ilcFreeKernel(kernel);
+    free(cachedCode);
+    return isMatching;
+}
+
+static DWORD WINAPI compileWorker(
+    LPVOID param)
+{
+    JobQueue* queue = (JobQueue*)param;
+
+    while (true) {
+        LONG jobIndex = InterlockedIncrement(&queue->nextJob) - 1;
+        if (jobIndex >= queue->jobCount) {
+            break;
+        }
+
+        const Job* job = &queue->jobs[jobIndex];
+        GR_PIPELINE_SHADER* mappings = ilcDeserializeMappings(job->mappingData, job->mappingSize);
+        unsigned ilSize = 0;
+        void* ilCode = readFile(&ilSize, job->ilPath);
+
+        if (mappings == NULL || ilCode == NULL) {
+            printf("failed to load %s\n", job->ilPath);
+            InterlockedIncrement(&queue->failedCount);
+        } else if (queue->verify) {
+            if (isJobCached(job, mappings, ilCode, ilSize)) {
+                InterlockedIncrement(&queue->compiledCount);
+            } else {
+                printf("%s is missing from the cache or doesn't match\n", job->ilPath);
+                InterlockedIncrement(&queue->failedCount);
+            }
+        } else {
+            // Compiling stores the result in the shader cache
+            unsigned spvSize = 0;
+            const uint32_t* spvCode = ilcCompileShader(&spvSize, mappings, ilCode, ilSize);
+            ilcReleaseShader(spvCode);
+            InterlockedIncrement(&queue->compiledCount);
+        }
+
+        free(ilCode);
+        ilcFreeMappings(mappings);
+    }
+
+    return 0;
+}
+
+int main(int argc, char *args[])
+{
+    bool compress = false;
+    bool verify = false;
+    int argIndex = 1;
+
+    if (argc > 1 && strcmp(args[1], "--compress") == 0) {
+        compress = true;
+        argIndex++;
+    } else if (argc > 1 && strcmp(args[1], "--verify") == 0) {
+        verify = true;
+        argIndex++;
+    }
+
+    if (argc - argIndex < 2) {
+        printf("usage: %s [--compress] dump_dir cache_dir\n"
+               "       %s --verify dump_dir cache_dir\n"
+               "       %s --compact cache_dir [max_size_mb]\n", args[0], args[0], args[0]);
+        return 1;
+    }
+
+    if (strcmp(args[argIndex], "--compact") == 0) {
+        unsigned maxSize = argc - argIndex > 2 ? strtoul(args[argIndex + 2], NULL, 10) * 1024 * 1024 : 0;
+
+        return ilcCompactShaderCache(args[argIndex + 1], maxSize) ? 0 : 1;
+    }
+
+    const char* dumpDir = args[argIndex];
+    const char* cacheDir = args[argIndex + 1];
+    JobQueue queue = { .verify = verify };
+
+    char pattern[PATH_LEN];
+    snprintf(pattern, PATH_LEN, "%s\\*_il.bin", dumpDir);
+
+    WIN32_FIND_DATA findData;
+    HANDLE findHandle = FindFirstFile(pattern, &findData);
+    if (findHandle == INVALID_HANDLE_VALUE) {
+        printf("no shaders found in %s\n", dumpDir);
+        return 1;
+    }
+    do {
+        addJobs(&queue, dumpDir, findData.cFileName);
+    } while (FindNextFile(findHandle, &findData));
+    FindClose(findHandle);
+
+    // No size cap, the whole pack is meant to be shipped
+    ilcOpenShaderCache(cacheDir, 0, compress);
+
+    SYSTEM_INFO systemInfo;
+    GetSystemInfo(&systemInfo);
+    unsigned threadCount = max(systemInfo.dwNumberOfProcessors, 1);
+    HANDLE* threads = malloc(sizeof(HANDLE) * threadCount);
+
+    printf("%s %u shaders on %u threads...\n", verify ? "verifying" : "compiling",
+           queue.jobCount, threadCount);
+
+    for (unsigned i = 0; i < threadCount; i++) {
+        threads[i] = CreateThread(NULL, 0, compileWorker, &queue, 0, NULL);
+    }
+    for (unsigned i = 0; i < threadCount; i++) {
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+    }
+
+    ilcCloseShaderCache();
+
+    printf("%s %ld shaders, %ld failed\n", verify ? "verified" : "compiled",
+           queue.compiledCount, queue.failedCount);
+
+    // Fold the journal into the pack so that it can be shipped as a single file
+    if (!verify && !ilcCompactShaderCache(cacheDir, 0)) {
+        queue.failedCount++;
+    }
+
+    for (unsigned i = 0; i < queue.jobCount; i++) {
+        free(queue.jobs[i].mappingData);
+    }
+    free(queue.jobs);
+    free(threads);
+
+    return queue.failedCount > 0 ? 1 : 0;
+}
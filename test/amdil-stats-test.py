@@ -0,0 +1,35 @@
+#!/usr/bin/python
+
+import os
+import subprocess
+import sys
+
+dirPath = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'res')
+binPaths = sorted(os.path.join(dirPath, f) for f in os.listdir(dirPath) if f.endswith('.bin'))
+
+result = subprocess.run(['wine', 'test/amdil-dis', '--stats'] + binPaths,
+                        stdout=subprocess.PIPE, universal_newlines=True)
+if result.returncode != 0:
+    print("stats mode failed")
+    exit(1)
+
+# Batch mode emits a CSV header and a row per shader, translation warnings go to the same output
+output = result.stdout
+headerLine = next((l for l in output.splitlines() if l.startswith('file,')), None)
+if headerLine is None:
+    print("no CSV header")
+    exit(1)
+header = headerLine.split(',')
+
+for binPath in binPaths:
+    index = output.find(binPath + ',')
+    if index < 0:
+        print("no stats row for {}".format(binPath))
+        exit(1)
+
+    line = output[index:].splitlines()[0]
+    values = line.split(',')
+    row = dict(zip(header, values))
+    if len(values) != len(header) or int(row['instrs']) == 0 or int(row['spv_words']) == 0:
+        print("bad stats row: {}".format(line))
+        exit(1)